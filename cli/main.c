@@ -48,7 +48,9 @@ typedef struct {
 static void
 print_stats_dict (gchar * peer_id, GstStructure * stats, gpointer user_data)
 {
-  guint jitter, loss, ping;
+  guint jitter, loss, ping, drops = 0, frames = 0;
+  guint64 proxy_dropped = 0, handoff_latency = 0;
+  gint skew = 0;
 
   if (stats == NULL || g_strcmp0 (peer_id, "local") == 0)
     return;
@@ -56,8 +58,16 @@ print_stats_dict (gchar * peer_id, GstStructure * stats, gpointer user_data)
   gst_structure_get_uint (stats, "jitter", &jitter);
   gst_structure_get_uint (stats, "packets-fractionlost", &loss);
   gst_structure_get_uint (stats, "round-trip", &ping);
-  g_printerr ("  To %s, jitter: %u, packet loss: %.2f%%, round trip: %ums\n",
-      peer_id, jitter, ((float) (loss * 100)) / 256, ping);
+  gst_structure_get_uint (stats, "kernel-drops", &drops);
+  gst_structure_get_int (stats, "av-skew", &skew);
+  gst_structure_get_uint (stats, "frames", &frames);
+  gst_structure_get_uint64 (stats, "proxy-dropped", &proxy_dropped);
+  gst_structure_get_uint64 (stats, "proxy-handoff-latency", &handoff_latency);
+  g_printerr ("  To %s, jitter: %u, packet loss: %.2f%%, round trip: %ums,"
+      " kernel drops: %u, A/V skew: %ims, frames: %u, playback drops: %"
+      G_GUINT64_FORMAT ", handoff: %.1fms\n", peer_id, jitter,
+      ((float) (loss * 100)) / 256, ping, drops, skew, frames, proxy_dropped,
+      (double) handoff_latency / GST_MSECOND);
 }
 
 static gboolean
@@ -95,10 +105,17 @@ local_done:
 static gboolean
 print_net_stats (OvLocalPeer * local)
 {
+  guint underruns, buffer_time;
+
   if (print_net_stats_type (local, "video") == G_SOURCE_REMOVE)
     return G_SOURCE_REMOVE;
   if (print_net_stats_type (local, "audio") == G_SOURCE_REMOVE)
     return G_SOURCE_REMOVE;
+
+  g_object_get (local, "audio-underruns", &underruns, "audio-buffer-time",
+      &buffer_time, NULL);
+  g_printerr ("Audio playout buffer: %ums, underruns: %u\n", buffer_time,
+      underruns);
   return G_SOURCE_CONTINUE;
 }
 
@@ -148,6 +165,16 @@ on_call_ended_continue (OvLocalPeer * local)
   ov_local_peer_call_hangup (local);
 }
 
+static void
+on_active_speaker_changed (OvLocalPeer * local, OvPeer * speaker,
+    gpointer user_data)
+{
+  gchar *addr_s;
+  g_object_get (speaker, "address-string", &addr_s, NULL);
+  g_print ("Active speaker is now %s\n", addr_s);
+  g_free (addr_s);
+}
+
 static gboolean
 on_app_exit (OvLocalPeer * local)
 {
@@ -436,6 +463,8 @@ main (int   argc,
   gboolean auto_exit = FALSE;
   gboolean discover_peers = FALSE;
   gboolean net_stats = FALSE;
+  gboolean composite_video = FALSE;
+  gchar *playback_mode = NULL;
   guint16 iface_port = 0;
   gchar *iface_name = NULL;
   gchar *device_path = NULL;
@@ -463,6 +492,12 @@ main (int   argc,
           " '1' or higher means after that many seconds.", "WHEN"},
     {"net-stats", 0, 0, G_OPTION_ARG_NONE, &net_stats, "Show network statistics"
           " as calculated via RTCP (default: no)", NULL},
+    {"composite-video", 0, 0, G_OPTION_ARG_NONE, &composite_video, "Show"
+          " video from all peers in a single window (default: no)", NULL},
+    {"playback-mode", 0, 0, G_OPTION_ARG_STRING, &playback_mode, "How to"
+          " play audio and video from peers: normal, headless (decode but"
+          " don't render), or count-frames (don't decode) (default: normal)",
+          "MODE"},
     {NULL}
   };
 
@@ -505,6 +540,9 @@ main (int   argc,
   local = ov_local_peer_new (iface_name, iface_port);
   if (local == NULL)
     goto out;
+  g_object_set (local, "composite-video", composite_video, NULL);
+  if (playback_mode != NULL)
+    gst_util_set_object_arg (G_OBJECT (local), "playback-mode", playback_mode);
 
   g_print ("Probing devices...\n");
   ov_local_peer_start (local);
@@ -570,6 +608,8 @@ remotes_done:
   else
     g_signal_connect (local, "call-all-remotes-gone",
         G_CALLBACK (on_call_ended_continue), NULL);
+  g_signal_connect (local, "active-speaker-changed",
+      G_CALLBACK (on_active_speaker_changed), NULL);
   g_unix_signal_add (SIGINT, (GSourceFunc) on_app_exit, local);
   if (exit_after > 0)
     g_timeout_add_seconds (exit_after, (GSourceFunc) on_app_exit, local);
@@ -584,6 +624,7 @@ out:
   g_strfreev (remotes);
   g_free (device_path);
   g_free (iface_name);
+  g_free (playback_mode);
   g_free (opts);
 
   return 0;
@@ -0,0 +1,757 @@
+/*
+ * Copyright (C) 2015 Centricular Ltd.
+ *   Author: Sebastian Dröge <sebastian@centricular.com>
+ *   Author: Nirbheek Chauhan <nirbheek@centricular.com>
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ */
+
+/**
+ * SECTION:element-ovaudiomixer
+ *
+ * Ovaudiomixer mixes live audio from any number of request sinkpads into one
+ * stream, like audiomixer does, but only for the single format that OneVideo
+ * uses for playback: interleaved stereo S16 at 48 kHz.
+ *
+ * Every 10 ms of running time the element outputs one block, as soon as the
+ * clock says that all inputs should have had the time to deliver their part
+ * of it (the upstream latency). Inputs that are muted with
+ * #GstOvAudioMixerPad:mute or whose buffers are flagged as GAP, f.ex.,
+ * because they are silent, are dropped as soon as they arrive and cost
+ * nothing while mixing. The others are added together with saturation using
+ * the fastest SIMD kernel that the CPU supports (see gstovmixerkernels.c).
+ * If no input has audio for a block, a GAP buffer of silence is output.
+ *
+ * Input that arrives too late for the block it belongs to is dropped, and
+ * each sinkpad queues at most RING_SAMPLES of audio that hasn't been mixed
+ * yet; the oldest audio is dropped when that fills up.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "gstovaudiomixer.h"
+#include "gstovmixerkernels.h"
+
+#include <string.h>
+
+#define GST_CAT_DEFAULT gst_ov_audio_mixer_debug
+GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
+
+#define MIXER_CAPS "audio/x-raw, format=(string)S16LE, " \
+  "layout=(string)interleaved, rate=(int)48000, channels=(int)2"
+#define RATE 48000
+#define CHANNELS 2
+/* Duration of each output buffer */
+#define PERIOD (10 * GST_MSECOND)
+#define PERIOD_FRAMES (RATE / 100)
+#define PERIOD_SAMPLES (PERIOD_FRAMES * CHANNELS)
+/* Unmixed audio queued per sinkpad, 341 ms. Must be a power of two. */
+#define RING_SAMPLES (1 << 15)
+/* Input that doesn't start within this many frames of where the previous
+ * buffer ended is treated as a discontinuity */
+#define DISCONT_FRAMES (RATE / 50)
+/* If the streaming thread wakes up this late, f.ex., after the machine was
+ * suspended, skip ahead instead of outputting all the blocks in between */
+#define MAX_LATENESS (200 * GST_MSECOND)
+
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE ("src",
+  GST_PAD_SRC,
+  GST_PAD_ALWAYS,
+  GST_STATIC_CAPS (MIXER_CAPS)
+);
+
+static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE ("sink_%u",
+  GST_PAD_SINK,
+  GST_PAD_REQUEST,
+  GST_STATIC_CAPS (MIXER_CAPS)
+);
+
+enum
+{
+  PROP_PAD_0,
+  PROP_PAD_MUTE,
+};
+
+#define DEFAULT_PAD_MUTE FALSE
+
+G_DEFINE_TYPE (GstOvAudioMixerPad, gst_ov_audio_mixer_pad, GST_TYPE_PAD);
+
+#define parent_class gst_ov_audio_mixer_parent_class
+G_DEFINE_TYPE (GstOvAudioMixer, gst_ov_audio_mixer, GST_TYPE_ELEMENT);
+
+static void
+gst_ov_audio_mixer_pad_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstOvAudioMixerPad *pad = GST_OV_AUDIO_MIXER_PAD (object);
+
+  switch (prop_id) {
+    case PROP_PAD_MUTE:
+      GST_OBJECT_LOCK (pad);
+      g_value_set_boolean (value, pad->mute);
+      GST_OBJECT_UNLOCK (pad);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_ov_audio_mixer_pad_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstOvAudioMixerPad *pad = GST_OV_AUDIO_MIXER_PAD (object);
+
+  switch (prop_id) {
+    case PROP_PAD_MUTE:
+      GST_OBJECT_LOCK (pad);
+      pad->mute = g_value_get_boolean (value);
+      GST_OBJECT_UNLOCK (pad);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_ov_audio_mixer_pad_finalize (GObject * object)
+{
+  GstOvAudioMixerPad *pad = GST_OV_AUDIO_MIXER_PAD (object);
+
+  g_free (pad->ring);
+
+  G_OBJECT_CLASS (gst_ov_audio_mixer_pad_parent_class)->finalize (object);
+}
+
+static void
+gst_ov_audio_mixer_pad_class_init (GstOvAudioMixerPadClass * klass)
+{
+  GObjectClass *gobject_class = (GObjectClass *) klass;
+
+  gobject_class->get_property = gst_ov_audio_mixer_pad_get_property;
+  gobject_class->set_property = gst_ov_audio_mixer_pad_set_property;
+  gobject_class->finalize = gst_ov_audio_mixer_pad_finalize;
+
+  /* Same name and meaning as the property on audiomixer's sinkpads */
+  g_object_class_install_property (gobject_class, PROP_PAD_MUTE,
+      g_param_spec_boolean ("mute", "Mute", "Mute this pad",
+          DEFAULT_PAD_MUTE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+}
+
+static void
+gst_ov_audio_mixer_pad_init (GstOvAudioMixerPad * pad)
+{
+  pad->mute = DEFAULT_PAD_MUTE;
+  pad->ring = g_new (gint16, RING_SAMPLES);
+  gst_segment_init (&pad->segment, GST_FORMAT_TIME);
+}
+
+/* Called with the mixer's lock TAKEN */
+static void
+pad_queue_clear (GstOvAudioMixerPad * pad)
+{
+  pad->read = 0;
+  pad->n_samples = 0;
+}
+
+/* Called with the mixer's lock TAKEN */
+static void
+pad_queue_skip (GstOvAudioMixerPad * pad, guint n_samples)
+{
+  n_samples = MIN (n_samples, pad->n_samples);
+  pad->read = (pad->read + n_samples) & (RING_SAMPLES - 1);
+  pad->n_samples -= n_samples;
+  pad->offset += n_samples / CHANNELS;
+}
+
+/* Called with the mixer's lock TAKEN */
+static void
+pad_queue_push (GstOvAudioMixerPad * pad, const gint16 * samples,
+    guint n_samples)
+{
+  guint write, first;
+
+  if (n_samples > RING_SAMPLES) {
+    pad_queue_skip (pad, pad->n_samples);
+    pad->offset += (n_samples - RING_SAMPLES) / CHANNELS;
+    samples += n_samples - RING_SAMPLES;
+    n_samples = RING_SAMPLES;
+  }
+
+  if (pad->n_samples + n_samples > RING_SAMPLES) {
+    GST_DEBUG_OBJECT (pad, "Queue full, dropping the oldest %u samples",
+        pad->n_samples + n_samples - RING_SAMPLES);
+    pad_queue_skip (pad, pad->n_samples + n_samples - RING_SAMPLES);
+  }
+
+  write = (pad->read + pad->n_samples) & (RING_SAMPLES - 1);
+  first = MIN (n_samples, RING_SAMPLES - write);
+  memcpy (pad->ring + write, samples, first * sizeof (gint16));
+  memcpy (pad->ring, samples + first, (n_samples - first) * sizeof (gint16));
+  pad->n_samples += n_samples;
+}
+
+static GstFlowReturn
+gst_ov_audio_mixer_sink_chain (GstPad * pad, GstObject * parent,
+    GstBuffer * buffer)
+{
+  GstOvAudioMixer *self = GST_OV_AUDIO_MIXER (parent);
+  GstOvAudioMixerPad *mpad = GST_OV_AUDIO_MIXER_PAD (pad);
+  GstClockTime running_time;
+  guint64 offset, end;
+  gboolean mute;
+  GstMapInfo map;
+
+  GST_OBJECT_LOCK (mpad);
+  mute = mpad->mute;
+  GST_OBJECT_UNLOCK (mpad);
+
+  /* Muted and silent input is dropped right away. The next buffer that isn't
+   * is placed by its own timestamp, so nothing needs to be queued instead. */
+  if (mute || GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_GAP) ||
+      !GST_CLOCK_TIME_IS_VALID (GST_BUFFER_PTS (buffer)))
+    goto out;
+
+  if (!gst_buffer_map (buffer, &map, GST_MAP_READ))
+    goto out;
+
+  g_mutex_lock (&self->lock);
+
+  running_time = gst_segment_to_running_time (&mpad->segment, GST_FORMAT_TIME,
+      GST_BUFFER_PTS (buffer));
+  if (!GST_CLOCK_TIME_IS_VALID (running_time))
+    goto unlock;
+
+  offset = gst_util_uint64_scale_round (running_time, RATE, GST_SECOND);
+  end = mpad->offset + mpad->n_samples / CHANNELS;
+
+  /* Small differences between the timestamps and the amount of audio are
+   * jitter, and the audio is queued right after what's already there */
+  if (mpad->n_samples == 0 || offset + DISCONT_FRAMES < end ||
+      offset > end + DISCONT_FRAMES) {
+    if (mpad->n_samples > 0)
+      GST_DEBUG_OBJECT (mpad, "Discontinuity: expected frame %"
+          G_GUINT64_FORMAT ", got %" G_GUINT64_FORMAT, end, offset);
+    pad_queue_clear (mpad);
+    mpad->offset = offset;
+  }
+
+  pad_queue_push (mpad, (const gint16 *) map.data,
+      (map.size / sizeof (gint16)) & ~(CHANNELS - 1));
+
+unlock:
+  g_mutex_unlock (&self->lock);
+  gst_buffer_unmap (buffer, &map);
+out:
+  gst_buffer_unref (buffer);
+  return GST_FLOW_OK;
+}
+
+static gboolean
+gst_ov_audio_mixer_sink_event (GstPad * pad, GstObject * parent,
+    GstEvent * event)
+{
+  GstOvAudioMixer *self = GST_OV_AUDIO_MIXER (parent);
+  GstOvAudioMixerPad *mpad = GST_OV_AUDIO_MIXER_PAD (pad);
+  gboolean ret = TRUE;
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_SEGMENT:
+      g_mutex_lock (&self->lock);
+      gst_event_copy_segment (event, &mpad->segment);
+      ret = mpad->segment.format == GST_FORMAT_TIME;
+      g_mutex_unlock (&self->lock);
+      break;
+    case GST_EVENT_CAPS:
+      /* The latency of the new input might be higher than the others */
+      gst_element_post_message (GST_ELEMENT (self),
+          gst_message_new_latency (GST_OBJECT (self)));
+      break;
+    case GST_EVENT_FLUSH_STOP:
+      g_mutex_lock (&self->lock);
+      pad_queue_clear (mpad);
+      gst_segment_init (&mpad->segment, GST_FORMAT_TIME);
+      g_mutex_unlock (&self->lock);
+      break;
+    default:
+      /* Our output is one continuous stream, so stream-start, EOS, tags, etc.
+       * from the inputs are not forwarded */
+      break;
+  }
+
+  gst_event_unref (event);
+  return ret;
+}
+
+static gboolean
+gst_ov_audio_mixer_query_caps (GstPad * pad, GstQuery * query)
+{
+  GstCaps *caps, *filter;
+
+  gst_query_parse_caps (query, &filter);
+  caps = gst_pad_get_pad_template_caps (pad);
+  if (filter != NULL) {
+    GstCaps *tmp = gst_caps_intersect_full (filter, caps,
+        GST_CAPS_INTERSECT_FIRST);
+    gst_caps_unref (caps);
+    caps = tmp;
+  }
+  gst_query_set_caps_result (query, caps);
+  gst_caps_unref (caps);
+
+  return TRUE;
+}
+
+static gboolean
+gst_ov_audio_mixer_sink_query (GstPad * pad, GstObject * parent,
+    GstQuery * query)
+{
+  switch (GST_QUERY_TYPE (query)) {
+    case GST_QUERY_CAPS:
+      return gst_ov_audio_mixer_query_caps (pad, query);
+    case GST_QUERY_ALLOCATION:
+      /* Input is copied into the queue, so any memory will do */
+      return FALSE;
+    default:
+      return gst_pad_query_default (pad, parent, query);
+  }
+}
+
+/* Returns the highest minimum latency of all live inputs */
+static GstClockTime
+gst_ov_audio_mixer_query_upstream_latency (GstOvAudioMixer * self,
+    GstClockTime * max_latency)
+{
+  GstClockTime min = 0, max = GST_CLOCK_TIME_NONE;
+  GPtrArray *pads;
+  guint ii;
+
+  g_mutex_lock (&self->lock);
+  pads = g_ptr_array_new_with_free_func (gst_object_unref);
+  for (ii = 0; ii < self->sinkpads->len; ii++)
+    g_ptr_array_add (pads, gst_object_ref (g_ptr_array_index (self->sinkpads,
+                ii)));
+  g_mutex_unlock (&self->lock);
+
+  for (ii = 0; ii < pads->len; ii++) {
+    GstClockTime pad_min, pad_max;
+    GstQuery *query;
+    gboolean live;
+
+    query = gst_query_new_latency ();
+    if (gst_pad_peer_query (g_ptr_array_index (pads, ii), query)) {
+      gst_query_parse_latency (query, &live, &pad_min, &pad_max);
+      if (live) {
+        min = MAX (min, pad_min);
+        if (GST_CLOCK_TIME_IS_VALID (pad_max))
+          max = GST_CLOCK_TIME_IS_VALID (max) ? MIN (max, pad_max) : pad_max;
+      }
+    }
+    gst_query_unref (query);
+  }
+  g_ptr_array_unref (pads);
+
+  *max_latency = max;
+  return min;
+}
+
+static gboolean
+gst_ov_audio_mixer_src_query (GstPad * pad, GstObject * parent,
+    GstQuery * query)
+{
+  GstOvAudioMixer *self = GST_OV_AUDIO_MIXER (parent);
+
+  switch (GST_QUERY_TYPE (query)) {
+    case GST_QUERY_CAPS:
+      return gst_ov_audio_mixer_query_caps (pad, query);
+    case GST_QUERY_LATENCY: {
+      GstClockTime min, max;
+
+      min = gst_ov_audio_mixer_query_upstream_latency (self, &max);
+      g_mutex_lock (&self->lock);
+      self->latency = min;
+      g_mutex_unlock (&self->lock);
+      GST_DEBUG_OBJECT (self, "Upstream latency %" GST_TIME_FORMAT,
+          GST_TIME_ARGS (min));
+
+      /* We're a live source as far as downstream is concerned, and each
+       * block goes out once all of it has arrived */
+      gst_query_set_latency (query, TRUE, min + PERIOD,
+          GST_CLOCK_TIME_IS_VALID (max) ? max + PERIOD : GST_CLOCK_TIME_NONE);
+      return TRUE;
+    }
+    default:
+      return gst_pad_query_default (pad, parent, query);
+  }
+}
+
+static gboolean
+gst_ov_audio_mixer_src_event (G_GNUC_UNUSED GstPad * pad,
+    G_GNUC_UNUSED GstObject * parent, GstEvent * event)
+{
+  /* Nothing upstream can seek, and QoS and latency don't affect us */
+  gst_event_unref (event);
+  return FALSE;
+}
+
+/* Called with the lock TAKEN. Mixes the queued audio of all inputs for the
+ * output block starting at frame self->next_offset into samples, which is
+ * already zeroed. Returns the number of inputs that were mixed in. */
+static guint
+gst_ov_audio_mixer_mix (GstOvAudioMixer * self, gint16 * samples)
+{
+  guint64 start = self->next_offset, end = start + PERIOD_FRAMES;
+  guint ii, mixed = 0;
+
+  for (ii = 0; ii < self->sinkpads->len; ii++) {
+    GstOvAudioMixerPad *pad = g_ptr_array_index (self->sinkpads, ii);
+    gint16 *dst;
+    guint n, first;
+    gboolean mute;
+
+    if (pad->n_samples == 0)
+      continue;
+
+    GST_OBJECT_LOCK (pad);
+    mute = pad->mute;
+    GST_OBJECT_UNLOCK (pad);
+    if (mute) {
+      pad_queue_clear (pad);
+      continue;
+    }
+
+    /* Too late to be mixed */
+    if (pad->offset < start)
+      pad_queue_skip (pad, (start - pad->offset) * CHANNELS);
+    if (pad->n_samples == 0 || pad->offset >= end)
+      continue;
+
+    dst = samples + (pad->offset - start) * CHANNELS;
+    n = MIN (pad->n_samples, (end - pad->offset) * CHANNELS);
+    first = MIN (n, RING_SAMPLES - pad->read);
+
+    /* The first input can be copied since the block is still silent */
+    if (mixed == 0) {
+      memcpy (dst, pad->ring + pad->read, first * sizeof (gint16));
+      memcpy (dst + first, pad->ring, (n - first) * sizeof (gint16));
+    } else {
+      self->mix (dst, pad->ring + pad->read, first);
+      self->mix (dst + first, pad->ring, n - first);
+    }
+
+    pad_queue_skip (pad, n);
+    mixed++;
+  }
+
+  return mixed;
+}
+
+static void
+gst_ov_audio_mixer_push_start_events (GstOvAudioMixer * self)
+{
+  GstSegment segment;
+  GstCaps *caps;
+  gchar *stream_id;
+
+  stream_id = gst_pad_create_stream_id (self->srcpad, GST_ELEMENT (self),
+      NULL);
+  gst_pad_push_event (self->srcpad, gst_event_new_stream_start (stream_id));
+  g_free (stream_id);
+
+  caps = gst_pad_get_pad_template_caps (self->srcpad);
+  gst_pad_push_event (self->srcpad, gst_event_new_caps (caps));
+  gst_caps_unref (caps);
+
+  /* Output timestamps are running time */
+  gst_segment_init (&segment, GST_FORMAT_TIME);
+  gst_pad_push_event (self->srcpad, gst_event_new_segment (&segment));
+}
+
+static void
+gst_ov_audio_mixer_loop (GstOvAudioMixer * self)
+{
+  GstClockTime base_time, latency, pts;
+  GstClockTimeDiff jitter;
+  GstClockReturn clock_ret;
+  GstFlowReturn flow;
+  GstBuffer *buffer;
+  GstClock *clock;
+  GstMapInfo map;
+  guint mixed;
+
+  GST_OBJECT_LOCK (self);
+  clock = GST_ELEMENT_CLOCK (self) ? gst_object_ref (GST_ELEMENT_CLOCK (self))
+      : NULL;
+  base_time = GST_ELEMENT_CAST (self)->base_time;
+  GST_OBJECT_UNLOCK (self);
+
+  if (clock == NULL) {
+    GST_ELEMENT_ERROR (self, CORE, CLOCK, (NULL), ("Need a clock to mix"));
+    goto pause;
+  }
+
+  if (!self->started) {
+    GstClockTime now = gst_clock_get_time (clock);
+
+    gst_ov_audio_mixer_push_start_events (self);
+    self->next_offset = now > base_time ?
+        gst_util_uint64_scale (now - base_time, RATE, GST_SECOND) : 0;
+    self->started = TRUE;
+  }
+
+  pts = gst_util_uint64_scale (self->next_offset, GST_SECOND, RATE);
+
+  g_mutex_lock (&self->lock);
+  if (self->paused) {
+    g_mutex_unlock (&self->lock);
+    goto pause;
+  }
+  latency = self->latency;
+  self->clock_id = gst_clock_new_single_shot_id (clock,
+      base_time + pts + PERIOD + latency);
+  g_mutex_unlock (&self->lock);
+
+  clock_ret = gst_clock_id_wait (self->clock_id, &jitter);
+
+  g_mutex_lock (&self->lock);
+  gst_clock_id_unref (self->clock_id);
+  self->clock_id = NULL;
+  g_mutex_unlock (&self->lock);
+
+  if (clock_ret == GST_CLOCK_UNSCHEDULED)
+    goto pause;
+
+  if (jitter > (GstClockTimeDiff) MAX_LATENESS) {
+    guint64 skip = gst_util_uint64_scale (jitter, RATE, GST_SECOND);
+
+    skip -= skip % PERIOD_FRAMES;
+    GST_WARNING_OBJECT (self, "Woke up %" GST_TIME_FORMAT " late, skipping "
+        "ahead", GST_TIME_ARGS (jitter));
+    self->next_offset += skip;
+    pts = gst_util_uint64_scale (self->next_offset, GST_SECOND, RATE);
+  }
+
+  buffer = gst_buffer_new_allocate (NULL, PERIOD_SAMPLES * sizeof (gint16),
+      NULL);
+  gst_buffer_map (buffer, &map, GST_MAP_WRITE);
+  memset (map.data, 0, map.size);
+
+  g_mutex_lock (&self->lock);
+  mixed = gst_ov_audio_mixer_mix (self, (gint16 *) map.data);
+  g_mutex_unlock (&self->lock);
+
+  gst_buffer_unmap (buffer, &map);
+
+  GST_BUFFER_PTS (buffer) = pts;
+  GST_BUFFER_DURATION (buffer) = PERIOD;
+  GST_BUFFER_OFFSET (buffer) = self->next_offset;
+  GST_BUFFER_OFFSET_END (buffer) = self->next_offset + PERIOD_FRAMES;
+  if (mixed == 0)
+    GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_GAP);
+  self->next_offset += PERIOD_FRAMES;
+
+  flow = gst_pad_push (self->srcpad, buffer);
+  /* The sink being shut down or reconfigured by the application is not a
+   * reason to stop mixing; we stop when our own state changes */
+  if (flow < GST_FLOW_EOS) {
+    GST_ELEMENT_ERROR (self, STREAM, FAILED, ("Internal data flow error."),
+        ("streaming task paused, reason %s (%d)", gst_flow_get_name (flow),
+            flow));
+    goto pause;
+  }
+
+  gst_object_unref (clock);
+  return;
+
+pause:
+  g_clear_object (&clock);
+  gst_pad_pause_task (self->srcpad);
+}
+
+static GstPad *
+gst_ov_audio_mixer_request_new_pad (GstElement * element,
+    GstPadTemplate * templ, G_GNUC_UNUSED const gchar * req_name,
+    G_GNUC_UNUSED const GstCaps * caps)
+{
+  GstOvAudioMixer *self = GST_OV_AUDIO_MIXER (element);
+  gboolean active;
+  GstPad *pad;
+  gchar *name;
+
+  g_mutex_lock (&self->lock);
+  name = g_strdup_printf ("sink_%u", self->next_pad_id++);
+  g_mutex_unlock (&self->lock);
+
+  pad = g_object_new (GST_TYPE_OV_AUDIO_MIXER_PAD, "name", name,
+      "direction", GST_PAD_SINK, "template", templ, NULL);
+  g_free (name);
+
+  gst_pad_set_chain_function (pad, gst_ov_audio_mixer_sink_chain);
+  gst_pad_set_event_function (pad, gst_ov_audio_mixer_sink_event);
+  gst_pad_set_query_function (pad, gst_ov_audio_mixer_sink_query);
+
+  g_mutex_lock (&self->lock);
+  g_ptr_array_add (self->sinkpads, gst_object_ref (pad));
+  g_mutex_unlock (&self->lock);
+
+  GST_OBJECT_LOCK (self);
+  active = GST_STATE (self) > GST_STATE_READY;
+  GST_OBJECT_UNLOCK (self);
+  if (active)
+    gst_pad_set_active (pad, TRUE);
+
+  if (!gst_element_add_pad (element, pad)) {
+    g_mutex_lock (&self->lock);
+    g_ptr_array_remove (self->sinkpads, pad);
+    g_mutex_unlock (&self->lock);
+    gst_object_unref (pad);
+    return NULL;
+  }
+
+  return pad;
+}
+
+static void
+gst_ov_audio_mixer_release_pad (GstElement * element, GstPad * pad)
+{
+  GstOvAudioMixer *self = GST_OV_AUDIO_MIXER (element);
+
+  g_mutex_lock (&self->lock);
+  g_ptr_array_remove (self->sinkpads, pad);
+  g_mutex_unlock (&self->lock);
+
+  gst_element_remove_pad (element, pad);
+}
+
+static GstStateChangeReturn
+gst_ov_audio_mixer_change_state (GstElement * element,
+    GstStateChange transition)
+{
+  GstOvAudioMixer *self = GST_OV_AUDIO_MIXER (element);
+  GstStateChangeReturn ret;
+
+  switch (transition) {
+    case GST_STATE_CHANGE_READY_TO_PAUSED:
+      self->started = FALSE;
+      self->next_offset = 0;
+      break;
+    case GST_STATE_CHANGE_PAUSED_TO_PLAYING:
+      g_mutex_lock (&self->lock);
+      self->paused = FALSE;
+      g_mutex_unlock (&self->lock);
+      gst_pad_start_task (self->srcpad,
+          (GstTaskFunction) gst_ov_audio_mixer_loop, self, NULL);
+      break;
+    case GST_STATE_CHANGE_PLAYING_TO_PAUSED:
+      /* The task pauses itself; waiting for it here could deadlock with a
+       * sink that blocks our push until it's PLAYING again */
+      g_mutex_lock (&self->lock);
+      self->paused = TRUE;
+      if (self->clock_id != NULL)
+        gst_clock_id_unschedule (self->clock_id);
+      g_mutex_unlock (&self->lock);
+      break;
+    default:
+      break;
+  }
+
+  ret = GST_ELEMENT_CLASS (parent_class)->change_state (element, transition);
+  if (ret == GST_STATE_CHANGE_FAILURE)
+    return ret;
+
+  switch (transition) {
+    case GST_STATE_CHANGE_READY_TO_PAUSED:
+    case GST_STATE_CHANGE_PLAYING_TO_PAUSED:
+      /* Like any live source, we only produce data in PLAYING */
+      ret = GST_STATE_CHANGE_NO_PREROLL;
+      break;
+    case GST_STATE_CHANGE_PAUSED_TO_READY: {
+      guint ii;
+
+      gst_pad_stop_task (self->srcpad);
+      g_mutex_lock (&self->lock);
+      for (ii = 0; ii < self->sinkpads->len; ii++)
+        pad_queue_clear (g_ptr_array_index (self->sinkpads, ii));
+      g_mutex_unlock (&self->lock);
+      break;
+    }
+    default:
+      break;
+  }
+
+  return ret;
+}
+
+static void
+gst_ov_audio_mixer_finalize (GObject * object)
+{
+  GstOvAudioMixer *self = GST_OV_AUDIO_MIXER (object);
+
+  g_ptr_array_unref (self->sinkpads);
+  g_mutex_clear (&self->lock);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+static void
+gst_ov_audio_mixer_class_init (GstOvAudioMixerClass * klass)
+{
+  GObjectClass *gobject_class = (GObjectClass *) klass;
+  GstElementClass *gstelement_class = (GstElementClass *) klass;
+
+  GST_DEBUG_CATEGORY_INIT (gst_ov_audio_mixer_debug, "ovaudiomixer", 0,
+      "OneVideo audio mixer");
+
+  gobject_class->finalize = gst_ov_audio_mixer_finalize;
+
+  gstelement_class->request_new_pad = gst_ov_audio_mixer_request_new_pad;
+  gstelement_class->release_pad = gst_ov_audio_mixer_release_pad;
+  gstelement_class->change_state = gst_ov_audio_mixer_change_state;
+
+  gst_element_class_add_pad_template (gstelement_class,
+      gst_static_pad_template_get (&src_template));
+  gst_element_class_add_pad_template (gstelement_class,
+      gst_static_pad_template_get (&sink_template));
+
+  gst_element_class_set_static_metadata (gstelement_class,
+      "OneVideo audio mixer", "Generic/Audio",
+      "Mixes live S16 stereo audio, skipping silent and muted inputs",
+      "Nirbheek Chauhan <nirbheek@centricular.com>");
+}
+
+static void
+gst_ov_audio_mixer_init (GstOvAudioMixer * self)
+{
+  self->srcpad = gst_pad_new_from_static_template (&src_template, "src");
+  gst_pad_set_query_function (self->srcpad, gst_ov_audio_mixer_src_query);
+  gst_pad_set_event_function (self->srcpad, gst_ov_audio_mixer_src_event);
+  gst_pad_use_fixed_caps (self->srcpad);
+  gst_element_add_pad (GST_ELEMENT (self), self->srcpad);
+
+  g_mutex_init (&self->lock);
+  self->sinkpads = g_ptr_array_new_with_free_func (gst_object_unref);
+  self->mix = gst_ov_mix_get_func ();
+}
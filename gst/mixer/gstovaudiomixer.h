@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2015 Centricular Ltd.
+ *   Author: Sebastian Dröge <sebastian@centricular.com>
+ *   Author: Nirbheek Chauhan <nirbheek@centricular.com>
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ */
+
+#ifndef __GST_OV_AUDIO_MIXER_H__
+#define __GST_OV_AUDIO_MIXER_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_OV_AUDIO_MIXER            (gst_ov_audio_mixer_get_type())
+#define GST_OV_AUDIO_MIXER(obj)            (G_TYPE_CHECK_INSTANCE_CAST((obj), GST_TYPE_OV_AUDIO_MIXER, GstOvAudioMixer))
+#define GST_IS_OV_AUDIO_MIXER(obj)         (G_TYPE_CHECK_INSTANCE_TYPE((obj), GST_TYPE_OV_AUDIO_MIXER))
+#define GST_OV_AUDIO_MIXER_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST((klass) , GST_TYPE_OV_AUDIO_MIXER, GstOvAudioMixerClass))
+#define GST_IS_OV_AUDIO_MIXER_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE((klass) , GST_TYPE_OV_AUDIO_MIXER))
+#define GST_OV_AUDIO_MIXER_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS((obj) , GST_TYPE_OV_AUDIO_MIXER, GstOvAudioMixerClass))
+
+#define GST_TYPE_OV_AUDIO_MIXER_PAD        (gst_ov_audio_mixer_pad_get_type())
+#define GST_OV_AUDIO_MIXER_PAD(obj)        (G_TYPE_CHECK_INSTANCE_CAST((obj), GST_TYPE_OV_AUDIO_MIXER_PAD, GstOvAudioMixerPad))
+#define GST_IS_OV_AUDIO_MIXER_PAD(obj)     (G_TYPE_CHECK_INSTANCE_TYPE((obj), GST_TYPE_OV_AUDIO_MIXER_PAD))
+
+typedef struct _GstOvAudioMixer GstOvAudioMixer;
+typedef struct _GstOvAudioMixerClass GstOvAudioMixerClass;
+typedef struct _GstOvAudioMixerPad GstOvAudioMixerPad;
+typedef struct _GstOvAudioMixerPadClass GstOvAudioMixerPadClass;
+
+struct _GstOvAudioMixerPad {
+  GstPad parent;
+
+  /* Protected by the object lock */
+  gboolean mute;
+
+  /* Protected by the mixer's lock */
+  GstSegment segment;
+  gint16 *ring;
+  /* Ring index of the first queued sample and the number of queued samples */
+  guint read;
+  guint n_samples;
+  /* Position of the first queued sample in the output, in frames of running
+   * time */
+  guint64 offset;
+};
+
+struct _GstOvAudioMixerPadClass {
+  GstPadClass parent_class;
+};
+
+struct _GstOvAudioMixer {
+  GstElement parent;
+
+  GstPad *srcpad;
+
+  /* Protects everything below and the queued data of all sinkpads */
+  GMutex lock;
+  GPtrArray *sinkpads;
+  guint next_pad_id;
+  GstClockID clock_id;
+  gboolean paused;
+  /* Highest latency of the inputs */
+  GstClockTime latency;
+
+  /* Only used from the streaming thread */
+  gboolean started;
+  guint64 next_offset;
+  void (*mix) (gint16 * dst, const gint16 * src, guint n_samples);
+};
+
+struct _GstOvAudioMixerClass {
+  GstElementClass parent_class;
+};
+
+GType gst_ov_audio_mixer_get_type (void);
+GType gst_ov_audio_mixer_pad_get_type (void);
+
+G_END_DECLS
+
+#endif /* __GST_OV_AUDIO_MIXER_H__ */
@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2015 Centricular Ltd.
+ *   Author: Sebastian Dröge <sebastian@centricular.com>
+ *   Author: Nirbheek Chauhan <nirbheek@centricular.com>
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ */
+
+/* Saturating S16 mixing kernels for ovaudiomixer.
+ *
+ * The x86 kernels are compiled with target attributes so that the rest of
+ * the plugin doesn't need -mavx2 and still runs on older CPUs; which one is
+ * used is decided at runtime. NEON is part of the baseline on the ARM
+ * targets where __ARM_NEON is defined, so no runtime check is needed there. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "gstovmixerkernels.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define OV_MIX_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define OV_MIX_HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+static void
+mix_s16_c (gint16 * dst, const gint16 * src, guint n_samples)
+{
+  guint ii;
+
+  for (ii = 0; ii < n_samples; ii++) {
+    gint sum = dst[ii] + src[ii];
+    dst[ii] = CLAMP (sum, G_MININT16, G_MAXINT16);
+  }
+}
+
+#ifdef OV_MIX_HAVE_X86
+__attribute__ ((target ("sse2")))
+static void
+mix_s16_sse2 (gint16 * dst, const gint16 * src, guint n_samples)
+{
+  guint ii = 0;
+
+  for (; ii + 8 <= n_samples; ii += 8) {
+    __m128i a = _mm_loadu_si128 ((const __m128i *) (dst + ii));
+    __m128i b = _mm_loadu_si128 ((const __m128i *) (src + ii));
+    _mm_storeu_si128 ((__m128i *) (dst + ii), _mm_adds_epi16 (a, b));
+  }
+
+  mix_s16_c (dst + ii, src + ii, n_samples - ii);
+}
+
+__attribute__ ((target ("avx2")))
+static void
+mix_s16_avx2 (gint16 * dst, const gint16 * src, guint n_samples)
+{
+  guint ii = 0;
+
+  for (; ii + 16 <= n_samples; ii += 16) {
+    __m256i a = _mm256_loadu_si256 ((const __m256i *) (dst + ii));
+    __m256i b = _mm256_loadu_si256 ((const __m256i *) (src + ii));
+    _mm256_storeu_si256 ((__m256i *) (dst + ii), _mm256_adds_epi16 (a, b));
+  }
+
+  mix_s16_c (dst + ii, src + ii, n_samples - ii);
+}
+#endif
+
+#ifdef OV_MIX_HAVE_NEON
+static void
+mix_s16_neon (gint16 * dst, const gint16 * src, guint n_samples)
+{
+  guint ii = 0;
+
+  for (; ii + 8 <= n_samples; ii += 8)
+    vst1q_s16 (dst + ii, vqaddq_s16 (vld1q_s16 (dst + ii),
+          vld1q_s16 (src + ii)));
+
+  mix_s16_c (dst + ii, src + ii, n_samples - ii);
+}
+#endif
+
+static GstOvMixKernel kernels[4];
+static guint n_kernels;
+
+static gpointer
+init_kernels (G_GNUC_UNUSED gpointer data)
+{
+  kernels[n_kernels++] = (GstOvMixKernel) {"c", mix_s16_c};
+#ifdef OV_MIX_HAVE_X86
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("sse2"))
+    kernels[n_kernels++] = (GstOvMixKernel) {"sse2", mix_s16_sse2};
+  if (__builtin_cpu_supports ("avx2"))
+    kernels[n_kernels++] = (GstOvMixKernel) {"avx2", mix_s16_avx2};
+#endif
+#ifdef OV_MIX_HAVE_NEON
+  kernels[n_kernels++] = (GstOvMixKernel) {"neon", mix_s16_neon};
+#endif
+  return NULL;
+}
+
+const GstOvMixKernel *
+gst_ov_mix_kernels_get (guint * n)
+{
+  static GOnce once = G_ONCE_INIT;
+
+  g_once (&once, init_kernels, NULL);
+  *n = n_kernels;
+  return kernels;
+}
+
+GstOvMixFunc
+gst_ov_mix_get_func (void)
+{
+  const GstOvMixKernel *k;
+  const gchar *name;
+  guint ii, n;
+
+  k = gst_ov_mix_kernels_get (&n);
+
+  name = g_getenv ("OV_MIX_KERNEL");
+  if (name != NULL)
+    for (ii = 0; ii < n; ii++)
+      if (g_strcmp0 (k[ii].name, name) == 0)
+        return k[ii].mix;
+
+  return k[n - 1].mix;
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2015 Centricular Ltd.
+ *   Author: Sebastian Dröge <sebastian@centricular.com>
+ *   Author: Nirbheek Chauhan <nirbheek@centricular.com>
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ */
+
+#ifndef __GST_OV_MIXER_KERNELS_H__
+#define __GST_OV_MIXER_KERNELS_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Adds n_samples S16 samples from src into dst, saturating at the limits
+ * of the sample format instead of wrapping around */
+typedef void (*GstOvMixFunc) (gint16 * dst, const gint16 * src,
+    guint n_samples);
+
+typedef struct {
+  const gchar *name;
+  GstOvMixFunc mix;
+} GstOvMixKernel;
+
+/* All the kernels that can run on this CPU, the plain C one first and the
+ * fastest one last */
+const GstOvMixKernel *gst_ov_mix_kernels_get (guint * n_kernels);
+
+/* The fastest kernel that can run on this CPU, or the one named by the
+ * OV_MIX_KERNEL environment variable if it can run */
+GstOvMixFunc gst_ov_mix_get_func (void);
+
+G_END_DECLS
+
+#endif /* __GST_OV_MIXER_KERNELS_H__ */
@@ -25,12 +25,22 @@
 
 #include "gstproxysrc.h"
 #include "gstproxysink.h"
+#ifdef HAVE_MEMFD_CREATE
+#include "gstshmproxysrc.h"
+#include "gstshmproxysink.h"
+#endif
 
 static gboolean
 plugin_init (GstPlugin * plugin)
 {
   gst_element_register (plugin, "proxysrc", GST_RANK_NONE, GST_TYPE_PROXY_SRC);
   gst_element_register (plugin, "proxysink", GST_RANK_NONE, GST_TYPE_PROXY_SINK);
+#ifdef HAVE_MEMFD_CREATE
+  gst_element_register (plugin, "shmproxysrc", GST_RANK_NONE,
+      GST_TYPE_SHM_PROXY_SRC);
+  gst_element_register (plugin, "shmproxysink", GST_RANK_NONE,
+      GST_TYPE_SHM_PROXY_SINK);
+#endif
 
   return TRUE;
 }
@@ -32,7 +32,8 @@
 
 G_BEGIN_DECLS
 
-void gst_proxy_sink_set_proxysrc (GstProxySink *sink, GstProxySrc *src);
+void gst_proxy_sink_add_proxysrc (GstProxySink *sink, GstProxySrc *src);
+void gst_proxy_sink_remove_proxysrc (GstProxySink *sink, GstProxySrc *src);
 
 GstPad* gst_proxy_sink_get_internal_sinkpad (GstProxySink *sink);
 
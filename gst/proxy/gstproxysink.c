@@ -34,12 +34,21 @@
  * having to manually shuttle buffers, events, queries, etc between the two.
  *
  * This element also copies sticky events onto the matching proxysrc element.
+ *
+ * Any number of proxysrc elements can be pointed at the same proxysink, in
+ * which case buffers and events are fanned out to all of them (without copying
+ * buffers) like with a tee. Each proxysrc has its own queue, so a slow or
+ * blocked proxysrc only affects the others if its queue is not leaky.
+ *
+ * The #GstProxySink:buffers and #GstProxySink:bytes properties count what went
+ * into the element; see proxysrc for queueing statistics on the other side.
  */
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
 #include "gstproxysink.h"
+#include "gstproxysink-priv.h"
 #include "gstproxysrc.h"
 #include "gstproxysrc-priv.h"
 
@@ -52,13 +61,49 @@ static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE ("sink",
   GST_STATIC_CAPS_ANY
 );
 
+/* One proxysrc that we push events, buffers, queries to */
+typedef struct
+{
+  gint refcount;
+  /* Only used for finding the consumer again; never dereferenced */
+  gpointer src;
+  /* The internal srcpad of the proxysrc */
+  GstPad *srcpad;
+  /* Whether there are sticky events pending for this proxysrc */
+  gboolean pending_sticky_events;
+  /* Flow return of the last buffer pushed into this proxysrc */
+  GstFlowReturn last_ret;
+} GstProxySinkConsumer;
+
+/* Immutable snapshot of the list of consumers; replaced as a whole every time
+ * a proxysrc is added or removed */
+typedef struct
+{
+  gint refcount;
+  guint n_consumers;
+  GstProxySinkConsumer *consumers[1];
+} GstProxySinkConsumers;
+
+enum
+{
+  PROP_0,
+  PROP_BUFFERS,
+  PROP_BYTES,
+};
+
 struct _GstProxySinkPrivate
 {
   GstPad *sinkpad;
-  /* The proxysrc that we push events, buffers, queries to */
-  GWeakRef proxysrc;
-  /* Whether there are sticky events pending */
-  gboolean pending_sticky_events;
+  /* Buffers and bytes that came in; only written to from the streaming
+   * thread, so no locking. Readers on 32-bit might see a torn value, which is
+   * fine for statistics. */
+  guint64 buffers;
+  guint64 bytes;
+  /* The proxysrcs that we push events, buffers, queries to. Replaced with the
+   * object lock taken, and read atomically without a ref by the chain
+   * functions so that they don't need to take any locks for every buffer; see
+   * gst_proxy_sink_set_consumers() */
+  GstProxySinkConsumers *consumers;
 };
 
 /* We're not subclassing from basesink because we don't want any of the special
@@ -79,16 +124,60 @@ static gboolean gst_proxy_sink_sink_event (GstPad *pad, GstObject *parent,
 
 static GstStateChangeReturn gst_proxy_sink_change_state (GstElement *element,
     GstStateChange transition);
+static void gst_proxy_sink_dispose (GObject *object);
+
+static void
+gst_proxy_sink_get_property (GObject * object, guint prop_id, GValue * value,
+    GParamSpec * spec)
+{
+  GstProxySink *self = GST_PROXY_SINK (object);
+
+  switch (prop_id) {
+    case PROP_BUFFERS:
+      g_value_set_uint64 (value, self->priv->buffers);
+      break;
+    case PROP_BYTES:
+      g_value_set_uint64 (value, self->priv->bytes);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, spec);
+      break;
+  }
+}
 
 static void
 gst_proxy_sink_class_init (GstProxySinkClass * klass)
 {
+  GObjectClass *gobject_class = (GObjectClass *) klass;
   GstElementClass *gstelement_class = (GstElementClass *) klass;
 
   GST_DEBUG_CATEGORY_INIT (gst_proxy_sink_debug, "proxysink", 0, "proxy sink");
 
   g_type_class_add_private (klass, sizeof (GstProxySinkPrivate));
 
+  gobject_class->dispose = gst_proxy_sink_dispose;
+  gobject_class->get_property = gst_proxy_sink_get_property;
+
+  /**
+   * GstProxySink:buffers:
+   *
+   * Number of buffers that came into the element since it was last started
+   */
+  g_object_class_install_property (gobject_class, PROP_BUFFERS,
+      g_param_spec_uint64 ("buffers", "Buffers",
+        "Number of buffers received", 0, G_MAXUINT64, 0,
+        G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstProxySink:bytes:
+   *
+   * Number of bytes that came into the element since it was last started
+   */
+  g_object_class_install_property (gobject_class, PROP_BYTES,
+      g_param_spec_uint64 ("bytes", "Bytes",
+        "Number of bytes received", 0, G_MAXUINT64, 0,
+        G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
   gstelement_class->change_state = gst_proxy_sink_change_state;
 
   gst_element_class_add_pad_template (gstelement_class,
@@ -116,6 +205,128 @@ gst_proxy_sink_init (GstProxySink * self)
   gst_element_add_pad (GST_ELEMENT (self), self->priv->sinkpad);
 }
 
+static GstProxySinkConsumer *
+gst_proxy_sink_consumer_new (GstProxySrc * src)
+{
+  GstProxySinkConsumer *consumer = g_new0 (GstProxySinkConsumer, 1);
+
+  consumer->refcount = 1;
+  consumer->src = src;
+  consumer->srcpad = gst_proxy_src_get_internal_srcpad (src);
+  /* If we're added while data is already flowing, the proxysrc needs to get
+   * the current sticky events before the next buffer */
+  consumer->pending_sticky_events = TRUE;
+  consumer->last_ret = GST_FLOW_OK;
+
+  return consumer;
+}
+
+static GstProxySinkConsumer *
+gst_proxy_sink_consumer_ref (GstProxySinkConsumer * consumer)
+{
+  g_atomic_int_inc (&consumer->refcount);
+  return consumer;
+}
+
+static void
+gst_proxy_sink_consumer_unref (GstProxySinkConsumer * consumer)
+{
+  if (!g_atomic_int_dec_and_test (&consumer->refcount))
+    return;
+
+  gst_object_unref (consumer->srcpad);
+  g_free (consumer);
+}
+
+static GstProxySinkConsumers *
+gst_proxy_sink_consumers_new (guint n_consumers)
+{
+  GstProxySinkConsumers *consumers;
+
+  consumers = g_malloc0 (sizeof (GstProxySinkConsumers) +
+      MAX (n_consumers, 1) * sizeof (GstProxySinkConsumer *));
+  consumers->refcount = 1;
+  consumers->n_consumers = n_consumers;
+
+  return consumers;
+}
+
+static void
+gst_proxy_sink_consumers_unref (GstProxySinkConsumers * consumers)
+{
+  guint ii;
+
+  if (consumers == NULL || !g_atomic_int_dec_and_test (&consumers->refcount))
+    return;
+
+  for (ii = 0; ii < consumers->n_consumers; ii++)
+    gst_proxy_sink_consumer_unref (consumers->consumers[ii]);
+  g_free (consumers);
+}
+
+/* Returns a ref to the current list of consumers, for use outside of the
+ * chain functions, which might run concurrently with a change in consumers */
+static GstProxySinkConsumers *
+gst_proxy_sink_get_consumers (GstProxySink * self)
+{
+  GstProxySinkConsumers *consumers;
+
+  GST_OBJECT_LOCK (self);
+  consumers = self->priv->consumers;
+  if (consumers)
+    g_atomic_int_inc (&consumers->refcount);
+  GST_OBJECT_UNLOCK (self);
+
+  return consumers;
+}
+
+/* Called with the object lock TAKEN; drops it */
+static void
+gst_proxy_sink_set_consumers (GstProxySink * self,
+    GstProxySinkConsumers * consumers)
+{
+  GstProxySinkConsumers *old_consumers = self->priv->consumers;
+
+  g_atomic_pointer_set (&self->priv->consumers, consumers);
+  GST_OBJECT_UNLOCK (self);
+
+  if (old_consumers) {
+    /* Buffers are always pushed while holding the stream lock of our sinkpad,
+     * so wait for a buffer that might be getting pushed using the old list */
+    GST_PAD_STREAM_LOCK (self->priv->sinkpad);
+    GST_PAD_STREAM_UNLOCK (self->priv->sinkpad);
+    gst_proxy_sink_consumers_unref (old_consumers);
+  }
+}
+
+static void
+gst_proxy_sink_dispose (GObject * object)
+{
+  GstProxySink *self = GST_PROXY_SINK (object);
+
+  GST_OBJECT_LOCK (self);
+  gst_proxy_sink_set_consumers (self, NULL);
+
+  G_OBJECT_CLASS (gst_proxy_sink_parent_class)->dispose (object);
+}
+
+static void
+gst_proxy_sink_reset_consumers (GstProxySink * self)
+{
+  GstProxySinkConsumers *consumers;
+  guint ii;
+
+  consumers = gst_proxy_sink_get_consumers (self);
+  if (consumers == NULL)
+    return;
+
+  for (ii = 0; ii < consumers->n_consumers; ii++) {
+    consumers->consumers[ii]->pending_sticky_events = FALSE;
+    consumers->consumers[ii]->last_ret = GST_FLOW_OK;
+  }
+  gst_proxy_sink_consumers_unref (consumers);
+}
+
 static GstStateChangeReturn
 gst_proxy_sink_change_state (GstElement * element, GstStateChange transition)
 {
@@ -126,7 +337,9 @@ gst_proxy_sink_change_state (GstElement * element, GstStateChange transition)
 
   switch (transition) {
   case GST_STATE_CHANGE_READY_TO_PAUSED:
-    self->priv->pending_sticky_events = FALSE;
+    gst_proxy_sink_reset_consumers (self);
+    self->priv->buffers = 0;
+    self->priv->bytes = 0;
     break;
   default:
     break;
@@ -141,21 +354,21 @@ static gboolean
 gst_proxy_sink_sink_query (GstPad * pad, GstObject * parent, GstQuery * query)
 {
   GstProxySink *self = GST_PROXY_SINK (parent);
-  GstProxySrc *src;
+  GstProxySinkConsumers *consumers;
   gboolean ret = FALSE;
+  guint ii;
 
   GST_LOG_OBJECT (pad, "Handling query of type '%s'",
     gst_query_type_get_name (GST_QUERY_TYPE (query)));
 
-  src = g_weak_ref_get (&self->priv->proxysrc);
-  if (src) {
-    GstPad *srcpad;
-    srcpad = gst_proxy_src_get_internal_srcpad (src);
+  consumers = gst_proxy_sink_get_consumers (self);
+  if (consumers == NULL)
+    return ret;
 
-    ret = gst_pad_peer_query (srcpad, query);
-    gst_object_unref (srcpad);
-    gst_object_unref (src);
-  }
+  /* Answered by the first proxysrc that can */
+  for (ii = 0; ii < consumers->n_consumers && !ret; ii++)
+    ret = gst_pad_peer_query (consumers->consumers[ii]->srcpad, query);
+  gst_proxy_sink_consumers_unref (consumers);
 
   return ret;
 }
@@ -176,77 +389,109 @@ copy_sticky_events(G_GNUC_UNUSED GstPad * pad, GstEvent ** event,
   return data->ret == GST_FLOW_OK;
 }
 
+static void
+gst_proxy_sink_consumer_copy_sticky_events (GstProxySinkConsumer * consumer,
+    GstPad * pad)
+{
+  CopyStickyEventsData data = { consumer->srcpad, GST_FLOW_OK };
+
+  gst_pad_sticky_events_foreach (pad, copy_sticky_events, &data);
+  consumer->pending_sticky_events = data.ret != GST_FLOW_OK;
+}
+
 static gboolean
 gst_proxy_sink_sink_event (GstPad * pad, GstObject * parent, GstEvent * event)
 {
   GstProxySink *self = GST_PROXY_SINK (parent);
-  GstProxySrc *src;
+  GstProxySinkConsumers *consumers;
   gboolean ret = FALSE;
   gboolean sticky = GST_EVENT_IS_STICKY (event);
+  guint ii;
 
   GST_LOG_OBJECT (pad, "Got %s event", GST_EVENT_TYPE_NAME (event));
 
   if (GST_EVENT_TYPE (event) == GST_EVENT_FLUSH_STOP)
-    self->priv->pending_sticky_events = FALSE;
+    gst_proxy_sink_reset_consumers (self);
 
-  src = g_weak_ref_get (&self->priv->proxysrc);
-  if (src) {
-    GstPad *srcpad;
-    srcpad = gst_proxy_src_get_internal_srcpad (src);
+  consumers = gst_proxy_sink_get_consumers (self);
+  if (consumers == NULL) {
+    gst_event_unref (event);
+    return ret;
+  }
 
-    if (sticky && self->priv->pending_sticky_events) {
-      CopyStickyEventsData data = { srcpad, GST_FLOW_OK };
+  for (ii = 0; ii < consumers->n_consumers; ii++) {
+    GstProxySinkConsumer *consumer = consumers->consumers[ii];
+    gboolean res;
 
-      gst_pad_sticky_events_foreach (pad, copy_sticky_events, &data);
-      self->priv->pending_sticky_events = data.ret != GST_FLOW_OK;
-    }
+    if (sticky && consumer->pending_sticky_events)
+      gst_proxy_sink_consumer_copy_sticky_events (consumer, pad);
 
-    ret = gst_pad_push_event (srcpad, event);
-    gst_object_unref (srcpad);
-    gst_object_unref (src);
+    res = gst_pad_push_event (consumer->srcpad, gst_event_ref (event));
 
-    if (!ret && sticky) {
-      self->priv->pending_sticky_events = TRUE;
-      ret = TRUE;
+    if (!res && sticky) {
+      consumer->pending_sticky_events = TRUE;
+      res = TRUE;
     }
-  } else
-    gst_event_unref (event);
+    ret |= res;
+  }
+  gst_proxy_sink_consumers_unref (consumers);
+  gst_event_unref (event);
 
   return ret;
 }
 
+/* Called with the stream lock of the sinkpad TAKEN */
+static void
+gst_proxy_sink_consumer_update_ret (GstProxySinkConsumer * consumer,
+    GstFlowReturn ret)
+{
+  /* Every proxysrc has its own flow return so that one of them being flushed
+   * or not-linked doesn't affect the others. We also never propagate it
+   * upstream, so we just keep track of it for debugging. */
+  if (G_UNLIKELY (ret != consumer->last_ret))
+    GST_DEBUG_OBJECT (consumer->srcpad, "Flow return changed: %s -> %s",
+        gst_flow_get_name (consumer->last_ret), gst_flow_get_name (ret));
+  consumer->last_ret = ret;
+}
+
+/* The buffer is shared by all proxysrcs: every push except the last one gets
+ * a new ref; no copies are made. This function and the one below are called
+ * with the stream lock of the sinkpad TAKEN, so the consumer list can't be
+ * freed while we're using it without a ref; see gst_proxy_sink_set_consumers() */
 static GstFlowReturn
 gst_proxy_sink_sink_chain (GstPad * pad, GstObject * parent, GstBuffer * buffer)
 {
   GstProxySink *self = GST_PROXY_SINK (parent);
-  GstProxySrc *src;
+  GstProxySinkConsumers *consumers;
   GstFlowReturn ret = GST_FLOW_OK;
+  guint ii, n;
 
   GST_LOG_OBJECT (pad, "Chaining buffer %p", buffer);
 
-  src = g_weak_ref_get (&self->priv->proxysrc);
-  if (src) {
-    GstPad *srcpad;
-    srcpad = gst_proxy_src_get_internal_srcpad (src);
+  self->priv->buffers++;
+  self->priv->bytes += gst_buffer_get_size (buffer);
 
-    if (self->priv->pending_sticky_events) {
-      CopyStickyEventsData data = { srcpad, GST_FLOW_OK };
+  consumers = g_atomic_pointer_get (&self->priv->consumers);
+  n = consumers ? consumers->n_consumers : 0;
+  if (G_UNLIKELY (n == 0)) {
+    gst_buffer_unref (buffer);
+    GST_LOG_OBJECT (pad, "Dropped buffer %p: no otherpad", buffer);
+    return GST_FLOW_OK;
+  }
 
-      gst_pad_sticky_events_foreach (pad, copy_sticky_events, &data);
-      self->priv->pending_sticky_events = data.ret != GST_FLOW_OK;
-    }
+  for (ii = 0; ii < n; ii++) {
+    GstProxySinkConsumer *consumer = consumers->consumers[ii];
 
-    ret = gst_pad_push (srcpad, buffer);
-    gst_object_unref (srcpad);
-    gst_object_unref (src);
+    if (G_UNLIKELY (consumer->pending_sticky_events))
+      gst_proxy_sink_consumer_copy_sticky_events (consumer, pad);
 
-    GST_LOG_OBJECT (pad, "Chained buffer %p: %s", buffer,
-        gst_flow_get_name (ret));
-  } else {
-    gst_buffer_unref (buffer);
-    GST_LOG_OBJECT (pad, "Dropped buffer %p: no otherpad", buffer);
+    ret = gst_pad_push (consumer->srcpad,
+        ii + 1 < n ? gst_buffer_ref (buffer) : buffer);
+    gst_proxy_sink_consumer_update_ret (consumer, ret);
   }
 
+  GST_LOG_OBJECT (pad, "Chained buffer %p to %u proxysrc(s)", buffer, n);
+
   return GST_FLOW_OK;
 }
 
@@ -255,33 +500,38 @@ gst_proxy_sink_sink_chain_list (GstPad * pad, GstObject * parent,
   GstBufferList * list)
 {
   GstProxySink *self = GST_PROXY_SINK (parent);
-  GstProxySrc *src;
+  GstProxySinkConsumers *consumers;
   GstFlowReturn ret = GST_FLOW_OK;
+  guint ii, n;
 
   GST_LOG_OBJECT (pad, "Chaining buffer list %p", list);
 
-  src = g_weak_ref_get (&self->priv->proxysrc);
-  if (src) {
-    GstPad *srcpad;
-    srcpad = gst_proxy_src_get_internal_srcpad (src);
+  n = gst_buffer_list_length (list);
+  self->priv->buffers += n;
+  for (ii = 0; ii < n; ii++)
+    self->priv->bytes += gst_buffer_get_size (gst_buffer_list_get (list, ii));
 
-    if (self->priv->pending_sticky_events) {
-      CopyStickyEventsData data = { srcpad, GST_FLOW_OK };
-
-      gst_pad_sticky_events_foreach (pad, copy_sticky_events, &data);
-      self->priv->pending_sticky_events = data.ret != GST_FLOW_OK;
-    }
-
-    ret = gst_pad_push_list (srcpad, list);
-    gst_object_unref (srcpad);
-    gst_object_unref (src);
-    GST_LOG_OBJECT (pad, "Chained buffer list %p: %s", list,
-        gst_flow_get_name (ret));
-  } else {
+  consumers = g_atomic_pointer_get (&self->priv->consumers);
+  n = consumers ? consumers->n_consumers : 0;
+  if (G_UNLIKELY (n == 0)) {
     gst_buffer_list_unref (list);
     GST_LOG_OBJECT (pad, "Dropped buffer list %p: no otherpad", list);
+    return GST_FLOW_OK;
+  }
+
+  for (ii = 0; ii < n; ii++) {
+    GstProxySinkConsumer *consumer = consumers->consumers[ii];
+
+    if (G_UNLIKELY (consumer->pending_sticky_events))
+      gst_proxy_sink_consumer_copy_sticky_events (consumer, pad);
+
+    ret = gst_pad_push_list (consumer->srcpad,
+        ii + 1 < n ? gst_buffer_list_ref (list) : list);
+    gst_proxy_sink_consumer_update_ret (consumer, ret);
   }
 
+  GST_LOG_OBJECT (pad, "Chained buffer list %p to %u proxysrc(s)", list, n);
+
   return GST_FLOW_OK;
 }
 
@@ -296,8 +546,73 @@ gst_proxy_sink_get_internal_sinkpad (GstProxySink * self)
 }
 
 void
-gst_proxy_sink_set_proxysrc (GstProxySink * self, GstProxySrc * src)
+gst_proxy_sink_add_proxysrc (GstProxySink * self, GstProxySrc * src)
 {
+  GstProxySinkConsumers *old_consumers, *consumers;
+  guint ii, n = 0;
+
   g_return_if_fail (self);
-  g_weak_ref_set (&self->priv->proxysrc, src);
+  g_return_if_fail (src);
+
+  GST_OBJECT_LOCK (self);
+  old_consumers = self->priv->consumers;
+  if (old_consumers) {
+    n = old_consumers->n_consumers;
+    for (ii = 0; ii < n; ii++) {
+      if (old_consumers->consumers[ii]->src == src) {
+        GST_OBJECT_UNLOCK (self);
+        return;
+      }
+    }
+  }
+
+  consumers = gst_proxy_sink_consumers_new (n + 1);
+  for (ii = 0; ii < n; ii++)
+    consumers->consumers[ii] =
+      gst_proxy_sink_consumer_ref (old_consumers->consumers[ii]);
+  consumers->consumers[n] = gst_proxy_sink_consumer_new (src);
+
+  GST_DEBUG_OBJECT (self, "Added %" GST_PTR_FORMAT ", now have %u proxysrc(s)",
+      src, n + 1);
+
+  gst_proxy_sink_set_consumers (self, consumers);
+}
+
+void
+gst_proxy_sink_remove_proxysrc (GstProxySink * self, GstProxySrc * src)
+{
+  GstProxySinkConsumers *old_consumers, *consumers;
+  guint ii, jj, n;
+
+  g_return_if_fail (self);
+
+  GST_OBJECT_LOCK (self);
+  old_consumers = self->priv->consumers;
+  if (old_consumers == NULL)
+    goto not_found;
+
+  n = old_consumers->n_consumers;
+  for (ii = 0; ii < n; ii++)
+    if (old_consumers->consumers[ii]->src == src)
+      break;
+  if (ii == n)
+    goto not_found;
+
+  if (n == 1) {
+    consumers = NULL;
+  } else {
+    consumers = gst_proxy_sink_consumers_new (n - 1);
+    for (ii = 0, jj = 0; ii < n; ii++)
+      if (old_consumers->consumers[ii]->src != src)
+        consumers->consumers[jj++] =
+          gst_proxy_sink_consumer_ref (old_consumers->consumers[ii]);
+  }
+
+  GST_DEBUG_OBJECT (self, "Removed %p, now have %u proxysrc(s)", src, n - 1);
+
+  gst_proxy_sink_set_consumers (self, consumers);
+  return;
+
+not_found:
+  GST_OBJECT_UNLOCK (self);
 }
@@ -36,6 +36,20 @@
  * The element queues buffers from the matching proxysink to an internal queue,
  * so everything downstream is properly decoupled from the upstream pipeline.
  *
+ * The internal queue can be bounded in time with the #GstProxySrc:max-latency
+ * property and made to drop buffers instead of blocking the upstream pipeline
+ * with #GstProxySrc:leaky. This is useful for live streams where a stall in
+ * the downstream pipeline should not cause latency to build up permanently.
+ *
+ * Several proxysrc elements can be pointed at the same proxysink. Each of them
+ * gets all the buffers (shared, not copied) and has its own queue, so they can
+ * be configured with different latencies and leakiness.
+ *
+ * Statistics about the data going through the element are available as
+ * read-only properties: #GstProxySrc:buffers, #GstProxySrc:bytes,
+ * #GstProxySrc:dropped, the current queue level and
+ * #GstProxySrc:handoff-latency. The #GstProxySrc::overrun signal is emitted
+ * when the queue fills up.
  */
 
 #ifdef HAVE_CONFIG_H
@@ -54,12 +68,66 @@ static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE ("src",
   GST_STATIC_CAPS_ANY
 );
 
+#define DEFAULT_MAX_LATENCY GST_SECOND
+#define DEFAULT_LEAKY GST_PROXY_SRC_LEAKY_NO
+
+/* Only one in this many buffers has its handoff latency measured, so that
+ * the probes don't take a lock or read the clock for every buffer */
+#define HANDOFF_SAMPLE_INTERVAL 16
+/* Give up on the buffer being measured after this many others came out of
+ * the queue: it was dropped, or the queue is too deep to care about the
+ * precise value */
+#define HANDOFF_SAMPLE_MAX_WAIT 64
+
 enum
 {
   PROP_0,
   PROP_PROXYSINK,
+  PROP_MAX_LATENCY,
+  PROP_LEAKY,
+  PROP_DROPPED,
+  PROP_CURRENT_LEVEL_TIME,
+  PROP_CURRENT_LEVEL_BUFFERS,
+  PROP_BUFFERS,
+  PROP_BYTES,
+  PROP_HANDOFF_LATENCY,
 };
 
+enum
+{
+  SIGNAL_OVERRUN,
+  LAST_SIGNAL
+};
+
+static guint gst_proxy_src_signals[LAST_SIGNAL] = { 0 };
+
+/* Same values as the leaky property on queue, so we can pass it through */
+typedef enum
+{
+  GST_PROXY_SRC_LEAKY_NO,
+  GST_PROXY_SRC_LEAKY_UPSTREAM,
+  GST_PROXY_SRC_LEAKY_DOWNSTREAM,
+} GstProxySrcLeaky;
+
+#define GST_TYPE_PROXY_SRC_LEAKY (gst_proxy_src_leaky_get_type ())
+static GType
+gst_proxy_src_leaky_get_type (void)
+{
+  static GType leaky_type = 0;
+  static const GEnumValue leaky[] = {
+    {GST_PROXY_SRC_LEAKY_NO, "Not Leaky", "no"},
+    {GST_PROXY_SRC_LEAKY_UPSTREAM, "Leaky on upstream (new buffers)",
+        "upstream"},
+    {GST_PROXY_SRC_LEAKY_DOWNSTREAM, "Leaky on downstream (old buffers)",
+        "downstream"},
+    {0, NULL, NULL},
+  };
+
+  if (!leaky_type)
+    leaky_type = g_enum_register_static ("GstProxySrcLeaky", leaky);
+  return leaky_type;
+}
+
 struct _GstProxySrcPrivate
 {
   /* Queue to hold buffers from proxysink */
@@ -72,6 +140,26 @@ struct _GstProxySrcPrivate
   GstPad *dummy_sinkpad;
   /* The matching proxysink; queries and events are sent to its sinkpad */
   GWeakRef proxysink;
+  /* Buffers that went into and came out of the queue; the difference minus
+   * the current queue level is the number of buffers the queue leaked */
+  guint buffers_in;
+  guint buffers_out;
+  /* Bytes that came out of the queue, and the smoothed time in nanoseconds
+   * from a buffer entering proxysink to it coming out of the queue. Only
+   * written to from the queue's thread, so no locking; like in proxysink,
+   * readers on 32-bit might see a torn value. */
+  guint64 bytes_out;
+  guint64 handoff_latency;
+
+  /* The buffer whose handoff latency is being measured. The upstream thread
+   * only writes sample_pts and sample_time while sample_pending is 0, and the
+   * queue's thread only reads them while it's 1, so they need no lock. */
+  gint sample_pending;
+  GstClockTime sample_pts;
+  gint64 sample_time;
+  /* Buffers that came out while waiting for the one above; only used by the
+   * queue's thread */
+  guint sample_wait;
 };
 
 /* We're not subclassing from basesrc because we don't want any of the special
@@ -88,6 +176,10 @@ static gboolean gst_proxy_src_internal_src_event (GstPad *pad, GstObject *parent
   GstEvent *event);
 
 static GstStateChangeReturn gst_proxy_src_change_state (GstElement *element, GstStateChange transition);
+static GstPadProbeReturn gst_proxy_src_buffers_in (GstPad *pad,
+  GstPadProbeInfo *info, gpointer user_data);
+static GstPadProbeReturn gst_proxy_src_buffers_out (GstPad *pad,
+  GstPadProbeInfo *info, gpointer user_data);
 static void gst_proxy_src_dispose (GObject *object);
 
 static void
@@ -100,6 +192,43 @@ gst_proxy_src_get_property (GObject * object,
     case PROP_PROXYSINK:
       g_value_take_object (value, g_weak_ref_get (&self->priv->proxysink));
       break;
+    case PROP_MAX_LATENCY:
+      g_object_get_property (G_OBJECT (self->priv->queue), "max-size-time",
+          value);
+      break;
+    case PROP_LEAKY: {
+      gint leaky;
+      g_object_get (self->priv->queue, "leaky", &leaky, NULL);
+      g_value_set_enum (value, leaky);
+      break;
+    }
+    case PROP_DROPPED: {
+      guint in, out, level;
+      /* Read out before in so that a buffer arriving in between can't make
+       * the difference go negative */
+      out = g_atomic_int_get (&self->priv->buffers_out);
+      g_object_get (self->priv->queue, "current-level-buffers", &level, NULL);
+      in = g_atomic_int_get (&self->priv->buffers_in);
+      g_value_set_uint64 (value, in > out + level ? in - out - level : 0);
+      break;
+    }
+    case PROP_CURRENT_LEVEL_TIME:
+      g_object_get_property (G_OBJECT (self->priv->queue), "current-level-time",
+          value);
+      break;
+    case PROP_CURRENT_LEVEL_BUFFERS:
+      g_object_get_property (G_OBJECT (self->priv->queue),
+          "current-level-buffers", value);
+      break;
+    case PROP_BUFFERS:
+      g_value_set_uint64 (value, g_atomic_int_get (&self->priv->buffers_out));
+      break;
+    case PROP_BYTES:
+      g_value_set_uint64 (value, self->priv->bytes_out);
+      break;
+    case PROP_HANDOFF_LATENCY:
+      g_value_set_uint64 (value, self->priv->handoff_latency);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, spec);
       break;
@@ -115,23 +244,28 @@ gst_proxy_src_set_property (GObject * object,
 
   switch (prop_id) {
     case PROP_PROXYSINK:
+      /* Remove ourselves from the existing proxysink to break the connection
+       * in that direction; other proxysrcs might still be using it */
+      sink = g_weak_ref_get (&self->priv->proxysink);
+      if (sink) {
+        gst_proxy_sink_remove_proxysrc (sink, self);
+        g_object_unref (sink);
+      }
       sink = g_value_dup_object (value);
-      if (sink == NULL) {
-        /* Unset proxysrc property on the existing proxysink to break the
-         * connection in that direction */
-        GstProxySink *old_sink = g_weak_ref_get (&self->priv->proxysink);
-        if (old_sink) {
-          gst_proxy_sink_set_proxysrc (old_sink, NULL);
-          g_object_unref (old_sink);
-        }
-        g_weak_ref_set (&self->priv->proxysink, NULL);
-      } else {
-        /* Set proxysrc property on the new proxysink to point to us */
-        gst_proxy_sink_set_proxysrc (sink, self);
-        g_weak_ref_set (&self->priv->proxysink, sink);
+      g_weak_ref_set (&self->priv->proxysink, sink);
+      if (sink) {
+        /* Add ourselves to the proxysrcs of the new proxysink */
+        gst_proxy_sink_add_proxysrc (sink, self);
         g_object_unref (sink);
       }
       break;
+    case PROP_MAX_LATENCY:
+      g_object_set_property (G_OBJECT (self->priv->queue), "max-size-time",
+          value);
+      break;
+    case PROP_LEAKY:
+      g_object_set (self->priv->queue, "leaky", g_value_get_enum (value), NULL);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, spec);
   }
@@ -156,6 +290,104 @@ gst_proxy_src_class_init (GstProxySrcClass * klass)
       g_param_spec_object ("proxysink", "Proxysink", "Matching proxysink",
         GST_TYPE_PROXY_SINK, G_PARAM_READWRITE));
 
+  /**
+   * GstProxySrc:max-latency:
+   *
+   * Maximum amount of data in nanoseconds that the internal queue will hold.
+   * The queue has no buffer or byte limits, so it is bounded only in time,
+   * including with the default value.
+   */
+  g_object_class_install_property (gobject_class, PROP_MAX_LATENCY,
+      g_param_spec_uint64 ("max-latency", "Max latency",
+        "Max. amount of data to queue in ns (0=disable)", 0, G_MAXUINT64,
+        DEFAULT_MAX_LATENCY, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstProxySrc:leaky:
+   *
+   * Where the internal queue should drop buffers when it is full. Use
+   * "downstream" for live video, which drops the oldest buffers so that
+   * latency recovers after a stall in the downstream pipeline.
+   */
+  g_object_class_install_property (gobject_class, PROP_LEAKY,
+      g_param_spec_enum ("leaky", "Leaky",
+        "Where the queue leaks, if at all", GST_TYPE_PROXY_SRC_LEAKY,
+        DEFAULT_LEAKY, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstProxySrc:dropped:
+   *
+   * Number of buffers dropped by the internal queue because it was full
+   */
+  g_object_class_install_property (gobject_class, PROP_DROPPED,
+      g_param_spec_uint64 ("dropped", "Dropped",
+        "Number of buffers dropped because the queue was full", 0, G_MAXUINT64,
+        0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstProxySrc:current-level-time:
+   *
+   * Amount of data currently in the internal queue in nanoseconds
+   */
+  g_object_class_install_property (gobject_class, PROP_CURRENT_LEVEL_TIME,
+      g_param_spec_uint64 ("current-level-time", "Current level (ns)",
+        "Current amount of data in the queue (in ns)", 0, G_MAXUINT64, 0,
+        G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstProxySrc:current-level-buffers:
+   *
+   * Number of buffers currently in the internal queue
+   */
+  g_object_class_install_property (gobject_class, PROP_CURRENT_LEVEL_BUFFERS,
+      g_param_spec_uint ("current-level-buffers", "Current level (buffers)",
+        "Current number of buffers in the queue", 0, G_MAXUINT, 0,
+        G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstProxySrc:buffers:
+   *
+   * Number of buffers that came out of the element since it was last started
+   */
+  g_object_class_install_property (gobject_class, PROP_BUFFERS,
+      g_param_spec_uint64 ("buffers", "Buffers",
+        "Number of buffers pushed downstream", 0, G_MAXUINT64, 0,
+        G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstProxySrc:bytes:
+   *
+   * Number of bytes that came out of the element since it was last started
+   */
+  g_object_class_install_property (gobject_class, PROP_BYTES,
+      g_param_spec_uint64 ("bytes", "Bytes",
+        "Number of bytes pushed downstream", 0, G_MAXUINT64, 0,
+        G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstProxySrc:handoff-latency:
+   *
+   * Smoothed time in nanoseconds between a buffer being pushed into the
+   * matching proxysink and it being pushed downstream by us. This is mostly
+   * the time spent in the internal queue. It is measured on one buffer in
+   * every 16.
+   */
+  g_object_class_install_property (gobject_class, PROP_HANDOFF_LATENCY,
+      g_param_spec_uint64 ("handoff-latency", "Handoff latency",
+        "Time from proxysink to proxysrc output (in ns)", 0, G_MAXUINT64, 0,
+        G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstProxySrc::overrun:
+   * @proxysrc: the proxysrc
+   *
+   * Emitted from the upstream streaming thread when the internal queue is
+   * full. If the queue is leaky, a buffer is dropped right after this.
+   */
+  gst_proxy_src_signals[SIGNAL_OVERRUN] =
+    g_signal_new ("overrun", G_TYPE_FROM_CLASS (klass), G_SIGNAL_RUN_FIRST,
+        0, NULL, NULL, NULL, G_TYPE_NONE, 0);
+
   gstelement_class->change_state = gst_proxy_src_change_state;
   gst_element_class_add_pad_template (gstelement_class,
     gst_static_pad_template_get (&src_template));
@@ -165,6 +397,13 @@ gst_proxy_src_class_init (GstProxySrcClass * klass)
       "Sebastian Dröge <sebastian@centricular.com>");
 }
 
+static void
+gst_proxy_src_on_queue_overrun (GstProxySrc * self)
+{
+  GST_DEBUG_OBJECT (self, "Queue overrun");
+  g_signal_emit (self, gst_proxy_src_signals[SIGNAL_OVERRUN], 0);
+}
+
 static void
 gst_proxy_src_init (GstProxySrc * self)
 {
@@ -179,13 +418,16 @@ gst_proxy_src_init (GstProxySrc * self)
   /* We feed incoming buffers into a queue to decouple the downstream pipeline
    * from the upstream pipeline */
   self->priv->queue = gst_element_factory_make ("queue", NULL);
+  /* Bound the queue only in time; the buffer and byte limits would otherwise
+   * kick in first for high-bitrate or low-framerate streams */
+  g_object_set (self->priv->queue, "max-size-time", DEFAULT_MAX_LATENCY,
+      "max-size-buffers", 0, "max-size-bytes", 0, NULL);
   gst_bin_add (GST_BIN (self), self->priv->queue);
 
   srcpad = gst_element_get_static_pad (self->priv->queue, "src");
   templ = gst_static_pad_template_get (&src_template);
   self->priv->srcpad = gst_ghost_pad_new_from_template ("src", srcpad, templ);
   gst_object_unref (templ);
-  gst_object_unref (srcpad);
 
   gst_element_add_pad (GST_ELEMENT (self), self->priv->srcpad);
 
@@ -211,12 +453,33 @@ gst_proxy_src_init (GstProxySrc * self)
   sinkpad = gst_element_get_static_pad (self->priv->queue, "sink");
   gst_pad_link (self->priv->internal_srcpad, sinkpad);
   gst_object_unref (sinkpad);
+
+  /* Track buffers going in and out of the queue for statistics */
+  gst_pad_add_probe (self->priv->internal_srcpad,
+      GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+      gst_proxy_src_buffers_in, self, NULL);
+  gst_pad_add_probe (srcpad,
+      GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+      gst_proxy_src_buffers_out, self, NULL);
+  gst_object_unref (srcpad);
+
+  g_signal_connect_swapped (self->priv->queue, "overrun",
+      G_CALLBACK (gst_proxy_src_on_queue_overrun), self);
 }
 
 static void
 gst_proxy_src_dispose (GObject * object)
 {
   GstProxySrc *self = GST_PROXY_SRC (object);
+  GstProxySink *sink;
+
+  /* Make the proxysink drop the ref to our internal srcpad */
+  sink = g_weak_ref_get (&self->priv->proxysink);
+  if (sink) {
+    gst_proxy_sink_remove_proxysrc (sink, self);
+    gst_object_unref (sink);
+  }
+  g_weak_ref_set (&self->priv->proxysink, NULL);
 
   gst_object_unparent (GST_OBJECT (self->priv->dummy_sinkpad));
   self->priv->dummy_sinkpad = NULL;
@@ -224,8 +487,6 @@ gst_proxy_src_dispose (GObject * object)
   gst_object_unparent (GST_OBJECT (self->priv->internal_srcpad));
   self->priv->internal_srcpad = NULL;
 
-  g_weak_ref_set (&self->priv->proxysink, NULL);
-
   G_OBJECT_CLASS (gst_proxy_src_parent_class)->dispose (object);
 }
 
@@ -248,6 +509,12 @@ gst_proxy_src_change_state (GstElement * element, GstStateChange transition)
     break;
   case GST_STATE_CHANGE_PAUSED_TO_READY:
     gst_pad_set_active (self->priv->internal_srcpad, FALSE);
+    g_atomic_int_set (&self->priv->buffers_in, 0);
+    g_atomic_int_set (&self->priv->buffers_out, 0);
+    self->priv->bytes_out = 0;
+    self->priv->handoff_latency = 0;
+    self->priv->sample_wait = 0;
+    g_atomic_int_set (&self->priv->sample_pending, 0);
     break;
   default:
     break;
@@ -256,6 +523,112 @@ gst_proxy_src_change_state (GstElement * element, GstStateChange transition)
   return ret;
 }
 
+/* Called from the upstream streaming thread */
+static void
+gst_proxy_src_handoff_in (GstProxySrc * self, GstBuffer * buffer)
+{
+  GstProxySrcPrivate *priv = self->priv;
+
+  /* Still waiting for the previous sample to come out */
+  if (!GST_BUFFER_PTS_IS_VALID (buffer) ||
+      g_atomic_int_get (&priv->sample_pending))
+    return;
+
+  priv->sample_pts = GST_BUFFER_PTS (buffer);
+  priv->sample_time = g_get_monotonic_time ();
+  g_atomic_int_set (&priv->sample_pending, 1);
+}
+
+/* Called from the streaming thread of our queue */
+static void
+gst_proxy_src_handoff_out (GstProxySrc * self, GstBuffer * buffer)
+{
+  GstProxySrcPrivate *priv = self->priv;
+  GstClockTimeDiff latency;
+
+  if (!g_atomic_int_get (&priv->sample_pending) ||
+      !GST_BUFFER_PTS_IS_VALID (buffer))
+    return;
+
+  if (GST_BUFFER_PTS (buffer) != priv->sample_pts) {
+    if (++priv->sample_wait < HANDOFF_SAMPLE_MAX_WAIT)
+      return;
+    GST_LOG_OBJECT (self, "Buffer being measured was dropped; giving up");
+    goto done;
+  }
+
+  latency = (g_get_monotonic_time () - priv->sample_time) * GST_USECOND;
+  if (priv->handoff_latency == 0)
+    priv->handoff_latency = latency;
+  else
+    priv->handoff_latency = (priv->handoff_latency * 7 + latency) / 8;
+
+done:
+  priv->sample_wait = 0;
+  g_atomic_int_set (&priv->sample_pending, 0);
+}
+
+/* Called from the upstream streaming thread (the one of proxysink) */
+static GstPadProbeReturn
+gst_proxy_src_buffers_in (G_GNUC_UNUSED GstPad * pad, GstPadProbeInfo * info,
+    gpointer user_data)
+{
+  GstProxySrc *self = user_data;
+  GstBuffer *buffer;
+  guint seq, len;
+
+  if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+    GstBufferList *list = GST_PAD_PROBE_INFO_BUFFER_LIST (info);
+
+    len = gst_buffer_list_length (list);
+    if (len == 0)
+      return GST_PAD_PROBE_OK;
+    buffer = gst_buffer_list_get (list, 0);
+  } else {
+    len = 1;
+    buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  }
+
+  /* Sample the first buffer whenever the count crosses a multiple of the
+   * interval */
+  seq = g_atomic_int_add (&self->priv->buffers_in, len);
+  if (seq % HANDOFF_SAMPLE_INTERVAL + len >= HANDOFF_SAMPLE_INTERVAL)
+    gst_proxy_src_handoff_in (self, buffer);
+
+  return GST_PAD_PROBE_OK;
+}
+
+/* Called from the streaming thread of our queue */
+static GstPadProbeReturn
+gst_proxy_src_buffers_out (G_GNUC_UNUSED GstPad * pad, GstPadProbeInfo * info,
+    gpointer user_data)
+{
+  GstProxySrc *self = user_data;
+
+  if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+    GstBufferList *list = GST_PAD_PROBE_INFO_BUFFER_LIST (info);
+    guint ii, len = gst_buffer_list_length (list);
+    guint64 bytes = 0;
+
+    for (ii = 0; ii < len; ii++) {
+      GstBuffer *buffer = gst_buffer_list_get (list, ii);
+
+      bytes += gst_buffer_get_size (buffer);
+      gst_proxy_src_handoff_out (self, buffer);
+    }
+    g_atomic_int_add (&self->priv->buffers_out, len);
+    self->priv->bytes_out += bytes;
+  } else {
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+
+    gst_proxy_src_handoff_out (self, buffer);
+    g_atomic_int_inc (&self->priv->buffers_out);
+    self->priv->bytes_out += gst_buffer_get_size (buffer);
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
 static gboolean
 gst_proxy_src_internal_src_query (GstPad * pad, GstObject * parent,
     GstQuery * query)
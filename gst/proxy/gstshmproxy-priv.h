@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2015 Centricular Ltd.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ */
+
+#ifndef __GST_SHM_PROXY_PRIV_H__
+#define __GST_SHM_PROXY_PRIV_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Wire protocol between shmproxysink and shmproxysrc
+ *
+ * Every message is a single datagram on a connected SOCK_SEQPACKET unix
+ * socket. It starts with a GstShmProxyMsgHeader, followed by payload_size
+ * bytes of payload. Buffer data is never sent over the socket itself: the
+ * memfd containing it is passed along with the header as SCM_RIGHTS ancillary
+ * data and mapped by the receiver, so buffers are never copied by us.
+ *
+ * Memory sent without a copy may belong to a buffer pool on the sender's side.
+ * Such buffers carry a non-zero id, and the receiver sends a RELEASE message
+ * with that id back over the same socket once it's done with the memory. Until
+ * then, the sender keeps a ref so that the pool can't recycle the memory.
+ *
+ * Each memory is its own memfd rather than a slot in one shared ring because
+ * the buffers we proxy have independent lifetimes: decoders and pools hand
+ * out memory of different sizes, and downstream (jitterbuffers, queues, video
+ * sinks keeping the last frame) releases it in any order. A ring would need
+ * either a copy into it or in-order release, where one frame held by a sink
+ * stalls everything behind it. With pooled memory the memfds are created once
+ * per pool buffer and then reused, so the per-buffer cost is one sendmsg()
+ * and one mmap(). Only buffers that upstream didn't allocate from us are
+ * copied into a new memfd.
+ *
+ * Upstream queries that can be serialized (see gst_shm_proxy_query_can_forward())
+ * are sent back as QUERY messages with a non-zero id. The receiver runs them
+ * upstream and answers with a QUERY_RESULT carrying the same id. */
+
+/* Large enough for any serialized event we're likely to see; bigger ones
+ * (f.ex., tags with embedded images) are dropped by the sender */
+#define GST_SHM_PROXY_MAX_PAYLOAD_SIZE (16 * 1024)
+
+typedef enum {
+  /* Payload is the event type as a guint32 followed by the serialized event
+   * structure (or nothing if the event has no structure) */
+  GST_SHM_PROXY_MSG_EVENT = 1,
+  /* No payload; one memfd containing buffer_size bytes of data starting at
+   * data_offset is passed along with the message */
+  GST_SHM_PROXY_MSG_BUFFER = 2,
+  /* Sent back by the receiver; no payload, id is that of a buffer the
+   * receiver no longer uses */
+  GST_SHM_PROXY_MSG_RELEASE = 3,
+  /* Sent back by the receiver; payload is the query type as a guint32
+   * followed by the fields of the query as a serialized structure */
+  GST_SHM_PROXY_MSG_QUERY = 4,
+  /* Answer to the QUERY with the same id; same payload with the results, or
+   * no payload if the query wasn't handled */
+  GST_SHM_PROXY_MSG_QUERY_RESULT = 5,
+} GstShmProxyMsgType;
+
+typedef struct {
+  guint32 type;
+  guint32 payload_size;
+  /* Only for GST_SHM_PROXY_MSG_BUFFER */
+  guint64 buffer_size;
+  guint64 pts;
+  guint64 dts;
+  guint64 duration;
+  guint64 offset;
+  guint64 offset_end;
+  /* Offset of the data inside the memfd */
+  guint64 data_offset;
+  guint32 flags;
+  /* For buffers, non-zero if the receiver must send a RELEASE for them; for
+   * queries, matches a QUERY_RESULT to its QUERY */
+  guint32 id;
+} GstShmProxyMsgHeader;
+
+/* memfd-backed memory; proposed by shmproxysink in allocation queries so that
+ * upstream writes straight into memory that can be passed to the other
+ * process without a copy */
+#define GST_SHM_PROXY_MEMORY_TYPE "ShmProxyMemory"
+
+void gst_shm_proxy_init (void);
+
+GstAllocator* gst_shm_proxy_allocator_get (void);
+gint gst_shm_proxy_memory_get_fd (GstMemory *mem);
+
+gboolean gst_shm_proxy_buffer_can_share (GstBuffer *buffer);
+gboolean gst_shm_proxy_send_buffer (gint fd, GstBuffer *buffer, guint32 id,
+    GError **error);
+gboolean gst_shm_proxy_send_event (gint fd, GstEvent *event, GError **error);
+
+gboolean gst_shm_proxy_query_can_forward (GstQuery *query);
+/* type is QUERY or QUERY_RESULT; query is NULL for the result of a query that
+ * wasn't handled */
+gboolean gst_shm_proxy_send_query (gint fd, GstShmProxyMsgType type,
+    GstQuery *query, guint32 id, GError **error);
+/* Copies the results of a query received in a QUERY_RESULT into the query
+ * that was sent */
+gboolean gst_shm_proxy_query_copy_result (GstQuery *query,
+    GstQuery *result);
+
+/* Receives one message and sets *type and *id from its header. Returns a
+ * buffer, an event, or a query (for QUERY, and QUERY_RESULT of a handled
+ * query). Returns NULL for RELEASE and QUERY_RESULT of an unhandled query,
+ * with error set on failure, and with *type set to 0 on a clean close of the
+ * connection. */
+GstMiniObject* gst_shm_proxy_receive (gint fd, GstShmProxyMsgType *type,
+    guint32 *id, GError **error);
+
+G_END_DECLS
+
+#endif /* __GST_SHM_PROXY_PRIV_H__ */
@@ -0,0 +1,522 @@
+/*
+ * Copyright (C) 2015 Centricular Ltd.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ */
+
+/**
+ * SECTION:element-shmproxysink
+ *
+ * Shmproxysink is like proxysink, except that the matching shmproxysrc can be
+ * in a different process. This allows running parts of a pipeline, such as
+ * decoders or video sinks, in an isolated helper process: if the helper
+ * crashes, the pipeline containing shmproxysink carries on.
+ *
+ * The two elements are connected with a SOCK_SEQPACKET unix socket, one end of
+ * which is given to each element with the #GstShmProxySink:fd property (f.ex.,
+ * from socketpair() before forking the helper). Events are serialized over the
+ * socket in order with the buffers. Buffer data is passed as a memfd: we
+ * propose a memfd-backed allocator upstream, so in the common case buffers are
+ * not copied at all, and shmproxysrc maps the memory directly. This includes
+ * buffers from pools that allocate from it, such as those of most decoders:
+ * we keep a ref on each such buffer until shmproxysrc tells us it's done with
+ * it, so its memory can't be recycled while the other process reads it.
+ *
+ * Upstream events and queries are sent back over the same socket and pushed
+ * upstream from our own thread; the answers to queries are sent back to
+ * shmproxysrc. Only queries that can be serialized are forwarded: latency,
+ * caps, accept-caps, position, duration and seeking.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "gstshmproxysink.h"
+#include "gstshmproxy-priv.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <glib-unix.h>
+
+#define GST_CAT_DEFAULT gst_shm_proxy_sink_debug
+GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
+
+static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE ("sink",
+  GST_PAD_SINK,
+  GST_PAD_ALWAYS,
+  GST_STATIC_CAPS_ANY
+);
+
+enum
+{
+  PROP_0,
+  PROP_FD,
+};
+
+struct _GstShmProxySinkPrivate
+{
+  GstPad *sinkpad;
+  /* Our own dup of the socket connected to the shmproxysrc */
+  gint fd;
+  /* Whether sending to shmproxysrc failed; we drop everything after that */
+  gboolean disconnected;
+
+  /* Reads releases and upstream events sent back by shmproxysrc while we're
+   * PAUSED or PLAYING */
+  GThread *reader;
+  /* Written to by the application thread to stop the reader */
+  gint wakeup_fds[2];
+
+  /* Protects the fields below, which are shared with the reader */
+  GMutex lock;
+  /* Buffers sent without a copy that shmproxysrc hasn't released yet, keyed
+   * by the id they were sent with; we own a ref on each */
+  GHashTable *in_flight;
+  guint32 last_id;
+  /* Set by the reader when the connection is closed; nothing will be
+   * released after that */
+  gboolean peer_closed;
+};
+
+#define parent_class gst_shm_proxy_sink_parent_class
+G_DEFINE_TYPE (GstShmProxySink, gst_shm_proxy_sink, GST_TYPE_ELEMENT);
+
+static gboolean gst_shm_proxy_sink_sink_query (GstPad *pad, GstObject *parent,
+    GstQuery *query);
+static GstFlowReturn gst_shm_proxy_sink_sink_chain (GstPad *pad,
+    GstObject *parent, GstBuffer *buffer);
+static GstFlowReturn gst_shm_proxy_sink_sink_chain_list (GstPad *pad,
+    GstObject *parent, GstBufferList *list);
+static gboolean gst_shm_proxy_sink_sink_event (GstPad *pad, GstObject *parent,
+    GstEvent *event);
+
+static GstStateChangeReturn gst_shm_proxy_sink_change_state (
+    GstElement *element, GstStateChange transition);
+static void gst_shm_proxy_sink_finalize (GObject *object);
+
+static void
+gst_shm_proxy_sink_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstShmProxySink *self = GST_SHM_PROXY_SINK (object);
+
+  switch (prop_id) {
+    case PROP_FD:
+      g_value_set_int (value, self->priv->fd);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_shm_proxy_sink_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstShmProxySink *self = GST_SHM_PROXY_SINK (object);
+  gint fd;
+
+  switch (prop_id) {
+    case PROP_FD:
+      if (self->priv->fd >= 0)
+        close (self->priv->fd);
+      fd = g_value_get_int (value);
+      self->priv->fd = fd >= 0 ? dup (fd) : -1;
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_shm_proxy_sink_class_init (GstShmProxySinkClass * klass)
+{
+  GObjectClass *gobject_class = (GObjectClass *) klass;
+  GstElementClass *gstelement_class = (GstElementClass *) klass;
+
+  GST_DEBUG_CATEGORY_INIT (gst_shm_proxy_sink_debug, "shmproxysink", 0,
+      "shared memory proxy sink");
+  gst_shm_proxy_init ();
+
+  g_type_class_add_private (klass, sizeof (GstShmProxySinkPrivate));
+
+  gobject_class->finalize = gst_shm_proxy_sink_finalize;
+  gobject_class->get_property = gst_shm_proxy_sink_get_property;
+  gobject_class->set_property = gst_shm_proxy_sink_set_property;
+
+  /**
+   * GstShmProxySink:fd:
+   *
+   * A connected SOCK_SEQPACKET unix socket, the other end of which is used by
+   * the matching shmproxysrc. The element uses its own dup of the fd.
+   */
+  g_object_class_install_property (gobject_class, PROP_FD,
+      g_param_spec_int ("fd", "Socket fd",
+        "Socket connected to the matching shmproxysrc", -1, G_MAXINT, -1,
+        G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY |
+        G_PARAM_STATIC_STRINGS));
+
+  gstelement_class->change_state = gst_shm_proxy_sink_change_state;
+
+  gst_element_class_add_pad_template (gstelement_class,
+    gst_static_pad_template_get (&sink_template));
+
+  gst_element_class_set_static_metadata (gstelement_class,
+      "Shared memory proxy sink", "Sink",
+      "Proxy sink for inter-process communication over shared memory",
+      "Centricular Ltd.");
+}
+
+static void
+gst_shm_proxy_sink_init (GstShmProxySink * self)
+{
+  self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self, GST_TYPE_SHM_PROXY_SINK,
+      GstShmProxySinkPrivate);
+  self->priv->fd = -1;
+  self->priv->wakeup_fds[0] = self->priv->wakeup_fds[1] = -1;
+  g_mutex_init (&self->priv->lock);
+  self->priv->in_flight = g_hash_table_new_full (NULL, NULL, NULL,
+      (GDestroyNotify) gst_buffer_unref);
+  self->priv->sinkpad = gst_pad_new_from_static_template (&sink_template, "sink");
+  gst_pad_set_chain_function (self->priv->sinkpad,
+    GST_DEBUG_FUNCPTR (gst_shm_proxy_sink_sink_chain));
+  gst_pad_set_chain_list_function (self->priv->sinkpad,
+    GST_DEBUG_FUNCPTR (gst_shm_proxy_sink_sink_chain_list));
+  gst_pad_set_event_function (self->priv->sinkpad,
+    GST_DEBUG_FUNCPTR (gst_shm_proxy_sink_sink_event));
+  gst_pad_set_query_function (self->priv->sinkpad,
+    GST_DEBUG_FUNCPTR (gst_shm_proxy_sink_sink_query));
+  gst_element_add_pad (GST_ELEMENT (self), self->priv->sinkpad);
+}
+
+static void
+gst_shm_proxy_sink_finalize (GObject * object)
+{
+  GstShmProxySink *self = GST_SHM_PROXY_SINK (object);
+
+  if (self->priv->fd >= 0)
+    close (self->priv->fd);
+  g_hash_table_unref (self->priv->in_flight);
+  g_mutex_clear (&self->priv->lock);
+
+  G_OBJECT_CLASS (gst_shm_proxy_sink_parent_class)->finalize (object);
+}
+
+/* Called from the reader thread */
+static void
+gst_shm_proxy_sink_answer_query (GstShmProxySink * self, GstQuery * query,
+    guint32 id)
+{
+  GError *error = NULL;
+  gboolean handled;
+
+  handled = gst_pad_peer_query (self->priv->sinkpad, query);
+  GST_LOG_OBJECT (self, "Answering %s query %u: %shandled",
+      GST_QUERY_TYPE_NAME (query), id, handled ? "" : "not ");
+
+  if (!gst_shm_proxy_send_query (self->priv->fd,
+          GST_SHM_PROXY_MSG_QUERY_RESULT, handled ? query : NULL, id, &error)) {
+    GST_DEBUG_OBJECT (self, "Unable to answer %s query: %s",
+        GST_QUERY_TYPE_NAME (query), error->message);
+    g_error_free (error);
+  }
+
+  gst_query_unref (query);
+}
+
+static gpointer
+gst_shm_proxy_sink_reader (GstShmProxySink * self)
+{
+  struct pollfd fds[2];
+  GstShmProxyMsgType type;
+  GstMiniObject *obj;
+  GError *error = NULL;
+  guint32 id;
+
+  fds[0].fd = self->priv->fd;
+  fds[0].events = POLLIN;
+  fds[1].fd = self->priv->wakeup_fds[0];
+  fds[1].events = POLLIN;
+
+  while (TRUE) {
+    if (poll (fds, 2, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      GST_ERROR_OBJECT (self, "poll() failed: %s", g_strerror (errno));
+      break;
+    }
+
+    /* Being stopped */
+    if (fds[1].revents)
+      return NULL;
+
+    obj = gst_shm_proxy_receive (self->priv->fd, &type, &id, &error);
+    if (obj != NULL && GST_IS_EVENT (obj) &&
+        GST_EVENT_IS_UPSTREAM (GST_EVENT (obj))) {
+      GST_LOG_OBJECT (self, "Pushing upstream %s event",
+          GST_EVENT_TYPE_NAME (GST_EVENT (obj)));
+      gst_pad_push_event (self->priv->sinkpad, GST_EVENT (obj));
+      continue;
+    } else if (obj != NULL && type == GST_SHM_PROXY_MSG_QUERY) {
+      gst_shm_proxy_sink_answer_query (self, GST_QUERY (obj), id);
+      continue;
+    } else if (obj != NULL) {
+      GST_WARNING_OBJECT (self, "Dropping unexpected %" GST_PTR_FORMAT, obj);
+      gst_mini_object_unref (obj);
+      continue;
+    }
+    if (error != NULL || type == 0)
+      break;
+    if (type != GST_SHM_PROXY_MSG_RELEASE) {
+      GST_WARNING_OBJECT (self, "Dropping unexpected message of type %u",
+          type);
+      continue;
+    }
+
+    GST_LOG_OBJECT (self, "Buffer %u released", id);
+    g_mutex_lock (&self->priv->lock);
+    g_hash_table_remove (self->priv->in_flight, GUINT_TO_POINTER (id));
+    g_mutex_unlock (&self->priv->lock);
+  }
+
+  if (error) {
+    GST_DEBUG_OBJECT (self, "Stopped reading: %s", error->message);
+    g_error_free (error);
+  }
+
+  /* shmproxysrc is gone, and its mappings with it */
+  g_mutex_lock (&self->priv->lock);
+  self->priv->peer_closed = TRUE;
+  g_hash_table_remove_all (self->priv->in_flight);
+  g_mutex_unlock (&self->priv->lock);
+
+  return NULL;
+}
+
+static gboolean
+gst_shm_proxy_sink_start_reader (GstShmProxySink * self)
+{
+  GError *error = NULL;
+
+  if (self->priv->fd < 0)
+    return TRUE;
+
+  if (!g_unix_open_pipe (self->priv->wakeup_fds, FD_CLOEXEC, &error)) {
+    GST_ELEMENT_ERROR (self, RESOURCE, OPEN_READ, (NULL),
+        ("Unable to create wakeup pipe: %s", error->message));
+    g_error_free (error);
+    return FALSE;
+  }
+
+  self->priv->peer_closed = FALSE;
+  self->priv->reader = g_thread_new ("shmproxysink",
+      (GThreadFunc) gst_shm_proxy_sink_reader, self);
+
+  return TRUE;
+}
+
+static void
+gst_shm_proxy_sink_stop_reader (GstShmProxySink * self)
+{
+  if (self->priv->reader == NULL)
+    return;
+
+  if (write (self->priv->wakeup_fds[1], "x", 1) < 0)
+    GST_WARNING_OBJECT (self, "Unable to wake up reader thread: %s",
+        g_strerror (errno));
+  g_thread_join (self->priv->reader);
+  self->priv->reader = NULL;
+
+  close (self->priv->wakeup_fds[0]);
+  close (self->priv->wakeup_fds[1]);
+  self->priv->wakeup_fds[0] = self->priv->wakeup_fds[1] = -1;
+
+  /* Upstream is stopped too, so these go back to inactive pools and are
+   * freed rather than recycled */
+  g_hash_table_remove_all (self->priv->in_flight);
+}
+
+static GstStateChangeReturn
+gst_shm_proxy_sink_change_state (GstElement * element,
+    GstStateChange transition)
+{
+  GstElementClass *gstelement_class =
+    GST_ELEMENT_CLASS (gst_shm_proxy_sink_parent_class);
+  GstShmProxySink *self = GST_SHM_PROXY_SINK (element);
+  GstStateChangeReturn ret;
+
+  switch (transition) {
+  case GST_STATE_CHANGE_READY_TO_PAUSED:
+    self->priv->disconnected = FALSE;
+    if (!gst_shm_proxy_sink_start_reader (self))
+      return GST_STATE_CHANGE_FAILURE;
+    break;
+  default:
+    break;
+  }
+
+  ret = gstelement_class->change_state (element, transition);
+
+  switch (transition) {
+  case GST_STATE_CHANGE_READY_TO_PAUSED:
+    if (ret == GST_STATE_CHANGE_FAILURE)
+      gst_shm_proxy_sink_stop_reader (self);
+    break;
+  case GST_STATE_CHANGE_PAUSED_TO_READY:
+    gst_shm_proxy_sink_stop_reader (self);
+    break;
+  default:
+    break;
+  }
+
+  return ret;
+}
+
+/* Called from the streaming thread. Like proxysink, we never return an error
+ * upstream: if the other process goes away, we just drop everything. */
+static void
+gst_shm_proxy_sink_handle_error (GstShmProxySink * self, GError * error)
+{
+  if (!self->priv->disconnected)
+    GST_ELEMENT_WARNING (self, RESOURCE, WRITE,
+        ("Lost connection to shmproxysrc"), ("%s", error->message));
+  else
+    GST_DEBUG_OBJECT (self, "%s", error->message);
+  /* A single event being too large doesn't break the connection */
+  if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOSPC))
+    self->priv->disconnected = TRUE;
+  g_error_free (error);
+}
+
+static gboolean
+gst_shm_proxy_sink_sink_query (GstPad * pad, GstObject * parent,
+    GstQuery * query)
+{
+  GstAllocator *allocator;
+
+  GST_LOG_OBJECT (pad, "Handling query of type '%s'",
+    gst_query_type_get_name (GST_QUERY_TYPE (query)));
+
+  if (GST_QUERY_TYPE (query) != GST_QUERY_ALLOCATION)
+    return gst_pad_query_default (pad, parent, query);
+
+  /* Memory from this allocator can be sent without a copy, whether or not it
+   * comes from a pool; see gst_shm_proxy_sink_send_buffer() */
+  allocator = gst_shm_proxy_allocator_get ();
+  gst_query_add_allocation_param (query, allocator, NULL);
+  gst_object_unref (allocator);
+
+  return TRUE;
+}
+
+static gboolean
+gst_shm_proxy_sink_sink_event (GstPad * pad, GstObject * parent,
+    GstEvent * event)
+{
+  GstShmProxySink *self = GST_SHM_PROXY_SINK (parent);
+  GError *error = NULL;
+
+  GST_LOG_OBJECT (pad, "Got %s event", GST_EVENT_TYPE_NAME (event));
+
+  if (self->priv->fd >= 0 && !self->priv->disconnected &&
+      !gst_shm_proxy_send_event (self->priv->fd, event, &error))
+    gst_shm_proxy_sink_handle_error (self, error);
+
+  gst_event_unref (event);
+
+  return TRUE;
+}
+
+/* Called from the streaming thread */
+static gboolean
+gst_shm_proxy_sink_send_buffer (GstShmProxySink * self, GstBuffer * buffer,
+    GError ** error)
+{
+  guint32 id;
+
+  if (!gst_shm_proxy_buffer_can_share (buffer))
+    return gst_shm_proxy_send_buffer (self->priv->fd, buffer, 0, error);
+
+  /* Keep a ref until shmproxysrc releases the buffer, so that its pool can't
+   * recycle the memory while the other process reads it. This must be in the
+   * table before sending, since the release can come back right away. */
+  g_mutex_lock (&self->priv->lock);
+  if (self->priv->peer_closed) {
+    g_mutex_unlock (&self->priv->lock);
+    GST_LOG_OBJECT (self, "Dropped buffer %p: connection closed", buffer);
+    return TRUE;
+  }
+  do {
+    id = ++self->priv->last_id;
+  } while (id == 0 ||
+      g_hash_table_contains (self->priv->in_flight, GUINT_TO_POINTER (id)));
+  g_hash_table_insert (self->priv->in_flight, GUINT_TO_POINTER (id),
+      gst_buffer_ref (buffer));
+  g_mutex_unlock (&self->priv->lock);
+
+  if (gst_shm_proxy_send_buffer (self->priv->fd, buffer, id, error))
+    return TRUE;
+
+  g_mutex_lock (&self->priv->lock);
+  g_hash_table_remove (self->priv->in_flight, GUINT_TO_POINTER (id));
+  g_mutex_unlock (&self->priv->lock);
+  return FALSE;
+}
+
+static GstFlowReturn
+gst_shm_proxy_sink_sink_chain (GstPad * pad, GstObject * parent,
+    GstBuffer * buffer)
+{
+  GstShmProxySink *self = GST_SHM_PROXY_SINK (parent);
+  GError *error = NULL;
+
+  GST_LOG_OBJECT (pad, "Chaining buffer %p", buffer);
+
+  if (G_UNLIKELY (self->priv->fd < 0 || self->priv->disconnected))
+    GST_LOG_OBJECT (pad, "Dropped buffer %p: not connected", buffer);
+  else if (!gst_shm_proxy_sink_send_buffer (self, buffer, &error))
+    gst_shm_proxy_sink_handle_error (self, error);
+
+  gst_buffer_unref (buffer);
+
+  return GST_FLOW_OK;
+}
+
+static GstFlowReturn
+gst_shm_proxy_sink_sink_chain_list (GstPad * pad, GstObject * parent,
+    GstBufferList * list)
+{
+  guint ii, len;
+
+  GST_LOG_OBJECT (pad, "Chaining buffer list %p", list);
+
+  len = gst_buffer_list_length (list);
+  for (ii = 0; ii < len; ii++)
+    gst_shm_proxy_sink_sink_chain (pad, parent,
+        gst_buffer_ref (gst_buffer_list_get (list, ii)));
+  gst_buffer_list_unref (list);
+
+  return GST_FLOW_OK;
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2015 Centricular Ltd.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ */
+
+#ifndef __GST_SHM_PROXY_SINK_H__
+#define __GST_SHM_PROXY_SINK_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_SHM_PROXY_SINK            (gst_shm_proxy_sink_get_type())
+#define GST_SHM_PROXY_SINK(obj)            (G_TYPE_CHECK_INSTANCE_CAST((obj), GST_TYPE_SHM_PROXY_SINK, GstShmProxySink))
+#define GST_IS_SHM_PROXY_SINK(obj)         (G_TYPE_CHECK_INSTANCE_TYPE((obj), GST_TYPE_SHM_PROXY_SINK))
+#define GST_SHM_PROXY_SINK_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST((klass) , GST_TYPE_SHM_PROXY_SINK, GstShmProxySinkClass))
+#define GST_IS_SHM_PROXY_SINK_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE((klass) , GST_TYPE_SHM_PROXY_SINK))
+#define GST_SHM_PROXY_SINK_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS((obj) , GST_TYPE_SHM_PROXY_SINK, GstShmProxySinkClass))
+
+typedef struct _GstShmProxySink GstShmProxySink;
+typedef struct _GstShmProxySinkClass GstShmProxySinkClass;
+typedef struct _GstShmProxySinkPrivate GstShmProxySinkPrivate;
+
+struct _GstShmProxySink {
+  GstElement parent;
+
+  /* < private > */
+  GstShmProxySinkPrivate *priv;
+  gpointer  _gst_reserved[GST_PADDING];
+};
+
+struct _GstShmProxySinkClass {
+  GstElementClass parent_class;
+};
+
+GType gst_shm_proxy_sink_get_type(void);
+
+G_END_DECLS
+
+#endif /* __GST_SHM_PROXY_SINK_H__ */
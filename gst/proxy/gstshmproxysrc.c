@@ -0,0 +1,638 @@
+/*
+ * Copyright (C) 2015 Centricular Ltd.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ */
+
+/**
+ * SECTION:element-shmproxysrc
+ *
+ * Shmproxysrc receives the events and buffers sent by a matching shmproxysink
+ * element, which is usually in a different process. Buffer data is mapped
+ * directly from the memfd passed by shmproxysink, so it is never copied.
+ *
+ * Upstream events are sent back to shmproxysink, which pushes them upstream
+ * in its own process. So are latency, caps, accept-caps, position, duration
+ * and seeking queries: the querying thread blocks until the answer comes back
+ * or QUERY_TIMEOUT passes. If the query can't be forwarded or isn't answered,
+ * latency and caps queries are answered locally, and others get the default
+ * handling.
+ *
+ * Since data only arrives when the other process sends it, this element
+ * behaves as a live source. Timestamps are forwarded as-is, so both pipelines
+ * should use the system clock with the same base time.
+ *
+ * See shmproxysink for details.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "gstshmproxysrc.h"
+#include "gstshmproxy-priv.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <glib-unix.h>
+
+#define GST_CAT_DEFAULT gst_shm_proxy_src_debug
+GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
+
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE ("src",
+  GST_PAD_SRC,
+  GST_PAD_ALWAYS,
+  GST_STATIC_CAPS_ANY
+);
+
+/* How long a forwarded query waits for its answer */
+#define QUERY_TIMEOUT (500 * G_TIME_SPAN_MILLISECOND)
+
+enum
+{
+  PROP_0,
+  PROP_FD,
+};
+
+typedef enum
+{
+  READ_OK,
+  READ_TIMEOUT,
+  READ_FLUSHING,
+  READ_ERROR,
+} GstShmProxySrcReadResult;
+
+struct _GstShmProxySrcPrivate
+{
+  GstPad *srcpad;
+  /* Our own dup of the socket connected to the shmproxysink */
+  gint fd;
+  /* Written to by the application thread to wake up the thread reading from
+   * the socket when the srcpad is deactivated */
+  gint wakeup_fds[2];
+
+  /* Protects the fields below */
+  GMutex lock;
+  GCond cond;
+  /* Whether the srcpad is inactive */
+  gboolean flushing;
+  /* Whether a thread is reading from the socket. Usually that's the
+   * streaming thread, but a thread waiting for the answer to a query reads
+   * it itself when nobody else does, f.ex. when it is the streaming thread. */
+  gboolean reading;
+  /* Buffers and events read by a query thread, for the streaming thread to
+   * push in order before reading anything else */
+  GQueue pending;
+
+  /* Only one query is forwarded at a time */
+  GMutex query_lock;
+  guint32 last_query_id;
+  /* Id of the query waiting for its answer, or 0, and the answer */
+  guint32 query_id;
+  gboolean query_answered;
+  GstQuery *query_result;
+};
+
+#define parent_class gst_shm_proxy_src_parent_class
+G_DEFINE_TYPE (GstShmProxySrc, gst_shm_proxy_src, GST_TYPE_ELEMENT);
+
+static gboolean gst_shm_proxy_src_src_query (GstPad *pad, GstObject *parent,
+    GstQuery *query);
+static gboolean gst_shm_proxy_src_src_event (GstPad *pad, GstObject *parent,
+    GstEvent *event);
+static gboolean gst_shm_proxy_src_src_activate_mode (GstPad *pad,
+    GstObject *parent, GstPadMode mode, gboolean active);
+
+static GstStateChangeReturn gst_shm_proxy_src_change_state (
+    GstElement *element, GstStateChange transition);
+static void gst_shm_proxy_src_finalize (GObject *object);
+
+static void
+gst_shm_proxy_src_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstShmProxySrc *self = GST_SHM_PROXY_SRC (object);
+
+  switch (prop_id) {
+    case PROP_FD:
+      g_value_set_int (value, self->priv->fd);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_shm_proxy_src_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstShmProxySrc *self = GST_SHM_PROXY_SRC (object);
+  gint fd;
+
+  switch (prop_id) {
+    case PROP_FD:
+      if (self->priv->fd >= 0)
+        close (self->priv->fd);
+      fd = g_value_get_int (value);
+      self->priv->fd = fd >= 0 ? dup (fd) : -1;
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_shm_proxy_src_class_init (GstShmProxySrcClass * klass)
+{
+  GObjectClass *gobject_class = (GObjectClass *) klass;
+  GstElementClass *gstelement_class = (GstElementClass *) klass;
+
+  GST_DEBUG_CATEGORY_INIT (gst_shm_proxy_src_debug, "shmproxysrc", 0,
+      "shared memory proxy src");
+  gst_shm_proxy_init ();
+
+  g_type_class_add_private (klass, sizeof (GstShmProxySrcPrivate));
+
+  gobject_class->finalize = gst_shm_proxy_src_finalize;
+  gobject_class->get_property = gst_shm_proxy_src_get_property;
+  gobject_class->set_property = gst_shm_proxy_src_set_property;
+
+  /**
+   * GstShmProxySrc:fd:
+   *
+   * A connected SOCK_SEQPACKET unix socket, the other end of which is used by
+   * the matching shmproxysink. The element uses its own dup of the fd.
+   */
+  g_object_class_install_property (gobject_class, PROP_FD,
+      g_param_spec_int ("fd", "Socket fd",
+        "Socket connected to the matching shmproxysink", -1, G_MAXINT, -1,
+        G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY |
+        G_PARAM_STATIC_STRINGS));
+
+  gstelement_class->change_state = gst_shm_proxy_src_change_state;
+
+  gst_element_class_add_pad_template (gstelement_class,
+    gst_static_pad_template_get (&src_template));
+
+  gst_element_class_set_static_metadata (gstelement_class,
+      "Shared memory proxy source", "Source",
+      "Proxy source for inter-process communication over shared memory",
+      "Centricular Ltd.");
+}
+
+static void
+gst_shm_proxy_src_init (GstShmProxySrc * self)
+{
+  GST_OBJECT_FLAG_SET (self, GST_ELEMENT_FLAG_SOURCE);
+
+  self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self, GST_TYPE_SHM_PROXY_SRC,
+      GstShmProxySrcPrivate);
+  self->priv->fd = -1;
+  self->priv->wakeup_fds[0] = self->priv->wakeup_fds[1] = -1;
+  g_mutex_init (&self->priv->lock);
+  g_cond_init (&self->priv->cond);
+  g_mutex_init (&self->priv->query_lock);
+  g_queue_init (&self->priv->pending);
+  self->priv->flushing = TRUE;
+
+  self->priv->srcpad = gst_pad_new_from_static_template (&src_template, "src");
+  gst_pad_set_activatemode_function (self->priv->srcpad,
+    GST_DEBUG_FUNCPTR (gst_shm_proxy_src_src_activate_mode));
+  gst_pad_set_event_function (self->priv->srcpad,
+    GST_DEBUG_FUNCPTR (gst_shm_proxy_src_src_event));
+  gst_pad_set_query_function (self->priv->srcpad,
+    GST_DEBUG_FUNCPTR (gst_shm_proxy_src_src_query));
+  gst_element_add_pad (GST_ELEMENT (self), self->priv->srcpad);
+}
+
+static void
+gst_shm_proxy_src_finalize (GObject * object)
+{
+  GstShmProxySrc *self = GST_SHM_PROXY_SRC (object);
+
+  if (self->priv->fd >= 0)
+    close (self->priv->fd);
+  g_mutex_clear (&self->priv->lock);
+  g_cond_clear (&self->priv->cond);
+  g_mutex_clear (&self->priv->query_lock);
+
+  G_OBJECT_CLASS (gst_shm_proxy_src_parent_class)->finalize (object);
+}
+
+static GstStateChangeReturn
+gst_shm_proxy_src_change_state (GstElement * element,
+    GstStateChange transition)
+{
+  GstElementClass *gstelement_class =
+    GST_ELEMENT_CLASS (gst_shm_proxy_src_parent_class);
+  GstStateChangeReturn ret;
+
+  ret = gstelement_class->change_state (element, transition);
+  if (ret == GST_STATE_CHANGE_FAILURE)
+    return ret;
+
+  switch (transition) {
+  case GST_STATE_CHANGE_READY_TO_PAUSED:
+  case GST_STATE_CHANGE_PLAYING_TO_PAUSED:
+    /* We're live */
+    ret = GST_STATE_CHANGE_NO_PREROLL;
+    break;
+  default:
+    break;
+  }
+
+  return ret;
+}
+
+/* Called with the lock TAKEN by the thread that set priv->reading, and
+ * returns with it TAKEN. Waits for at most timeout_ms (-1 for no limit) for a
+ * message and reads it. The answer to a query is handed to the thread waiting
+ * for it; buffers and events are returned in obj. */
+static GstShmProxySrcReadResult
+gst_shm_proxy_src_read (GstShmProxySrc * self, gint timeout_ms,
+    GstMiniObject ** obj, GError ** error)
+{
+  GstShmProxySrcPrivate *priv = self->priv;
+  GstShmProxyMsgType type;
+  struct pollfd fds[2];
+  guint32 id;
+  gint ret;
+
+  *obj = NULL;
+  fds[0].fd = priv->fd;
+  fds[0].events = POLLIN;
+  fds[1].fd = priv->wakeup_fds[0];
+  fds[1].events = POLLIN;
+
+  g_mutex_unlock (&priv->lock);
+  do {
+    ret = poll (fds, 2, timeout_ms);
+  } while (ret < 0 && errno == EINTR);
+
+  if (ret < 0) {
+    gint errsv = errno;
+    g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errsv),
+        "poll() failed: %s", g_strerror (errsv));
+    g_mutex_lock (&priv->lock);
+    return READ_ERROR;
+  }
+
+  /* Being deactivated */
+  if (fds[1].revents) {
+    g_mutex_lock (&priv->lock);
+    return READ_FLUSHING;
+  }
+
+  if (ret == 0) {
+    g_mutex_lock (&priv->lock);
+    return READ_TIMEOUT;
+  }
+
+  *obj = gst_shm_proxy_receive (priv->fd, &type, &id, error);
+  g_mutex_lock (&priv->lock);
+
+  if (*error == NULL && type == GST_SHM_PROXY_MSG_QUERY_RESULT) {
+    if (id != 0 && id == priv->query_id) {
+      priv->query_result = (GstQuery *) * obj;
+      priv->query_answered = TRUE;
+      g_cond_broadcast (&priv->cond);
+    } else {
+      GST_DEBUG_OBJECT (self, "Dropping answer to query %u: timed out", id);
+      if (*obj)
+        gst_mini_object_unref (*obj);
+    }
+    *obj = NULL;
+    return READ_OK;
+  }
+
+  if (*obj != NULL && (GST_IS_BUFFER (*obj) || GST_IS_EVENT (*obj)))
+    return READ_OK;
+
+  if (*obj != NULL || (*error == NULL && type != 0)) {
+    g_clear_pointer (obj, gst_mini_object_unref);
+    g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+        "Received unexpected message of type %u", type);
+  }
+
+  /* Connection closed if no error is set */
+  return READ_ERROR;
+}
+
+static void
+gst_shm_proxy_src_loop (GstPad * pad)
+{
+  GstShmProxySrc *self = GST_SHM_PROXY_SRC (GST_PAD_PARENT (pad));
+  GstShmProxySrcPrivate *priv = self->priv;
+  GstShmProxySrcReadResult res = READ_OK;
+  GstMiniObject *obj;
+  GstFlowReturn ret;
+  GError *error = NULL;
+
+  g_mutex_lock (&priv->lock);
+  while (g_queue_is_empty (&priv->pending) && priv->reading &&
+      !priv->flushing)
+    g_cond_wait (&priv->cond, &priv->lock);
+
+  if (priv->flushing) {
+    g_mutex_unlock (&priv->lock);
+    goto pause;
+  }
+
+  obj = g_queue_pop_head (&priv->pending);
+  if (obj == NULL) {
+    priv->reading = TRUE;
+    res = gst_shm_proxy_src_read (self, -1, &obj, &error);
+    priv->reading = FALSE;
+    g_cond_broadcast (&priv->cond);
+  }
+  g_mutex_unlock (&priv->lock);
+
+  if (res == READ_FLUSHING)
+    goto pause;
+
+  if (res == READ_ERROR) {
+    if (error) {
+      GST_ELEMENT_ERROR (self, RESOURCE, READ,
+          ("Error receiving from shmproxysink"), ("%s", error->message));
+      g_error_free (error);
+    } else {
+      GST_ELEMENT_WARNING (self, RESOURCE, READ,
+          ("Lost connection to shmproxysink"), (NULL));
+    }
+    gst_pad_push_event (pad, gst_event_new_eos ());
+    goto pause;
+  }
+
+  /* The answer to a query */
+  if (obj == NULL)
+    return;
+
+  if (GST_IS_EVENT (obj)) {
+    GST_LOG_OBJECT (pad, "Received %s event",
+        GST_EVENT_TYPE_NAME (GST_EVENT (obj)));
+    gst_pad_push_event (pad, GST_EVENT (obj));
+    return;
+  }
+
+  GST_LOG_OBJECT (pad, "Received buffer %p", obj);
+  ret = gst_pad_push (pad, GST_BUFFER (obj));
+  if (ret == GST_FLOW_OK)
+    return;
+
+  GST_DEBUG_OBJECT (pad, "Pausing task: %s", gst_flow_get_name (ret));
+  if (ret == GST_FLOW_NOT_LINKED || ret < GST_FLOW_EOS) {
+    GST_ELEMENT_ERROR (self, STREAM, FAILED, ("Internal data stream error."),
+        ("streaming stopped, reason %s", gst_flow_get_name (ret)));
+    gst_pad_push_event (pad, gst_event_new_eos ());
+  }
+
+pause:
+  gst_pad_pause_task (pad);
+}
+
+static gboolean
+gst_shm_proxy_src_src_activate_mode (GstPad * pad, GstObject * parent,
+    GstPadMode mode, gboolean active)
+{
+  GstShmProxySrc *self = GST_SHM_PROXY_SRC (parent);
+  GError *error = NULL;
+
+  if (mode != GST_PAD_MODE_PUSH)
+    return FALSE;
+
+  if (active) {
+    if (self->priv->fd < 0) {
+      GST_ELEMENT_ERROR (self, RESOURCE, NOT_FOUND,
+          ("No socket to receive from"), ("fd property not set"));
+      return FALSE;
+    }
+    if (!g_unix_open_pipe (self->priv->wakeup_fds, FD_CLOEXEC, &error)) {
+      GST_ELEMENT_ERROR (self, RESOURCE, OPEN_READ, (NULL),
+          ("Unable to create wakeup pipe: %s", error->message));
+      g_error_free (error);
+      return FALSE;
+    }
+    g_mutex_lock (&self->priv->lock);
+    self->priv->flushing = FALSE;
+    g_mutex_unlock (&self->priv->lock);
+    return gst_pad_start_task (pad, (GstTaskFunction) gst_shm_proxy_src_loop,
+        pad, NULL);
+  }
+
+  /* Wake up whoever is waiting in poll() or for the reader to finish, and
+   * wait for the streaming thread to stop */
+  g_mutex_lock (&self->priv->lock);
+  self->priv->flushing = TRUE;
+  g_cond_broadcast (&self->priv->cond);
+  g_mutex_unlock (&self->priv->lock);
+  if (write (self->priv->wakeup_fds[1], "x", 1) < 0)
+    GST_WARNING_OBJECT (self, "Unable to wake up streaming thread: %s",
+        g_strerror (errno));
+  gst_pad_stop_task (pad);
+
+  /* A query thread may still be reading */
+  g_mutex_lock (&self->priv->lock);
+  while (self->priv->reading)
+    g_cond_wait (&self->priv->cond, &self->priv->lock);
+  g_queue_free_full (g_queue_copy (&self->priv->pending),
+      (GDestroyNotify) gst_mini_object_unref);
+  g_queue_clear (&self->priv->pending);
+  g_mutex_unlock (&self->priv->lock);
+
+  close (self->priv->wakeup_fds[0]);
+  close (self->priv->wakeup_fds[1]);
+  self->priv->wakeup_fds[0] = self->priv->wakeup_fds[1] = -1;
+
+  return TRUE;
+}
+
+/* Sends the query to shmproxysink, which runs it upstream in its own process,
+ * and waits up to QUERY_TIMEOUT for the answer. Called from any thread,
+ * including the streaming thread when something downstream queries while
+ * handling data that we pushed. */
+static gboolean
+gst_shm_proxy_src_forward_query (GstShmProxySrc * self, GstQuery * query)
+{
+  GstShmProxySrcPrivate *priv = self->priv;
+  GstShmProxySrcReadResult res;
+  GstQuery *result = NULL;
+  GError *error = NULL;
+  gboolean answered;
+  gint64 deadline;
+  guint32 id;
+
+  if (!gst_shm_proxy_query_can_forward (query))
+    return FALSE;
+
+  g_mutex_lock (&priv->query_lock);
+  g_mutex_lock (&priv->lock);
+  /* Nothing answers unless both elements are at least PAUSED */
+  if (priv->flushing) {
+    g_mutex_unlock (&priv->lock);
+    g_mutex_unlock (&priv->query_lock);
+    return FALSE;
+  }
+  id = ++priv->last_query_id;
+  if (id == 0)
+    id = ++priv->last_query_id;
+  priv->query_id = id;
+  priv->query_answered = FALSE;
+  g_mutex_unlock (&priv->lock);
+
+  deadline = g_get_monotonic_time () + QUERY_TIMEOUT;
+  gst_shm_proxy_send_query (priv->fd, GST_SHM_PROXY_MSG_QUERY, query, id,
+      &error);
+
+  g_mutex_lock (&priv->lock);
+  while (error == NULL && !priv->query_answered && !priv->flushing) {
+    GstMiniObject *obj;
+    gint64 now = g_get_monotonic_time ();
+
+    if (now >= deadline)
+      break;
+
+    if (priv->reading) {
+      g_cond_wait_until (&priv->cond, &priv->lock, deadline);
+      continue;
+    }
+
+    priv->reading = TRUE;
+    res = gst_shm_proxy_src_read (self, (deadline - now + 999) / 1000, &obj,
+        &error);
+    priv->reading = FALSE;
+    g_cond_broadcast (&priv->cond);
+
+    if (obj != NULL)
+      g_queue_push_tail (&priv->pending, obj);
+    if (res == READ_FLUSHING)
+      break;
+    /* The connection is closed; the streaming thread will notice too */
+    if (res == READ_ERROR && error == NULL)
+      break;
+  }
+  answered = priv->query_answered;
+  result = priv->query_result;
+  priv->query_result = NULL;
+  priv->query_id = 0;
+  g_mutex_unlock (&priv->lock);
+  g_mutex_unlock (&priv->query_lock);
+
+  if (error != NULL) {
+    GST_DEBUG_OBJECT (self, "Unable to forward %s query: %s",
+        GST_QUERY_TYPE_NAME (query), error->message);
+    g_error_free (error);
+    return FALSE;
+  }
+
+  if (!answered) {
+    GST_WARNING_OBJECT (self, "%s query not answered in time",
+        GST_QUERY_TYPE_NAME (query));
+    return FALSE;
+  }
+
+  if (result == NULL)
+    return FALSE;
+
+  answered = gst_shm_proxy_query_copy_result (query, result);
+  gst_query_unref (result);
+
+  return answered;
+}
+
+static gboolean
+gst_shm_proxy_src_src_query (GstPad * pad, GstObject * parent,
+    GstQuery * query)
+{
+  GstShmProxySrc *self = GST_SHM_PROXY_SRC (parent);
+
+  GST_LOG_OBJECT (pad, "Handling query of type '%s'",
+    gst_query_type_get_name (GST_QUERY_TYPE (query)));
+
+  if (gst_shm_proxy_src_forward_query (self, query)) {
+    /* Data only arrives when the other process sends it, whatever upstream
+     * of shmproxysink is */
+    if (GST_QUERY_TYPE (query) == GST_QUERY_LATENCY) {
+      GstClockTime min, max;
+
+      gst_query_parse_latency (query, NULL, &min, &max);
+      gst_query_set_latency (query, TRUE, min, max);
+    }
+    return TRUE;
+  }
+
+  switch (GST_QUERY_TYPE (query)) {
+    case GST_QUERY_LATENCY:
+      gst_query_set_latency (query, TRUE, 0, GST_CLOCK_TIME_NONE);
+      return TRUE;
+    case GST_QUERY_CAPS: {
+      GstCaps *caps, *filter;
+
+      caps = gst_pad_get_current_caps (pad);
+      if (caps == NULL)
+        break;
+      gst_query_parse_caps (query, &filter);
+      if (filter) {
+        GstCaps *tmp = gst_caps_intersect_full (filter, caps,
+            GST_CAPS_INTERSECT_FIRST);
+        gst_caps_unref (caps);
+        caps = tmp;
+      }
+      gst_query_set_caps_result (query, caps);
+      gst_caps_unref (caps);
+      return TRUE;
+    }
+    default:
+      break;
+  }
+
+  return gst_pad_query_default (pad, parent, query);
+}
+
+static gboolean
+gst_shm_proxy_src_src_event (GstPad * pad, GstObject * parent,
+    GstEvent * event)
+{
+  GstShmProxySrc *self = GST_SHM_PROXY_SRC (parent);
+  GError *error = NULL;
+  gboolean ret = FALSE;
+
+  GST_LOG_OBJECT (pad, "Sending upstream %s event",
+      GST_EVENT_TYPE_NAME (event));
+
+  if (self->priv->fd < 0) {
+    GST_DEBUG_OBJECT (pad, "Dropping upstream %s event: not connected",
+        GST_EVENT_TYPE_NAME (event));
+  } else if (!gst_shm_proxy_send_event (self->priv->fd, event, &error)) {
+    GST_WARNING_OBJECT (pad, "Unable to send upstream %s event: %s",
+        GST_EVENT_TYPE_NAME (event), error->message);
+    g_error_free (error);
+  } else {
+    /* Whether upstream handled it is only known in the other process */
+    ret = TRUE;
+  }
+
+  gst_event_unref (event);
+
+  return ret;
+}
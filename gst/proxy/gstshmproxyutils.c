@@ -0,0 +1,898 @@
+/*
+ * Copyright (C) 2015 Centricular Ltd.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ */
+
+/* For memfd_create() and file sealing */
+#define _GNU_SOURCE
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "gstshmproxy-priv.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+GST_DEBUG_CATEGORY_STATIC (gst_shm_proxy_debug);
+#define GST_CAT_DEFAULT gst_shm_proxy_debug
+
+/* Older libcs don't define the sealing API even when the kernel has it */
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS (1024 + 9)
+#define F_GET_SEALS (1024 + 10)
+#define F_SEAL_SEAL   0x0001
+#define F_SEAL_SHRINK 0x0002
+#define F_SEAL_GROW   0x0004
+#endif
+#ifndef MFD_ALLOW_SEALING
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+
+/* Sealed on every memfd we send. Without SHRINK, the other process could
+ * truncate the memfd while we have it mapped and crash us with SIGBUS. */
+#define MEMFD_SEALS (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL)
+
+/* Only buffer flags are sent; the lower bits are mini object flags */
+#define BUFFER_FLAGS_MASK (~((guint) GST_MINI_OBJECT_FLAG_LAST - 1))
+
+typedef struct {
+  GstMemory mem;
+  gint fd;
+  gpointer data;
+} GstShmProxyMemory;
+
+typedef struct {
+  GstAllocator parent;
+} GstShmProxyAllocator;
+
+typedef struct {
+  GstAllocatorClass parent_class;
+} GstShmProxyAllocatorClass;
+
+GType gst_shm_proxy_allocator_get_type (void);
+G_DEFINE_TYPE (GstShmProxyAllocator, gst_shm_proxy_allocator,
+    GST_TYPE_ALLOCATOR);
+
+static GstMemory *
+gst_shm_proxy_allocator_alloc (GstAllocator * allocator, gsize size,
+    GstAllocationParams * params)
+{
+  GstShmProxyMemory *mem;
+  gsize maxsize;
+  gpointer data;
+  gint fd;
+
+  /* mmap() always gives us page-aligned memory, so params->align is
+   * satisfied for free */
+  maxsize = MAX (params->prefix + size + params->padding, 1);
+
+  fd = memfd_create ("shmproxy", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd < 0) {
+    GST_ERROR ("Unable to create memfd: %s", g_strerror (errno));
+    return NULL;
+  }
+
+  if (ftruncate (fd, maxsize) < 0) {
+    GST_ERROR ("Unable to resize memfd to %" G_GSIZE_FORMAT ": %s", maxsize,
+        g_strerror (errno));
+    close (fd);
+    return NULL;
+  }
+
+  /* The size is fixed from now on; the receiver refuses unsealed memfds */
+  if (fcntl (fd, F_ADD_SEALS, MEMFD_SEALS) < 0) {
+    GST_ERROR ("Unable to seal memfd: %s", g_strerror (errno));
+    close (fd);
+    return NULL;
+  }
+
+  data = mmap (NULL, maxsize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED) {
+    GST_ERROR ("Unable to map memfd: %s", g_strerror (errno));
+    close (fd);
+    return NULL;
+  }
+
+  if ((params->flags & GST_MEMORY_FLAG_ZERO_PREFIXED) && params->prefix)
+    memset (data, 0, params->prefix);
+  if ((params->flags & GST_MEMORY_FLAG_ZERO_PADDED) && params->padding)
+    memset ((guint8 *) data + params->prefix + size, 0, params->padding);
+
+  mem = g_slice_new (GstShmProxyMemory);
+  gst_memory_init (GST_MEMORY_CAST (mem), params->flags, allocator, NULL,
+      maxsize, params->align, params->prefix, size);
+  mem->fd = fd;
+  mem->data = data;
+
+  return GST_MEMORY_CAST (mem);
+}
+
+static void
+gst_shm_proxy_allocator_free (G_GNUC_UNUSED GstAllocator * allocator,
+    GstMemory * memory)
+{
+  GstShmProxyMemory *mem = (GstShmProxyMemory *) memory;
+
+  /* Shared memories point into the mapping of their parent */
+  if (memory->parent == NULL) {
+    munmap (mem->data, memory->maxsize);
+    close (mem->fd);
+  }
+  g_slice_free (GstShmProxyMemory, mem);
+}
+
+static gpointer
+gst_shm_proxy_memory_map (GstMemory * memory, G_GNUC_UNUSED gsize maxsize,
+    G_GNUC_UNUSED GstMapFlags flags)
+{
+  return ((GstShmProxyMemory *) memory)->data;
+}
+
+static void
+gst_shm_proxy_memory_unmap (G_GNUC_UNUSED GstMemory * memory)
+{
+}
+
+static GstMemory *
+gst_shm_proxy_memory_share (GstMemory * memory, gssize offset, gssize size)
+{
+  GstShmProxyMemory *mem = (GstShmProxyMemory *) memory;
+  GstShmProxyMemory *sub;
+  GstMemory *parent;
+
+  if (size == -1)
+    size = memory->size - offset;
+
+  parent = memory->parent ? memory->parent : memory;
+
+  sub = g_slice_new (GstShmProxyMemory);
+  gst_memory_init (GST_MEMORY_CAST (sub),
+      GST_MINI_OBJECT_FLAGS (parent) | GST_MINI_OBJECT_FLAG_LOCK_READONLY,
+      memory->allocator, parent, memory->maxsize, memory->align,
+      memory->offset + offset, size);
+  sub->fd = mem->fd;
+  sub->data = mem->data;
+
+  return GST_MEMORY_CAST (sub);
+}
+
+static void
+gst_shm_proxy_allocator_class_init (GstShmProxyAllocatorClass * klass)
+{
+  GstAllocatorClass *allocator_class = (GstAllocatorClass *) klass;
+
+  allocator_class->alloc = gst_shm_proxy_allocator_alloc;
+  allocator_class->free = gst_shm_proxy_allocator_free;
+}
+
+static void
+gst_shm_proxy_allocator_init (GstShmProxyAllocator * self)
+{
+  GstAllocator *allocator = (GstAllocator *) self;
+
+  allocator->mem_type = GST_SHM_PROXY_MEMORY_TYPE;
+  allocator->mem_map = gst_shm_proxy_memory_map;
+  allocator->mem_unmap = gst_shm_proxy_memory_unmap;
+  allocator->mem_share = gst_shm_proxy_memory_share;
+}
+
+/* Called from class_init of the elements */
+void
+gst_shm_proxy_init (void)
+{
+  static gsize initialized = 0;
+
+  if (g_once_init_enter (&initialized)) {
+    GST_DEBUG_CATEGORY_INIT (gst_shm_proxy_debug, "shmproxy", 0,
+        "shared memory proxy");
+    g_once_init_leave (&initialized, 1);
+  }
+}
+
+/* Returns a new ref to the allocator; it's shared by all elements */
+GstAllocator *
+gst_shm_proxy_allocator_get (void)
+{
+  static gsize allocator = 0;
+
+  if (g_once_init_enter (&allocator)) {
+    GstAllocator *tmp = g_object_new (gst_shm_proxy_allocator_get_type (),
+        NULL);
+    gst_object_ref_sink (tmp);
+    g_once_init_leave (&allocator, (gsize) tmp);
+  }
+
+  return gst_object_ref ((GstAllocator *) allocator);
+}
+
+gint
+gst_shm_proxy_memory_get_fd (GstMemory * mem)
+{
+  if (!gst_memory_is_type (mem, GST_SHM_PROXY_MEMORY_TYPE))
+    return -1;
+  return ((GstShmProxyMemory *) mem)->fd;
+}
+
+static gboolean
+gst_shm_proxy_send (gint fd, GstShmProxyMsgHeader * header,
+    gconstpointer payload, gint memfd, GError ** error)
+{
+  struct iovec iov[2];
+  struct msghdr msg = { 0 };
+  union {
+    struct cmsghdr hdr;
+    gchar buf[CMSG_SPACE (sizeof (gint))];
+  } control;
+  ssize_t ret;
+
+  iov[0].iov_base = header;
+  iov[0].iov_len = sizeof (*header);
+  iov[1].iov_base = (gpointer) payload;
+  iov[1].iov_len = header->payload_size;
+  msg.msg_iov = iov;
+  msg.msg_iovlen = header->payload_size ? 2 : 1;
+
+  if (memfd >= 0) {
+    struct cmsghdr *cmsg;
+
+    memset (&control, 0, sizeof (control));
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof (control.buf);
+    cmsg = CMSG_FIRSTHDR (&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN (sizeof (gint));
+    memcpy (CMSG_DATA (cmsg), &memfd, sizeof (gint));
+  }
+
+  do {
+    /* MSG_NOSIGNAL: a crashed peer must not take us down with SIGPIPE */
+    ret = sendmsg (fd, &msg, MSG_NOSIGNAL);
+  } while (ret < 0 && errno == EINTR);
+
+  if (ret < 0) {
+    gint errsv = errno;
+    g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errsv),
+        "Unable to send message: %s", g_strerror (errsv));
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Whether all the buffer's data is in one memory from our allocator, so that
+ * it can be sent without a copy. The caller must keep a ref on such buffers
+ * until the receiver releases them. */
+gboolean
+gst_shm_proxy_buffer_can_share (GstBuffer * buffer)
+{
+  return gst_buffer_n_memory (buffer) == 1 &&
+    gst_buffer_get_size (buffer) > 0 &&
+    gst_shm_proxy_memory_get_fd (gst_buffer_peek_memory (buffer, 0)) >= 0;
+}
+
+/* With a non-zero id, sends the buffer without copying; it must be one for
+ * which gst_shm_proxy_buffer_can_share() is TRUE. With an id of 0, copies it
+ * into a new memfd first. */
+gboolean
+gst_shm_proxy_send_buffer (gint fd, GstBuffer * buffer, guint32 id,
+    GError ** error)
+{
+  GstShmProxyMsgHeader header = { 0 };
+  GstMemory *mem = NULL;
+  gboolean ret;
+  gint memfd = -1;
+
+  header.type = GST_SHM_PROXY_MSG_BUFFER;
+  header.buffer_size = gst_buffer_get_size (buffer);
+  header.pts = GST_BUFFER_PTS (buffer);
+  header.dts = GST_BUFFER_DTS (buffer);
+  header.duration = GST_BUFFER_DURATION (buffer);
+  header.offset = GST_BUFFER_OFFSET (buffer);
+  header.offset_end = GST_BUFFER_OFFSET_END (buffer);
+  header.flags = GST_BUFFER_FLAGS (buffer) & BUFFER_FLAGS_MASK;
+  header.id = id;
+
+  if (id != 0) {
+    GstMemory *bmem = gst_buffer_peek_memory (buffer, 0);
+
+    memfd = gst_shm_proxy_memory_get_fd (bmem);
+    header.data_offset = bmem->offset;
+    g_return_val_if_fail (memfd >= 0, FALSE);
+  }
+
+  if (memfd < 0) {
+    GstAllocator *allocator = gst_shm_proxy_allocator_get ();
+    GstMapInfo info;
+
+    GST_LOG ("Copying buffer %p into a new memfd", buffer);
+    mem = gst_allocator_alloc (allocator, header.buffer_size, NULL);
+    gst_object_unref (allocator);
+    if (mem == NULL) {
+      g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_NOMEM,
+          "Unable to allocate %" G_GUINT64_FORMAT " bytes of shared memory",
+          header.buffer_size);
+      return FALSE;
+    }
+
+    gst_memory_map (mem, &info, GST_MAP_WRITE);
+    gst_buffer_extract (buffer, 0, info.data, info.size);
+    gst_memory_unmap (mem, &info);
+
+    memfd = gst_shm_proxy_memory_get_fd (mem);
+    header.data_offset = mem->offset;
+  }
+
+  ret = gst_shm_proxy_send (fd, &header, NULL, memfd, error);
+
+  if (mem)
+    gst_memory_unref (mem);
+
+  return ret;
+}
+
+/* Sends the type of an event or query followed by the structure, if any */
+static gboolean
+gst_shm_proxy_send_structure (gint fd, GstShmProxyMsgType msg_type,
+    guint32 id, guint32 type, const GstStructure * s, GError ** error)
+{
+  GstShmProxyMsgHeader header = { 0 };
+  gchar *payload, *str = NULL;
+  gsize len = 0;
+  gboolean ret;
+
+  if (s) {
+    str = gst_structure_to_string (s);
+    len = strlen (str) + 1;
+  }
+
+  if (sizeof (type) + len > GST_SHM_PROXY_MAX_PAYLOAD_SIZE) {
+    g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_NOSPC,
+        "Serialized %s is too large: %" G_GSIZE_FORMAT " bytes",
+        msg_type == GST_SHM_PROXY_MSG_EVENT ?
+        gst_event_type_get_name (type) : gst_query_type_get_name (type), len);
+    g_free (str);
+    return FALSE;
+  }
+
+  payload = g_malloc (sizeof (type) + len);
+  memcpy (payload, &type, sizeof (type));
+  if (str)
+    memcpy (payload + sizeof (type), str, len);
+
+  header.type = msg_type;
+  header.payload_size = sizeof (type) + len;
+  header.id = id;
+
+  ret = gst_shm_proxy_send (fd, &header, payload, -1, error);
+
+  g_free (payload);
+  g_free (str);
+
+  return ret;
+}
+
+gboolean
+gst_shm_proxy_send_event (gint fd, GstEvent * event, GError ** error)
+{
+  return gst_shm_proxy_send_structure (fd, GST_SHM_PROXY_MSG_EVENT, 0,
+      GST_EVENT_TYPE (event), gst_event_get_structure (event), error);
+}
+
+/* Queries are sent as a structure of our own that only has the fields needed
+ * to recreate them with their constructors. The structures of the queries
+ * themselves can contain fields that can't be serialized (objects, or NULL
+ * caps before the query is answered), so only these types are forwarded. */
+gboolean
+gst_shm_proxy_query_can_forward (GstQuery * query)
+{
+  switch (GST_QUERY_TYPE (query)) {
+    case GST_QUERY_LATENCY:
+    case GST_QUERY_CAPS:
+    case GST_QUERY_ACCEPT_CAPS:
+    case GST_QUERY_POSITION:
+    case GST_QUERY_DURATION:
+    case GST_QUERY_SEEKING:
+      return TRUE;
+    default:
+      return FALSE;
+  }
+}
+
+/* The arguments of the query if result is FALSE, else its results */
+static GstStructure *
+gst_shm_proxy_query_to_structure (GstQuery * query, gboolean result)
+{
+  GstStructure *s;
+  GstFormat format;
+  GstCaps *caps;
+  gboolean live, res;
+  GstClockTime min, max;
+  gint64 value, start, end;
+
+  s = gst_structure_new_empty ("query");
+
+  switch (GST_QUERY_TYPE (query)) {
+    case GST_QUERY_LATENCY:
+      if (!result)
+        break;
+      gst_query_parse_latency (query, &live, &min, &max);
+      gst_structure_set (s, "live", G_TYPE_BOOLEAN, live, "min",
+          G_TYPE_UINT64, min, "max", G_TYPE_UINT64, max, NULL);
+      break;
+    case GST_QUERY_CAPS:
+      if (result)
+        gst_query_parse_caps_result (query, &caps);
+      else
+        gst_query_parse_caps (query, &caps);
+      if (caps)
+        gst_structure_set (s, "caps", GST_TYPE_CAPS, caps, NULL);
+      break;
+    case GST_QUERY_ACCEPT_CAPS:
+      if (result) {
+        gst_query_parse_accept_caps_result (query, &res);
+        gst_structure_set (s, "result", G_TYPE_BOOLEAN, res, NULL);
+      } else {
+        gst_query_parse_accept_caps (query, &caps);
+        gst_structure_set (s, "caps", GST_TYPE_CAPS, caps, NULL);
+      }
+      break;
+    case GST_QUERY_POSITION:
+      gst_query_parse_position (query, &format, &value);
+      gst_structure_set (s, "format", GST_TYPE_FORMAT, format, NULL);
+      if (result)
+        gst_structure_set (s, "value", G_TYPE_INT64, value, NULL);
+      break;
+    case GST_QUERY_DURATION:
+      gst_query_parse_duration (query, &format, &value);
+      gst_structure_set (s, "format", GST_TYPE_FORMAT, format, NULL);
+      if (result)
+        gst_structure_set (s, "value", G_TYPE_INT64, value, NULL);
+      break;
+    case GST_QUERY_SEEKING:
+      gst_query_parse_seeking (query, &format, &res, &start, &end);
+      gst_structure_set (s, "format", GST_TYPE_FORMAT, format, NULL);
+      if (result)
+        gst_structure_set (s, "seekable", G_TYPE_BOOLEAN, res, "start",
+            G_TYPE_INT64, start, "end", G_TYPE_INT64, end, NULL);
+      break;
+    default:
+      g_assert_not_reached ();
+  }
+
+  return s;
+}
+
+static GstQuery *
+gst_shm_proxy_query_from_structure (guint32 type, const GstStructure * s)
+{
+  GstQuery *query = NULL;
+  GstCaps *caps = NULL;
+  gint format = GST_FORMAT_UNDEFINED;
+
+  gst_structure_get (s, "caps", GST_TYPE_CAPS, &caps, NULL);
+  gst_structure_get_enum (s, "format", GST_TYPE_FORMAT, &format);
+
+  switch (type) {
+    case GST_QUERY_LATENCY:
+      query = gst_query_new_latency ();
+      break;
+    case GST_QUERY_CAPS:
+      query = gst_query_new_caps (caps);
+      break;
+    case GST_QUERY_ACCEPT_CAPS:
+      if (caps)
+        query = gst_query_new_accept_caps (caps);
+      break;
+    case GST_QUERY_POSITION:
+      query = gst_query_new_position (format);
+      break;
+    case GST_QUERY_DURATION:
+      query = gst_query_new_duration (format);
+      break;
+    case GST_QUERY_SEEKING:
+      query = gst_query_new_seeking (format);
+      break;
+    default:
+      break;
+  }
+
+  if (caps)
+    gst_caps_unref (caps);
+
+  return query;
+}
+
+gboolean
+gst_shm_proxy_send_query (gint fd, GstShmProxyMsgType type, GstQuery * query,
+    guint32 id, GError ** error)
+{
+  GstShmProxyMsgHeader header = { 0 };
+  GstStructure *s;
+  gboolean ret;
+
+  /* Not handled */
+  if (query == NULL) {
+    header.type = type;
+    header.id = id;
+    return gst_shm_proxy_send (fd, &header, NULL, -1, error);
+  }
+
+  s = gst_shm_proxy_query_to_structure (query,
+      type == GST_SHM_PROXY_MSG_QUERY_RESULT);
+  ret = gst_shm_proxy_send_structure (fd, type, id, GST_QUERY_TYPE (query), s,
+      error);
+  gst_structure_free (s);
+
+  return ret;
+}
+
+gboolean
+gst_shm_proxy_query_copy_result (GstQuery * query, GstQuery * result)
+{
+  const GstStructure *s = gst_query_get_structure (result);
+  gint format = GST_FORMAT_UNDEFINED;
+  GstClockTime min, max;
+  gint64 value, start, end;
+  gboolean live, res;
+  GstCaps *caps;
+
+  if (s == NULL || GST_QUERY_TYPE (query) != GST_QUERY_TYPE (result))
+    return FALSE;
+
+  gst_structure_get_enum (s, "format", GST_TYPE_FORMAT, &format);
+
+  switch (GST_QUERY_TYPE (query)) {
+    case GST_QUERY_LATENCY:
+      if (!gst_structure_get (s, "live", G_TYPE_BOOLEAN, &live, "min",
+              G_TYPE_UINT64, &min, "max", G_TYPE_UINT64, &max, NULL))
+        return FALSE;
+      gst_query_set_latency (query, live, min, max);
+      return TRUE;
+    case GST_QUERY_CAPS:
+      if (!gst_structure_get (s, "caps", GST_TYPE_CAPS, &caps, NULL))
+        return FALSE;
+      gst_query_set_caps_result (query, caps);
+      gst_caps_unref (caps);
+      return TRUE;
+    case GST_QUERY_ACCEPT_CAPS:
+      if (!gst_structure_get_boolean (s, "result", &res))
+        return FALSE;
+      gst_query_set_accept_caps_result (query, res);
+      return TRUE;
+    case GST_QUERY_POSITION:
+      if (!gst_structure_get_int64 (s, "value", &value))
+        return FALSE;
+      gst_query_set_position (query, format, value);
+      return TRUE;
+    case GST_QUERY_DURATION:
+      if (!gst_structure_get_int64 (s, "value", &value))
+        return FALSE;
+      gst_query_set_duration (query, format, value);
+      return TRUE;
+    case GST_QUERY_SEEKING:
+      if (!gst_structure_get (s, "seekable", G_TYPE_BOOLEAN, &res, "start",
+              G_TYPE_INT64, &start, "end", G_TYPE_INT64, &end, NULL))
+        return FALSE;
+      gst_query_set_seeking (query, format, res, start, end);
+      return TRUE;
+    default:
+      return FALSE;
+  }
+}
+
+typedef struct {
+  gpointer data;
+  gsize size;
+  /* Our own dup of the socket to send the RELEASE on, or -1 */
+  gint release_fd;
+  guint32 id;
+} GstShmProxyMapping;
+
+/* Called from whichever thread drops the last ref on the buffer */
+static void
+gst_shm_proxy_mapping_free (GstShmProxyMapping * mapping)
+{
+  munmap (mapping->data, mapping->size);
+
+  if (mapping->release_fd >= 0) {
+    GstShmProxyMsgHeader header = { 0 };
+    GError *error = NULL;
+
+    header.type = GST_SHM_PROXY_MSG_RELEASE;
+    header.id = mapping->id;
+    if (!gst_shm_proxy_send (mapping->release_fd, &header, NULL, -1, &error)) {
+      /* The sender is gone, and its ref on the buffer with it */
+      GST_DEBUG ("Unable to release buffer %u: %s", mapping->id,
+          error->message);
+      g_error_free (error);
+    }
+    close (mapping->release_fd);
+  }
+
+  g_slice_free (GstShmProxyMapping, mapping);
+}
+
+static GstBuffer *
+gst_shm_proxy_buffer_new (GstShmProxyMsgHeader * header, gint memfd,
+    gint fd, GError ** error)
+{
+  gint release_fd = -1;
+  GstShmProxyMapping *mapping;
+  GstBuffer *buffer;
+  struct stat st;
+  gpointer data;
+  gsize size;
+  gint seals;
+
+  if (header->buffer_size == 0) {
+    buffer = gst_buffer_new ();
+    goto out;
+  }
+
+  /* Only map memfds whose size can't change under us, and never past their
+   * end: touching pages beyond it would raise SIGBUS */
+  seals = fcntl (memfd, F_GET_SEALS);
+  if (seals < 0 || !(seals & F_SEAL_SHRINK)) {
+    g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+        "Received memfd is not sealed against shrinking");
+    return NULL;
+  }
+
+  if (fstat (memfd, &st) < 0) {
+    gint errsv = errno;
+    g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errsv),
+        "Unable to stat received memfd: %s", g_strerror (errsv));
+    return NULL;
+  }
+
+  if (header->buffer_size > (guint64) st.st_size ||
+      header->data_offset > (guint64) st.st_size - header->buffer_size) {
+    g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+        "Received buffer of %" G_GUINT64_FORMAT " bytes at offset %"
+        G_GUINT64_FORMAT " does not fit in a memfd of %" G_GINT64_FORMAT
+        " bytes", header->buffer_size, header->data_offset,
+        (gint64) st.st_size);
+    return NULL;
+  }
+
+  /* The buffer may outlive the element that received it, so the release
+   * needs its own fd */
+  if (header->id != 0) {
+    release_fd = fcntl (fd, F_DUPFD_CLOEXEC, 0);
+    if (release_fd < 0) {
+      gint errsv = errno;
+      g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errsv),
+          "Unable to dup socket: %s", g_strerror (errsv));
+      return NULL;
+    }
+  }
+
+  /* Map read-only: the memory still belongs to the other process */
+  size = header->data_offset + header->buffer_size;
+  data = mmap (NULL, size, PROT_READ, MAP_SHARED, memfd, 0);
+  if (data == MAP_FAILED) {
+    gint errsv = errno;
+    g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errsv),
+        "Unable to map received memfd: %s", g_strerror (errsv));
+    if (release_fd >= 0)
+      close (release_fd);
+    return NULL;
+  }
+
+  mapping = g_slice_new (GstShmProxyMapping);
+  mapping->data = data;
+  mapping->size = size;
+  mapping->release_fd = release_fd;
+  mapping->id = header->id;
+  buffer = gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY, data, size,
+      header->data_offset, header->buffer_size, mapping,
+      (GDestroyNotify) gst_shm_proxy_mapping_free);
+
+out:
+  GST_BUFFER_PTS (buffer) = header->pts;
+  GST_BUFFER_DTS (buffer) = header->dts;
+  GST_BUFFER_DURATION (buffer) = header->duration;
+  GST_BUFFER_OFFSET (buffer) = header->offset;
+  GST_BUFFER_OFFSET_END (buffer) = header->offset_end;
+  GST_BUFFER_FLAG_SET (buffer, header->flags & BUFFER_FLAGS_MASK);
+
+  return buffer;
+}
+
+/* Parses the payload of an EVENT, QUERY or QUERY_RESULT message */
+static gboolean
+gst_shm_proxy_parse_structure (GstShmProxyMsgHeader * header, gchar * payload,
+    guint32 * type, GstStructure ** s, GError ** error)
+{
+  *s = NULL;
+
+  if (header->payload_size < sizeof (*type))
+    goto invalid;
+
+  memcpy (type, payload, sizeof (*type));
+  if (header->payload_size > sizeof (*type)) {
+    /* Always NUL-terminated by the sender */
+    payload[header->payload_size - 1] = '\0';
+    *s = gst_structure_from_string (payload + sizeof (*type), NULL);
+    if (*s == NULL)
+      goto invalid;
+  }
+
+  return TRUE;
+
+invalid:
+  g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+      "Received invalid %s message",
+      header->type == GST_SHM_PROXY_MSG_EVENT ? "event" : "query");
+  return FALSE;
+}
+
+static GstEvent *
+gst_shm_proxy_event_new (GstShmProxyMsgHeader * header, gchar * payload,
+    GError ** error)
+{
+  GstStructure *s;
+  guint32 type;
+
+  if (!gst_shm_proxy_parse_structure (header, payload, &type, &s, error))
+    return NULL;
+
+  return gst_event_new_custom (type, s);
+}
+
+static GstQuery *
+gst_shm_proxy_query_new (GstShmProxyMsgHeader * header, gchar * payload,
+    GError ** error)
+{
+  GstQuery *query = NULL;
+  GstStructure *s;
+  guint32 type;
+
+  /* The result of a query that wasn't handled */
+  if (header->type == GST_SHM_PROXY_MSG_QUERY_RESULT &&
+      header->payload_size == 0)
+    return NULL;
+
+  if (!gst_shm_proxy_parse_structure (header, payload, &type, &s, error))
+    return NULL;
+  if (s == NULL || header->id == 0)
+    goto invalid;
+
+  /* Results are only a container for gst_shm_proxy_query_copy_result() */
+  if (header->type == GST_SHM_PROXY_MSG_QUERY_RESULT)
+    return gst_query_new_custom (type, s);
+
+  query = gst_shm_proxy_query_from_structure (type, s);
+  gst_structure_free (s);
+  if (query == NULL)
+    goto invalid;
+
+  return query;
+
+invalid:
+  if (s)
+    gst_structure_free (s);
+  g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+      "Received invalid query message");
+  return NULL;
+}
+
+GstMiniObject *
+gst_shm_proxy_receive (gint fd, GstShmProxyMsgType * type, guint32 * id,
+    GError ** error)
+{
+  GstShmProxyMsgHeader header;
+  gchar payload[GST_SHM_PROXY_MAX_PAYLOAD_SIZE];
+  struct iovec iov[2];
+  struct msghdr msg = { 0 };
+  struct cmsghdr *cmsg;
+  union {
+    struct cmsghdr hdr;
+    gchar buf[CMSG_SPACE (sizeof (gint))];
+  } control;
+  GstMiniObject *ret = NULL;
+  gint memfd = -1;
+  ssize_t len;
+
+  iov[0].iov_base = &header;
+  iov[0].iov_len = sizeof (header);
+  iov[1].iov_base = payload;
+  iov[1].iov_len = sizeof (payload);
+  msg.msg_iov = iov;
+  msg.msg_iovlen = 2;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof (control.buf);
+
+  *type = 0;
+  *id = 0;
+
+  do {
+    len = recvmsg (fd, &msg, MSG_CMSG_CLOEXEC);
+  } while (len < 0 && errno == EINTR);
+
+  if (len < 0) {
+    gint errsv = errno;
+    g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errsv),
+        "Unable to receive message: %s", g_strerror (errsv));
+    return NULL;
+  }
+
+  /* Connection closed */
+  if (len == 0)
+    return NULL;
+
+  for (cmsg = CMSG_FIRSTHDR (&msg); cmsg; cmsg = CMSG_NXTHDR (&msg, cmsg))
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+      memcpy (&memfd, CMSG_DATA (cmsg), sizeof (gint));
+
+  if ((gsize) len < sizeof (header) ||
+      (gsize) len - sizeof (header) != header.payload_size ||
+      (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+    g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+        "Received truncated message");
+    goto out;
+  }
+
+  *type = header.type;
+  *id = header.id;
+
+  switch (header.type) {
+    case GST_SHM_PROXY_MSG_BUFFER:
+      if (memfd < 0) {
+        g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+            "Received buffer message without memfd");
+        goto out;
+      }
+      ret = (GstMiniObject *) gst_shm_proxy_buffer_new (&header, memfd, fd,
+          error);
+      break;
+    case GST_SHM_PROXY_MSG_EVENT:
+      ret = (GstMiniObject *) gst_shm_proxy_event_new (&header, payload, error);
+      break;
+    case GST_SHM_PROXY_MSG_RELEASE:
+      if (header.id == 0)
+        g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+            "Received invalid release message");
+      break;
+    case GST_SHM_PROXY_MSG_QUERY:
+    case GST_SHM_PROXY_MSG_QUERY_RESULT:
+      ret = (GstMiniObject *) gst_shm_proxy_query_new (&header, payload, error);
+      break;
+    default:
+      g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+          "Received message of unknown type %u", header.type);
+  }
+
+out:
+  /* Either mapped already or not needed; the mapping stays valid */
+  if (memfd >= 0)
+    close (memfd);
+  return ret;
+}
@@ -62,7 +62,10 @@ static const struct {
    *   (peer2_id, arecv_port2, arecv_rtcpsr_port2, vrecv_port2, vrecv_rtcpsr_port2),
    *   ...])
    *
-   *   Note that the rtcprr ports are shared between all peers */
+   *   Note that the rtcprr ports are shared between all peers
+   *
+   *   The four caps strings are empty if the caps hash in START_NEGOTIATE
+   *   matched, and the negotiator uses the caps it has cached instead */
   {OV_TCP_MSG_TYPE_REPLY_CAPS,       "reply media caps",   "(xqqssssa(sqqqq))"},
 
   /* Format: (call_id, peer_id_str, peer_port)
@@ -114,52 +117,197 @@ static const struct {
   /* Format: call_id, peer_id_str */
   {OV_TCP_MSG_TYPE_END_CALL,         "end call",           "(xs)"},
 
+  /* Sent by a peer in a call to all the other peers in it when adding a new
+   * peer (the joiner) to the call. Each of them allocates ports to receive
+   * from the joiner and replies with a REPLY_CAPS that only lists the joiner.
+   * Peers that don't know this message reply with an error.
+   *
+   * Format: (call_id, joiner_id, joiner_addr)
+   * joiner_addr is as resolved by the peer that's adding the joiner */
+  {OV_TCP_MSG_TYPE_QUERY_JOIN,       "query join call",    "(xss)"},
+
+  /* Sent after QUERY_JOIN with the caps that the joiner will send and the ports
+   * that it will receive on; same as the list in CALL_DETAILS, but only with
+   * the joiner in it. The caps that the peer sends don't change. The peer
+   * starts sending to and receiving from the joiner right away.
+   *
+   * Format:
+   * (call_id,
+   *  [(joiner_id, send_acaps, send_vcaps,
+   *    arecv_port, arecv_rtcpsr_port, arecv_rtcprr_port,
+   *    vrecv_port, vrecv_rtcpsr_port, vrecv_rtcprr_port)]) */
+  {OV_TCP_MSG_TYPE_JOIN_DETAILS,     "join details",       "(xa(sssqqqqqq))"},
+
   {0}
 };
 
-const char *
-ov_tcp_msg_type_to_string (OvTcpMsgType type, guint version)
+/* Messages whose format changed in a later version. New fields are only ever
+ * appended to the end of a tuple, so that a message can be converted to an
+ * older version by dropping them; see ov_tcp_msg_set_version(). */
+static const struct {
+  OvTcpMsgType type;
+  guint32 since_version;
+  const char *type_variant_string;
+} type_changes[] = {
+  /* Format: (call_id, peer_id_str, peer_port, caps_hash)
+   * caps_hash is the ov_tcp_caps_hash() of the caps that the negotiator has
+   * cached for this peer from a previous call, or 0. If it matches, the peer
+   * sends empty strings instead of its caps in REPLY_CAPS. */
+  {OV_TCP_MSG_TYPE_START_NEGOTIATE,  3,                  "(xsqt)"},
+
+  {0}
+};
+
+/* Message types are either queries (100..199) or replies (200..299), so they
+ * index this directly after subtracting OV_TCP_MSG_TYPE_FIRST. Each slot holds
+ * the index into type_strings plus one, or 0 for unknown types. */
+#define OV_TCP_MSG_TYPE_FIRST OV_TCP_MSG_TYPE_START_NEGOTIATE
+#define OV_TCP_MSG_TYPE_SLOTS 200
+static guint8 type_slots[OV_TCP_MSG_TYPE_SLOTS];
+/* The format of each entry in type_strings for each version in ov_versions,
+ * and the same parsed once, so that parsing a message body doesn't have to
+ * validate the type string every time */
+static const char *variant_strings[G_N_ELEMENTS (ov_versions)]
+    [G_N_ELEMENTS (type_strings)];
+static GVariantType *variant_types[G_N_ELEMENTS (ov_versions)]
+    [G_N_ELEMENTS (type_strings)];
+
+static void
+ov_tcp_msg_types_init (void)
+{
+  static gsize initialized = 0;
+  int ii, jj, vv;
+
+  if (!g_once_init_enter (&initialized))
+    return;
+
+  for (ii = 0; type_strings[ii].type; ii++) {
+    g_assert (type_strings[ii].type >= OV_TCP_MSG_TYPE_FIRST &&
+        type_strings[ii].type - OV_TCP_MSG_TYPE_FIRST < OV_TCP_MSG_TYPE_SLOTS);
+    type_slots[type_strings[ii].type - OV_TCP_MSG_TYPE_FIRST] = ii + 1;
+
+    for (vv = 0; vv < G_N_ELEMENTS (ov_versions); vv++) {
+      variant_strings[vv][ii] = type_strings[ii].type_variant_string;
+      /* type_changes is ordered by version, so the last match wins */
+      for (jj = 0; type_changes[jj].type; jj++)
+        if (type_changes[jj].type == type_strings[ii].type &&
+            type_changes[jj].since_version <= ov_versions[vv])
+          variant_strings[vv][ii] = type_changes[jj].type_variant_string;
+      variant_types[vv][ii] = g_variant_type_new (variant_strings[vv][ii]);
+    }
+  }
+
+  g_once_init_leave (&initialized, 1);
+}
+
+/* Returns the index of @type in type_strings, or -1 if it's unknown */
+static int
+ov_tcp_msg_type_lookup (OvTcpMsgType type)
 {
-  int ii, len;
+  ov_tcp_msg_types_init ();
 
-  len = sizeof (ov_versions) / sizeof (ov_versions[0]);
+  if (type < OV_TCP_MSG_TYPE_FIRST ||
+      type - OV_TCP_MSG_TYPE_FIRST >= OV_TCP_MSG_TYPE_SLOTS)
+    return -1;
 
-  for (ii = 0; ii < len; ii++)
-    if (version == ov_versions[ii])
-      goto supported;
+  return type_slots[type - OV_TCP_MSG_TYPE_FIRST] - 1;
+}
 
-  GST_ERROR ("Unsupported version: %u", version);
-  return NULL;
+/* ov_versions[] has no gaps, so version - OV_TCP_MIN_VERSION indexes it */
+gboolean
+ov_tcp_msg_version_is_supported (guint32 version)
+{
+  return version >= OV_TCP_MIN_VERSION && version <= OV_TCP_MAX_VERSION;
+}
 
-supported:
-  for (ii = 0; type_strings[ii].type; ii++)
-    if (type_strings[ii].type == type)
-      return type_strings[ii].type_string;
+/* Version 1 sends message bodies in big-endian (network) byte order, and
+ * later versions in little-endian so that little-endian hosts (all the ones
+ * we run on) don't need to byteswap */
+static gboolean
+ov_tcp_msg_version_needs_byteswap (guint32 version)
+{
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+  return version == 1;
+#elif G_BYTE_ORDER == G_BIG_ENDIAN
+  return version != 1;
+#else
+#error "Unsupported byte order: " STR(G_BYTE_ORDER)
+#endif
+}
+
+const char *
+ov_tcp_msg_type_to_string (OvTcpMsgType type, guint version)
+{
+  int ii;
 
-  return "unknown message type";
+  if (!ov_tcp_msg_version_is_supported (version)) {
+    GST_ERROR ("Unsupported version: %u", version);
+    return NULL;
+  }
+
+  ii = ov_tcp_msg_type_lookup (type);
+  if (ii < 0)
+    return "unknown message type";
+
+  return type_strings[ii].type_string;
 }
 
 const char *
 ov_tcp_msg_type_to_variant_type (OvTcpMsgType type, guint version)
 {
-  int ii, len;
+  int ii;
 
-  len = sizeof (ov_versions) / sizeof (ov_versions[0]);
+  if (!ov_tcp_msg_version_is_supported (version)) {
+    GST_ERROR ("Unsupported version: %u", version);
+    return NULL;
+  }
 
-  for (ii = 0; ii < len; ii++)
-    if (version == ov_versions[ii])
-      goto supported;
+  ii = ov_tcp_msg_type_lookup (type);
+  if (ii < 0) {
+    GST_ERROR ("Unknown message type: %u", type);
+    return NULL;
+  }
 
-  GST_ERROR ("Unsupported version: %u", version);
-  return NULL;
+  return variant_strings[version - OV_TCP_MIN_VERSION][ii];
+}
+
+/* Same as ov_tcp_msg_type_to_variant_type(), but already parsed */
+const GVariantType *
+ov_tcp_msg_type_to_gvariant_type (OvTcpMsgType type, guint version)
+{
+  int ii;
 
-supported:
-  for (ii = 0; type_strings[ii].type; ii++)
-    if (type_strings[ii].type == type)
-      return type_strings[ii].type_variant_string;
+  if (!ov_tcp_msg_version_is_supported (version)) {
+    GST_ERROR ("Unsupported version: %u", version);
+    return NULL;
+  }
+
+  ii = ov_tcp_msg_type_lookup (type);
+  if (ii < 0) {
+    GST_ERROR ("Unknown message type: %u", type);
+    return NULL;
+  }
 
-  GST_ERROR ("Unknown message type: %u", type);
-  return NULL;
+  return variant_types[version - OV_TCP_MIN_VERSION][ii];
+}
+
+G_LOCK_DEFINE_STATIC (msg_id);
+
+/* Message ids must be unique among the requests in flight on a connection
+ * since replies are matched to them by id. Start from the monotonic time so
+ * ids are also unlikely to repeat across restarts. */
+static guint64
+ov_tcp_msg_next_id (void)
+{
+  guint64 id;
+  static guint64 last_id = 0;
+
+  G_LOCK (msg_id);
+  id = MAX ((guint64) g_get_monotonic_time (), last_id + 1);
+  last_id = id;
+  G_UNLOCK (msg_id);
+
+  return id;
 }
 
 OvTcpMsg *
@@ -169,8 +317,7 @@ ov_tcp_msg_new (OvTcpMsgType type, GVariant * data)
 
   msg = g_new0 (OvTcpMsg, 1);
   msg->version = OV_TCP_MAX_VERSION;
-  /* FIXME: Collisions? */
-  msg->id = g_get_monotonic_time ();
+  msg->id = ov_tcp_msg_next_id ();
   msg->type = type;
 
   if (data != NULL) {
@@ -182,6 +329,19 @@ ov_tcp_msg_new (OvTcpMsgType type, GVariant * data)
   return msg;
 }
 
+OvTcpMsg *
+ov_tcp_msg_copy (OvTcpMsg * msg)
+{
+  OvTcpMsg *copy;
+
+  copy = g_new0 (OvTcpMsg, 1);
+  *copy = *msg;
+  if (copy->variant)
+    g_variant_ref (copy->variant);
+
+  return copy;
+}
+
 void
 ov_tcp_msg_free (OvTcpMsg * msg)
 {
@@ -236,15 +396,15 @@ ov_tcp_msg_new_ack (guint64 id)
 
 OvTcpMsg *
 ov_tcp_msg_new_start_negotiate (guint64 call_id, gchar * local_id,
-    guint16 local_port)
+    guint16 local_port, guint64 caps_hash)
 {
   OvTcpMsg *msg;
   const gchar *variant_type;
 
   variant_type = ov_tcp_msg_type_to_variant_type (
-      OV_TCP_MSG_TYPE_START_NEGOTIATE, OV_TCP_MIN_VERSION);
+      OV_TCP_MSG_TYPE_START_NEGOTIATE, OV_TCP_MAX_VERSION);
   msg = ov_tcp_msg_new (OV_TCP_MSG_TYPE_START_NEGOTIATE,
-      g_variant_new (variant_type, call_id, local_id, local_port));
+      g_variant_new (variant_type, call_id, local_id, local_port, caps_hash));
 
   return msg;
 }
@@ -277,6 +437,63 @@ ov_tcp_msg_new_cancel_negotiate (guint64 call_id, gchar * local_id)
   return msg;
 }
 
+/* Converts @msg to the format of @version, which must not be newer than
+ * msg->version. Fields that were added after @version are dropped. */
+void
+ov_tcp_msg_set_version (OvTcpMsg * msg, guint32 version)
+{
+  guint ii, n_items;
+  GVariant *variant, **items;
+  const GVariantType *variant_type;
+
+  g_return_if_fail (version <= msg->version);
+
+  variant_type = ov_tcp_msg_type_to_gvariant_type (msg->type, version);
+  msg->version = version;
+  if (msg->variant == NULL ||
+      g_variant_is_of_type (msg->variant, variant_type))
+    return;
+
+  n_items = g_variant_type_n_items (variant_type);
+  items = g_new (GVariant*, n_items);
+  for (ii = 0; ii < n_items; ii++)
+    items[ii] = g_variant_get_child_value (msg->variant, ii);
+  variant = g_variant_ref_sink (g_variant_new_tuple (items, n_items));
+  for (ii = 0; ii < n_items; ii++)
+    g_variant_unref (items[ii]);
+  g_free (items);
+
+  g_assert (g_variant_is_of_type (variant, variant_type));
+  g_variant_unref (msg->variant);
+  msg->variant = variant;
+  msg->data = g_variant_get_data (msg->variant);
+  msg->size = g_variant_get_size (msg->variant);
+}
+
+/* A 64-bit FNV-1a hash of the caps a peer sends in REPLY_CAPS. Never returns
+ * 0, which means "no caps" in START_NEGOTIATE. */
+guint64
+ov_tcp_caps_hash (const gchar * send_acaps, const gchar * send_vcaps,
+    const gchar * recv_acaps, const gchar * recv_vcaps)
+{
+  guint ii;
+  const guchar *p;
+  guint64 hash = G_GUINT64_CONSTANT (14695981039346656037);
+  const gchar *caps[4] = {send_acaps, send_vcaps, recv_acaps, recv_vcaps};
+
+  for (ii = 0; ii < 4; ii++) {
+    /* Include the terminating nul so that the strings can't run together */
+    for (p = (const guchar *) caps[ii]; ; p++) {
+      hash ^= *p;
+      hash *= G_GUINT64_CONSTANT (1099511628211);
+      if (*p == '\0')
+        break;
+    }
+  }
+
+  return hash != 0 ? hash : 1;
+}
+
 gchar *
 ov_tcp_msg_print (OvTcpMsg * msg)
 {
@@ -287,15 +504,43 @@ ov_tcp_msg_print (OvTcpMsg * msg)
   return tmp;
 }
 
+/* Returns the header and body of @msg serialized into one buffer, ready to be
+ * written to the network. The body is in the byte order of msg->version. */
+GBytes *
+ov_tcp_msg_to_bytes (OvTcpMsg * msg)
+{
+  guint8 *data;
+  GVariant *variant;
+
+  data = g_malloc (OV_TCP_MSG_HEADER_SIZE + msg->size);
+
+  /* The header is always big endian so that every version can read it */
+  GST_WRITE_UINT32_BE (data, msg->version);
+  GST_WRITE_UINT64_BE (data + 4, msg->id);
+  GST_WRITE_UINT32_BE (data + 12, msg->type);
+  GST_WRITE_UINT32_BE (data + 16, msg->size);
+
+  if (msg->size > 0) {
+    if (ov_tcp_msg_version_needs_byteswap (msg->version)) {
+      variant = g_variant_byteswap (msg->variant);
+      g_assert (msg->size == g_variant_get_size (variant));
+      g_variant_store (variant, data + OV_TCP_MSG_HEADER_SIZE);
+      g_variant_unref (variant);
+    } else {
+      g_variant_store (msg->variant, data + OV_TCP_MSG_HEADER_SIZE);
+    }
+  }
+
+  return g_bytes_new_take (data, OV_TCP_MSG_HEADER_SIZE + msg->size);
+}
+
 gboolean
 ov_tcp_msg_write_to_stream (GOutputStream * output, OvTcpMsg * msg,
     GCancellable * cancellable, GError ** error)
 {
   gchar *tmp;
-  guint32 tmp1;
-  guint64 tmp2;
-  GVariant *variant;
-  gboolean ret = FALSE;
+  GBytes *bytes;
+  gboolean ret;
 
   tmp = ov_tcp_msg_print (msg);
   GST_DEBUG ("Writing msg type %s to the network; contents: %s",
@@ -303,54 +548,20 @@ ov_tcp_msg_write_to_stream (GOutputStream * output, OvTcpMsg * msg,
       tmp);
   g_free (tmp);
 
-  /* TODO: Error checking */
-  /* Write header */
-  tmp1 = GUINT32_TO_BE (msg->version);
-  if (!g_output_stream_write_all (output, &tmp1, sizeof (tmp1), NULL,
-        cancellable, error))
-    goto err;
-  tmp2 = GUINT64_TO_BE (msg->id);
-  if (!g_output_stream_write_all (output, &tmp2, sizeof (tmp2), NULL,
-        cancellable, error))
-    goto err;
-  tmp1 = GUINT32_TO_BE (msg->type);
-  if (!g_output_stream_write_all (output, &tmp1, sizeof (tmp1), NULL,
-        cancellable, error))
-    goto err;
-  tmp1 = GUINT32_TO_BE (msg->size);
-  if (!g_output_stream_write_all (output, &tmp1, sizeof (tmp1), NULL,
-        cancellable, error))
-    goto err;
-
-  if (msg->size > 0) {
-    guint32 size;
-
-    /* Network data is always big endian */
-#if G_BYTE_ORDER == G_LITTLE_ENDIAN
-    variant = g_variant_byteswap (msg->variant);
-#elif G_BYTE_ORDER == G_BIG_ENDIAN
-    variant = g_variant_get_normal_form (msg->variant);
-#else
-#error "Unsupported byte order: " STR(G_BYTE_ORDER)
-#endif
-    size = g_variant_get_size (variant);
-    g_assert (msg->size == size);
-
-    /* Write data */
-    ret = g_output_stream_write_all (output, g_variant_get_data (variant),
-        size, NULL, cancellable, error);
-    g_variant_unref (variant);
-  } else {
-    ret = TRUE;
+  /* Header and body go out in one write so they don't end up in separate
+   * segments */
+  bytes = ov_tcp_msg_to_bytes (msg);
+  ret = g_output_stream_write_all (output, g_bytes_get_data (bytes, NULL),
+      g_bytes_get_size (bytes), NULL, cancellable, error);
+  g_bytes_unref (bytes);
+
+  if (!ret) {
+    tmp = ov_tcp_msg_print (msg);
+    GST_ERROR ("Unable to write msg: %s", tmp);
+    g_free (tmp);
   }
 
-out:
   return ret;
-err:
-  tmp = ov_tcp_msg_print (msg);
-  GST_ERROR ("Unable to write header for msg: %s", tmp);
-  g_free (tmp);
-  goto out;
 }
 
 gboolean
@@ -382,6 +593,59 @@ ov_tcp_msg_write_new_ack_to_stream (GOutputStream * output, guint64 id,
   return ret;
 }
 
+/* Parses the OV_TCP_MSG_HEADER_SIZE bytes of header in @data into @msg */
+gboolean
+ov_tcp_msg_parse_header (OvTcpMsg * msg, const gchar * data)
+{
+  msg->version = GST_READ_UINT32_BE (data);
+
+  if (!ov_tcp_msg_version_is_supported (msg->version)) {
+    GST_ERROR ("Message version %u is not supported", msg->version);
+    return FALSE;
+  }
+
+  msg->id = GST_READ_UINT64_BE (data + 4);
+  msg->type = GST_READ_UINT32_BE (data + 12);
+  msg->size = GST_READ_UINT32_BE (data + 16);
+
+  if (msg->size > OV_TCP_MAX_MSG_SIZE) {
+    GST_ERROR ("Message body of %u bytes is too large", msg->size);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Parses the body in @body into msg->variant according to the type and
+ * version already set from the header */
+gboolean
+ov_tcp_msg_parse_body (OvTcpMsg * msg, GBytes * body)
+{
+  GVariant *variant;
+  const GVariantType *variant_type;
+
+  variant_type = ov_tcp_msg_type_to_gvariant_type (msg->type,
+      msg->version);
+  if (!variant_type)
+    return FALSE;
+
+  variant = g_variant_new_from_bytes (variant_type, body, FALSE);
+  g_variant_ref_sink (variant);
+
+  if (ov_tcp_msg_version_needs_byteswap (msg->version)) {
+    msg->variant = g_variant_byteswap (variant);
+    g_variant_unref (variant);
+  } else {
+    /* Untrusted data is fine to use directly; GVariant checks it on access */
+    msg->variant = variant;
+  }
+
+  msg->data = g_variant_get_data (msg->variant);
+  msg->size = g_variant_get_size (msg->variant);
+
+  return TRUE;
+}
+
 /* Does a blocking read for the header */
 gboolean
 ov_tcp_msg_read_header_from_stream (GInputStream * input, OvTcpMsg * msg,
@@ -399,84 +663,51 @@ ov_tcp_msg_read_header_from_stream (GInputStream * input, OvTcpMsg * msg,
   if (!ret)
     return FALSE;
 
-  if (bytes_read < sizeof (tmp)) {
-    GST_ERROR ("Unable to read message length prefix, got EOS");
+  if (bytes_read == 0) {
+    /* The other side closed the connection between messages */
+    GST_DEBUG ("Connection closed, no more messages");
     return FALSE;
   }
 
-  msg->version = GST_READ_UINT32_BE (tmp);
-
-  if (msg->version != 1) {
-    GST_ERROR ("Message version %u is not supported", msg->version);
+  if (bytes_read < sizeof (tmp)) {
+    GST_ERROR ("Unable to read message length prefix, got EOS");
     return FALSE;
   }
 
-  msg->id = GST_READ_UINT64_BE (tmp + 4);
-  msg->type = GST_READ_UINT32_BE (tmp + 12);
-  msg->size = GST_READ_UINT32_BE (tmp + 16);
-
-  return TRUE;
+  return ov_tcp_msg_parse_header (msg, tmp);
 }
 
-/* Does a blocking read and returns a (transfer-full) buffer with the contents
- * of the body */
+/* Does a blocking read of the body and parses it into msg->variant */
 gboolean
 ov_tcp_msg_read_body_from_stream (GInputStream * input, OvTcpMsg * msg,
     GCancellable * cancellable, GError ** error)
 {
-  GBytes *read;
-  GByteArray *barray;
-  GVariant *variant;
-  const gchar *variant_type;
-  gsize size_left = msg->size;
+  gchar *data;
+  GBytes *body;
+  gsize bytes_read;
+  gboolean ret;
 
   g_return_val_if_fail (msg != NULL, FALSE);
 
-  barray = g_byte_array_new ();
-
-  /* FIXME: Add a timeout that cancels if we don't get the data for a while */
-  do {
-    gsize size;
-    guint8 *data;
-
-    read = g_input_stream_read_bytes (input, size_left, cancellable, error);
-    if (g_bytes_get_size (read) == 0)
-      break;
-    data = g_bytes_unref_to_data (read, &size);
-    g_byte_array_append (barray, data, size);
+  data = g_malloc (msg->size);
+  ret = g_input_stream_read_all (input, data, msg->size, &bytes_read,
+      cancellable, error);
+  if (!ret) {
     g_free (data);
-    size_left -= size;
-  } while (size_left > 0);
+    return FALSE;
+  }
 
-  if (size_left > 0) {
-    g_byte_array_free (barray, TRUE);
+  if (bytes_read < msg->size) {
+    g_free (data);
     GST_ERROR ("Unable to finish reading incoming data due to EOS");
     return FALSE;
   }
 
-  read = g_byte_array_free_to_bytes (barray);
-
-  variant_type = ov_tcp_msg_type_to_variant_type (msg->type,
-      msg->version);
-  variant = g_variant_new_from_bytes (G_VARIANT_TYPE (variant_type), read,
-      FALSE);
-  g_variant_ref_sink (variant);
-  g_bytes_unref (read);
-
-  /* Network data is always big endian */
-#if G_BYTE_ORDER == G_LITTLE_ENDIAN
-  msg->variant = g_variant_byteswap (variant);
-#elif G_BYTE_ORDER == G_BIG_ENDIAN
-  msg->variant = g_variant_get_normal_form (variant);
-#else
-#error "Unsupported byte order: " STR(G_BYTE_ORDER)
-#endif
-  g_variant_unref (variant);
+  body = g_bytes_new_take (data, msg->size);
+  ret = ov_tcp_msg_parse_body (msg, body);
+  g_bytes_unref (body);
 
-  msg->data = g_variant_get_data (msg->variant);
-  msg->size = g_variant_get_size (msg->variant);
-
-  return TRUE;
+  return ret;
 }
 
 OvTcpMsg *
@@ -34,6 +34,16 @@
 G_BEGIN_DECLS
 
 #define OV_TCP_TIMEOUT 5
+/* Incoming control connections are kept open between messages, but are closed
+ * if the remote doesn't send anything for this many seconds. The remote will
+ * reconnect when it has something to say. */
+#define OV_TCP_IDLE_TIMEOUT 15
+/* Incoming control connections we keep open at once, in total and from any
+ * one host. Further connections are closed right away. Each connection can
+ * buffer up to OV_TCP_MAX_MSG_SIZE, so this bounds what remotes can make us
+ * allocate. */
+#define OV_TCP_MAX_INCOMING_CONNS 32
+#define OV_TCP_MAX_INCOMING_CONNS_PER_HOST 8
 
 /* Zeroconf is 224.0.0.251 on port 53. We use the same address but the port is
  * OV_DEFAULT_COMM_PORT.
@@ -52,6 +62,8 @@ enum _OvTcpMsgType {
   OV_TCP_MSG_TYPE_PAUSE_CALL,
   OV_TCP_MSG_TYPE_RESUME_CALL,
   OV_TCP_MSG_TYPE_END_CALL,
+  OV_TCP_MSG_TYPE_QUERY_JOIN,
+  OV_TCP_MSG_TYPE_JOIN_DETAILS,
 
   /* Replies */
   OV_TCP_MSG_TYPE_ACK = 200,
@@ -67,6 +79,7 @@ typedef struct _OvTcpMsg OvTcpMsg;
 
 struct _OvTcpMsg {
   guint32 version;
+  /* Unique per message; replies carry the id of the request instead */
   guint64 id;
   guint32 type; /* OvTcpMsgType */
   guint32 size;
@@ -77,14 +90,21 @@ struct _OvTcpMsg {
 
 /* Size of the metadata sent with a OvTcpMsg */
 #define OV_TCP_MSG_HEADER_SIZE 20
-
-/* Ordered from oldest to newest */
-static const guint32 ov_versions[] = {1,};
+/* Largest message body we accept; anything bigger is a broken or malicious
+ * peer and we drop the connection */
+#define OV_TCP_MAX_MSG_SIZE (1024 * 1024)
+
+/* Ordered from oldest to newest
+ * 1: Message bodies are big endian
+ * 2: Message bodies are little endian; the header is still big endian
+ * 3: START_NEGOTIATE carries a caps hash */
+static const guint32 ov_versions[] = {1, 2, 3,};
 #define OV_TCP_MIN_VERSION ov_versions[0]
-#define OV_TCP_MAX_VERSION ov_versions[0]
+#define OV_TCP_MAX_VERSION ov_versions[G_N_ELEMENTS (ov_versions) - 1]
 
 OvTcpMsg*     ov_tcp_msg_new                    (OvTcpMsgType type,
                                                  GVariant *data);
+OvTcpMsg*     ov_tcp_msg_copy                   (OvTcpMsg *msg);
 void          ov_tcp_msg_free                   (OvTcpMsg *msg);
 OvTcpMsg*     ov_tcp_msg_new_error              (guint64 id,
                                                  const gchar *error_msg);
@@ -93,14 +113,28 @@ OvTcpMsg*     ov_tcp_msg_new_error_call         (guint64 id,
 OvTcpMsg*     ov_tcp_msg_new_ack                (guint64 id);
 OvTcpMsg*     ov_tcp_msg_new_start_negotiate    (guint64 call_id,
                                                  gchar *local_id,
-                                                 guint16 local_port);
+                                                 guint16 local_port,
+                                                 guint64 caps_hash);
 OvTcpMsg*     ov_tcp_msg_new_ok_negotiate       (guint64 call_id,
                                                  gchar *local_id);
 OvTcpMsg*     ov_tcp_msg_new_cancel_negotiate   (guint64 call_id,
                                                  gchar *local_id);
 
+void          ov_tcp_msg_set_version            (OvTcpMsg *msg,
+                                                 guint32 version);
+guint64       ov_tcp_caps_hash                  (const gchar *send_acaps,
+                                                 const gchar *send_vcaps,
+                                                 const gchar *recv_acaps,
+                                                 const gchar *recv_vcaps);
+
 gchar*        ov_tcp_msg_print                  (OvTcpMsg *msg);
 
+GBytes*       ov_tcp_msg_to_bytes                     (OvTcpMsg *msg);
+gboolean      ov_tcp_msg_parse_header                 (OvTcpMsg *msg,
+                                                       const gchar *data);
+gboolean      ov_tcp_msg_parse_body                   (OvTcpMsg *msg,
+                                                       GBytes *body);
+
 gboolean      ov_tcp_msg_write_to_stream              (GOutputStream *output,
                                                        OvTcpMsg *msg,
                                                        GCancellable *cancellable,
@@ -131,6 +165,9 @@ const gchar*  ov_tcp_msg_type_to_string               (OvTcpMsgType type,
                                                        guint32 version);
 const gchar*  ov_tcp_msg_type_to_variant_type         (OvTcpMsgType type,
                                                        guint32 version);
+const GVariantType* ov_tcp_msg_type_to_gvariant_type  (OvTcpMsgType type,
+                                                       guint32 version);
+gboolean      ov_tcp_msg_version_is_supported         (guint32 version);
 
 G_END_DECLS
 
@@ -32,65 +32,432 @@
 #include "incoming.h"
 #include "ov-local-peer-priv.h"
 
-static guint timeout_value = 0;
-
-#define OV_NEGOTIATE_TIMEOUT_SECONDS 5
+/*-- Negotiatee state machine --*/
 
+/* Fires on the default main context once the negotiator has taken too long
+ * to send us what the current step is waiting for */
 static gboolean
-check_negotiate_timeout (OvLocalPeer * local)
+on_negotiate_deadline (OvLocalPeer * local)
 {
-  OvLocalPeerState state;
+  GError *error;
+  OvCall *call, *found = NULL;
+  GHashTableIter iter;
+  OvLocalPeerPrivate *priv;
 
-  state = ov_local_peer_get_state (local);
-  /* Quit if we failed due to some reason */
-  if (state & OV_LOCAL_STATE_FAILED)
+  priv = ov_local_peer_get_private (local);
+
+  ov_local_peer_lock (local);
+  g_hash_table_iter_init (&iter, priv->calls);
+  while (!found && g_hash_table_iter_next (&iter, NULL, (gpointer *) &call))
+    if (call->negotiate != NULL &&
+        call->negotiate->deadline_source == g_main_current_source ())
+      found = call;
+  /* The step finished or was aborted while we were waiting for the lock */
+  if (found == NULL) {
+    ov_local_peer_unlock (local);
     return G_SOURCE_REMOVE;
+  }
 
-  timeout_value += 1;
+  error = g_error_new (G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+      "Timed out waiting for '%s' from %s", ov_negotiate_step_to_string (
+        found->negotiate->step), found->negotiate->negotiator->id);
+  GST_WARNING ("%s, stopping negotiation", error->message);
+  ov_local_peer_call_negotiate_abort (local, found, TRUE);
+  ov_local_peer_unlock (local);
 
-  if (timeout_value > OV_NEGOTIATE_TIMEOUT_SECONDS) {
-    GST_DEBUG ("Timed out during negotiation, stopping...");
-    ov_local_peer_set_state_failed (local);
-    ov_local_peer_set_state_timedout (local);
-    ov_local_peer_negotiate_abort (local);
-    timeout_value = 0;
-    g_signal_emit_by_name (local, "negotiate-aborted", NULL);
-    return G_SOURCE_REMOVE;
+  g_signal_emit_by_name (local, "negotiate-aborted", error);
+  g_error_free (error);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Called with the lock TAKEN. Moves the negotiation of @call on to @step,
+ * which gets its own deadline starting now. */
+static void
+ov_negotiate_enter_step (OvLocalPeer * local, OvCall * call,
+    OvNegotiateStep step)
+{
+  gint64 now;
+  OvNegotiate *negotiate;
+
+  negotiate = call->negotiate;
+  now = g_get_monotonic_time ();
+
+  if (negotiate->start_time == 0) {
+    negotiate->start_time = now;
+  } else {
+    negotiate->step_durations[negotiate->step] += now - negotiate->step_time;
+    GST_DEBUG ("Negotiation step '%s' of call %" G_GUINT64_FORMAT " took %"
+        G_GINT64_FORMAT "ms", ov_negotiate_step_to_string (negotiate->step),
+        negotiate->call_id,
+        negotiate->step_durations[negotiate->step] / 1000);
   }
 
-  return G_SOURCE_CONTINUE;
+  negotiate->step = step;
+  negotiate->step_time = now;
+  negotiate->deadline = now + OV_NEGOTIATE_STEP_TIMEOUT_MSECS * 1000;
+
+  if (negotiate->deadline_source) {
+    g_source_destroy (negotiate->deadline_source);
+    g_source_unref (negotiate->deadline_source);
+  }
+  /* GLib timeouts use the monotonic clock too */
+  negotiate->deadline_source =
+    g_timeout_source_new (OV_NEGOTIATE_STEP_TIMEOUT_MSECS);
+  g_source_set_callback (negotiate->deadline_source,
+      (GSourceFunc) on_negotiate_deadline, local, NULL);
+  g_source_attach (negotiate->deadline_source, NULL);
+}
+
+/* Called with the lock TAKEN. Checks that @msg is for a call we're
+ * negotiating and that it's what the current step is waiting for, and sets
+ * @call to that call. Returns an error reply if it isn't. */
+static OvTcpMsg *
+ov_negotiate_check_step (OvLocalPeer * local, OvTcpMsg * msg,
+    guint64 call_id, OvNegotiateStep step, OvCall ** call)
+{
+  gchar *error_msg;
+  OvTcpMsg *reply;
+  OvCall *found;
+
+  found = ov_local_peer_get_call (local, call_id);
+  if (found == NULL || found->negotiate == NULL) {
+    if (ov_local_peer_get_negotiating_call (local) == NULL)
+      return ov_tcp_msg_new_error (msg->id, "Busy");
+    return ov_tcp_msg_new_error (msg->id, "Invalid call id");
+  }
+
+  if (!(found->state & OV_LOCAL_STATE_NEGOTIATEE))
+    return ov_tcp_msg_new_error (msg->id, "Busy");
+
+  if (found->negotiate->step != step) {
+    error_msg = g_strdup_printf ("Unexpected '%s' while waiting for '%s'",
+        ov_negotiate_step_to_string (step),
+        ov_negotiate_step_to_string (found->negotiate->step));
+    GST_WARNING ("%s", error_msg);
+    reply = ov_tcp_msg_new_error (msg->id, error_msg);
+    g_free (error_msg);
+    return reply;
+  }
+
+  *call = found;
+  return NULL;
+}
+
+typedef struct _OvIncomingConn OvIncomingConn;
+
+/* Message bodies are read into a buffer of this size at first, which is
+ * doubled whenever it fills up; the size in the header is only a claim */
+#define OV_INCOMING_BODY_CHUNK 4096
+
+/* An incoming control connection from a remote. All of this is only touched
+ * from the comms thread, which services every connection with async reads and
+ * writes so that no connection can hold up the others. */
+struct _OvIncomingConn {
+  /* One ref for being open, and one for each pending read or write */
+  guint refcount;
+  OvLocalPeer *local;
+  GSocketConnection *connection;
+  gchar *addr_s;
+  /* Address without the port, for limiting connections per host */
+  gchar *host;
+  /* Cancelled on close, which fails any pending read or write */
+  GCancellable *cancellable;
+  gboolean closed;
+
+  /* The message being read. @offset bytes of the header have arrived so far,
+   * or of the body once it has been allocated. @body_alloc bytes of the body
+   * are allocated. */
+  OvTcpMsg *msg;
+  gchar header[OV_TCP_MSG_HEADER_SIZE];
+  gchar *body;
+  gsize body_alloc;
+  gsize offset;
+  /* Unset when we stop reading because of a protocol error; the connection is
+   * closed once the pending replies have been written */
+  gboolean reading;
+
+  /* Serialized replies waiting to be written. The head is being written, and
+   * @write_offset bytes of it have been written so far. */
+  GQueue replies;
+  gsize write_offset;
+
+  /* Closes the connection if the remote is idle for OV_TCP_IDLE_TIMEOUT, or
+   * takes more than OV_TCP_TIMEOUT to send a message or read our replies */
+  GSource *deadline;
+  gboolean deadline_busy;
+};
+
+static void
+ov_incoming_conn_unref (OvIncomingConn * conn)
+{
+  GBytes *bytes;
+  OvLocalPeerPrivate *priv;
+
+  if (--conn->refcount > 0)
+    return;
+
+  priv = ov_local_peer_get_private (conn->local);
+
+  GST_DEBUG ("Freeing incoming connection from %s", conn->addr_s);
+  g_io_stream_close (G_IO_STREAM (conn->connection), NULL, NULL);
+  g_object_unref (conn->connection);
+  g_object_unref (conn->cancellable);
+  ov_tcp_msg_free (conn->msg);
+  g_free (conn->body);
+  while ((bytes = g_queue_pop_head (&conn->replies)))
+    g_bytes_unref (bytes);
+  g_free (conn->addr_s);
+  g_free (conn->host);
+
+  priv->incoming_conns = g_list_remove (priv->incoming_conns, conn);
+  g_free (conn);
+
+  if (priv->comms_stopping && priv->incoming_conns == NULL)
+    g_main_loop_quit (priv->comms_loop);
+}
+
+static void
+ov_incoming_conn_close (OvIncomingConn * conn)
+{
+  if (conn->closed)
+    return;
+
+  conn->closed = TRUE;
+  g_cancellable_cancel (conn->cancellable);
+  if (conn->deadline) {
+    g_source_destroy (conn->deadline);
+    g_clear_pointer (&conn->deadline, g_source_unref);
+  }
+  /* Drop the ref for being open; pending reads and writes hold their own */
+  ov_incoming_conn_unref (conn);
 }
 
 static gboolean
-ov_local_peer_handle_start_negotiate (OvLocalPeer * local,
-    GSocketConnection * connection, OvTcpMsg * msg)
+on_incoming_conn_deadline (OvIncomingConn * conn)
 {
-  guint64 call_id;
+  if (conn->deadline_busy)
+    GST_WARNING ("Remote %s took too long to send a message or read a reply,"
+        " closing connection", conn->addr_s);
+  else
+    GST_DEBUG ("Connection from %s idle for %is, closing", conn->addr_s,
+        OV_TCP_IDLE_TIMEOUT);
+  ov_incoming_conn_close (conn);
+  return G_SOURCE_REMOVE;
+}
+
+/* Re-arms the deadline when the connection switches between idle and busy, or
+ * when @progress is set because a whole message was read or written. Partial
+ * reads and writes never extend it, so a remote can't keep the connection
+ * busy forever by trickling bytes. */
+static void
+ov_incoming_conn_update_deadline (OvIncomingConn * conn, gboolean progress)
+{
+  gboolean busy;
+
+  if (conn->closed)
+    return;
+
+  busy = conn->offset > 0 || conn->body != NULL ||
+    !g_queue_is_empty (&conn->replies);
+  if (conn->deadline && busy == conn->deadline_busy && !progress)
+    return;
+
+  if (conn->deadline) {
+    g_source_destroy (conn->deadline);
+    g_source_unref (conn->deadline);
+  }
+
+  conn->deadline = g_timeout_source_new_seconds (busy ? OV_TCP_TIMEOUT :
+      OV_TCP_IDLE_TIMEOUT);
+  g_source_set_callback (conn->deadline,
+      (GSourceFunc) on_incoming_conn_deadline, conn, NULL);
+  g_source_attach (conn->deadline, g_main_context_get_thread_default ());
+  conn->deadline_busy = busy;
+}
+
+static void ov_incoming_conn_write (OvIncomingConn * conn);
+
+static void
+on_incoming_conn_written (GOutputStream * output, GAsyncResult * res,
+    OvIncomingConn * conn)
+{
+  gssize written;
+  GBytes *bytes;
+  GError *error = NULL;
+
+  written = g_output_stream_write_finish (output, res, &error);
+  if (conn->closed)
+    goto out;
+
+  if (written < 0) {
+    GST_ERROR ("Unable to write reply to %s: %s", conn->addr_s,
+        error->message);
+    ov_incoming_conn_close (conn);
+    goto out;
+  }
+
+  conn->write_offset += written;
+  bytes = g_queue_peek_head (&conn->replies);
+  if (conn->write_offset < g_bytes_get_size (bytes)) {
+    ov_incoming_conn_write (conn);
+    goto out;
+  }
+
+  g_bytes_unref (g_queue_pop_head (&conn->replies));
+  conn->write_offset = 0;
+
+  if (!g_queue_is_empty (&conn->replies))
+    ov_incoming_conn_write (conn);
+  else if (!conn->reading) {
+    ov_incoming_conn_close (conn);
+    goto out;
+  }
+
+  ov_incoming_conn_update_deadline (conn, TRUE);
+out:
+  g_clear_error (&error);
+  ov_incoming_conn_unref (conn);
+}
+
+static void
+ov_incoming_conn_write (OvIncomingConn * conn)
+{
+  gsize size;
+  const gchar *data;
   GOutputStream *output;
+
+  data = g_bytes_get_data (g_queue_peek_head (&conn->replies), &size);
+  output = g_io_stream_get_output_stream (G_IO_STREAM (conn->connection));
+
+  conn->refcount++;
+  g_output_stream_write_async (output, data + conn->write_offset,
+      size - conn->write_offset, G_PRIORITY_DEFAULT, conn->cancellable,
+      (GAsyncReadyCallback) on_incoming_conn_written, conn);
+}
+
+/* Queues @reply to the message currently being handled to be written to the
+ * remote; does not take ownership */
+static gboolean
+ov_incoming_conn_send_reply (OvIncomingConn * conn, OvTcpMsg * reply)
+{
+  gchar *tmp;
+
+  if (conn->closed)
+    return FALSE;
+
+  /* Replies carry the id of the request they answer, so the remote can have
+   * several requests in flight on this connection */
+  reply->id = conn->msg->id;
+  /* Reply in the version the remote used, which it is known to understand */
+  ov_tcp_msg_set_version (reply, conn->msg->version);
+
+  tmp = ov_tcp_msg_print (reply);
+  GST_DEBUG ("Replying to %s with msg type %s; contents: %s", conn->addr_s,
+      ov_tcp_msg_type_to_string (reply->type, reply->version), tmp);
+  g_free (tmp);
+
+  g_queue_push_tail (&conn->replies, ov_tcp_msg_to_bytes (reply));
+  if (g_queue_get_length (&conn->replies) == 1)
+    ov_incoming_conn_write (conn);
+
+  ov_incoming_conn_update_deadline (conn, FALSE);
+  return TRUE;
+}
+
+static void
+ov_incoming_conn_send_new_error (OvIncomingConn * conn, guint64 id,
+    const gchar * error_msg)
+{
+  OvTcpMsg *reply;
+
+  reply = ov_tcp_msg_new_error (id, error_msg);
+  ov_incoming_conn_send_reply (conn, reply);
+  ov_tcp_msg_free (reply);
+}
+
+/* Called with the lock TAKEN. A new call can be negotiated while other calls
+ * are in progress, but we only negotiate one call at a time, so START_NEGOTIATE
+ * is refused while another call is being negotiated or while the application
+ * is setting up a call of its own. The one exception is a resend of the
+ * START_NEGOTIATE that began the negotiation that we're in, which is
+ * acknowledged again. Returns the reply to send if we're not going to start
+ * negotiating, and NULL otherwise. */
+static OvTcpMsg *
+ov_negotiate_check_busy (OvLocalPeer * local, OvTcpMsg * msg,
+    guint64 call_id, const gchar * negotiator_id)
+{
+  gchar *local_id, *error_msg;
+  OvTcpMsg *reply;
+  OvCall *call;
+  OvLocalPeerPrivate *priv;
+
+  priv = ov_local_peer_get_private (local);
+  call = ov_local_peer_get_call (local, call_id);
+
+  if (call != NULL && call->negotiate != NULL &&
+      g_strcmp0 (call->negotiate->negotiator->id, negotiator_id) == 0) {
+    if (call->negotiate->step != OV_NEGOTIATE_STEP_QUERY_CAPS) {
+      error_msg = g_strdup_printf ("Unexpected 'start negotiate' while "
+          "waiting for '%s'", ov_negotiate_step_to_string (
+            call->negotiate->step));
+      reply = ov_tcp_msg_new_error (msg->id, error_msg);
+      g_free (error_msg);
+      return reply;
+    }
+    GST_DEBUG ("Got START_NEGOTIATE for call %" G_GUINT64_FORMAT " again",
+        call_id);
+    g_object_get (OV_PEER (local), "id", &local_id, NULL);
+    reply = ov_tcp_msg_new_ok_negotiate (msg->id, local_id);
+    g_free (local_id);
+    return reply;
+  }
+
+  if (call != NULL || priv->state != OV_LOCAL_STATE_STARTED ||
+      ov_local_peer_get_negotiating_call (local) != NULL ||
+      (priv->call->id == 0 && priv->call->remote_peers->len > 0)) {
+    GST_DEBUG ("Refusing to negotiate call %" G_GUINT64_FORMAT " with %s: "
+        "busy", call_id, negotiator_id);
+    return ov_tcp_msg_new_error (msg->id, "Busy");
+  }
+
+  return NULL;
+}
+
+static gboolean
+ov_local_peer_handle_start_negotiate (OvLocalPeer * local,
+    OvIncomingConn * conn, OvTcpMsg * msg)
+{
+  guint64 call_id, caps_hash = 0;
   OvTcpMsg *reply;
   const gchar *variant_type;
   GSocketAddress *remote_addr, *negotiator_addr;
   guint16 negotiator_port;
   gchar *local_id, *negotiator_id;
+  OvCall *call;
   OvLocalPeerPrivate *priv;
-  OvLocalPeerState state;
   OvPeer *incoming;
   gboolean ret = FALSE;
 
   priv = ov_local_peer_get_private (local);
 
   variant_type = ov_tcp_msg_type_to_variant_type (
-      OV_TCP_MSG_TYPE_START_NEGOTIATE, OV_TCP_MAX_VERSION);
+      OV_TCP_MSG_TYPE_START_NEGOTIATE, msg->version);
   if (!g_variant_is_of_type (msg->variant, G_VARIANT_TYPE (variant_type))) {
     reply = ov_tcp_msg_new_error (msg->id, "Invalid message data");
     goto send_reply;
   }
-  g_variant_get (msg->variant, variant_type, &call_id, &negotiator_id,
-      &negotiator_port);
+  if (msg->version >= 3)
+    g_variant_get (msg->variant, variant_type, &call_id, &negotiator_id,
+        &negotiator_port, &caps_hash);
+  else
+    g_variant_get (msg->variant, variant_type, &call_id, &negotiator_id,
+        &negotiator_port);
 
-  state = ov_local_peer_get_state (local);
-  if (!(state & OV_LOCAL_STATE_STARTED)) {
-    reply = ov_tcp_msg_new_error (msg->id, "Busy");
+  ov_local_peer_lock (local);
+  reply = ov_negotiate_check_busy (local, msg, call_id, negotiator_id);
+  ov_local_peer_unlock (local);
+  if (reply) {
     g_free (negotiator_id);
     goto send_reply;
   }
@@ -98,7 +465,8 @@ ov_local_peer_handle_start_negotiate (OvLocalPeer * local,
   /* We receive the port to use while talking to the negotiator, but we must
    * derive the host to use from the connection itself because the negotiator
    * does not always know what address we're resolving it as */
-  remote_addr = g_socket_connection_get_remote_address (connection, NULL);
+  remote_addr = g_socket_connection_get_remote_address (conn->connection,
+      NULL);
   negotiator_addr = g_inet_socket_address_new (
       g_inet_socket_address_get_address (G_INET_SOCKET_ADDRESS (remote_addr)),
       negotiator_port);
@@ -109,27 +477,43 @@ ov_local_peer_handle_start_negotiate (OvLocalPeer * local,
   g_object_unref (incoming);
   if (!ret) {
     reply = ov_tcp_msg_new_error (msg->id, "Refused");
+    g_object_unref (negotiator_addr);
     g_free (negotiator_id);
     goto send_reply;
   }
 
   ov_local_peer_lock (local);
 
-  priv->negotiate = g_new0 (OvNegotiate, 1);
-  priv->negotiate->call_id = call_id;
-  priv->negotiate->negotiator =
+  /* Something else might've started while the signal was being handled */
+  reply = ov_negotiate_check_busy (local, msg, call_id, negotiator_id);
+  if (reply) {
+    ov_local_peer_unlock (local);
+    g_object_unref (negotiator_addr);
+    g_free (negotiator_id);
+    ret = FALSE;
+    goto send_reply;
+  }
+
+  /* Calls that are in progress keep going; the application is told about
+   * this one and acts on it from now on */
+  if (priv->call->id == 0)
+    call = priv->call;
+  else
+    call = ov_call_new ();
+  ov_local_peer_insert_call (local, call, call_id);
+  ov_local_peer_set_current_call (local, call);
+
+  call->negotiate = g_new0 (OvNegotiate, 1);
+  call->negotiate->call_id = call_id;
+  call->negotiate->negotiator =
     ov_remote_peer_new (local, G_INET_SOCKET_ADDRESS (negotiator_addr));
   g_object_unref (negotiator_addr);
-  priv->negotiate->negotiator->id = negotiator_id;
-
-  /* Set a rough timer for timing out the negotiation */
-  timeout_value = 0;
-  priv->negotiate->check_timeout_id =
-    g_timeout_add_seconds_full (G_PRIORITY_DEFAULT_IDLE, 1,
-        (GSourceFunc) check_negotiate_timeout, local, NULL);
+  call->negotiate->negotiator->id = negotiator_id;
+  call->negotiate->caps_hash = caps_hash;
+  ov_negotiate_enter_step (local, call, OV_NEGOTIATE_STEP_QUERY_CAPS);
 
-  ov_local_peer_set_state (local, OV_LOCAL_STATE_NEGOTIATING);
-  ov_local_peer_set_state_negotiatee (local);
+  ov_call_set_state (call, OV_LOCAL_STATE_NEGOTIATING);
+  ov_call_set_state_negotiatee (call);
 
   g_object_get (OV_PEER (local), "id", &local_id, NULL);
   reply = ov_tcp_msg_new_ok_negotiate (msg->id, local_id);
@@ -139,8 +523,7 @@ ov_local_peer_handle_start_negotiate (OvLocalPeer * local,
 
   ov_local_peer_unlock (local);
 send_reply:
-  output = g_io_stream_get_output_stream (G_IO_STREAM (connection));
-  ov_tcp_msg_write_to_stream (output, reply, NULL, NULL);
+  ov_incoming_conn_send_reply (conn, reply);
 
   ov_tcp_msg_free (reply);
   return ret;
@@ -148,16 +531,14 @@ send_reply:
 
 static gboolean
 ov_local_peer_handle_cancel_negotiate (OvLocalPeer * local,
-    GOutputStream * output, OvTcpMsg * msg)
+    OvIncomingConn * conn, OvTcpMsg * msg)
 {
   guint64 call_id;
   OvTcpMsg *reply;
+  OvCall *call;
   const gchar *variant_type;
-  OvLocalPeerPrivate *priv;
   gboolean ret = FALSE;
 
-  priv = ov_local_peer_get_private (local);
-
   variant_type = ov_tcp_msg_type_to_variant_type (
       OV_TCP_MSG_TYPE_CANCEL_NEGOTIATE, OV_TCP_MAX_VERSION);
   if (!g_variant_is_of_type (msg->variant, G_VARIANT_TYPE (variant_type))) {
@@ -166,24 +547,25 @@ ov_local_peer_handle_cancel_negotiate (OvLocalPeer * local,
   }
   g_variant_get (msg->variant, variant_type, &call_id, NULL);
 
-  if (priv->negotiate == NULL || call_id != priv->negotiate->call_id) {
+  ov_local_peer_lock (local);
+  call = ov_local_peer_get_call (local, call_id);
+  if (call == NULL || call->negotiate == NULL) {
+    ov_local_peer_unlock (local);
     reply = ov_tcp_msg_new_error (msg->id, "Invalid call id");
     goto send_reply;
   }
 
   GST_DEBUG ("Received a CANCEL_NEGOTIATE");
 
-  if (!ov_local_peer_negotiate_abort (local)) {
-    reply = ov_tcp_msg_new_error (msg->id, "Unable to stop negotiation");
-    goto send_reply;
-  }
+  ov_local_peer_call_negotiate_abort (local, call, FALSE);
+  ov_local_peer_unlock (local);
 
   reply = ov_tcp_msg_new_ack (msg->id);
 
   ret = TRUE;
 
 send_reply:
-  ov_tcp_msg_write_to_stream (output, reply, NULL, NULL);
+  ov_incoming_conn_send_reply (conn, reply);
 
   if (ret)
     g_signal_emit_by_name (local, "negotiate-aborted", NULL);
@@ -194,23 +576,22 @@ send_reply:
 
 /* Called with the lock TAKEN */
 static gboolean
-setup_negotiate_remote_peers (OvLocalPeer * local, OvTcpMsg * msg)
+setup_negotiate_remote_peers (OvLocalPeer * local, OvCall * call,
+    OvTcpMsg * msg)
 {
   GVariantIter *iter;
   GHashTable *remotes;
   const gchar *variant_type;
   gchar *peer_id, *peer_addr_s;
-  OvLocalPeerPrivate *priv;
-
-  priv = ov_local_peer_get_private (local);
+  OvNegotiate *negotiate = call->negotiate;
 
   remotes = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
       (GDestroyNotify) ov_remote_peer_free);
 
   /* Add the negotiator; it won't be in the list of remotes below because
    * those are all new remotes */
-  g_hash_table_insert (remotes, priv->negotiate->negotiator->id,
-      priv->negotiate->negotiator);
+  g_hash_table_insert (remotes, negotiate->negotiator->id,
+      negotiate->negotiator);
 
   variant_type = ov_tcp_msg_type_to_variant_type (
       OV_TCP_MSG_TYPE_QUERY_CAPS, OV_TCP_MAX_VERSION);
@@ -234,22 +615,23 @@ setup_negotiate_remote_peers (OvLocalPeer * local, OvTcpMsg * msg)
   }
   g_variant_iter_free (iter);
 
-  g_assert (priv->negotiate->remotes == NULL);
-  priv->negotiate->remotes = remotes;
+  g_assert (negotiate->remotes == NULL);
+  negotiate->remotes = remotes;
   return TRUE;
 err:
+  /* The negotiator isn't ours to free */
+  g_hash_table_steal (remotes, negotiate->negotiator->id);
   g_hash_table_unref (remotes);
   return FALSE;
 }
 
 static gboolean
 ov_local_peer_handle_query_reply_caps (OvLocalPeer * local,
-    GSocketConnection * connection, OvTcpMsg * msg)
+    OvIncomingConn * conn, OvTcpMsg * msg)
 {
   gchar *tmp;
   gboolean ret;
-  guint64 call_id;
-  GOutputStream *output;
+  guint64 call_id, cached_hash;
   GHashTableIter iter;
   GVariantBuilder *peers;
   const gchar *variant_type;
@@ -257,9 +639,10 @@ ov_local_peer_handle_query_reply_caps (OvLocalPeer * local,
   gchar *recv_acaps, *recv_vcaps;
   /* The caps that we can send */
   gchar *send_acaps, *send_vcaps;
+  GstCaps *send_caps[2];
   OvRemotePeer *remote;
   OvTcpMsg *reply;
-  OvLocalPeerState state;
+  OvCall *call;
   OvLocalPeerPrivate *priv;
 
   priv = ov_local_peer_get_private (local);
@@ -275,42 +658,51 @@ ov_local_peer_handle_query_reply_caps (OvLocalPeer * local,
 
   ov_local_peer_lock (local);
 
-  state = ov_local_peer_get_state (local);
-  if (!(state & (OV_LOCAL_STATE_NEGOTIATING | OV_LOCAL_STATE_NEGOTIATEE))) {
-    reply = ov_tcp_msg_new_error (msg->id, "Busy");
+  reply = ov_negotiate_check_step (local, msg, call_id,
+      OV_NEGOTIATE_STEP_QUERY_CAPS, &call);
+  if (reply) {
     ov_local_peer_unlock (local);
     goto send_reply;
   }
 
-  if (priv->negotiate->call_id != call_id) {
-    reply = ov_tcp_msg_new_error (msg->id, "Invalid call id");
+  /* Allocate ports for all peers listed (pre-setup) */
+  if (!setup_negotiate_remote_peers (local, call, msg)) {
+    reply = ov_tcp_msg_new_error (msg->id, "Invalid list of peers");
     ov_local_peer_unlock (local);
     goto send_reply;
   }
-
-  timeout_value = 0;
-
-  /* Allocate ports for all peers listed (pre-setup) */
-  setup_negotiate_remote_peers (local, msg);
+  ov_negotiate_enter_step (local, call, OV_NEGOTIATE_STEP_CALL_DETAILS);
 
   /* Build the 'reply-caps' msg */
   peers = g_variant_builder_new (G_VARIANT_TYPE ("a(sqqqq)"));
-  g_hash_table_iter_init (&iter, priv->negotiate->remotes);
+  g_hash_table_iter_init (&iter, call->negotiate->remotes);
   while (g_hash_table_iter_next (&iter, NULL, (gpointer) &remote))
     g_variant_builder_add (peers, "(sqqqq)", remote->id,
         remote->priv->recv_ports[0], remote->priv->recv_ports[1],
         remote->priv->recv_ports[2], remote->priv->recv_ports[3]);
+  cached_hash = call->negotiate->caps_hash;
+  /* Fixed by the calls we're already in, if any */
+  ov_local_peer_get_send_caps (local, &send_caps[0], &send_caps[1]);
 
   ov_local_peer_unlock (local);
 
-  send_acaps = gst_caps_to_string (priv->supported_send_acaps);
+  send_acaps = gst_caps_to_string (send_caps[0]);
   /* TODO: Decide send_vcaps based on our upload bandwidth limit */
-  send_vcaps = gst_caps_to_string (priv->supported_send_vcaps);
+  send_vcaps = gst_caps_to_string (send_caps[1]);
+  gst_caps_unref (send_caps[0]);
+  gst_caps_unref (send_caps[1]);
   /* TODO: Fixate and restrict recv_?caps as per CPU and download
    * bandwidth limits based on the number of peers */
   recv_acaps = gst_caps_to_string (priv->supported_recv_acaps);
   recv_vcaps = gst_caps_to_string (priv->supported_recv_vcaps);
 
+  /* The negotiator already has our caps from a previous call */
+  if (cached_hash != 0 && cached_hash ==
+      ov_tcp_caps_hash (send_acaps, send_vcaps, recv_acaps, recv_vcaps)) {
+    GST_DEBUG ("Negotiator has our caps cached, not sending them");
+    send_acaps[0] = send_vcaps[0] = recv_acaps[0] = recv_vcaps[0] = '\0';
+  }
+
   variant_type = ov_tcp_msg_type_to_variant_type (
       OV_TCP_MSG_TYPE_REPLY_CAPS, OV_TCP_MAX_VERSION);
   reply = ov_tcp_msg_new (OV_TCP_MSG_TYPE_REPLY_CAPS,
@@ -329,8 +721,7 @@ ov_local_peer_handle_query_reply_caps (OvLocalPeer * local,
   g_free (tmp);
 
 send_reply:
-  output = g_io_stream_get_output_stream (G_IO_STREAM (connection));
-  ret = ov_tcp_msg_write_to_stream (output, reply, NULL, NULL);
+  ret = ov_incoming_conn_send_reply (conn, reply);
   /* XXX: Failure return here is not a fatal error. If our message did not get
    * through, the negotiation will just timeout instead. */
   ov_tcp_msg_free (reply);
@@ -340,7 +731,7 @@ send_reply:
 
 /* Called with the lock TAKEN */
 static gboolean
-set_call_details (OvLocalPeer * local, OvTcpMsg * msg)
+set_call_details (OvLocalPeer * local, OvCall * call, OvTcpMsg * msg)
 {
   GVariantIter *iter;
   const gchar *vtype;
@@ -350,29 +741,32 @@ set_call_details (OvLocalPeer * local, OvTcpMsg * msg)
   guint32 ports[6] = {};
 
   priv = ov_local_peer_get_private (local);
-  remotes = priv->negotiate->remotes;
+  remotes = call->negotiate->remotes;
 
   vtype = ov_tcp_msg_type_to_variant_type (
       OV_TCP_MSG_TYPE_CALL_DETAILS, OV_TCP_MAX_VERSION);
 
   g_variant_get (msg->variant, vtype, NULL, &acaps, &vcaps, &iter);
 
-    /* Set our send_caps; unreffing any existing ones if necessary */
-  if (priv->send_acaps != NULL)
-    gst_caps_unref (priv->send_acaps);
-  priv->send_acaps = gst_caps_from_string (acaps);
-  if (priv->send_vcaps != NULL)
-    gst_caps_unref (priv->send_vcaps);
-  priv->send_vcaps = gst_caps_from_string (vcaps);
+  /* Set our send_caps, unless another call is already transmitting them. We
+   * only offered what it's transmitting, so that's what we were given. */
+  if (priv->transmit == NULL) {
+    if (priv->send_acaps != NULL)
+      gst_caps_unref (priv->send_acaps);
+    priv->send_acaps = gst_caps_from_string (acaps);
+    if (priv->send_vcaps != NULL)
+      gst_caps_unref (priv->send_vcaps);
+    priv->send_vcaps = gst_caps_from_string (vcaps);
+
+    /* Set the video format we're sending */
+    priv->send_video_format = ov_caps_to_video_format (priv->send_vcaps);
+    /* If this wasn't already set, that means we're doing passthrough of video
+     * data from the video source device to the payloader */
+    if (priv->device_video_format == OV_VIDEO_FORMAT_UNKNOWN)
+      priv->device_video_format = priv->send_video_format;
+  }
   g_free (acaps); g_free (vcaps);
 
-  /* Set the video format we're sending */
-  priv->send_video_format = ov_caps_to_video_format (priv->send_vcaps);
-  /* If this wasn't already set, that means we're doing passthrough of video
-   * data from the video source device to the payloader */
-  if (priv->device_video_format == OV_VIDEO_FORMAT_UNKNOWN)
-    priv->device_video_format = priv->send_video_format;
-
   while (g_variant_iter_loop (iter, "(sssqqqqqq)", &peer_id, &acaps, &vcaps,
         &ports[0], &ports[1], &ports[2], &ports[3], &ports[4], &ports[5])) {
     OvRemotePeer *remote;
@@ -400,8 +794,8 @@ set_call_details (OvLocalPeer * local, OvTcpMsg * msg)
     remote->priv->recv_vcaps = gst_caps_from_string (vcaps);
   }
 
-  ov_local_peer_set_state (local, OV_LOCAL_STATE_NEGOTIATED);
-  ov_local_peer_set_state_negotiatee (local);
+  ov_call_set_state (call, OV_LOCAL_STATE_NEGOTIATED);
+  ov_call_set_state_negotiatee (call);
 
   g_variant_iter_free (iter);
   return TRUE;
@@ -412,18 +806,15 @@ err:
 }
 
 static gboolean
-ov_local_peer_handle_call_details (OvLocalPeer * local, GOutputStream * output,
+ov_local_peer_handle_call_details (OvLocalPeer * local, OvIncomingConn * conn,
     OvTcpMsg * msg)
 {
   guint64 call_id;
   OvTcpMsg *reply;
+  OvCall *call;
   const gchar *variant_type;
-  OvLocalPeerPrivate *priv;
-  OvLocalPeerState state;
   gboolean ret = FALSE;
 
-  priv = ov_local_peer_get_private (local);
-
   variant_type = ov_tcp_msg_type_to_variant_type (
       OV_TCP_MSG_TYPE_CALL_DETAILS, OV_TCP_MAX_VERSION);
   if (!g_variant_is_of_type (msg->variant, G_VARIANT_TYPE (variant_type))) {
@@ -434,27 +825,20 @@ ov_local_peer_handle_call_details (OvLocalPeer * local, GOutputStream * output,
 
   ov_local_peer_lock (local);
 
-  state = ov_local_peer_get_state (local);
-  if (!(state & (OV_LOCAL_STATE_NEGOTIATING | OV_LOCAL_STATE_NEGOTIATEE))) {
-    reply = ov_tcp_msg_new_error (msg->id, "Busy");
-    goto send_reply_unlock;
-  }
-
-  if (priv->negotiate == NULL || priv->negotiate->call_id != call_id) {
-    reply = ov_tcp_msg_new_error (msg->id, "Invalid call id");
+  reply = ov_negotiate_check_step (local, msg, call_id,
+      OV_NEGOTIATE_STEP_CALL_DETAILS, &call);
+  if (reply)
     goto send_reply_unlock;
-  }
-
-  timeout_value = 0;
 
   /* Set call details */
-  if (!set_call_details (local, msg)) {
+  if (!set_call_details (local, call, msg)) {
     reply = ov_tcp_msg_new_error_call (call_id, "Invalid call details");
     /* XXX: We don't abort the negotiation because of invalid call details.
      * We give the negotiator another chance to send us the call details or to
      * abort negotiation, or we just timeout eventually. */
     goto send_reply_unlock;
   }
+  ov_negotiate_enter_step (local, call, OV_NEGOTIATE_STEP_START_CALL);
 
   reply = ov_tcp_msg_new_ack (msg->id);
   ret = TRUE;
@@ -462,7 +846,7 @@ ov_local_peer_handle_call_details (OvLocalPeer * local, GOutputStream * output,
 send_reply_unlock:
   ov_local_peer_unlock (local);
 send_reply:
-  ov_tcp_msg_write_to_stream (output, reply, NULL, NULL);
+  ov_incoming_conn_send_reply (conn, reply);
 
   ov_tcp_msg_free (reply);
   return ret;
@@ -470,18 +854,16 @@ send_reply:
 
 /* Called with the lock TAKEN */
 static gboolean
-start_call (OvLocalPeer * local, OvTcpMsg * msg)
+start_call (OvLocalPeer * local, OvCall * call, OvTcpMsg * msg)
 {
   gchar *peer_id;
   const gchar *vtype;
   GVariantIter *iter;
   GHashTable *remotes;
-  OvLocalPeerPrivate *priv;
 
-  priv = ov_local_peer_get_private (local);
-  remotes = priv->negotiate->remotes;
+  remotes = call->negotiate->remotes;
 
-  g_assert (priv->remote_peers->len == 0);
+  g_assert (call->remote_peers->len == 0);
 
   vtype = ov_tcp_msg_type_to_variant_type (
       OV_TCP_MSG_TYPE_START_CALL, OV_TCP_MAX_VERSION);
@@ -497,25 +879,18 @@ start_call (OvLocalPeer * local, OvTcpMsg * msg)
       goto err;
     }
 
-    /* Move from the negotiating hash table to the local peer */
-    ov_local_peer_add_remote (local, remote);
+    /* Move from the negotiating hash table to the call */
+    ov_call_add_remote (call, remote);
     g_hash_table_steal (remotes, peer_id);
   }
   g_variant_iter_free (iter);
 
-  /* Move the call id */
-  priv->active_call_id = priv->negotiate->call_id;
-  ov_local_peer_set_state (local, OV_LOCAL_STATE_READY |
-      OV_LOCAL_STATE_NEGOTIATEE);
-
-  /* Negotiation has finished, remove timer */
-  g_source_remove (priv->negotiate->check_timeout_id);
+  ov_call_set_state (call, OV_LOCAL_STATE_READY | OV_LOCAL_STATE_NEGOTIATEE);
 
-  /* Clear out negotiate struct. Freeing the remotes removes the allocated
-   * udp ports as well */
-  g_clear_pointer (&priv->negotiate->remotes,
-      (GDestroyNotify) g_hash_table_unref);
-  g_clear_pointer (&priv->negotiate, g_free);
+  /* Negotiation has finished; this also frees the remotes that aren't in the
+   * call */
+  ov_negotiate_free (call->negotiate, "finished");
+  call->negotiate = NULL;
 
   return TRUE;
 err:
@@ -525,18 +900,15 @@ err:
 }
 
 static gboolean
-ov_local_peer_handle_start_call (OvLocalPeer * local, GOutputStream * output,
+ov_local_peer_handle_start_call (OvLocalPeer * local, OvIncomingConn * conn,
     OvTcpMsg * msg)
 {
   guint64 call_id;
   OvTcpMsg *reply;
+  OvCall *call;
   const gchar *variant_type;
-  OvLocalPeerPrivate *priv;
-  OvLocalPeerState state;
   gboolean ret = FALSE;
 
-  priv = ov_local_peer_get_private (local);
-
   variant_type = ov_tcp_msg_type_to_variant_type (
       OV_TCP_MSG_TYPE_START_CALL, OV_TCP_MAX_VERSION);
   if (!g_variant_is_of_type (msg->variant, G_VARIANT_TYPE (variant_type))) {
@@ -547,22 +919,13 @@ ov_local_peer_handle_start_call (OvLocalPeer * local, GOutputStream * output,
 
   ov_local_peer_lock (local);
 
-  state = ov_local_peer_get_state (local);
-  if (!(state & (OV_LOCAL_STATE_NEGOTIATED | OV_LOCAL_STATE_NEGOTIATEE))) {
-    reply = ov_tcp_msg_new_error (msg->id, "Busy");
+  reply = ov_negotiate_check_step (local, msg, call_id,
+      OV_NEGOTIATE_STEP_START_CALL, &call);
+  if (reply)
     goto send_reply_unlock;
-  }
-
-  if (priv->negotiate == NULL ||
-      priv->negotiate->call_id != call_id) {
-    reply = ov_tcp_msg_new_error (msg->id, "Invalid call id");
-    goto send_reply_unlock;
-  }
-
-  timeout_value = 0;
 
   /* Start calling the specified list of peers */
-  if (!start_call (local, msg)) {
+  if (!start_call (local, call, msg)) {
     reply = ov_tcp_msg_new_error_call (call_id, "Invalid list of peers");
     /* XXX: We don't abort the negotiation because of this error here.
      * We give the negotiator another chance to start the call, or to
@@ -570,13 +933,16 @@ ov_local_peer_handle_start_call (OvLocalPeer * local, GOutputStream * output,
     goto send_reply_unlock;
   }
 
+  /* The application starts the call that it's told has been negotiated */
+  ov_local_peer_set_current_call (local, call);
+
   reply = ov_tcp_msg_new_ack (msg->id);
   ret = TRUE;
 
 send_reply_unlock:
   ov_local_peer_unlock (local);
 send_reply:
-  ov_tcp_msg_write_to_stream (output, reply, NULL, NULL);
+  ov_incoming_conn_send_reply (conn, reply);
   /* Emit signal after unlocking and after writing the reply */
   if (ret)
     g_signal_emit_by_name (local, "negotiate-finished");
@@ -585,17 +951,253 @@ send_reply:
   return ret;
 }
 
+/* Called with the lock TAKEN
+ *
+ * Whether @conn comes from one of the remotes in @call. Remotes connect to
+ * us from an ephemeral port, so only the address is compared. */
+static gboolean
+ov_incoming_conn_is_from_call (OvCall * call, OvIncomingConn * conn)
+{
+  guint ii;
+  gchar *host;
+  gboolean found = FALSE;
+  GPtrArray *remotes = call->remote_peers;
+
+  for (ii = 0; ii < remotes->len && !found; ii++) {
+    OvRemotePeer *remote = g_ptr_array_index (remotes, ii);
+
+    host = g_inet_address_to_string (
+        g_inet_socket_address_get_address (remote->addr));
+    found = g_strcmp0 (host, conn->host) == 0;
+    g_free (host);
+  }
+
+  return found;
+}
+
+/* Another peer in the call is adding a new remote to it */
+static gboolean
+ov_local_peer_handle_query_join (OvLocalPeer * local, OvIncomingConn * conn,
+    OvTcpMsg * msg)
+{
+  guint64 call_id;
+  OvTcpMsg *reply;
+  GVariantBuilder *peers;
+  GInetSocketAddress *joiner_addr;
+  const gchar *variant_type;
+  gchar *joiner_id = NULL, *joiner_addr_s = NULL;
+  gchar *send_acaps, *send_vcaps, *recv_acaps, *recv_vcaps;
+  GstCaps *send_caps[2];
+  OvRemotePeer *joiner;
+  OvCall *call;
+  OvLocalPeerPrivate *priv;
+  gboolean ret = FALSE;
+
+  priv = ov_local_peer_get_private (local);
+
+  variant_type = ov_tcp_msg_type_to_variant_type (
+      OV_TCP_MSG_TYPE_QUERY_JOIN, OV_TCP_MAX_VERSION);
+  if (!g_variant_is_of_type (msg->variant, G_VARIANT_TYPE (variant_type))) {
+    reply = ov_tcp_msg_new_error (msg->id, "Invalid message data");
+    goto send_reply;
+  }
+  g_variant_get (msg->variant, variant_type, &call_id, &joiner_id,
+      &joiner_addr_s);
+
+  ov_local_peer_lock (local);
+
+  call = ov_local_peer_get_call (local, call_id);
+  if (call == NULL) {
+    reply = ov_tcp_msg_new_error (msg->id, "Invalid call id");
+    goto send_reply_unlock;
+  }
+
+  if (!(call->state & (OV_LOCAL_STATE_PLAYING | OV_LOCAL_STATE_PAUSED))) {
+    reply = ov_tcp_msg_new_error (msg->id, "Busy");
+    goto send_reply_unlock;
+  }
+
+  /* Only peers in the call can add remotes to it */
+  if (!ov_incoming_conn_is_from_call (call, conn)) {
+    GST_WARNING ("Rejecting QUERY_JOIN from %s: not in the call",
+        conn->addr_s);
+    reply = ov_tcp_msg_new_error (msg->id, "Not in the call");
+    goto send_reply_unlock;
+  }
+
+  if (ov_call_get_remote_by_id (call, joiner_id)) {
+    reply = ov_tcp_msg_new_error (msg->id, "Already in the call");
+    goto send_reply_unlock;
+  }
+
+  joiner_addr = ov_inet_socket_address_from_string (joiner_addr_s);
+  if (joiner_addr == NULL) {
+    reply = ov_tcp_msg_new_error (msg->id, "Invalid address");
+    goto send_reply_unlock;
+  }
+
+  /* Allocate ports to receive from the joiner. If an earlier attempt to add
+   * it failed, this replaces the ports allocated then. */
+  joiner = ov_remote_peer_new (local, joiner_addr);
+  g_object_unref (joiner_addr);
+  joiner->id = joiner_id;
+  joiner_id = NULL;
+  /* Freed by ov_local_peer_check_timeouts() if the JOIN_DETAILS or END_CALL
+   * for it never arrive */
+  joiner->last_seen = g_get_monotonic_time ();
+  g_hash_table_replace (call->joining, joiner->id, joiner);
+
+  peers = g_variant_builder_new (G_VARIANT_TYPE ("a(sqqqq)"));
+  g_variant_builder_add (peers, "(sqqqq)", joiner->id,
+      joiner->priv->recv_ports[0], joiner->priv->recv_ports[1],
+      joiner->priv->recv_ports[2], joiner->priv->recv_ports[3]);
+
+  /* What we're already transmitting */
+  ov_local_peer_get_send_caps (local, &send_caps[0], &send_caps[1]);
+  send_acaps = gst_caps_to_string (send_caps[0]);
+  send_vcaps = gst_caps_to_string (send_caps[1]);
+  gst_caps_unref (send_caps[0]);
+  gst_caps_unref (send_caps[1]);
+  recv_acaps = gst_caps_to_string (priv->supported_recv_acaps);
+  recv_vcaps = gst_caps_to_string (priv->supported_recv_vcaps);
+
+  variant_type = ov_tcp_msg_type_to_variant_type (
+      OV_TCP_MSG_TYPE_REPLY_CAPS, OV_TCP_MAX_VERSION);
+  reply = ov_tcp_msg_new (OV_TCP_MSG_TYPE_REPLY_CAPS,
+      g_variant_new (variant_type, call_id, priv->recv_rtcp_ports[0],
+        priv->recv_rtcp_ports[1], send_acaps, send_vcaps, recv_acaps,
+        recv_vcaps, peers));
+  g_variant_builder_unref (peers);
+
+  g_free (send_acaps); g_free (send_vcaps);
+  g_free (recv_acaps); g_free (recv_vcaps);
+
+  GST_DEBUG ("Allocated ports for remote %s joining the call", joiner->id);
+  ret = TRUE;
+
+send_reply_unlock:
+  ov_local_peer_unlock (local);
+send_reply:
+  ov_incoming_conn_send_reply (conn, reply);
+
+  ov_tcp_msg_free (reply);
+  g_free (joiner_id);
+  g_free (joiner_addr_s);
+  return ret;
+}
+
 static gboolean
-ov_local_peer_remove_peer_from_call (OvLocalPeer * local, GOutputStream * output,
+ov_local_peer_handle_join_details (OvLocalPeer * local, OvIncomingConn * conn,
     OvTcpMsg * msg)
+{
+  guint ii;
+  guint64 call_id;
+  guint16 ports[6];
+  OvTcpMsg *reply;
+  GVariantIter *iter = NULL;
+  const gchar *variant_type;
+  gchar *joiner_id = NULL, *acaps = NULL, *vcaps = NULL;
+  GstCaps *recv_acaps = NULL, *recv_vcaps = NULL;
+  OvRemotePeer *joiner;
+  OvCall *call;
+  OvPeer *added = NULL;
+  gboolean ret = FALSE;
+
+  variant_type = ov_tcp_msg_type_to_variant_type (
+      OV_TCP_MSG_TYPE_JOIN_DETAILS, OV_TCP_MAX_VERSION);
+  if (!g_variant_is_of_type (msg->variant, G_VARIANT_TYPE (variant_type))) {
+    reply = ov_tcp_msg_new_error (msg->id, "Invalid message data");
+    goto send_reply;
+  }
+  g_variant_get (msg->variant, variant_type, &call_id, &iter);
+  /* Remotes are added one at a time */
+  if (g_variant_iter_n_children (iter) != 1) {
+    reply = ov_tcp_msg_new_error (msg->id, "Invalid message data");
+    goto send_reply;
+  }
+  g_variant_iter_next (iter, "(sssqqqqqq)", &joiner_id, &acaps, &vcaps,
+      &ports[0], &ports[1], &ports[2], &ports[3], &ports[4], &ports[5]);
+  recv_acaps = gst_caps_from_string (acaps);
+  recv_vcaps = gst_caps_from_string (vcaps);
+  if (recv_acaps == NULL || recv_vcaps == NULL) {
+    GST_WARNING ("Rejecting JOIN_DETAILS from %s: invalid caps",
+        conn->addr_s);
+    reply = ov_tcp_msg_new_error (msg->id, "Invalid message data");
+    goto send_reply;
+  }
+
+  ov_local_peer_lock (local);
+
+  call = ov_local_peer_get_call (local, call_id);
+  if (call == NULL) {
+    reply = ov_tcp_msg_new_error (msg->id, "Invalid call id");
+    goto send_reply_unlock;
+  }
+
+  if (!(call->state & (OV_LOCAL_STATE_PLAYING | OV_LOCAL_STATE_PAUSED))) {
+    reply = ov_tcp_msg_new_error (msg->id, "Busy");
+    goto send_reply_unlock;
+  }
+
+  if (!ov_incoming_conn_is_from_call (call, conn)) {
+    GST_WARNING ("Rejecting JOIN_DETAILS from %s: not in the call",
+        conn->addr_s);
+    reply = ov_tcp_msg_new_error (msg->id, "Not in the call");
+    goto send_reply_unlock;
+  }
+
+  joiner = g_hash_table_lookup (call->joining, joiner_id);
+  if (joiner == NULL) {
+    reply = ov_tcp_msg_new_error_call (call_id, "Invalid peer id");
+    goto send_reply_unlock;
+  }
+  g_hash_table_steal (call->joining, joiner_id);
+
+  for (ii = 0; ii < 6; ii++)
+    joiner->priv->send_ports[ii] = ports[ii];
+  joiner->priv->recv_acaps = recv_acaps, recv_acaps = NULL;
+  joiner->priv->recv_vcaps = recv_vcaps, recv_vcaps = NULL;
+
+  added = ov_peer_new (joiner->addr);
+  /* Start sending to and receiving from the joiner */
+  if (!ov_local_peer_call_add_remote (local, call, joiner)) {
+    reply = ov_tcp_msg_new_error_call (call_id, "Unable to add peer");
+    g_clear_object (&added);
+    goto send_reply_unlock;
+  }
+
+  reply = ov_tcp_msg_new_ack (msg->id);
+  ret = TRUE;
+
+send_reply_unlock:
+  ov_local_peer_unlock (local);
+send_reply:
+  ov_incoming_conn_send_reply (conn, reply);
+
+  /* Emit signal after unlocking and after writing the reply */
+  if (ret) {
+    g_signal_emit_by_name (local, "call-remote-added", added);
+    g_object_unref (added);
+  }
+
+  ov_tcp_msg_free (reply);
+  g_clear_pointer (&iter, g_variant_iter_free);
+  g_clear_pointer (&recv_acaps, gst_caps_unref);
+  g_clear_pointer (&recv_vcaps, gst_caps_unref);
+  g_free (joiner_id); g_free (acaps); g_free (vcaps);
+  return ret;
+}
+
+static gboolean
+ov_local_peer_remove_peer_from_call (OvLocalPeer * local,
+    OvIncomingConn * conn, OvTcpMsg * msg)
 {
   guint64 call_id;
   OvTcpMsg *reply;
   OvPeer *removed;
   OvRemotePeer *remote;
   const gchar *variant_type;
-  GPtrArray *remote_peers;
-  OvLocalPeerState state;
+  OvCall *call;
   gchar *peer_id = NULL;
   gboolean all_remotes_gone = FALSE;
   gboolean ret = FALSE;
@@ -610,16 +1212,26 @@ ov_local_peer_remove_peer_from_call (OvLocalPeer * local, GOutputStream * output
 
   ov_local_peer_lock (local);
 
-  state = ov_local_peer_get_state (local);
-  if (!(state & OV_LOCAL_STATE_PAUSED ||
-        state & OV_LOCAL_STATE_PLAYING)) {
+  call = ov_local_peer_get_call (local, call_id);
+  if (call == NULL) {
+    reply = ov_tcp_msg_new_error (msg->id, "Invalid call id");
+    goto send_reply_unlock;
+  }
+
+  if (!(call->state & OV_LOCAL_STATE_PAUSED ||
+        call->state & OV_LOCAL_STATE_PLAYING)) {
     reply = ov_tcp_msg_new_error (msg->id, "Busy");
     goto send_reply_unlock;
   }
 
-  remote = ov_local_peer_get_remote_by_id (local, peer_id);
+  remote = ov_call_get_remote_by_id (call, peer_id);
   if (!remote) {
-    reply = ov_tcp_msg_new_error_call (call_id, "Invalid peer id");
+    /* Adding this remote to the call was abandoned before it joined; free the
+     * ports we allocated for it */
+    if (g_hash_table_remove (call->joining, peer_id))
+      reply = ov_tcp_msg_new_ack (msg->id);
+    else
+      reply = ov_tcp_msg_new_error_call (call_id, "Invalid peer id");
     goto send_reply_unlock;
   }
 
@@ -629,10 +1241,11 @@ ov_local_peer_remove_peer_from_call (OvLocalPeer * local, GOutputStream * output
   /* Remove the specified peer from the call */
   ov_local_peer_remove_remote (local, remote);
 
-  remote_peers = ov_local_peer_get_remotes (local);
-  if (remote_peers->len == 0) {
+  if (call->remote_peers->len == 0) {
     GST_DEBUG ("No peers left in call");
     all_remotes_gone = TRUE;
+    /* The application hangs up the current call when it's told */
+    ov_local_peer_set_current_call (local, call);
   }
 
   reply = ov_tcp_msg_new_ack (msg->id);
@@ -642,7 +1255,7 @@ ov_local_peer_remove_peer_from_call (OvLocalPeer * local, GOutputStream * output
 send_reply_unlock:
   ov_local_peer_unlock (local);
 send_reply:
-  ov_tcp_msg_write_to_stream (output, reply, NULL, NULL);
+  ov_incoming_conn_send_reply (conn, reply);
 
   /* Emit signals after unlocking and after writing the reply */
   if (ret) {
@@ -657,94 +1270,264 @@ send_reply:
   return ret;
 }
 
-/* TODO: This does blocking reads over the network, which is ok for now because
- * we're using a threaded listener with 10 threads. However, this makes us
- * susceptible to DoS attacks. Needs fixing. */
-gboolean
-on_incoming_peer_tcp_connection (GSocketService * service,
-    GSocketConnection * connection, GObject * source_object G_GNUC_UNUSED,
-    OvLocalPeer * local)
+static void
+ov_incoming_conn_dispatch (OvIncomingConn * conn, OvTcpMsg * msg)
 {
-  gchar *tmp;
-  gboolean ret;
-  GInputStream *input;
-  GOutputStream *output;
-  OvTcpMsg *msg;
-  GError *error = NULL;
-
-  input = g_io_stream_get_input_stream (G_IO_STREAM (connection));
-  output = g_io_stream_get_output_stream (G_IO_STREAM (connection));
-
-  msg = g_new0 (OvTcpMsg, 1);
-
-  ret = ov_tcp_msg_read_header_from_stream (input, msg, NULL,
-      &error);
-  if (ret != TRUE) {
-    GST_ERROR ("Unable to read message length prefix: %s",
-        error ? error->message : "Unknown error");
-    if (msg->id)
-      /* TODO: Make this more specific; add GError types and send back and
-       * forth. In general, error handling is quite crap everywhere right
-       * now. */
-      ov_tcp_msg_write_new_error_to_stream (output, msg->id,
-          "Couldn't finish reading header", NULL, NULL);
-    goto out;
-  }
-
-  GST_DEBUG ("Incoming message type '%s' and version %u of length %u bytes",
-      ov_tcp_msg_type_to_string (msg->type, msg->version),
-      msg->version, msg->size);
+  OvLocalPeer *local = conn->local;
 
   /* TODO: Handle incoming messages when we're busy negotiating a call, or
    * are in a call, etc. */
 
-  if (msg->size == 0)
-    goto body_done;
-
-  /* Read the rest of the message */
-  ret = ov_tcp_msg_read_body_from_stream (input, msg, NULL, &error);
-  if (ret != TRUE) {
-    GST_ERROR ("Unable to read message body: %s",
-        error ? error->message : "Unknown error");
-    ov_tcp_msg_write_new_error_to_stream (output, msg->id,
-        "Couldn't read body", NULL, NULL);
-    goto out;
-  }
-
-  tmp = g_variant_print (msg->variant, FALSE);
-  GST_DEBUG ("Received message body: %s", tmp);
-  g_free (tmp);
-
-body_done:
   switch (msg->type) {
     case OV_TCP_MSG_TYPE_START_NEGOTIATE:
-      ov_local_peer_handle_start_negotiate (local, connection, msg);
+      ov_local_peer_handle_start_negotiate (local, conn, msg);
       break;
     case OV_TCP_MSG_TYPE_CANCEL_NEGOTIATE:
-      ov_local_peer_handle_cancel_negotiate (local, output, msg);
+      ov_local_peer_handle_cancel_negotiate (local, conn, msg);
       break;
     case OV_TCP_MSG_TYPE_QUERY_CAPS:
-      ov_local_peer_handle_query_reply_caps (local, connection, msg);
+      ov_local_peer_handle_query_reply_caps (local, conn, msg);
       break;
     case OV_TCP_MSG_TYPE_CALL_DETAILS:
-      ov_local_peer_handle_call_details (local, output, msg);
+      ov_local_peer_handle_call_details (local, conn, msg);
       break;
     case OV_TCP_MSG_TYPE_START_CALL:
-      ov_local_peer_handle_start_call (local, output, msg);
+      ov_local_peer_handle_start_call (local, conn, msg);
       break;
     case OV_TCP_MSG_TYPE_END_CALL:
-      ov_local_peer_remove_peer_from_call (local, output, msg);
+      ov_local_peer_remove_peer_from_call (local, conn, msg);
+      break;
+    case OV_TCP_MSG_TYPE_QUERY_JOIN:
+      ov_local_peer_handle_query_join (local, conn, msg);
+      break;
+    case OV_TCP_MSG_TYPE_JOIN_DETAILS:
+      ov_local_peer_handle_join_details (local, conn, msg);
       break;
     default:
-      ov_tcp_msg_write_new_error_to_stream (output, msg->id,
-          "Unknown message type", NULL, NULL);
+      ov_incoming_conn_send_new_error (conn, msg->id, "Unknown message type");
+  }
+}
+
+static void ov_incoming_conn_read (OvIncomingConn * conn);
+
+static void
+on_incoming_conn_read (GInputStream * input, GAsyncResult * res,
+    OvIncomingConn * conn)
+{
+  gchar *tmp;
+  gssize bytes_read;
+  GBytes *body;
+  GError *error = NULL;
+
+  bytes_read = g_input_stream_read_finish (input, res, &error);
+  if (conn->closed)
+    goto out;
+
+  if (bytes_read < 0) {
+    GST_ERROR ("Unable to read from %s: %s", conn->addr_s, error->message);
+    ov_incoming_conn_close (conn);
+    goto out;
+  }
+
+  if (bytes_read == 0) {
+    if (conn->offset == 0 && conn->body == NULL)
+      GST_DEBUG ("Remote %s closed the connection", conn->addr_s);
+    else
+      GST_ERROR ("Remote %s closed the connection in the middle of a message",
+          conn->addr_s);
+    ov_incoming_conn_close (conn);
+    goto out;
+  }
+
+  conn->offset += bytes_read;
+
+  if (conn->body == NULL) {
+    /* Reading the header */
+    if (conn->offset < OV_TCP_MSG_HEADER_SIZE)
+      goto read_more;
+
+    if (!ov_tcp_msg_parse_header (conn->msg, conn->header)) {
+      /* We can't know where the next message starts, so stop reading and
+       * close after telling the remote what went wrong */
+      conn->reading = FALSE;
+      if (conn->msg->id)
+        /* TODO: Make this more specific; add GError types and send back and
+         * forth. In general, error handling is quite crap everywhere right
+         * now. */
+        ov_incoming_conn_send_new_error (conn, conn->msg->id,
+            "Couldn't finish reading header");
+      if (g_queue_is_empty (&conn->replies))
+        ov_incoming_conn_close (conn);
+      goto out;
+    }
+
+    GST_DEBUG ("Incoming message type '%s' and version %u of length %u bytes",
+        ov_tcp_msg_type_to_string (conn->msg->type, conn->msg->version),
+        conn->msg->version, conn->msg->size);
+
+    if (conn->msg->size == 0)
+      goto body_done;
+
+    /* Read the rest of the message */
+    conn->body_alloc = MIN (conn->msg->size, OV_INCOMING_BODY_CHUNK);
+    conn->body = g_malloc (conn->body_alloc);
+    conn->offset = 0;
+    goto read_more;
+  }
+
+  if (conn->offset < conn->msg->size) {
+    if (conn->offset == conn->body_alloc) {
+      conn->body_alloc = MIN (conn->body_alloc * 2, conn->msg->size);
+      conn->body = g_realloc (conn->body, conn->body_alloc);
+    }
+    goto read_more;
+  }
+
+  body = g_bytes_new_take (conn->body, conn->msg->size);
+  conn->body = NULL;
+  if (!ov_tcp_msg_parse_body (conn->msg, body)) {
+    GST_ERROR ("Unable to parse message body from %s", conn->addr_s);
+    ov_incoming_conn_send_new_error (conn, conn->msg->id,
+        "Couldn't read body");
+    g_bytes_unref (body);
+    goto next_msg;
   }
+  g_bytes_unref (body);
+
+  tmp = g_variant_print (conn->msg->variant, FALSE);
+  GST_DEBUG ("Received message body: %s", tmp);
+  g_free (tmp);
+
+body_done:
+  ov_incoming_conn_dispatch (conn, conn->msg);
+
+next_msg:
+  ov_tcp_msg_free (conn->msg);
+  conn->msg = g_new0 (OvTcpMsg, 1);
+  conn->offset = 0;
+  ov_incoming_conn_update_deadline (conn, TRUE);
 
+read_more:
+  if (!conn->closed)
+    ov_incoming_conn_read (conn);
 out:
-  /* FIXME: Check error */
-  g_io_stream_close (G_IO_STREAM (connection), NULL, &error);
   g_clear_error (&error);
-  ov_tcp_msg_free (msg);
-  /* Call again for new connections */
-  return FALSE;
+  ov_incoming_conn_unref (conn);
+}
+
+static void
+ov_incoming_conn_read (OvIncomingConn * conn)
+{
+  gchar *buffer;
+  gsize size;
+  GInputStream *input;
+
+  if (conn->body == NULL) {
+    buffer = conn->header;
+    size = OV_TCP_MSG_HEADER_SIZE;
+  } else {
+    buffer = conn->body;
+    size = conn->body_alloc;
+  }
+
+  ov_incoming_conn_update_deadline (conn, FALSE);
+
+  input = g_io_stream_get_input_stream (G_IO_STREAM (conn->connection));
+  conn->refcount++;
+  g_input_stream_read_async (input, buffer + conn->offset,
+      size - conn->offset, G_PRIORITY_DEFAULT, conn->cancellable,
+      (GAsyncReadyCallback) on_incoming_conn_read, conn);
+}
+
+/* Runs in the comms thread for every new incoming connection. Remotes keep
+ * the connection open and send all their control messages for a call on it,
+ * so we keep reading until they close it, go idle, or misbehave. */
+gboolean
+on_incoming_peer_tcp_connection (GSocketService * service,
+    GSocketConnection * connection, GObject * source_object G_GNUC_UNUSED,
+    OvLocalPeer * local)
+{
+  GSocketAddress *addr;
+  OvIncomingConn *conn;
+  OvLocalPeerPrivate *priv;
+  guint n_total = 0, n_host = 0;
+  gchar *host, *addr_s;
+  GList *l;
+
+  priv = ov_local_peer_get_private (local);
+
+  addr = g_socket_connection_get_remote_address (connection, NULL);
+  if (addr) {
+    addr_s = ov_inet_socket_address_to_string (G_INET_SOCKET_ADDRESS (addr));
+    host = g_inet_address_to_string (
+        g_inet_socket_address_get_address (G_INET_SOCKET_ADDRESS (addr)));
+  } else {
+    addr_s = g_strdup ("unknown");
+    host = g_strdup ("unknown");
+  }
+  g_clear_object (&addr);
+
+  for (l = priv->incoming_conns; l != NULL; l = l->next) {
+    n_total++;
+    if (g_strcmp0 (((OvIncomingConn *) l->data)->host, host) == 0)
+      n_host++;
+  }
+
+  if (n_total >= OV_TCP_MAX_INCOMING_CONNS ||
+      n_host >= OV_TCP_MAX_INCOMING_CONNS_PER_HOST) {
+    GST_WARNING ("Rejecting incoming connection from %s: %u open from that "
+        "host, %u in total", addr_s, n_host, n_total);
+    g_io_stream_close (G_IO_STREAM (connection), NULL, NULL);
+    g_free (addr_s);
+    g_free (host);
+    return TRUE;
+  }
+
+  conn = g_new0 (OvIncomingConn, 1);
+  conn->refcount = 1;
+  conn->local = local;
+  conn->connection = g_object_ref (connection);
+  conn->cancellable = g_cancellable_new ();
+  conn->msg = g_new0 (OvTcpMsg, 1);
+  conn->reading = TRUE;
+  g_queue_init (&conn->replies);
+  conn->addr_s = addr_s;
+  conn->host = host;
+  GST_DEBUG ("New incoming connection from %s", conn->addr_s);
+
+  ov_socket_set_tcp_nodelay (g_socket_connection_get_socket (connection));
+
+  priv->incoming_conns = g_list_prepend (priv->incoming_conns, conn);
+  ov_incoming_conn_read (conn);
+
+  return TRUE;
+}
+
+/* Runs in the comms thread. Stops accepting connections, closes all open ones,
+ * and quits the comms loop once they have all been freed. */
+gboolean
+ov_local_peer_stop_incoming (OvLocalPeer * local)
+{
+  GList *conns, *l;
+  OvLocalPeerPrivate *priv;
+
+  priv = ov_local_peer_get_private (local);
+  priv->comms_stopping = TRUE;
+
+  if (priv->tcp_server) {
+    g_signal_handlers_disconnect_by_data (priv->tcp_server, local);
+    g_socket_service_stop (priv->tcp_server);
+    g_clear_object (&priv->tcp_server);
+  }
+
+  /* Closing can free the connection and remove it from the list */
+  conns = g_list_copy (priv->incoming_conns);
+  for (l = conns; l != NULL; l = l->next)
+    ov_incoming_conn_close (l->data);
+  g_list_free (conns);
+
+  if (priv->incoming_conns == NULL)
+    g_main_loop_quit (priv->comms_loop);
+
+  return G_SOURCE_REMOVE;
 }
@@ -38,6 +38,7 @@ gboolean on_incoming_peer_tcp_connection (GSocketService *service,
                                           GSocketConnection *connection,
                                           GObject *source_object,
                                           OvLocalPeer *local);
+gboolean ov_local_peer_stop_incoming     (OvLocalPeer *local);
 
 G_END_DECLS
 
@@ -65,6 +65,53 @@ GST_DEBUG_CATEGORY_EXTERN (onevideo_debug);
 #define RTP_JPEG_VIDEO_CAPS_STR "application/x-rtp, payload=26, media=video, clock-rate=90000, encoding-name=JPEG"
 #define RTP_H264_VIDEO_CAPS_STR "application/x-rtp, payload=96, media=video, clock-rate=90000, encoding-name=H264"
 
+/* Upper limit for the receive buffer size when growing it in response to
+ * kernel drops, and how much received data (in ms) it should be able to hold */
+#define OV_RECV_BUFSIZE_MAX (16 * 1024 * 1024)
+#define OV_RECV_BUFSIZE_MSECS 250
+
+/* Size of the video frame produced when compositing video from all remotes
+ * into a single sink */
+#define OV_COMPOSITOR_WIDTH 1280
+#define OV_COMPOSITOR_HEIGHT 720
+
+/* How often the audio level of each remote is measured, the level (in dB)
+ * above which a remote is considered to be speaking, and how long a remote
+ * must be the loudest before it becomes the active speaker */
+#define OV_AUDIO_LEVEL_INTERVAL_MS 100
+#define OV_ACTIVE_SPEAKER_THRESHOLD_DB -50.0
+#define OV_ACTIVE_SPEAKER_HOLD_MS 500
+/* Number of JPEG frames that the queue in front of each remote's decoder
+ * holds. When it is full, the highest-priority remote's queue waits for the
+ * decoder and the others drop their oldest frame, so frames are only lost
+ * when decoding can't keep up with all the remotes. */
+#define OV_DECODE_QUEUE_FRAMES 2
+
+/* Decoded audio from a remote whose peak stays below this S16 sample value
+ * (about -60 dBFS) is treated as silence and is not mixed, and how often (in
+ * buffers) we log how much audio was skipped */
+#define OV_AUDIO_SILENCE_THRESHOLD 32
+#define OV_AUDIO_SILENCE_REPORT_BUFFERS 1000
+/* Samples checked at a time when looking for silence; see
+ * ov_audio_block_is_silent() */
+#define OV_AUDIO_SILENCE_BLOCK 64
+
+/* Frame rate of the local self-view preview */
+#define OV_PREVIEW_FPS 10
+
+/* The maximum amount by which we will delay audio or video from a remote to
+ * bring them in sync, and the minimum change in skew that we will act on */
+#define OV_AV_SYNC_MAX_OFFSET_MS 250
+#define OV_AV_SYNC_THRESHOLD_MS 15
+
+/* Maximum amount of video that will be queued for playback for each remote
+ * on top of the A/V sync delay, which is applied downstream of the queue and
+ * so backs it up by as much; older frames are dropped when the playback
+ * pipeline can't keep up */
+#define OV_VIDEO_PLAYBACK_MAX_LATENCY_MS 200
+#define OV_VIDEO_PLAYBACK_QUEUE_MS \
+  (OV_AV_SYNC_MAX_OFFSET_MS + OV_VIDEO_PLAYBACK_MAX_LATENCY_MS)
+
 /* For simplicity, we always use 0 for audio RTP sessions and 1 for video
  * XXX: These are also used as indices for the ssrc[] arrays on OvLocalPeerPriv
  * and OvRemotePeerPriv, so keep them within the range */
@@ -104,6 +151,9 @@ enum _OvVideoFormat {
   OV_VIDEO_FORMAT_H264        = 1 << 4, /* Not supported yet */
 };
 
+typedef struct _OvControlChannel OvControlChannel;
+typedef struct _OvCall OvCall;
+
 struct _OvRemotePeerPrivate {
   /* The destination ports we transmit data to using udpsink, in order:
    * {audio_rtp, audio_send_rtcp SRs, audio_send_rtcp RRs,
@@ -114,6 +164,9 @@ struct _OvRemotePeerPrivate {
    *  video_rtp, video_recv_rtcp SRs} */
   guint16 recv_ports[4];
 
+  /* The call that this remote is in, once it has been added to one */
+  OvCall *call;
+
   /* When this remote starts sending us data, we store the audio and
    * video SSRCs here so we can keep track of RTP statistics via the
    * RTPSource for this SSRC within the RTPSession inside GstRtpBin
@@ -125,13 +178,60 @@ struct _OvRemotePeerPrivate {
    * {audio_ssrc, video_ssrc} */
   guint ssrcs[2];
 
+  /* Set (atomically) when the remote has left the call, either with an RTCP
+   * BYE or because its ports have become unreachable */
+  gint departed;
+
+  /*-- Control channel --*/
+  /* Long-lived TCP connection that we send control messages to this remote on
+   * and read its replies from. Opened on first use (usually START_NEGOTIATE),
+   * reused for the rest of the call, and reopened if the remote closed it.
+   * Several requests can be in flight on it at once. See outgoing.c. */
+  OvControlChannel *control;
+
   /*-- Receive pipeline --*/
   /* The format that we will receive data in from this peer */
   GstCaps *recv_acaps;
   GstCaps *recv_vcaps;
+  /* The RTP bin that receives data from this peer, and the SSRCs of the
+   * sources in it that this peer is sending us data from
+   * {audio_ssrc, video_ssrc} */
+  GstElement *rtpbin;
+  guint recv_ssrcs[2];
+  /* Sockets we receive RTP data on {audio, video}, and the number of packets
+   * the kernel had dropped on them when we last checked */
+  GSocket *recv_rtp_sockets[2];
+  guint recv_drops[2];
+  /* PTS and RTP timestamp of the latest {audio, video} RTP buffer that was
+   * depayloaded, set from the streaming threads. Used for A/V sync. */
+  GMutex av_sync_lock;
+  GstClockTime last_pts[2];
+  guint32 last_rtptime[2];
+  /* Delay currently applied to {audio, video} in the playback pipeline, and
+   * the A/V skew remaining after that (positive means audio is late) */
+  gint64 av_sync_delays[2];
+  gint64 av_skew;
+  /* Loudest RMS level (in dB) of audio received from this remote over the last
+   * OV_AUDIO_LEVEL_INTERVAL_MS, and the monotonic time when it was measured */
+  gdouble audio_level;
+  gint64 audio_level_time;
+  /* Audio buffers from this remote that reached the mixer, and how many
+   * of those were silent and hence skipped while mixing */
+  guint audio_buffers;
+  guint audio_silent_buffers;
+  /* Number of {audio, video} frames from this remote that reached playback */
+  guint frames[2];
+  /* Monotonic time at which this remote last became the active speaker, or 0
+   * if it hasn't spoken yet, and its resulting position in the call when
+   * ordered by that; 0 is the highest priority */
+  gint64 last_active_speaker;
+  guint priority;
   /* Pre-depayloader queues */
   GstElement *aqueue;
   GstElement *vqueue;
+  /* Queue in front of the video decoder; NULL for H264, whose frames can't be
+   * dropped, and in the count-frames playback mode */
+  GstElement *decode_queue;
   /* Depayloaders */
   GstElement *adepay;
   GstElement *vdepay;
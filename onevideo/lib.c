@@ -37,15 +37,34 @@
 
 #include <string.h>
 
+#ifdef __linux__
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#endif
+
 GST_DEBUG_CATEGORY (onevideo_debug);
 #define GST_CAT_DEFAULT onevideo_debug
 
 static gboolean ov_local_peer_begin_transmit (OvLocalPeer *local);
+#ifdef IP_RECVERR
+static gboolean on_transmit_socket_error (GSocket *socket,
+    GIOCondition condition, OvLocalPeer *local);
+#endif
 
 #define on_remote_receive_error ov_on_gst_bus_error
 
 /* Default timeout for remote peers */
 #define OV_REMOTE_PEER_TIMEOUT_SECONDS 10
+/* How long a remote that another peer is adding to the call can wait for its
+ * JOIN_DETAILS after its QUERY_JOIN. The peer adding it sends them within
+ * two request timeouts unless it failed or went away. */
+#define OV_JOINING_TIMEOUT_SECONDS (3 * OV_TCP_TIMEOUT)
+
+/* How long to wait for our RTCP BYE packets to be sent when we stop
+ * transmitting, in milliseconds */
+#define OV_TRANSMIT_BYE_TIMEOUT_MSECS 200
 
 static void
 ov_local_peer_clear_transmit (OvLocalPeerPrivate * priv)
@@ -63,22 +82,106 @@ ov_local_peer_clear_transmit (OvLocalPeerPrivate * priv)
 }
 
 static void
-ov_local_peer_stop_transmit (OvLocalPeer * local)
+on_stopping_transmit_eos (G_GNUC_UNUSED GstBus * bus,
+    G_GNUC_UNUSED GstMessage * msg, OvLocalPeer * local)
+{
+  ov_local_peer_finish_stop_transmit (local);
+}
+
+static gboolean
+on_stopping_transmit_timeout (OvLocalPeer * local)
+{
+  GST_DEBUG ("Timed out waiting for the transmit pipeline to send BYE");
+  ov_local_peer_finish_stop_transmit (local);
+  return G_SOURCE_REMOVE;
+}
+
+/* Tears down the transmit pipeline of the previous call once it has sent its
+ * RTCP BYE packets or timed out doing so. Also called before a new transmit
+ * pipeline is set up, since that reuses the video capsfilter. */
+void
+ov_local_peer_finish_stop_transmit (OvLocalPeer * local)
 {
+  GstBus *bus;
+  GstElement *pipeline;
   GstStateChangeReturn ret;
   OvLocalPeerPrivate *priv;
 
+  ov_local_peer_lock (local);
   priv = ov_local_peer_get_private (local);
 
-  if (priv->transmit != NULL) {
-    ret = gst_element_set_state (priv->transmit, GST_STATE_NULL);
-    g_assert (ret == GST_STATE_CHANGE_SUCCESS);
+  pipeline = priv->stopping_transmit;
+  if (pipeline == NULL) {
+    ov_local_peer_unlock (local);
+    return;
   }
-  /* Each call has a new transmit pipeline */
-  ov_local_peer_clear_transmit (priv);
+  priv->stopping_transmit = NULL;
+
+  if (priv->stopping_transmit_timeout != NULL) {
+    g_source_destroy (priv->stopping_transmit_timeout);
+    g_clear_pointer (&priv->stopping_transmit_timeout, g_source_unref);
+  }
+
+  bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+  g_signal_handlers_disconnect_by_func (bus, on_stopping_transmit_eos, local);
+  gst_bus_remove_signal_watch (bus);
+  gst_object_unref (bus);
+
+  ret = gst_element_set_state (pipeline, GST_STATE_NULL);
+  g_assert (ret == GST_STATE_CHANGE_SUCCESS);
+  /* The next transmit pipeline reuses the capsfilter */
+  if (GST_OBJECT_PARENT (priv->transmit_vcapsfilter) == GST_OBJECT (pipeline))
+    gst_bin_remove (GST_BIN (pipeline), priv->transmit_vcapsfilter);
+  gst_object_unref (pipeline);
+
   /* Clear capsfilter for new pipeline */
   g_object_set (priv->transmit_vcapsfilter, "caps", NULL, NULL);
   GST_DEBUG ("Stopped transmitting");
+  ov_local_peer_unlock (local);
+}
+
+/* Called with the lock TAKEN */
+static void
+ov_local_peer_stop_transmit (OvLocalPeer * local)
+{
+  GstBus *bus;
+  OvLocalPeerPrivate *priv;
+
+  priv = ov_local_peer_get_private (local);
+
+  if (priv->transmit_error_source != NULL) {
+    g_source_destroy (priv->transmit_error_source);
+    g_clear_pointer (&priv->transmit_error_source, g_source_unref);
+  }
+
+  /* A previous call's pipeline should be long gone by now */
+  ov_local_peer_finish_stop_transmit (local);
+
+  if (priv->transmit == NULL)
+    return;
+
+  /* Nothing must touch our state from the old pipeline's streaming threads */
+  if (priv->rtpbin != NULL)
+    g_signal_handlers_disconnect_by_data (priv->rtpbin, local);
+
+  /* EOS makes rtpbin send an RTCP BYE for our sources, which lets remotes
+   * know immediately that we've left. The pipeline is torn down from the main
+   * loop once the EOS reaches the bus, or after a short timeout. */
+  priv->stopping_transmit = g_object_ref (priv->transmit);
+  bus = gst_pipeline_get_bus (GST_PIPELINE (priv->transmit));
+  g_signal_connect (bus, "message::eos",
+      G_CALLBACK (on_stopping_transmit_eos), local);
+  gst_object_unref (bus);
+  priv->stopping_transmit_timeout =
+    g_timeout_source_new (OV_TRANSMIT_BYE_TIMEOUT_MSECS);
+  g_source_set_callback (priv->stopping_transmit_timeout,
+      (GSourceFunc) on_stopping_transmit_timeout, local, NULL);
+  g_source_attach (priv->stopping_transmit_timeout, NULL);
+  gst_element_send_event (priv->transmit, gst_event_new_eos ());
+
+  /* Each call has a new transmit pipeline */
+  ov_local_peer_clear_transmit (priv);
+  GST_DEBUG ("Stopping transmitting");
 }
 
 static void
@@ -86,9 +189,49 @@ ov_local_peer_clear_playback (OvLocalPeerPrivate * priv)
 {
   priv->audiosink = NULL;
   priv->audiomixer = NULL;
+  /* Keep the app's sink around for the next call; it's inside the playback
+   * bin of the call that rendered it */
+  if (priv->video_sink != NULL && GST_OBJECT_PARENT (priv->video_sink) != NULL)
+    gst_bin_remove (GST_BIN (GST_OBJECT_PARENT (priv->video_sink)),
+        priv->video_sink);
   g_clear_object (&priv->playback);
 }
 
+/* Called with the lock TAKEN, once the remotes in @call have been removed.
+ * Removes the bin that mixed and composited them from the playback pipeline,
+ * which keeps playing the other calls. */
+static void
+ov_local_peer_teardown_call_playback (OvLocalPeer * local, OvCall * call)
+{
+  GstStateChangeReturn ret;
+  GstPad *srcpad;
+  OvLocalPeerPrivate *priv;
+
+  priv = ov_local_peer_get_private (local);
+
+  if (call->playback == NULL)
+    return;
+
+  srcpad = gst_element_get_static_pad (call->playback, "audiopad");
+  gst_pad_unlink (srcpad, call->audiomixer_pad);
+  gst_object_unref (srcpad);
+  gst_element_release_request_pad (priv->audiomixer, call->audiomixer_pad);
+  g_clear_object (&call->audiomixer_pad);
+
+  /* Keep the app's sink around for the next call */
+  if (priv->video_sink != NULL &&
+      GST_OBJECT_PARENT (priv->video_sink) == GST_OBJECT (call->playback))
+    gst_bin_remove (GST_BIN (call->playback), priv->video_sink);
+
+  ret = gst_element_set_state (call->playback, GST_STATE_NULL);
+  g_assert (ret == GST_STATE_CHANGE_SUCCESS);
+  gst_bin_remove (GST_BIN (priv->playback), call->playback);
+  call->playback = NULL;
+  call->audiomixer = NULL;
+  call->compositor = NULL;
+  GST_DEBUG ("Stopped playback of call %" G_GUINT64_FORMAT, call->id);
+}
+
 static void
 ov_local_peer_stop_playback (OvLocalPeer * local)
 {
@@ -157,6 +300,11 @@ ov_remote_peer_new (OvLocalPeer * local, GInetSocketAddress * addr)
   g_free (name);
 
   remote->priv = g_new0 (OvRemotePeerPrivate, 1);
+  g_mutex_init (&remote->priv->av_sync_lock);
+  remote->priv->control = ov_control_channel_new (local, remote->addr,
+      remote->addr_s);
+  remote->priv->last_pts[OV_AUDIO_RTP_SESSION] = GST_CLOCK_TIME_NONE;
+  remote->priv->last_pts[OV_VIDEO_RTP_SESSION] = GST_CLOCK_TIME_NONE;
   name = g_strdup_printf ("audio-playback-bin-%s", remote->addr_s);
   remote->priv->aplayback = gst_bin_new (name);
   g_free (name);
@@ -225,10 +373,92 @@ ov_get_gtkglsink (GstElement ** out_sink, gpointer * out_widget)
   return TRUE;
 }
 
+/* Same layout as GdkRectangle; we don't link to GTK+ */
+typedef struct {
+  gint x, y;
+  gint width, height;
+} OvRectangle;
+
+/* Scale video to the size of the widget before converting it to a format that
+ * gtksink can render. Converting after scaling is much cheaper than converting
+ * the full decoded frame when the widget is smaller than the video, which is
+ * almost always the case with more than one remote. */
+static void
+on_gtksink_size_allocate (GObject * widget, OvRectangle * allocation,
+    GstElement * capsfilter)
+{
+  GstCaps *caps;
+  gint width, height;
+
+  /* Sizes must be even for I420 */
+  width = MAX (allocation->width & ~1, 2);
+  height = MAX (allocation->height & ~1, 2);
+
+  g_object_get (capsfilter, "caps", &caps, NULL);
+  if (caps != NULL && !gst_caps_is_any (caps)) {
+    GstStructure *s = gst_caps_get_structure (caps, 0);
+    gint cur_width, cur_height;
+
+    if (gst_structure_get_int (s, "width", &cur_width) &&
+        gst_structure_get_int (s, "height", &cur_height) &&
+        cur_width == width && cur_height == height) {
+      gst_caps_unref (caps);
+      return;
+    }
+  }
+  g_clear_pointer (&caps, gst_caps_unref);
+
+  GST_DEBUG ("Scaling video to %ix%i for display", width, height);
+  caps = gst_caps_new_simple ("video/x-raw", "width", G_TYPE_INT, width,
+      "height", G_TYPE_INT, height, "pixel-aspect-ratio", GST_TYPE_FRACTION, 1,
+      1, NULL);
+  g_object_set (capsfilter, "caps", caps, NULL);
+  gst_caps_unref (caps);
+}
+
+typedef struct {
+  GstClockTime start;
+  GstClockTime total;
+  guint frames;
+} OvRenderCost;
+
+#define OV_RENDER_COST_REPORT_FRAMES 300
+
+static GstPadProbeReturn
+on_render_path_enter (GstPad * pad, GstPadProbeInfo * info,
+    OvRenderCost * cost)
+{
+  cost->start = gst_util_get_timestamp ();
+  return GST_PAD_PROBE_OK;
+}
+
+/* Everything between the two probes happens in the same streaming thread, so
+ * the difference is the time spent scaling and converting each frame */
+static GstPadProbeReturn
+on_render_path_leave (GstPad * pad, GstPadProbeInfo * info,
+    OvRenderCost * cost)
+{
+  if (!GST_CLOCK_TIME_IS_VALID (cost->start))
+    return GST_PAD_PROBE_OK;
+
+  cost->total += gst_util_get_timestamp () - cost->start;
+  cost->start = GST_CLOCK_TIME_NONE;
+
+  if (++cost->frames == OV_RENDER_COST_REPORT_FRAMES) {
+    GST_DEBUG_OBJECT (pad, "Scaling and converting took %" G_GUINT64_FORMAT
+        "us per frame over the last %u frames", cost->total / cost->frames /
+        GST_USECOND, cost->frames);
+    cost->total = 0;
+    cost->frames = 0;
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
 static gboolean
 ov_get_gtksink (GstElement ** out_sink, gpointer * out_widget)
 {
-  GstElement *sink, *bin, *convert;
+  GstElement *sink, *bin, *scale, *capsfilter, *convert;
   GstPad *ghostpad, *sinkpad;
 
   g_return_val_if_fail (out_sink != NULL, FALSE);
@@ -244,14 +474,21 @@ ov_get_gtksink (GstElement ** out_sink, gpointer * out_widget)
   if (!gst_bin_add (GST_BIN (bin), sink))
     return FALSE;
 
+  /* videoscale ! capsfilter ! videoconvert ! gtksink
+   * The capsfilter caps are set to the widget size once it's allocated; until
+   * then this is equivalent to videoconvert ! gtksink */
+  scale = gst_element_factory_make ("videoscale", NULL);
+  capsfilter = gst_element_factory_make ("capsfilter", NULL);
   convert = gst_element_factory_make ("videoconvert", NULL);
-  if (!gst_bin_add (GST_BIN (bin), convert))
+  if (!gst_bin_add (GST_BIN (bin), scale) ||
+      !gst_bin_add (GST_BIN (bin), capsfilter) ||
+      !gst_bin_add (GST_BIN (bin), convert))
     return FALSE;
 
-  if (!gst_element_link (convert, sink))
+  if (!gst_element_link_many (scale, capsfilter, convert, sink, NULL))
     return FALSE;
 
-  sinkpad = gst_element_get_static_pad (convert, "sink");
+  sinkpad = gst_element_get_static_pad (scale, "sink");
   ghostpad = gst_ghost_pad_new ("sink", sinkpad);
   g_object_unref (sinkpad);
 
@@ -260,11 +497,317 @@ ov_get_gtksink (GstElement ** out_sink, gpointer * out_widget)
   if (!gst_element_add_pad (bin, ghostpad))
     return FALSE;
 
+  /* Measure how much time each frame spends before reaching the sink */
+  if (gst_debug_category_get_threshold (GST_CAT_DEFAULT) >= GST_LEVEL_DEBUG) {
+    OvRenderCost *cost = g_new0 (OvRenderCost, 1);
+
+    cost->start = GST_CLOCK_TIME_NONE;
+    g_object_set_data_full (G_OBJECT (bin), "ov-render-cost", cost, g_free);
+    gst_pad_add_probe (ghostpad, GST_PAD_PROBE_TYPE_BUFFER,
+        (GstPadProbeCallback) on_render_path_enter, cost, NULL);
+    sinkpad = gst_element_get_static_pad (sink, "sink");
+    gst_pad_add_probe (sinkpad, GST_PAD_PROBE_TYPE_BUFFER,
+        (GstPadProbeCallback) on_render_path_leave, cost, NULL);
+    g_object_unref (sinkpad);
+  }
+
   g_object_get (sink, "widget", out_widget, NULL);
+  g_signal_connect_object (*out_widget, "size-allocate",
+      G_CALLBACK (on_gtksink_size_allocate), capsfilter, 0);
   *out_sink = bin;
   return TRUE;
 }
 
+gpointer
+ov_local_peer_add_gtksink (OvLocalPeer * local)
+{
+  gpointer widget;
+  GstElement *sink;
+  OvLocalPeerPrivate *priv;
+
+  priv = ov_local_peer_get_private (local);
+  priv->composite_video = TRUE;
+
+  /* There's only one GL context when compositing, so Mesa is fine */
+  if (ov_get_gtkglsink (&sink, &widget))
+    goto out;
+
+  g_printerr ("Unable to create gtkglsink bin; falling back to gtksink\n");
+
+  if (ov_get_gtksink (&sink, &widget))
+    goto out;
+
+  g_printerr ("Unable to use gtksink; falling back to non-embedded video sink\n");
+  return NULL;
+
+out:
+  /* Added to the playback pipeline in the next call */
+  g_clear_object (&priv->video_sink);
+  priv->video_sink = gst_object_ref_sink (sink);
+  return widget;
+}
+
+gpointer
+ov_local_peer_add_preview_sink (OvLocalPeer * local)
+{
+  gpointer widget;
+  GstElement *sink;
+  OvLocalPeerPrivate *priv;
+
+  priv = ov_local_peer_get_private (local);
+
+  /* Not gtkglsink since that would add another GL context, which crashes with
+   * Mesa if remotes are also rendered using GL. The preview is small anyway,
+   * so scaling and converting it in software is cheap. */
+  if (!ov_get_gtksink (&sink, &widget)) {
+    g_printerr ("Unable to use gtksink; not showing a preview\n");
+    return NULL;
+  }
+
+  /* Added to the transmit pipeline in the next call */
+  g_clear_object (&priv->preview_sink);
+  priv->preview_sink = gst_object_ref_sink (sink);
+  return widget;
+}
+
+/* Most recent active speaker first */
+static gint
+compare_last_active_speaker (OvRemotePeer ** a, OvRemotePeer ** b)
+{
+  gint64 ta = (*a)->priv->last_active_speaker;
+  gint64 tb = (*b)->priv->last_active_speaker;
+
+  return (ta < tb) - (ta > tb);
+}
+
+static gint
+compare_priority (OvRemotePeer ** a, OvRemotePeer ** b)
+{
+  return (gint) (*a)->priv->priority - (gint) (*b)->priv->priority;
+}
+
+/* Returns a copy of the remotes in @call, sorted by @func.
+ * Called with the lock TAKEN */
+static GPtrArray *
+ov_call_sort_remotes (OvCall * call, GCompareFunc func)
+{
+  guint ii;
+  GPtrArray *sorted;
+
+  sorted = g_ptr_array_sized_new (call->remote_peers->len);
+  for (ii = 0; ii < call->remote_peers->len; ii++)
+    g_ptr_array_add (sorted, g_ptr_array_index (call->remote_peers, ii));
+  /* Stable, so remotes that compare equal keep the order they joined in */
+  g_ptr_array_sort (sorted, func);
+
+  return sorted;
+}
+
+/* Lay out video from all remotes in @call being composited in a grid that
+ * fills the output frame. Called every time a remote is added, removed,
+ * paused, or resumed, and when the priorities of remotes change. */
+void
+ov_local_peer_update_video_layout (OvLocalPeer * local, OvCall * call)
+{
+  GList *l, *pads, *ordered = NULL;
+  GPtrArray *remotes;
+  GstPad *srcpad, *sinkpad;
+  guint ii, n_pads, cols, rows;
+  gint width, height;
+
+  if (call->compositor == NULL)
+    return;
+
+  GST_OBJECT_LOCK (call->compositor);
+  pads = g_list_copy_deep (GST_ELEMENT (call->compositor)->sinkpads,
+      (GCopyFunc) gst_object_ref, NULL);
+  n_pads = GST_ELEMENT (call->compositor)->numsinkpads;
+  GST_OBJECT_UNLOCK (call->compositor);
+
+  if (n_pads == 0)
+    return;
+
+  /* Tiles are filled in priority order, so the active speaker gets the first
+   * one. Pads that aren't linked to a remote in the call go last. */
+  ov_local_peer_lock (local);
+  remotes = ov_call_sort_remotes (call, (GCompareFunc) compare_priority);
+  for (ii = 0; ii < remotes->len; ii++) {
+    OvRemotePeer *remote = g_ptr_array_index (remotes, ii);
+
+    if (remote->priv->vplayback == NULL)
+      continue;
+    srcpad = gst_element_get_static_pad (remote->priv->vplayback, "videopad");
+    sinkpad = srcpad ? gst_pad_get_peer (srcpad) : NULL;
+    l = sinkpad ? g_list_find (pads, sinkpad) : NULL;
+    if (l != NULL) {
+      pads = g_list_remove_link (pads, l);
+      ordered = g_list_concat (ordered, l);
+    }
+    g_clear_object (&sinkpad);
+    g_clear_object (&srcpad);
+  }
+  g_ptr_array_free (remotes, TRUE);
+  ov_local_peer_unlock (local);
+  pads = g_list_concat (ordered, pads);
+
+  /* As square a grid as possible, filled row by row */
+  for (cols = 1; cols * cols < n_pads; cols++);
+  rows = (n_pads + cols - 1) / cols;
+  width = OV_COMPOSITOR_WIDTH / cols;
+  height = OV_COMPOSITOR_HEIGHT / rows;
+
+  /* XXX: This does not preserve the aspect ratio of each remote's video */
+  for (l = pads, ii = 0; l != NULL; l = l->next, ii++)
+    g_object_set (l->data, "xpos", (ii % cols) * width,
+        "ypos", (ii / cols) * height, "width", width, "height", height, NULL);
+
+  GST_DEBUG ("Composited video of %u remotes in a %ux%u grid", n_pads, cols,
+      rows);
+  g_list_free_full (pads, gst_object_unref);
+}
+
+/* Called from the main thread every time the audio level of a remote in the
+ * call @call_id is measured. The loudest remote becomes the active speaker once
+ * it has been the loudest for OV_ACTIVE_SPEAKER_HOLD_MS, so that short
+ * interjections or two people talking at once don't cause the speaker to flap
+ * back and forth. */
+void
+ov_local_peer_update_active_speaker (OvLocalPeer * local, guint64 call_id)
+{
+  guint ii;
+  gint64 now;
+  gdouble loudest_level = OV_ACTIVE_SPEAKER_THRESHOLD_DB;
+  OvRemotePeer *loudest = NULL;
+  OvPeer *speaker = NULL;
+  OvCall *call;
+
+  now = g_get_monotonic_time ();
+
+  ov_local_peer_lock (local);
+  if (!(call = ov_local_peer_get_call (local, call_id)))
+    goto out;
+
+  for (ii = 0; ii < call->remote_peers->len; ii++) {
+    OvRemotePeer *remote = g_ptr_array_index (call->remote_peers, ii);
+
+    if (remote->state != OV_REMOTE_STATE_PLAYING)
+      continue;
+    /* We haven't received audio from this remote for a while */
+    if ((now - remote->priv->audio_level_time) >
+        2 * OV_AUDIO_LEVEL_INTERVAL_MS * 1000)
+      continue;
+    if (remote->priv->audio_level > loudest_level) {
+      loudest = remote;
+      loudest_level = remote->priv->audio_level;
+    }
+  }
+
+  /* Keep the current candidate across pauses between words */
+  if (loudest == NULL)
+    goto out;
+
+  if (loudest == call->active_speaker) {
+    call->speaker_candidate = NULL;
+    goto out;
+  }
+
+  if (loudest != call->speaker_candidate) {
+    call->speaker_candidate = loudest;
+    call->speaker_candidate_since = now;
+    goto out;
+  }
+
+  if ((now - call->speaker_candidate_since) <
+      OV_ACTIVE_SPEAKER_HOLD_MS * 1000)
+    goto out;
+
+  GST_DEBUG ("Active speaker is now %s (%.1f dB)", loudest->addr_s,
+      loudest_level);
+  call->active_speaker = loudest;
+  call->speaker_candidate = NULL;
+  loudest->priv->last_active_speaker = now;
+  /* The signal is about the call that the application is looking at */
+  if (call == ov_local_peer_get_private (local)->call)
+    speaker = ov_peer_new (loudest->addr);
+  ov_local_peer_update_priorities (local, call);
+
+out:
+  ov_local_peer_unlock (local);
+
+  if (speaker != NULL) {
+    g_signal_emit_by_name (local, "active-speaker-changed", speaker);
+    g_object_unref (speaker);
+  }
+}
+
+/* Called with the lock TAKEN. Ranks remotes by how recently they were the
+ * active speaker; the current speaker is always first. The ranking decides the
+ * video layout, and which remotes may drop frames before decoding when the
+ * decoders can't keep up. Remotes are never thinned out otherwise. */
+void
+ov_local_peer_update_priorities (OvLocalPeer * local, OvCall * call)
+{
+  guint ii;
+  gboolean changed = FALSE;
+  GPtrArray *sorted;
+
+  sorted = ov_call_sort_remotes (call,
+      (GCompareFunc) compare_last_active_speaker);
+  for (ii = 0; ii < sorted->len; ii++) {
+    OvRemotePeer *remote = g_ptr_array_index (sorted, ii);
+
+    if (remote->priv->priority != ii) {
+      remote->priv->priority = ii;
+      changed = TRUE;
+    }
+    /* Until somebody speaks, all remotes are equally important */
+    if (remote->priv->decode_queue != NULL)
+      g_object_set (remote->priv->decode_queue, "leaky",
+          (ii > 0 && call->active_speaker != NULL) ? 2 : 0, NULL);
+  }
+  g_ptr_array_free (sorted, TRUE);
+
+  if (changed)
+    ov_local_peer_update_video_layout (local, call);
+}
+
+OvRemotePeer *
+ov_local_peer_get_active_speaker (OvLocalPeer * local)
+{
+  OvRemotePeer *remote;
+
+  ov_local_peer_lock (local);
+  remote = ov_local_peer_get_private (local)->call->active_speaker;
+  ov_local_peer_unlock (local);
+
+  return remote;
+}
+
+/* Unlink video of this remote from the compositor of its call (if any) */
+static void
+ov_remote_peer_unlink_composited_video (OvRemotePeer * remote)
+{
+  GstPad *srcpad, *sinkpad;
+  OvCall *call;
+
+  call = remote->priv->call;
+  if (call->compositor == NULL)
+    return;
+
+  srcpad = gst_element_get_static_pad (remote->priv->vplayback, "videopad");
+  sinkpad = gst_pad_get_peer (srcpad);
+
+  if (sinkpad) {
+    gst_pad_unlink (srcpad, sinkpad);
+    gst_element_release_request_pad (call->compositor, sinkpad);
+    gst_object_unref (sinkpad);
+    GST_DEBUG ("Released compositor sinkpad of %s", remote->addr_s);
+  }
+  gst_object_unref (srcpad);
+
+  ov_local_peer_update_video_layout (remote->local, call);
+}
+
 gboolean
 _ov_opengl_is_mesa (void)
 {
@@ -346,7 +889,7 @@ ov_remote_peer_pause (OvRemotePeer * remote)
     gst_object_unref (srcpad);
     GST_DEBUG ("Unlinked audio pads of %s", remote->addr_s);
 
-    gst_element_release_request_pad (local_priv->audiomixer, sinkpad);
+    gst_element_release_request_pad (remote->priv->call->audiomixer, sinkpad);
     gst_object_unref (sinkpad);
     GST_DEBUG ("Released audiomixer sinkpad of %s", remote->addr_s);
 
@@ -356,6 +899,7 @@ ov_remote_peer_pause (OvRemotePeer * remote)
   }
 
   if (remote->priv->video_proxysrc != NULL) {
+    ov_remote_peer_unlink_composited_video (remote);
     ret = gst_element_set_state (remote->priv->vplayback, GST_STATE_PAUSED);
     g_assert (ret == GST_STATE_CHANGE_SUCCESS);
     GST_DEBUG ("Paused video of %s", remote->addr_s);
@@ -371,9 +915,11 @@ ov_remote_peer_resume (OvRemotePeer * remote)
   gboolean res;
   GstStateChangeReturn ret;
   gchar *addr_only;
+  OvCall *call;
   OvLocalPeerPrivate *local_priv;
 
   local_priv = ov_local_peer_get_private (remote->local);
+  call = remote->priv->call;
 
   g_assert (remote->state == OV_REMOTE_STATE_PAUSED);
 
@@ -392,7 +938,7 @@ ov_remote_peer_resume (OvRemotePeer * remote)
 
   if (remote->priv->audio_proxysrc != NULL) {
     res = gst_element_link_pads (remote->priv->aplayback, "audiopad",
-          local_priv->audiomixer, "sink_%u");
+          call->audiomixer, "sink_%u");
     g_assert (res);
     ret = gst_element_set_state (remote->priv->aplayback, GST_STATE_PLAYING);
     g_assert (ret == GST_STATE_CHANGE_SUCCESS);
@@ -400,6 +946,12 @@ ov_remote_peer_resume (OvRemotePeer * remote)
   }
 
   if (remote->priv->video_proxysrc != NULL) {
+    if (call->compositor != NULL) {
+      res = gst_element_link_pads (remote->priv->vplayback, "videopad",
+          call->compositor, "sink_%u");
+      g_assert (res);
+      ov_local_peer_update_video_layout (remote->local, call);
+    }
     ret = gst_element_set_state (remote->priv->vplayback, GST_STATE_PLAYING);
     g_assert (ret == GST_STATE_CHANGE_SUCCESS);
     GST_DEBUG ("Resumed video of %s", remote->addr_s);
@@ -419,6 +971,10 @@ ov_remote_peer_set_muted (OvRemotePeer * remote, gboolean muted)
 
   g_return_if_fail (remote != NULL);
 
+  /* Audio isn't played back in count-frames mode */
+  if (remote->priv->audio_proxysrc == NULL)
+    return;
+
   srcpad = gst_element_get_static_pad (remote->priv->aplayback, "audiopad");
   g_assert (srcpad);
 
@@ -437,6 +993,9 @@ ov_remote_peer_get_muted (OvRemotePeer * remote)
 
   g_return_val_if_fail (remote != NULL, FALSE);
 
+  if (remote->priv->audio_proxysrc == NULL)
+    return FALSE;
+
   srcpad = gst_element_get_static_pad (remote->priv->aplayback, "audiopad");
   g_assert (srcpad);
 
@@ -448,6 +1007,33 @@ ov_remote_peer_get_muted (OvRemotePeer * remote)
   return muted;
 }
 
+gboolean
+ov_remote_peer_is_active_speaker (OvRemotePeer * remote)
+{
+  gboolean ret;
+
+  g_return_val_if_fail (remote != NULL, FALSE);
+
+  ov_local_peer_lock (remote->local);
+  ret = remote->priv->call != NULL &&
+    remote->priv->call->active_speaker == remote;
+  ov_local_peer_unlock (remote->local);
+
+  return ret;
+}
+
+guint
+ov_remote_peer_get_priority (OvRemotePeer * remote)
+{
+  guint priority;
+
+  ov_local_peer_lock (remote->local);
+  priority = remote->priv->priority;
+  ov_local_peer_unlock (remote->local);
+
+  return priority;
+}
+
 /* Does not do any operations that involve taking the OvLocalPeer lock.
  * See: ov_local_peer_remove_remote()
  *
@@ -486,7 +1072,8 @@ ov_remote_peer_remove_not_array (OvRemotePeer * remote)
       gst_pad_unlink (srcpad, sinkpad);
       GST_DEBUG ("Unlinked audio pad of %s", remote->addr_s);
 
-      gst_element_release_request_pad (local_priv->audiomixer, sinkpad);
+      gst_element_release_request_pad (remote->priv->call->audiomixer,
+          sinkpad);
       gst_object_unref (sinkpad);
       GST_DEBUG ("Released audiomixer sinkpad of %s", remote->addr_s);
     } else {
@@ -496,18 +1083,19 @@ ov_remote_peer_remove_not_array (OvRemotePeer * remote)
 
     ret = gst_element_set_state (remote->priv->aplayback, GST_STATE_NULL);
     g_assert (ret == GST_STATE_CHANGE_SUCCESS);
-    res =
-      gst_bin_remove (GST_BIN (local_priv->playback), remote->priv->aplayback);
+    res = gst_bin_remove (GST_BIN (remote->priv->call->playback),
+        remote->priv->aplayback);
     g_assert (res);
     remote->priv->aplayback = NULL;
     GST_DEBUG ("Released audio playback bin of remote %s", remote->addr_s);
   }
 
   if (remote->priv->video_proxysrc != NULL) {
+    ov_remote_peer_unlink_composited_video (remote);
     ret = gst_element_set_state (remote->priv->vplayback, GST_STATE_NULL);
     g_assert (ret == GST_STATE_CHANGE_SUCCESS);
-    res =
-      gst_bin_remove (GST_BIN (local_priv->playback), remote->priv->vplayback);
+    res = gst_bin_remove (GST_BIN (remote->priv->call->playback),
+        remote->priv->vplayback);
     g_assert (res);
     remote->priv->vplayback = NULL;
     GST_DEBUG ("Released video playback bin of remote %s", remote->addr_s);
@@ -553,6 +1141,11 @@ ov_remote_peer_free (OvRemotePeer * remote)
     gst_caps_unref (remote->priv->recv_acaps);
   if (remote->priv->recv_vcaps)
     gst_caps_unref (remote->priv->recv_vcaps);
+  g_clear_object (&remote->priv->recv_rtp_sockets[OV_AUDIO_RTP_SESSION]);
+  g_clear_object (&remote->priv->recv_rtp_sockets[OV_VIDEO_RTP_SESSION]);
+  g_mutex_clear (&remote->priv->av_sync_lock);
+  /* Requests that are still queued on it are sent before it's closed */
+  ov_control_channel_release (remote->priv->control);
   g_object_unref (remote->addr);
   g_free (remote->addr_s);
   g_free (remote->id);
@@ -1159,25 +1752,27 @@ ov_local_peer_get_remotes (OvLocalPeer * local)
   /* XXX: Access to this is not thread-safe
    * Perhaps we should return a copy with OvPeers? */
   OvLocalPeerPrivate *priv = ov_local_peer_get_private (local);
-  return priv->remote_peers;
+  return priv->call->remote_peers;
 }
 
+/* Looks in the current call first, and then in the other calls */
 OvRemotePeer *
 ov_local_peer_get_remote_by_id (OvLocalPeer * local,
     const gchar * id)
 {
-  guint ii;
+  OvCall *call;
+  GHashTableIter iter;
   OvRemotePeer *remote;
   OvLocalPeerPrivate *priv;
 
   ov_local_peer_lock (local);
   priv = ov_local_peer_get_private (local);
 
-  for (ii = 0; ii < priv->remote_peers->len; ii++) {
-    remote = g_ptr_array_index (priv->remote_peers, ii);
-    if (g_strcmp0 (id, remote->id))
-      break;
-  }
+  remote = ov_call_get_remote_by_id (priv->call, id);
+  g_hash_table_iter_init (&iter, priv->calls);
+  while (remote == NULL &&
+      g_hash_table_iter_next (&iter, NULL, (gpointer *) &call))
+    remote = ov_call_get_remote_by_id (call, id);
   ov_local_peer_unlock (local);
 
   return remote;
@@ -1205,9 +1800,10 @@ append_clients (gpointer data, gpointer user_data)
   g_free (addr_s);
 }
 
-/* Called with the lock TAKEN */
+/* Called with the lock TAKEN. Starts sending to the remotes in @call; the
+ * remotes of calls started later are added to the clients as they start. */
 static gboolean
-ov_local_peer_begin_transmit (OvLocalPeer * local)
+ov_local_peer_begin_transmit (OvLocalPeer * local, OvCall * call)
 {
   GSocket *socket;
   GString **clients;
@@ -1224,7 +1820,7 @@ ov_local_peer_begin_transmit (OvLocalPeer * local)
   clients[1] = g_string_new ("");
   clients[2] = g_string_new ("");
   clients[3] = g_string_new ("");
-  g_ptr_array_foreach (priv->remote_peers, append_clients, clients);
+  g_ptr_array_foreach (call->remote_peers, append_clients, clients);
 
   g_object_get (OV_PEER (local), "address", &addr, NULL);
   local_addr_s =
@@ -1232,7 +1828,27 @@ ov_local_peer_begin_transmit (OvLocalPeer * local)
   g_object_unref (addr);
 
   /* Send audio RTP to all remote peers */
-  g_object_set (priv->asend_rtp_sink, "clients", clients[0]->str, NULL);
+  socket = ov_get_socket_for_addr (local_addr_s, 0);
+  g_object_set (priv->asend_rtp_sink, "clients", clients[0]->str,
+      "socket", socket, NULL);
+#ifdef IP_RECVERR
+  {
+    gint val = 1;
+    /* Audio RTP packets are sent to every remote all the time, so this is
+     * where we find out first if a remote is no longer listening */
+    if (setsockopt (g_socket_get_fd (socket), IPPROTO_IP, IP_RECVERR, &val,
+          sizeof (val)) == 0) {
+      priv->transmit_error_source =
+        g_socket_create_source (socket, G_IO_ERR, NULL);
+      g_source_set_callback (priv->transmit_error_source,
+          (GSourceFunc) on_transmit_socket_error, local, NULL);
+      g_source_attach (priv->transmit_error_source, NULL);
+    } else {
+      GST_WARNING ("Unable to set IP_RECVERR on transmit socket");
+    }
+  }
+#endif
+  g_object_unref (socket);
   /* Send audio RTCP SRs to all remote peers */
   socket = ov_get_socket_for_addr (local_addr_s, priv->recv_rtcp_ports[0]);
   g_object_set (priv->asend_rtcp_sink, "clients", clients[1]->str,
@@ -1275,11 +1891,39 @@ ov_local_peer_add_remote (OvLocalPeer * local, OvRemotePeer * remote)
 
   ov_local_peer_lock (local);
   priv = ov_local_peer_get_private (local);
+  /* Remotes added while a call is in progress are for a new call, which is
+   * negotiated alongside it */
+  if (priv->call->id != 0 &&
+      priv->call->state & (OV_LOCAL_STATE_PLAYING | OV_LOCAL_STATE_PAUSED))
+    ov_local_peer_set_current_call (local, ov_call_new ());
   /* Add to our list of remote peers */
-  g_ptr_array_add (priv->remote_peers, remote);
+  ov_call_add_remote (priv->call, remote);
   ov_local_peer_unlock (local);
 }
 
+/* Called with the lock TAKEN. Starts sending to @remote from the transmit
+ * pipeline, which is already sending to the others. */
+static void
+ov_local_peer_add_clients (OvLocalPeer * local, OvRemotePeer * remote)
+{
+  gchar *addr_only;
+  OvLocalPeerPrivate *priv;
+
+  priv = ov_local_peer_get_private (local);
+
+  addr_only = g_inet_address_to_string (
+      g_inet_socket_address_get_address (remote->addr));
+  g_signal_emit_by_name (priv->asend_rtp_sink, "add", addr_only,
+      remote->priv->send_ports[0]);
+  g_signal_emit_by_name (priv->asend_rtcp_sink, "add", addr_only,
+      remote->priv->send_ports[1]);
+  g_signal_emit_by_name (priv->vsend_rtp_sink, "add", addr_only,
+      remote->priv->send_ports[3]);
+  g_signal_emit_by_name (priv->vsend_rtcp_sink, "add", addr_only,
+      remote->priv->send_ports[4]);
+  g_free (addr_only);
+}
+
 static gboolean
 ov_local_peer_setup_remote (OvLocalPeer * local, OvRemotePeer * remote)
 {
@@ -1294,17 +1938,69 @@ ov_local_peer_setup_remote (OvLocalPeer * local, OvRemotePeer * remote)
 void
 ov_local_peer_remove_remote (OvLocalPeer * local, OvRemotePeer * remote)
 {
-  OvLocalPeerPrivate *local_priv;
+  OvCall *call;
 
   ov_local_peer_lock (local);
-  local_priv = ov_local_peer_get_private (local);
+  call = remote->priv->call;
   /* Remove from the peers list first so nothing else tries to use it */
-  g_ptr_array_remove (local_priv->remote_peers, remote);
+  g_ptr_array_remove (call->remote_peers, remote);
+  if (call->active_speaker == remote)
+    call->active_speaker = NULL;
+  if (call->speaker_candidate == remote)
+    call->speaker_candidate = NULL;
+  ov_local_peer_update_priorities (local, call);
   ov_local_peer_unlock (local);
 
   ov_remote_peer_remove_not_array (remote);
 }
 
+/* Called with the lock TAKEN
+ *
+ * Adds @remote to @call while it's playing. The pipelines of the other
+ * remotes and the transmit pipeline are left alone; @remote gets its own
+ * receive pipeline and playback bins, and is added as a client to the
+ * multiudpsinks, which doesn't interrupt sending to the other clients.
+ *
+ * @remote is freed if this fails. */
+gboolean
+ov_local_peer_call_add_remote (OvLocalPeer * local, OvCall * call,
+    OvRemotePeer * remote)
+{
+  GstStateChangeReturn ret;
+
+  /* Its playback bins go in the call's bin */
+  remote->priv->call = call;
+  ov_local_peer_setup_remote (local, remote);
+
+  ret = gst_element_set_state (remote->receive, GST_STATE_PLAYING);
+  if (ret == GST_STATE_CHANGE_FAILURE) {
+    GST_ERROR ("Unable to set %s receive pipeline to PLAYING!",
+        remote->addr_s);
+    ov_remote_peer_remove_not_array (remote);
+    return FALSE;
+  }
+  /* The playback pipeline is already PLAYING */
+  if (remote->priv->audio_proxysrc != NULL)
+    gst_element_sync_state_with_parent (remote->priv->aplayback);
+  if (remote->priv->video_proxysrc != NULL)
+    gst_element_sync_state_with_parent (remote->priv->vplayback);
+
+  /* Start transmitting */
+  ov_local_peer_add_clients (local, remote);
+
+  /* Give it as long to start sending as remotes get at the start of a call */
+  remote->last_seen = g_get_monotonic_time ();
+  remote->state = OV_REMOTE_STATE_PLAYING;
+  ov_call_add_remote (call, remote);
+  /* New remotes haven't spoken yet, so they get the lowest priority */
+  ov_local_peer_update_priorities (local, call);
+
+  GST_DEBUG ("Added remote %s to the call; receiving on ports %u, %u, %u, %u",
+      remote->addr_s, remote->priv->recv_ports[0], remote->priv->recv_ports[1],
+      remote->priv->recv_ports[2], remote->priv->recv_ports[3]);
+  return TRUE;
+}
+
 gboolean
 ov_local_peer_start (OvLocalPeer * local)
 {
@@ -1361,62 +2057,553 @@ err:
   goto out;
 }
 
+/* Returns the RTPSource stats for the source this remote is sending us data
+ * from in the given session, or NULL if it's not known yet */
+static GstStructure *
+ov_remote_peer_get_recv_source_stats (OvRemotePeer * remote, guint session)
+{
+  GObject *rtpsession, *rtpsource;
+  GstStructure *stats = NULL;
+
+  if (remote->priv->rtpbin == NULL || remote->priv->recv_ssrcs[session] == 0)
+    return NULL;
+
+  g_signal_emit_by_name (remote->priv->rtpbin, "get-internal-session",
+      session, &rtpsession);
+  if (rtpsession == NULL)
+    return NULL;
+
+  g_signal_emit_by_name (rtpsession, "get-source-by-ssrc",
+      remote->priv->recv_ssrcs[session], &rtpsource);
+  if (rtpsource != NULL) {
+    g_object_get (rtpsource, "stats", &stats, NULL);
+    g_object_unref (rtpsource);
+  }
+  g_object_unref (rtpsession);
+
+  return stats;
+}
+
+static guint64
+ov_remote_peer_get_recv_bitrate (OvRemotePeer * remote, guint session)
+{
+  GstStructure *stats;
+  guint64 bitrate = 0;
+
+  stats = ov_remote_peer_get_recv_source_stats (remote, session);
+  if (stats == NULL)
+    return 0;
+
+  gst_structure_get_uint64 (stats, "bitrate", &bitrate);
+  gst_structure_free (stats);
+
+  return bitrate;
+}
+
+/* Convert an RTP timestamp from the remote into the remote's NTP time (in ns)
+ * using the mapping from the last RTCP SR it sent us */
+static gboolean
+ov_remote_peer_rtptime_to_sender_time (OvRemotePeer * remote, guint session,
+    guint32 rtptime, gint64 * sender_time)
+{
+  guint64 ntptime;
+  guint sr_rtptime;
+  gint clock_rate;
+  gboolean have_sr = FALSE;
+  GstStructure *stats;
+
+  stats = ov_remote_peer_get_recv_source_stats (remote, session);
+  if (stats == NULL)
+    return FALSE;
+
+  if (!gst_structure_get_boolean (stats, "have-sr", &have_sr) || !have_sr ||
+      !gst_structure_get_uint64 (stats, "sr-ntptime", &ntptime) ||
+      !gst_structure_get_uint (stats, "sr-rtptime", &sr_rtptime) ||
+      !gst_structure_get_int (stats, "clock-rate", &clock_rate) ||
+      clock_rate <= 0) {
+    gst_structure_free (stats);
+    return FALSE;
+  }
+  gst_structure_free (stats);
+
+  /* NTP time is 32.32 fixed point; the RTP timestamp difference can be
+   * negative and wraps around */
+  *sender_time = gst_util_uint64_scale (ntptime, GST_SECOND,
+      G_GUINT64_CONSTANT (1) << 32);
+  *sender_time += ((gint64) (gint32) (rtptime - sr_rtptime)) * GST_SECOND /
+    clock_rate;
+
+  return TRUE;
+}
+
+/* Measure the A/V skew for this remote and correct it by delaying whichever
+ * stream is early at the proxysrc in the playback pipeline.
+ *
+ * rtpbin already tries to sync the two streams with RTCP SRs inside the
+ * receive pipeline, but what matters is the time at which audio and video from
+ * the same instant at the sender are played. Both pipelines use the system
+ * clock with a base time of 0, so we compare the PTS of the latest buffer of
+ * each stream against the sender's NTP time for its RTP timestamp, and add
+ * the time that it'll still wait in the proxysrc queue before playback. */
+static void
+ov_remote_peer_update_av_sync (OvRemotePeer * remote)
+{
+  guint session;
+  gint64 offsets[2], skew, delays[2] = {0, 0};
+  gint64 max_delay = OV_AV_SYNC_MAX_OFFSET_MS * GST_MSECOND;
+
+  for (session = OV_AUDIO_RTP_SESSION; session <= OV_VIDEO_RTP_SESSION;
+      session++) {
+    GstClockTime pts;
+    guint32 rtptime;
+    gint64 sender_time;
+    guint64 level = 0;
+    GstElement *proxysrc = (session == OV_AUDIO_RTP_SESSION) ?
+      remote->priv->audio_proxysrc : remote->priv->video_proxysrc;
+
+    g_mutex_lock (&remote->priv->av_sync_lock);
+    pts = remote->priv->last_pts[session];
+    rtptime = remote->priv->last_rtptime[session];
+    g_mutex_unlock (&remote->priv->av_sync_lock);
+
+    if (!GST_CLOCK_TIME_IS_VALID (pts) ||
+        !ov_remote_peer_rtptime_to_sender_time (remote, session, rtptime,
+          &sender_time))
+      return;
+
+    offsets[session] = (gint64) pts - sender_time;
+
+    /* The queues of the two streams can be of different depths. Our own
+     * delay is applied after the queue and backs it up by as much, so don't
+     * count that part or we'd be correcting for our own correction. */
+    if (proxysrc != NULL)
+      g_object_get (proxysrc, "current-level-time", &level, NULL);
+    offsets[session] += MAX ((gint64) level -
+        remote->priv->av_sync_delays[session], 0);
+  }
+
+  /* Positive means audio is played later than video */
+  skew = offsets[OV_AUDIO_RTP_SESSION] - offsets[OV_VIDEO_RTP_SESSION];
+  if (skew > 0)
+    delays[OV_VIDEO_RTP_SESSION] = MIN (skew, max_delay);
+  else
+    delays[OV_AUDIO_RTP_SESSION] = MIN (-skew, max_delay);
+
+  /* Skew left over after our correction, which is what the user sees */
+  remote->priv->av_skew = skew - delays[OV_VIDEO_RTP_SESSION] +
+    delays[OV_AUDIO_RTP_SESSION];
+  GST_TRACE ("A/V skew for %s: %" G_GINT64_FORMAT "ms, corrected: %"
+      G_GINT64_FORMAT "ms", remote->addr_s, skew / GST_MSECOND,
+      remote->priv->av_skew / GST_MSECOND);
+
+  for (session = OV_AUDIO_RTP_SESSION; session <= OV_VIDEO_RTP_SESSION;
+      session++) {
+    GstPad *srcpad;
+    GstElement *proxysrc = (session == OV_AUDIO_RTP_SESSION) ?
+      remote->priv->audio_proxysrc : remote->priv->video_proxysrc;
+
+    /* Don't cause a discontinuity for every little change */
+    if (proxysrc == NULL || ABS (delays[session] -
+          remote->priv->av_sync_delays[session]) <
+        OV_AV_SYNC_THRESHOLD_MS * GST_MSECOND)
+      continue;
+
+    GST_DEBUG ("Delaying %s from %s by %" G_GINT64_FORMAT "ms",
+        OV_RTP_SESSION_TO_NAME (session), remote->addr_s,
+        delays[session] / GST_MSECOND);
+    srcpad = gst_element_get_static_pad (proxysrc, "src");
+    gst_pad_set_offset (srcpad, delays[session]);
+    gst_object_unref (srcpad);
+    remote->priv->av_sync_delays[session] = delays[session];
+  }
+}
+
+/* If the kernel has dropped packets because the socket receive buffer was full,
+ * grow the buffer so it can hold OV_RECV_BUFSIZE_MSECS of data at the current
+ * bitrate (or at least double it), upto OV_RECV_BUFSIZE_MAX */
+static void
+ov_remote_peer_tune_recv_buffers (OvRemotePeer * remote)
+{
+  guint session;
+
+  for (session = OV_AUDIO_RTP_SESSION; session <= OV_VIDEO_RTP_SESSION;
+      session++) {
+    guint drops;
+    guint64 bitrate;
+    gint size, new_size;
+    GSocket *socket = remote->priv->recv_rtp_sockets[session];
+
+    if (socket == NULL)
+      continue;
+
+    drops = ov_socket_get_kernel_drops (socket);
+    if (drops <= remote->priv->recv_drops[session])
+      continue;
+
+    size = ov_socket_get_recv_buffer_size (socket);
+    bitrate = ov_remote_peer_get_recv_bitrate (remote, session);
+    GST_DEBUG ("Kernel dropped %u %s packets from %s (bitrate: %" G_GUINT64_FORMAT
+        ", buffer size: %i)", drops - remote->priv->recv_drops[session],
+        OV_RTP_SESSION_TO_NAME (session), remote->addr_s, bitrate, size);
+    remote->priv->recv_drops[session] = drops;
+
+    if (size >= OV_RECV_BUFSIZE_MAX)
+      continue;
+
+    /* The size reported by the kernel is twice what was set, so setting the
+     * reported size will double it */
+    new_size = MAX (size, bitrate / 8 * OV_RECV_BUFSIZE_MSECS / 1000);
+    new_size = MIN (new_size, OV_RECV_BUFSIZE_MAX);
+    new_size = ov_socket_set_recv_buffer_size (socket, new_size);
+    GST_DEBUG ("Grew %s receive buffer for %s from %i to %i",
+        OV_RTP_SESSION_TO_NAME (session), remote->addr_s, size, new_size);
+  }
+}
+
+static gboolean
+copy_sticky_event (G_GNUC_UNUSED GstPad * pad, GstEvent ** event,
+    gpointer sinkpad)
+{
+  gst_pad_send_event (sinkpad, gst_event_ref (*event));
+  return TRUE;
+}
+
+/* Called from the mixer's streaming thread with each buffer it outputs while
+ * a grow of the audio playout buffer is pending */
+static GstPadProbeReturn
+on_audiomixer_blocked (GstPad * pad, GstPadProbeInfo * info,
+    OvLocalPeer * local)
+{
+  GstPad *sinkpad;
+  GstElement *sink;
+  guint buffer_time;
+  OvLocalPeerPrivate *priv = ov_local_peer_get_private (local);
+
+  /* Only reconfigure the sink while nobody is speaking, so that the short
+   * gap in playout while it's restarted is never heard */
+  if (!GST_BUFFER_FLAG_IS_SET (GST_PAD_PROBE_INFO_BUFFER (info),
+          GST_BUFFER_FLAG_GAP))
+    return GST_PAD_PROBE_PASS;
+
+  buffer_time = g_atomic_int_get (&priv->audio_buffer_time);
+  sinkpad = gst_pad_get_peer (pad);
+  sink = GST_ELEMENT (gst_pad_get_parent (sinkpad));
+
+  /* The ring buffer is (re)allocated with the new buffer-time when the sink
+   * is set to READY and then receives the caps again. The sink isn't async,
+   * so it's PLAYING again as soon as this returns. */
+  gst_element_set_state (sink, GST_STATE_READY);
+  g_object_set (sink, "buffer-time", (gint64) buffer_time * 1000, NULL);
+  gst_element_sync_state_with_parent (sink);
+  gst_pad_sticky_events_foreach (pad, copy_sticky_event, sinkpad);
+
+  gst_object_unref (sink);
+  gst_object_unref (sinkpad);
+
+  GST_DEBUG ("Audio playout buffer is now %ums", buffer_time);
+  g_atomic_int_set (&priv->audio_buffer_grow_pending, FALSE);
+  return GST_PAD_PROBE_REMOVE;
+}
+
+/* Grow the audio playout buffer if the audiosink reported underruns since the
+ * last time we grew it. Called periodically during a call. The buffer is
+ * grown at most once every OV_AUDIO_BUFFER_GROW_INTERVAL_SECS, and the new
+ * size is applied at the next silence.
+ *
+ * Called with the lock TAKEN */
+static void
+ov_local_peer_tune_audio_buffer (OvLocalPeer * local)
+{
+  GstPad *srcpad;
+  gint64 now;
+  guint underruns, buffer_time;
+  OvLocalPeerPrivate *priv;
+
+  priv = ov_local_peer_get_private (local);
+  if (priv->audiosink == NULL ||
+      g_atomic_int_get (&priv->audio_buffer_grow_pending))
+    return;
+
+  underruns = g_atomic_int_get (&priv->audio_underruns);
+  if (underruns == priv->audio_underruns_handled)
+    return;
+
+  now = g_get_monotonic_time ();
+  if (priv->audio_buffer_grown_time != 0 && now - priv->audio_buffer_grown_time
+      < OV_AUDIO_BUFFER_GROW_INTERVAL_SECS * G_USEC_PER_SEC)
+    return;
+  priv->audio_underruns_handled = underruns;
+
+  buffer_time = MIN (priv->audio_buffer_time * 3 / 2,
+      MAX (OV_AUDIO_BUFFER_TIME_MAX_MSECS, priv->audio_buffer_time_start));
+  if (buffer_time <= priv->audio_buffer_time)
+    return;
+
+  GST_DEBUG ("%u audio underruns, growing playout buffer from %ums to %ums",
+      underruns, priv->audio_buffer_time, buffer_time);
+  g_atomic_int_set (&priv->audio_buffer_time, buffer_time);
+  priv->audio_buffer_grown_time = now;
+  g_atomic_int_set (&priv->audio_buffer_grow_pending, TRUE);
+
+  /* Reconfigure the sink between two buffers so that the mixer never sees a
+   * flushing sinkpad */
+  srcpad = gst_element_get_static_pad (priv->audiomixer, "src");
+  gst_pad_add_probe (srcpad,
+      GST_PAD_PROBE_TYPE_BLOCK | GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) on_audiomixer_blocked, local, NULL);
+  gst_object_unref (srcpad);
+}
+
+/* Called with the lock TAKEN */
+static void
+ov_local_peer_clear_remotes_timeout_source (OvLocalPeerPrivate * priv)
+{
+  if (priv->remotes_timeout_source == NULL)
+    return;
+  g_source_destroy (priv->remotes_timeout_source);
+  g_clear_pointer (&priv->remotes_timeout_source, g_source_unref);
+}
+
 static gboolean
 ov_local_peer_check_timeouts (OvLocalPeer * local)
 {
-  guint ii;
+  guint ii, n_gone;
   gint64 current_time;
-  GPtrArray *remotes;
-  GPtrArray *timedout = g_ptr_array_new ();
+  GHashTableIter calls;
+  OvCall *call;
+  OvLocalPeerPrivate *priv;
+  GPtrArray *gone = g_ptr_array_new ();
   GPtrArray *removed = g_ptr_array_new ();
-  gboolean all_remotes_gone = FALSE;
+  GArray *timedout = g_array_new (FALSE, FALSE, sizeof (gboolean));
+  /* Ids of the calls that all remotes have left */
+  GArray *ended = g_array_new (FALSE, FALSE, sizeof (guint64));
+  gboolean in_call = FALSE;
+  gboolean ret = G_SOURCE_REMOVE;
 
-  GST_DEBUG ("Checking for remote timeouts...");
+  GST_TRACE ("Checking for remote timeouts...");
 
   ov_local_peer_lock (local);
+  priv = ov_local_peer_get_private (local);
 
   if (ov_local_peer_get_state (local) == OV_LOCAL_STATE_STOPPED) {
     GST_DEBUG ("Already stopped; skipping timeout check");
-    return G_SOURCE_REMOVE;
+    goto out_unlock;
   }
 
+  /* The call has already ended (all remotes gone or hangup) */
+  if (priv->remotes_timeout_source == NULL)
+    goto out_unlock;
+
   current_time = g_get_monotonic_time ();
-  remotes = ov_local_peer_get_remotes (local);
-  for (ii = 0; ii < remotes->len; ii++) {
-    OvRemotePeer *remote = g_ptr_array_index (remotes, ii);
-    if ((current_time - remote->last_seen) >
-        OV_REMOTE_PEER_TIMEOUT_SECONDS * G_USEC_PER_SEC)
-      g_ptr_array_add (timedout, remote);
+
+  g_hash_table_iter_init (&calls, priv->calls);
+  while (g_hash_table_iter_next (&calls, NULL, (gpointer *) &call)) {
+    if (!(call->state & (OV_LOCAL_STATE_PLAYING | OV_LOCAL_STATE_PAUSED)))
+      continue;
+
+    /* Free the ports allocated for remotes that never finished joining */
+    if (g_hash_table_size (call->joining) > 0) {
+      GHashTableIter iter;
+      OvRemotePeer *joiner;
+
+      g_hash_table_iter_init (&iter, call->joining);
+      while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &joiner)) {
+        if ((current_time - joiner->last_seen) <=
+            OV_JOINING_TIMEOUT_SECONDS * G_USEC_PER_SEC)
+          continue;
+        GST_WARNING ("Remote %s never finished joining the call, forgetting"
+            " it", joiner->id);
+        g_hash_table_iter_remove (&iter);
+      }
+    }
+
+    /* The last remote was removed by someone else (f.ex., an END_CALL
+     * message) who is also responsible for announcing that the call has
+     * ended */
+    if (call->remote_peers->len == 0)
+      continue;
+
+    n_gone = gone->len;
+    for (ii = 0; ii < call->remote_peers->len; ii++) {
+      gboolean remote_timedout;
+      OvRemotePeer *remote = g_ptr_array_index (call->remote_peers, ii);
+
+      /* Remotes that sent an RTCP BYE or whose ports are unreachable are
+       * removed immediately; the rest are removed only after the timeout */
+      if (g_atomic_int_get (&remote->priv->departed))
+        remote_timedout = FALSE;
+      else if ((current_time - remote->last_seen) >
+          OV_REMOTE_PEER_TIMEOUT_SECONDS * G_USEC_PER_SEC)
+        remote_timedout = TRUE;
+      else {
+        ov_remote_peer_tune_recv_buffers (remote);
+        ov_remote_peer_update_av_sync (remote);
+        continue;
+      }
+
+      g_ptr_array_add (gone, remote);
+      g_array_append_val (timedout, remote_timedout);
+    }
+
+    if (gone->len - n_gone == call->remote_peers->len)
+      g_array_append_val (ended, call->id);
+    else
+      in_call = TRUE;
   }
 
-  if (timedout->len == remotes->len)
-    all_remotes_gone = TRUE;
+  /* The playback pipeline and this source are shared by all calls */
+  if (in_call) {
+    ov_local_peer_tune_audio_buffer (local);
+    ret = G_SOURCE_CONTINUE;
+  } else {
+    ov_local_peer_clear_remotes_timeout_source (priv);
+  }
 
-  for (ii = 0; ii < timedout->len; ii++) {
-    OvRemotePeer *remote = g_ptr_array_index (timedout, ii);
+  for (ii = 0; ii < gone->len; ii++) {
+    OvRemotePeer *remote = g_ptr_array_index (gone, ii);
     OvPeer *peer = ov_peer_new (remote->addr);
-    GST_DEBUG ("Remote peer %s timed out, removing...", remote->addr_s);
+    GST_DEBUG ("Remote peer %s %s, removing...", remote->addr_s,
+        g_array_index (timedout, gboolean, ii) ? "timed out" : "left");
     ov_local_peer_remove_remote (local, remote);
     g_ptr_array_add (removed, peer);
   }
 
+out_unlock:
   ov_local_peer_unlock (local);
-  g_ptr_array_free (timedout, TRUE);
+  g_ptr_array_free (gone, TRUE);
 
   for (ii = 0; ii < removed->len; ii++) {
     OvPeer *peer = g_ptr_array_index (removed, ii);
-    g_signal_emit_by_name (local, "call-remote-gone", peer, TRUE);
+    g_signal_emit_by_name (local, "call-remote-gone", peer,
+        g_array_index (timedout, gboolean, ii));
     g_object_unref (peer);
   }
   g_ptr_array_free (removed, TRUE);
+  g_array_free (timedout, TRUE);
+
+  /* The application hangs up the current call when it's told that everyone
+   * left, so make each of these calls current before telling it */
+  for (ii = 0; ii < ended->len; ii++) {
+    ov_local_peer_lock (local);
+    call = ov_local_peer_get_call (local,
+        g_array_index (ended, guint64, ii));
+    if (call != NULL)
+      ov_local_peer_set_current_call (local, call);
+    ov_local_peer_unlock (local);
 
-  if (!all_remotes_gone)
-    return G_SOURCE_CONTINUE;
+    if (call != NULL)
+      g_signal_emit_by_name (local, "call-all-remotes-gone");
+  }
+  g_array_free (ended, TRUE);
+
+  return ret;
+}
 
-  g_signal_emit_by_name (local, "call-all-remotes-gone");
+static gboolean
+ov_local_peer_check_departed (OvLocalPeer * local)
+{
+  ov_local_peer_check_timeouts (local);
   return G_SOURCE_REMOVE;
 }
 
+/* Can be called from any thread. Remotes that have been marked as departed
+ * will be removed from the call (from the main thread) as soon as possible
+ * instead of waiting for the next timeout check */
+void
+ov_local_peer_schedule_remotes_check (OvLocalPeer * local)
+{
+  g_idle_add_full (G_PRIORITY_DEFAULT, (GSourceFunc)
+      ov_local_peer_check_departed, g_object_ref (local), g_object_unref);
+}
+
+#ifdef IP_RECVERR
+/* Called from the main thread when the socket we transmit audio RTP on has
+ * a pending error. Since IP_RECVERR is set on it, ICMP errors are queued along
+ * with the original destination, which tells us which remote went away. */
+static gboolean
+on_transmit_socket_error (GSocket * socket, GIOCondition condition,
+    OvLocalPeer * local)
+{
+  guint ii;
+  gint fd, err;
+  socklen_t len;
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+  struct sockaddr_in dest;
+  struct sock_extended_err *ee;
+  gchar control[256];
+  GHashTableIter iter;
+  OvCall *call;
+  OvLocalPeerPrivate *priv;
+  gboolean departed = FALSE;
+
+  fd = g_socket_get_fd (socket);
+
+  ov_local_peer_lock (local);
+  priv = ov_local_peer_get_private (local);
+
+  while (TRUE) {
+    GSocketAddress *addr;
+
+    memset (&msg, 0, sizeof (msg));
+    msg.msg_name = &dest;
+    msg.msg_namelen = sizeof (dest);
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof (control);
+    if (recvmsg (fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+      break;
+
+    for (cmsg = CMSG_FIRSTHDR (&msg); cmsg; cmsg = CMSG_NXTHDR (&msg, cmsg)) {
+      if (cmsg->cmsg_level != IPPROTO_IP || cmsg->cmsg_type != IP_RECVERR)
+        continue;
+      ee = (struct sock_extended_err *) CMSG_DATA (cmsg);
+      /* We only care about ICMP port unreachable */
+      if (ee->ee_origin != SO_EE_ORIGIN_ICMP || ee->ee_errno != ECONNREFUSED)
+        continue;
+
+      addr = g_socket_address_new_from_native (&dest, sizeof (dest));
+      /* All calls transmit from this socket */
+      g_hash_table_iter_init (&iter, priv->calls);
+      while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &call)) {
+        for (ii = 0; ii < call->remote_peers->len; ii++) {
+          OvRemotePeer *remote = g_ptr_array_index (call->remote_peers, ii);
+          GInetSocketAddress *iaddr = G_INET_SOCKET_ADDRESS (addr);
+
+          /* Until the remote has sent us RTCP, its receive pipeline might not
+           * be up yet, in which case port unreachable is expected */
+          if (remote->priv->ssrcs[OV_AUDIO_RTP_SESSION] == 0 ||
+              g_inet_socket_address_get_port (iaddr) !=
+              remote->priv->send_ports[0] ||
+              !g_inet_address_equal (g_inet_socket_address_get_address (iaddr),
+                g_inet_socket_address_get_address (remote->addr)))
+            continue;
+
+          GST_DEBUG ("Remote %s is unreachable", remote->addr_s);
+          g_atomic_int_set (&remote->priv->departed, 1);
+          departed = TRUE;
+        }
+      }
+      g_object_unref (addr);
+    }
+  }
+
+  ov_local_peer_unlock (local);
+
+  /* Clear the pending socket error so that udpsink doesn't get it on the next
+   * send and so that we aren't woken up again for the same error */
+  len = sizeof (err);
+  getsockopt (fd, SOL_SOCKET, SO_ERROR, &err, &len);
+
+  if (departed)
+    ov_local_peer_schedule_remotes_check (local);
+
+  return G_SOURCE_CONTINUE;
+}
+#endif
+
+/* Starts the current call. If other calls are in progress, the transmit and
+ * playback pipelines are already running, and the remotes in this call are
+ * added to them. */
 gboolean
 ov_local_peer_call_start (OvLocalPeer * local)
 {
@@ -1425,11 +2612,13 @@ ov_local_peer_call_start (OvLocalPeer * local)
   gint current_time;
   GstStateChangeReturn ret;
   OvRemotePeer *remote;
+  OvCall *call;
   OvLocalPeerPrivate *priv;
   OvLocalPeerState state;
 
   ov_local_peer_lock (local);
   priv = ov_local_peer_get_private (local);
+  call = priv->call;
   state = ov_local_peer_get_state (local);
 
   if (!(state & OV_LOCAL_STATE_READY)) {
@@ -1438,22 +2627,33 @@ ov_local_peer_call_start (OvLocalPeer * local)
     return FALSE;
   }
 
-  /* We can only setup the transmit pipeline once we know whether we will be
-   * transmitting H264 or JPEG */
-  res = ov_local_peer_setup_transmit_pipeline (local);
-  g_assert (res);
+  if (priv->transmit == NULL) {
+    /* We can only setup the transmit pipeline once we know whether we will be
+     * transmitting H264 or JPEG */
+    ov_local_peer_finish_stop_transmit (local);
+    res = ov_local_peer_setup_transmit_pipeline (local);
+    g_assert (res);
 
-  /* Setup the playback pipeline anew to avoid bugs with reuse of elements */
-  res = ov_local_peer_setup_playback_pipeline (local);
-  g_assert (res);
+    /* Setup the playback pipeline anew to avoid bugs with reuse of elements */
+    res = ov_local_peer_setup_playback_pipeline (local);
+    g_assert (res);
 
-  /* Begin transmission */
-  res = ov_local_peer_begin_transmit (local);
+    /* Begin transmission */
+    res = ov_local_peer_begin_transmit (local, call);
+    g_assert (res);
+  } else {
+    /* Another call is transmitting; send the same thing to this one */
+    for (index = 0; index < call->remote_peers->len; index++)
+      ov_local_peer_add_clients (local,
+          g_ptr_array_index (call->remote_peers, index));
+  }
+
+  res = ov_local_peer_setup_call_playback (local, call);
   g_assert (res);
 
   current_time = g_get_monotonic_time ();
-  for (index = 0; index < priv->remote_peers->len; index++) {
-    remote = g_ptr_array_index (priv->remote_peers, index);
+  for (index = 0; index < call->remote_peers->len; index++) {
+    remote = g_ptr_array_index (call->remote_peers, index);
     remote->last_seen = current_time;
 
     /* Call details have all been set, so we can do the setup */
@@ -1471,22 +2671,28 @@ ov_local_peer_call_start (OvLocalPeer * local)
         remote->priv->recv_ports[3]);
     remote->state = OV_REMOTE_STATE_PLAYING;
   }
+  ov_local_peer_update_priorities (local, call);
 
+  /* Also brings up the bins of this call if the pipeline is already playing */
   ret = gst_element_set_state (priv->playback, GST_STATE_PLAYING);
   if (ret == GST_STATE_CHANGE_FAILURE)
     goto play_fail;
 
   GST_DEBUG ("Ready to playback data from all remotes");
   /* The difference between negotiator and negotiatee ends with playback */
-  ov_local_peer_set_state (local, OV_LOCAL_STATE_PLAYING);
+  ov_call_set_state (call, OV_LOCAL_STATE_PLAYING);
+
+  /* Fallback for remotes that go away without an RTCP BYE or an ICMP error.
+   * Checks the remotes of all calls. */
+  if (priv->remotes_timeout_source == NULL) {
+    priv->remotes_timeout_source =
+      g_timeout_source_new (priv->timeout_check_interval);
+    g_source_set_callback (priv->remotes_timeout_source,
+        (GSourceFunc) ov_local_peer_check_timeouts, local, NULL);
+    g_source_attach (priv->remotes_timeout_source, NULL);
+  }
   ov_local_peer_unlock (local);
 
-  priv->remotes_timeout_source =
-    g_timeout_source_new_seconds (OV_REMOTE_PEER_TIMEOUT_SECONDS/2);
-  g_source_set_callback (priv->remotes_timeout_source,
-      (GSourceFunc) ov_local_peer_check_timeouts, local, NULL);
-  g_source_attach (priv->remotes_timeout_source, NULL);
-
   return TRUE;
 
   play_fail: {
@@ -1502,41 +2708,84 @@ ov_local_peer_call_start (OvLocalPeer * local)
   }
 }
 
-/* Resets the local peer to a state equivalent to after callign
- * ov_local_peer_start() */
-void
-ov_local_peer_call_hangup (OvLocalPeer * local)
+/* Called with the lock TAKEN. Ends @call, which might be freed. Once no other
+ * call is in progress, resets the local peer to a state equivalent to after
+ * calling ov_local_peer_start() */
+static void
+ov_local_peer_hangup_call (OvLocalPeer * local, OvCall * call)
 {
   OvLocalPeerState state;
   OvLocalPeerPrivate *priv;
 
-  ov_local_peer_lock (local);
   priv = ov_local_peer_get_private (local);
-  state = ov_local_peer_get_state (local);
+  state = call->state;
 
-  /* Signal end of call if we're in a call and haven't ended the call */
-  if (state >= OV_LOCAL_STATE_READY && priv->remote_peers->len > 0)
-    ov_local_peer_send_end_call (local);
+  /* The negotiation task owns the call until it's done with it, and ends it
+   * once it notices that it has been cancelled */
+  if (call->negotiator_task != NULL) {
+    ov_local_peer_call_negotiate_abort (local, call, FALSE);
+    return;
+  }
+
+  /* Hung up while a remote was negotiating a call with us */
+  if (call->negotiate != NULL) {
+    ov_negotiate_free (call->negotiate, "hung up");
+    call->negotiate = NULL;
+  }
 
-  GST_DEBUG ("Ending call on local peer");
-  /* Remove all the remote peers added to the local peer */
-  if (priv->remote_peers->len > 0) {
-    g_ptr_array_foreach (priv->remote_peers,
-        (GFunc) ov_remote_peer_remove_not_array, NULL);
-    g_ptr_array_free (priv->remote_peers, TRUE);
-    priv->remote_peers = g_ptr_array_new ();
+  /* Signal end of call if we're in a call and haven't ended the call */
+  if (state >= OV_LOCAL_STATE_READY && call->remote_peers->len > 0)
+    ov_local_peer_send_end_call (local, call);
+
+  GST_DEBUG ("Ending call %" G_GUINT64_FORMAT " on local peer", call->id);
+  /* Stop adding a remote to the call, and forget the ones that others were
+   * adding */
+  if (call->join_task != NULL) {
+    g_cancellable_cancel (g_task_get_cancellable (call->join_task));
+    call->join_task = NULL;
+  }
+  g_hash_table_remove_all (call->joining);
+  /* Remove all the remote peers added to the call */
+  if (call->remote_peers->len > 0) {
+    if (state >= OV_LOCAL_STATE_PLAYING)
+      g_ptr_array_foreach (call->remote_peers,
+          (GFunc) ov_remote_peer_remove_not_array, NULL);
+    else
+      g_ptr_array_foreach (call->remote_peers, (GFunc) ov_remote_peer_free,
+          NULL);
+    g_ptr_array_free (call->remote_peers, TRUE);
+    call->remote_peers = g_ptr_array_new ();
   }
+  call->active_speaker = NULL;
+  call->speaker_candidate = NULL;
 
   if (state >= OV_LOCAL_STATE_PLAYING) {
-    GST_DEBUG ("Stopping transmit and playback");
-    ov_local_peer_stop_transmit (local);
-    ov_local_peer_stop_playback (local);
+    ov_local_peer_teardown_call_playback (local, call);
+    if (!ov_local_peer_in_other_calls (local, call)) {
+      GST_DEBUG ("Stopping transmit and playback");
+      ov_local_peer_clear_remotes_timeout_source (priv);
+      ov_local_peer_stop_transmit (local);
+      ov_local_peer_stop_playback (local);
+    }
   }
 
-  g_clear_pointer (&priv->send_acaps, gst_caps_unref);
-  g_clear_pointer (&priv->send_vcaps, gst_caps_unref);
+  /* The caps we send stay decided while another call is using them */
+  if (!ov_local_peer_in_other_calls (local, call)) {
+    g_clear_pointer (&priv->send_acaps, gst_caps_unref);
+    g_clear_pointer (&priv->send_vcaps, gst_caps_unref);
+  }
   /* Revert state to STARTED */
-  ov_local_peer_set_state (local, OV_LOCAL_STATE_STARTED);
+  ov_call_set_state (call, OV_LOCAL_STATE_STARTED);
+  ov_local_peer_end_call (local, call);
+}
+
+/* Ends the current call. The most recent of the other calls, if any, becomes
+ * the current one. */
+void
+ov_local_peer_call_hangup (OvLocalPeer * local)
+{
+  ov_local_peer_lock (local);
+  ov_local_peer_hangup_call (local, ov_local_peer_get_private (local)->call);
   ov_local_peer_unlock (local);
 }
 
@@ -1551,22 +2800,23 @@ ov_local_peer_stop (OvLocalPeer * local)
   state = ov_local_peer_get_state (local);
 
   GST_DEBUG ("Stopping local peer");
-  /* Stop negotiating if negotiating */
-  if (state & OV_LOCAL_STATE_NEGOTIATING)
-    ov_local_peer_negotiate_abort (local);
-
-  if (state >= OV_LOCAL_STATE_READY)
-    ov_local_peer_call_hangup (local);
+  /* Stop negotiating, and hang up every call */
+  if (state != OV_LOCAL_STATE_NULL && state != OV_LOCAL_STATE_STOPPED) {
+    GList *l, *calls;
+
+    calls = g_hash_table_get_values (priv->calls);
+    for (l = calls; l != NULL; l = l->next)
+      ov_local_peer_hangup_call (local, l->data);
+    g_list_free (calls);
+    /* Remotes that were added to a call that never got an id */
+    if (priv->call->id == 0)
+      ov_local_peer_hangup_call (local, priv->call);
+  }
 
   if (state >= OV_LOCAL_STATE_STARTED) {
     /* Stop video device monitor */
     gst_device_monitor_stop (priv->dm);
 
-    /* Stop and free TCP server */
-    g_signal_handlers_disconnect_by_data (priv->tcp_server, local);
-    g_socket_service_stop (priv->tcp_server);
-    g_clear_object (&priv->tcp_server);
-
     /* Stop and destroy multicast socket sources */
     g_clear_pointer (&priv->mc_socket_source, g_source_destroy);
 
@@ -1577,4 +2827,8 @@ ov_local_peer_stop (OvLocalPeer * local)
 
   ov_local_peer_set_state (local, OV_LOCAL_STATE_STOPPED);
   ov_local_peer_unlock (local);
+
+  /* Stop the TCP server and close incoming connections. Done without the lock
+   * since incoming message handlers take it. */
+  ov_local_peer_teardown_comms (local);
 }
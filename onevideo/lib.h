@@ -81,7 +81,9 @@ gboolean            ov_local_peer_discovery_start   (OvLocalPeer *local,
                                                      GError **error);
 void                ov_local_peer_discovery_stop    (OvLocalPeer *local);
 
-/* Setup, negotiation, and calling */
+/* Setup, negotiation, and calling. These act on the current call; adding
+ * a remote while the current call is in progress starts setting up a new one
+ * alongside it. */
 void                ov_local_peer_add_remote        (OvLocalPeer *local,
                                                      OvRemotePeer *remote);
 void                ov_local_peer_remove_remote     (OvLocalPeer *local,
@@ -91,9 +93,21 @@ gboolean            ov_local_peer_start             (OvLocalPeer *local);
 gboolean            ov_local_peer_negotiate_start   (OvLocalPeer *local);
 gboolean            ov_local_peer_negotiate_abort   (OvLocalPeer *local);
 gboolean            ov_local_peer_call_start        (OvLocalPeer *local);
+/* Asynchronously add a remote peer to the active call */
+gboolean            ov_local_peer_call_join_start   (OvLocalPeer *local,
+                                                     OvRemotePeer *remote);
 void                ov_local_peer_call_hangup       (OvLocalPeer *local);
 void                ov_local_peer_stop              (OvLocalPeer *local);
 
+/* Render video from all remote peers into a single (composited) sink */
+gpointer            ov_local_peer_add_gtksink       (OvLocalPeer *local);
+
+/* Show a low-framerate preview of the video that we transmit */
+gpointer            ov_local_peer_add_preview_sink  (OvLocalPeer *local);
+
+/* The remote peer that is currently speaking (NULL if nobody has spoken yet) */
+OvRemotePeer*       ov_local_peer_get_active_speaker (OvLocalPeer *local);
+
 /* Video device discovery */
 GList*              ov_local_peer_get_video_devices (OvLocalPeer *local);
 gboolean            ov_local_peer_set_video_device  (OvLocalPeer *local,
@@ -114,7 +128,12 @@ void                ov_remote_peer_set_muted          (OvRemotePeer *remote,
 gboolean            ov_remote_peer_get_muted          (OvRemotePeer *remote);
 void                ov_remote_peer_pause              (OvRemotePeer *remote);
 void                ov_remote_peer_resume             (OvRemotePeer *remote);
+gboolean            ov_remote_peer_is_active_speaker  (OvRemotePeer *remote);
+/* Rank of the remote in the call by how recently it was the active speaker;
+ * 0 is the highest. For layout and quality allocation decisions. */
+guint               ov_remote_peer_get_priority       (OvRemotePeer *remote);
 
+/* Remotes in the current call */
 GPtrArray*          ov_local_peer_get_remotes         (OvLocalPeer *local);
 OvRemotePeer*       ov_local_peer_get_remote_by_id    (OvLocalPeer *local,
                                                        const gchar *peer_id);
@@ -29,6 +29,7 @@
 #include "lib-priv.h"
 #include "outgoing.h"
 #include "ov-local-peer-priv.h"
+#include "utils.h"
 
 #include <string.h>
 
@@ -75,25 +76,434 @@ handle_tcp_msg_ok_negotiate (OvTcpMsg * msg)
   return peer_id;
 }
 
-OvTcpMsg *
-ov_remote_peer_send_tcp_msg (OvRemotePeer * remote, OvTcpMsg * msg,
-    GCancellable * cancellable, GError ** error)
+/*-- Control channel --*/
+
+/* A long-lived TCP connection to a remote that we send requests on. Requests
+ * are written in order and can be pipelined; the remote replies to each one
+ * with a message carrying the same id, and replies are matched to requests by
+ * that id. All connection state is only touched from the control thread, which
+ * runs priv->control_context and never takes the local peer lock, so requests
+ * make progress even while the caller holds it. */
+struct _OvControlChannel {
+  /* One ref for the remote, and one for each queued request, pending invoke
+   * and in-flight read, write or connect */
+  gint refcount;
+  OvLocalPeer *local;
+  GInetSocketAddress *addr;
+  gchar *addr_s;
+
+  /* Everything below is only touched from the control thread */
+  gboolean listed;
+  /* Protocol version to send requests in. Starts at the newest one and steps
+   * down if the remote turns out not to understand it. */
+  guint32 version;
+  /* The remote is gone; close once there's nothing left to send */
+  gboolean released;
+  GSocketConnection *conn;
+  /* Cancels I/O on the current connection (or connection attempt) */
+  GCancellable *cancellable;
+  gboolean connecting;
+  /* Set once we've had a reply on conn. If the connection fails after that,
+   * the remote most likely closed it while idle and it's safe to resend. */
+  gboolean conn_used;
+
+  /* Requests (GTask) waiting to be written, in order. The head is being
+   * written if @writing is set, and @write_offset bytes of it are done. */
+  GQueue outq;
+  gboolean writing;
+  gsize write_offset;
+  /* Requests that have been written and are waiting for a reply, by id */
+  GHashTable *pending;
+  /* One-way messages (OvOnewayMsg) waiting to be sent again */
+  GList *retries;
+
+  /* The reply being read; same scheme as OvIncomingConn */
+  OvTcpMsg *msg;
+  gchar header[OV_TCP_MSG_HEADER_SIZE];
+  gchar *body;
+  gsize offset;
+};
+
+typedef struct {
+  OvControlChannel *channel;
+  guint64 id;
+  OvTcpMsg *msg;
+  /* @msg serialized in channel->version; set once we start writing it */
+  GBytes *bytes;
+  /* Timeout in seconds for the whole request, including connecting */
+  guint timeout;
+  GSource *timeout_source;
+  GSource *cancel_source;
+  gboolean retried;
+  /* Still sent if the control thread is stopping, instead of failing */
+  gboolean flush;
+  /* The task has already returned */
+  gboolean done;
+} OvControlRequest;
+
+/* How a one-way message of @type is sent: how long to wait for the remote to
+ * acknowledge it, and how many times to try before giving up */
+typedef struct {
+  OvTcpMsgType type;
+  guint timeout;
+  guint attempts;
+} OvOnewayPolicy;
+
+static const OvOnewayPolicy oneway_policies[] = {
+  /* The remote keeps sending us media and waiting for ours until it gets this
+   * or its own timeout fires */
+  {OV_TCP_MSG_TYPE_END_CALL,         2, 4},
+  /* The remote keeps its ports reserved until its negotiate timeout */
+  {OV_TCP_MSG_TYPE_CANCEL_NEGOTIATE, 1, 3},
+};
+
+/* Everything else is unimportant: one quick try */
+static const OvOnewayPolicy oneway_default_policy = {0, 1, 1};
+
+/* Delay before the first resend, doubled for each one after that */
+#define OV_ONEWAY_RETRY_MS 250
+#define OV_ONEWAY_RETRY_MAX_MS 2000
+
+/* A message that we don't wait for the reply to, sent and resent from the
+ * control thread */
+typedef struct {
+  OvControlChannel *channel;
+  OvTcpMsg *msg;
+  const OvOnewayPolicy *policy;
+  guint attempt;
+  GSource *retry_source;
+} OvOnewayMsg;
+
+static void ov_control_channel_connect (OvControlChannel * channel);
+static void ov_control_channel_write (OvControlChannel * channel);
+static void ov_control_channel_read (OvControlChannel * channel);
+static void ov_oneway_msg_free (OvOnewayMsg * oneway);
+
+OvControlChannel *
+ov_control_channel_new (OvLocalPeer * local, GInetSocketAddress * addr,
+    const gchar * addr_s)
 {
-  gchar *tmp;
-  gboolean ret;
-  GSocketClient *client;
+  OvControlChannel *channel;
+
+  channel = g_new0 (OvControlChannel, 1);
+  channel->refcount = 1;
+  channel->local = local;
+  channel->addr = g_object_ref (addr);
+  channel->addr_s = g_strdup (addr_s);
+  channel->version = OV_TCP_MAX_VERSION;
+  g_queue_init (&channel->outq);
+  channel->pending = g_hash_table_new (g_int64_hash, g_int64_equal);
+
+  return channel;
+}
+
+static OvControlChannel *
+ov_control_channel_ref (OvControlChannel * channel)
+{
+  g_atomic_int_inc (&channel->refcount);
+  return channel;
+}
+
+/* The last ref is always dropped in the control thread, or after it has
+ * exited */
+static void
+ov_control_channel_unref (OvControlChannel * channel)
+{
+  OvLocalPeerPrivate *priv;
+
+  if (!g_atomic_int_dec_and_test (&channel->refcount))
+    return;
+
+  priv = ov_local_peer_get_private (channel->local);
+  if (channel->listed)
+    priv->control_channels = g_list_remove (priv->control_channels, channel);
+
+  g_assert (channel->conn == NULL);
+  g_assert (g_queue_is_empty (&channel->outq));
+  g_assert (channel->retries == NULL);
+  g_clear_object (&channel->cancellable);
+  g_hash_table_unref (channel->pending);
+  ov_tcp_msg_free (channel->msg);
+  g_free (channel->body);
+  g_object_unref (channel->addr);
+  g_free (channel->addr_s);
+  g_free (channel);
+}
+
+static void
+ov_control_request_free (OvControlRequest * req)
+{
+  ov_tcp_msg_free (req->msg);
+  if (req->bytes)
+    g_bytes_unref (req->bytes);
+  g_free (req);
+}
+
+/* Counts in-flight async operations so that the control thread only quits
+ * once they have all come back */
+static void
+ov_control_op_begin (OvControlChannel * channel)
+{
+  OvLocalPeerPrivate *priv = ov_local_peer_get_private (channel->local);
+
+  priv->control_ops++;
+  ov_control_channel_ref (channel);
+}
+
+static void
+ov_control_op_end (OvControlChannel * channel)
+{
+  OvLocalPeerPrivate *priv = ov_local_peer_get_private (channel->local);
+
+  priv->control_ops--;
+  if (priv->control_stopping && priv->control_ops == 0)
+    g_main_loop_quit (priv->control_loop);
+  ov_control_channel_unref (channel);
+}
+
+static void
+ov_control_channel_close (OvControlChannel * channel)
+{
+  /* A request that already returned was only kept around to finish writing */
+  if (channel->writing) {
+    OvControlRequest *req =
+      g_task_get_task_data (g_queue_peek_head (&channel->outq));
+    if (req->done)
+      g_queue_pop_head (&channel->outq);
+  }
+
+  if (channel->cancellable)
+    g_cancellable_cancel (channel->cancellable);
+  g_clear_object (&channel->cancellable);
+
+  if (channel->conn) {
+    GST_DEBUG ("Closing control connection to %s", channel->addr_s);
+    g_io_stream_close (G_IO_STREAM (channel->conn), NULL, NULL);
+    g_clear_object (&channel->conn);
+  }
+
+  channel->connecting = FALSE;
+  channel->conn_used = FALSE;
+  channel->writing = FALSE;
+  channel->write_offset = 0;
+  g_clear_pointer (&channel->msg, ov_tcp_msg_free);
+  g_clear_pointer (&channel->body, g_free);
+  channel->offset = 0;
+}
+
+static void
+ov_control_channel_maybe_close (OvControlChannel * channel)
+{
+  OvLocalPeerPrivate *priv = ov_local_peer_get_private (channel->local);
+
+  if ((channel->released || priv->control_stopping) &&
+      g_queue_is_empty (&channel->outq) &&
+      g_hash_table_size (channel->pending) == 0)
+    ov_control_channel_close (channel);
+}
+
+/* Returns @reply or @error from the request's task and forgets about it.
+ * Takes ownership of both. */
+static void
+ov_control_request_return (GTask * task, OvTcpMsg * reply, GError * error)
+{
+  OvControlRequest *req = g_task_get_task_data (task);
+  OvControlChannel *channel = req->channel;
+
+  g_assert (!req->done);
+  req->done = TRUE;
+
+  if (req->timeout_source) {
+    g_source_destroy (req->timeout_source);
+    g_clear_pointer (&req->timeout_source, g_source_unref);
+  }
+  if (req->cancel_source) {
+    g_source_destroy (req->cancel_source);
+    g_clear_pointer (&req->cancel_source, g_source_unref);
+  }
+
+  g_hash_table_remove (channel->pending, &req->id);
+  /* If it's being written, the writer drops it once it's done */
+  if (!(channel->writing && g_queue_peek_head (&channel->outq) == task))
+    g_queue_remove (&channel->outq, task);
+
+  if (reply)
+    g_task_return_pointer (task, reply, (GDestroyNotify) ov_tcp_msg_free);
+  else
+    g_task_return_error (task, error);
+
+  ov_control_channel_maybe_close (channel);
+  g_object_unref (task);
+  ov_control_channel_unref (channel);
+}
+
+/* If @keep_flush is set, requests that should be flushed are left alone */
+static void
+ov_control_channel_fail_all (OvControlChannel * channel, const GError * error,
+    gboolean keep_flush)
+{
+  GList *tasks, *l;
+
+  tasks = g_list_concat (g_hash_table_get_values (channel->pending),
+      g_list_copy (channel->outq.head));
+  for (l = tasks; l != NULL; l = l->next) {
+    OvControlRequest *req = g_task_get_task_data (l->data);
+    if (!req->done && !(keep_flush && req->flush))
+      ov_control_request_return (l->data, NULL, g_error_copy (error));
+  }
+  g_list_free (tasks);
+}
+
+static gint
+compare_request_ids (GTask * a, GTask * b)
+{
+  OvControlRequest *ra = g_task_get_task_data (a);
+  OvControlRequest *rb = g_task_get_task_data (b);
+
+  return ra->id < rb->id ? -1 : (ra->id > rb->id ? 1 : 0);
+}
+
+/* Older remotes close the connection without replying when they get a
+ * message in a version they don't know. If that's what happened, step down to
+ * the previous version and return TRUE. */
+static gboolean
+ov_control_channel_downgrade (OvControlChannel * channel,
+    const GError * error)
+{
+  guint ii;
+
+  /* We've had replies on this connection, or nothing was sent on it yet */
+  if (channel->conn_used || (g_hash_table_size (channel->pending) == 0 &&
+        !(channel->writing && channel->write_offset > 0)))
+    return FALSE;
+
+  /* Timeouts and protocol errors don't mean anything about the version */
+  if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT) ||
+      g_error_matches (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA))
+    return FALSE;
+
+  for (ii = 1; ii < G_N_ELEMENTS (ov_versions); ii++) {
+    if (ov_versions[ii] != channel->version)
+      continue;
+    GST_INFO ("Remote %s closed the connection without replying; falling "
+        "back to protocol version %u", channel->addr_s, ov_versions[ii - 1]);
+    channel->version = ov_versions[ii - 1];
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
+/* The connection failed. Requests that were sent on a connection that was
+ * already in use get one more try on a new connection; everything else fails
+ * with @error. If the remote didn't understand our protocol version, they're
+ * all resent in an older one instead. */
+static void
+ov_control_channel_disconnected (OvControlChannel * channel,
+    const GError * error)
+{
+  GList *sent, *l;
+  gboolean retry = channel->conn_used;
+  gboolean downgraded;
+
+  GST_DEBUG ("Control connection to %s failed: %s", channel->addr_s,
+      error->message);
+
+  downgraded = ov_control_channel_downgrade (channel, error);
+
+  /* A partially-written head request counts as sent */
+  if (channel->writing) {
+    GTask *head = g_queue_pop_head (&channel->outq);
+    OvControlRequest *req = g_task_get_task_data (head);
+    if (!req->done)
+      g_hash_table_insert (channel->pending, &req->id, head);
+    channel->writing = FALSE;
+  }
+  ov_control_channel_close (channel);
+
+  /* Requeue in the order they were sent */
+  sent = g_list_sort (g_hash_table_get_values (channel->pending),
+      (GCompareFunc) compare_request_ids);
+  for (l = g_list_last (sent); l != NULL; l = l->prev) {
+    OvControlRequest *req = g_task_get_task_data (l->data);
+
+    if (downgraded || (retry && !req->retried)) {
+      if (!downgraded)
+        req->retried = TRUE;
+      /* Serialized again when it's written, in channel->version */
+      g_clear_pointer (&req->bytes, g_bytes_unref);
+      g_hash_table_remove (channel->pending, &req->id);
+      g_queue_push_head (&channel->outq, l->data);
+    } else {
+      ov_control_request_return (l->data, NULL, g_error_copy (error));
+    }
+  }
+  g_list_free (sent);
+
+  if (!g_queue_is_empty (&channel->outq))
+    ov_control_channel_connect (channel);
+}
+
+static void
+on_control_channel_connected (GSocketClient * client, GAsyncResult * res,
+    GCancellable * cancellable)
+{
+  GSocket *socket;
   GSocketConnection *conn;
-  GInputStream *input;
-  GOutputStream *output;
+  OvControlChannel *channel;
+  GError *error = NULL;
+
+  channel = g_object_get_data (G_OBJECT (cancellable), "ov-control-channel");
+  conn = g_socket_client_connect_finish (client, res, &error);
+  /* Closed while we were connecting; the cancellable is per-attempt */
+  if (g_cancellable_is_cancelled (cancellable)) {
+    g_clear_object (&conn);
+    goto out;
+  }
+  channel->connecting = FALSE;
+
+  if (!conn) {
+    GST_ERROR ("Unable to connect to %s: %s", channel->addr_s,
+        error->message);
+    /* Don't retry on connection failures, just fail everything waiting */
+    ov_control_channel_fail_all (channel, error, FALSE);
+    goto out;
+  }
+
+  socket = g_socket_connection_get_socket (conn);
+  /* Control messages are small and we always wait for the reply, so don't let
+   * Nagle hold them back waiting for more data */
+  ov_socket_set_tcp_nodelay (socket);
+  /* Notice remotes that went away without closing the connection */
+  g_socket_set_keepalive (socket, TRUE);
+
+  GST_DEBUG ("Opened control connection to %s", channel->addr_s);
+  channel->conn = conn;
+  channel->msg = g_new0 (OvTcpMsg, 1);
+
+  ov_control_channel_read (channel);
+  ov_control_channel_write (channel);
+out:
+  g_clear_error (&error);
+  g_object_unref (cancellable);
+  ov_control_op_end (channel);
+}
+
+static void
+ov_control_channel_connect (OvControlChannel * channel)
+{
+  GSocketClient *client;
   GSocketAddress *addr;
   GInetSocketAddress *local_addr;
-  OvTcpMsg *reply = NULL;
+
+  if (channel->conn || channel->connecting)
+    return;
 
   client = g_socket_client_new ();
 
   /* Set local address with random port to ensure that we connect from the same
    * interface that we're listening on */
-  g_object_get (OV_PEER (remote->local), "address", &local_addr, NULL);
+  g_object_get (OV_PEER (channel->local), "address", &local_addr, NULL);
   addr = g_inet_socket_address_new (
       g_inet_socket_address_get_address (local_addr), 0);
   g_socket_client_set_local_address (client, addr);
@@ -103,133 +513,798 @@ ov_remote_peer_send_tcp_msg (OvRemotePeer * remote, OvTcpMsg * msg,
   /* Set timeout */
   g_socket_client_set_timeout (client, OV_TCP_TIMEOUT);
 
-  conn = g_socket_client_connect (client, G_SOCKET_CONNECTABLE (remote->addr),
-      cancellable, error);
-  if (!conn) {
-    GST_ERROR ("Unable to connect to %s (%s): %s", remote->id, remote->addr_s,
-        error ? (*error)->message : "Unknown error");
-    goto no_conn;
+  channel->connecting = TRUE;
+  g_clear_object (&channel->cancellable);
+  channel->cancellable = g_cancellable_new ();
+  g_object_set_data (G_OBJECT (channel->cancellable), "ov-control-channel",
+      channel);
+  ov_control_op_begin (channel);
+  g_socket_client_connect_async (client, G_SOCKET_CONNECTABLE (channel->addr),
+      channel->cancellable,
+      (GAsyncReadyCallback) on_control_channel_connected,
+      g_object_ref (channel->cancellable));
+  g_object_unref (client);
+}
+
+static void
+on_control_channel_written (GOutputStream * output, GAsyncResult * res,
+    OvControlChannel * channel)
+{
+  gssize written;
+  GTask *head;
+  OvControlRequest *req;
+  GError *error = NULL;
+
+  written = g_output_stream_write_finish (output, res, &error);
+  /* Stale write from a connection that has been closed */
+  if (!channel->conn ||
+      output != g_io_stream_get_output_stream (G_IO_STREAM (channel->conn)))
+    goto out;
+
+  if (written < 0) {
+    ov_control_channel_disconnected (channel, error);
+    goto out;
   }
 
-  tmp = ov_tcp_msg_print (msg);
-  GST_TRACE ("Sending to '%s' a '%s' msg of size %u: %s", remote->id,
-      ov_tcp_msg_type_to_string (msg->type, msg->version),
-      msg->size, tmp);
-  g_free (tmp);
+  head = g_queue_peek_head (&channel->outq);
+  req = g_task_get_task_data (head);
+  channel->write_offset += written;
+  if (channel->write_offset < g_bytes_get_size (req->bytes)) {
+    channel->writing = FALSE;
+    ov_control_channel_write (channel);
+    goto out;
+  }
+
+  g_queue_pop_head (&channel->outq);
+  channel->writing = FALSE;
+  channel->write_offset = 0;
+  if (req->done)
+    /* Timed out or cancelled while being written */
+    ov_control_channel_maybe_close (channel);
+  else
+    g_hash_table_insert (channel->pending, &req->id, head);
+
+  ov_control_channel_write (channel);
+out:
+  g_clear_error (&error);
+  ov_control_op_end (channel);
+}
+
+static void
+ov_control_channel_write (OvControlChannel * channel)
+{
+  gsize size;
+  const gchar *data;
+  GTask *head;
+  OvControlRequest *req;
+  GOutputStream *output;
+
+  if (channel->writing || g_queue_is_empty (&channel->outq))
+    return;
+
+  if (!channel->conn) {
+    ov_control_channel_connect (channel);
+    return;
+  }
+
+  /* Version 1 remotes don't put the request id in their replies, so we can
+   * only match a reply to the one request that is waiting for it */
+  if (channel->version < 2 && g_hash_table_size (channel->pending) > 0)
+    return;
+
+  head = g_queue_peek_head (&channel->outq);
+  req = g_task_get_task_data (head);
+  if (req->bytes == NULL) {
+    ov_tcp_msg_set_version (req->msg, channel->version);
+    req->bytes = ov_tcp_msg_to_bytes (req->msg);
+  }
+  data = g_bytes_get_data (req->bytes, &size);
+
+  output = g_io_stream_get_output_stream (G_IO_STREAM (channel->conn));
+  channel->writing = TRUE;
+  ov_control_op_begin (channel);
+  g_output_stream_write_async (output, data + channel->write_offset,
+      size - channel->write_offset, G_PRIORITY_DEFAULT, channel->cancellable,
+      (GAsyncReadyCallback) on_control_channel_written, channel);
+}
+
+static void
+ov_control_channel_handle_reply (OvControlChannel * channel, OvTcpMsg * reply)
+{
+  GTask *task;
+
+  task = g_hash_table_lookup (channel->pending, &reply->id);
+  if (!task && channel->version < 2 &&
+      g_hash_table_size (channel->pending) == 1) {
+    GHashTableIter iter;
+
+    g_hash_table_iter_init (&iter, channel->pending);
+    g_hash_table_iter_next (&iter, NULL, (gpointer) &task);
+  }
+  if (!task) {
+    /* Reply to a request that has timed out or been cancelled */
+    GST_DEBUG ("Dropping reply '%s' from %s to unknown request %"
+        G_GUINT64_FORMAT, ov_tcp_msg_type_to_string (reply->type,
+          reply->version), channel->addr_s, reply->id);
+    ov_tcp_msg_free (reply);
+    return;
+  }
 
-  output = g_io_stream_get_output_stream (G_IO_STREAM (conn));
-  ret = ov_tcp_msg_write_to_stream (output, msg, cancellable, error);
-  if (!ret)
+  channel->conn_used = TRUE;
+  ov_control_request_return (task, reply, NULL);
+  /* With version 1 remotes, the next request waits for this reply */
+  ov_control_channel_write (channel);
+}
+
+static void
+on_control_channel_read (GInputStream * input, GAsyncResult * res,
+    OvControlChannel * channel)
+{
+  gssize bytes_read;
+  GBytes *body;
+  OvTcpMsg *reply;
+  GError *error = NULL;
+
+  bytes_read = g_input_stream_read_finish (input, res, &error);
+  /* Stale read from a connection that has been closed */
+  if (!channel->conn ||
+      input != g_io_stream_get_input_stream (G_IO_STREAM (channel->conn)))
     goto out;
 
-  input = g_io_stream_get_input_stream (G_IO_STREAM (conn));
-  reply = ov_tcp_msg_read_from_stream (input, cancellable, error);
-  if (!reply)
+  if (bytes_read <= 0) {
+    if (bytes_read == 0)
+      g_set_error_literal (&error, G_IO_ERROR, G_IO_ERROR_CLOSED,
+          "Connection closed by remote");
+    if (g_queue_is_empty (&channel->outq) &&
+        g_hash_table_size (channel->pending) == 0) {
+      /* The remote closed an idle connection; reconnect on the next send */
+      GST_DEBUG ("Idle control connection to %s closed: %s", channel->addr_s,
+          error->message);
+      ov_control_channel_close (channel);
+    } else {
+      ov_control_channel_disconnected (channel, error);
+    }
+    goto out;
+  }
+
+  channel->offset += bytes_read;
+
+  if (channel->body == NULL) {
+    if (channel->offset < OV_TCP_MSG_HEADER_SIZE)
+      goto read_more;
+
+    if (!ov_tcp_msg_parse_header (channel->msg, channel->header)) {
+      g_set_error (&error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+          "Invalid reply header from %s", channel->addr_s);
+      /* Never retry on protocol errors */
+      channel->conn_used = FALSE;
+      ov_control_channel_disconnected (channel, error);
+      goto out;
+    }
+
+    if (channel->msg->size == 0)
+      goto reply_done;
+
+    channel->body = g_malloc (channel->msg->size);
+    channel->offset = 0;
+    goto read_more;
+  }
+
+  if (channel->offset < channel->msg->size)
+    goto read_more;
+
+  body = g_bytes_new_take (channel->body, channel->msg->size);
+  channel->body = NULL;
+  if (!ov_tcp_msg_parse_body (channel->msg, body)) {
+    GST_ERROR ("Unable to parse reply body from %s", channel->addr_s);
+    g_bytes_unref (body);
+    g_clear_pointer (&channel->msg, ov_tcp_msg_free);
+    goto next_reply;
+  }
+  g_bytes_unref (body);
+
+reply_done:
+  reply = channel->msg;
+  channel->msg = NULL;
+  GST_DEBUG ("Read reply type %s and version %u of length %u bytes from %s",
+      ov_tcp_msg_type_to_string (reply->type, reply->version),
+      reply->version, reply->size, channel->addr_s);
+  ov_control_channel_handle_reply (channel, reply);
+  /* Handling the reply can close the channel */
+  if (!channel->conn)
     goto out;
 
+next_reply:
+  channel->msg = g_new0 (OvTcpMsg, 1);
+  channel->offset = 0;
+read_more:
+  ov_control_channel_read (channel);
 out:
-  g_io_stream_close (G_IO_STREAM (conn), NULL, NULL);
-  g_object_unref (conn);
-no_conn:
-  g_object_unref (client);
-  return reply;
+  g_clear_error (&error);
+  ov_control_op_end (channel);
+}
+
+static void
+ov_control_channel_read (OvControlChannel * channel)
+{
+  gchar *buffer;
+  gsize size;
+  GInputStream *input;
+
+  if (channel->body == NULL) {
+    buffer = channel->header;
+    size = OV_TCP_MSG_HEADER_SIZE;
+  } else {
+    buffer = channel->body;
+    size = channel->msg->size;
+  }
+
+  input = g_io_stream_get_input_stream (G_IO_STREAM (channel->conn));
+  ov_control_op_begin (channel);
+  g_input_stream_read_async (input, buffer + channel->offset,
+      size - channel->offset, G_PRIORITY_DEFAULT, channel->cancellable,
+      (GAsyncReadyCallback) on_control_channel_read, channel);
+}
+
+/* We gave up on a request that a version 1 remote may still reply to. Those
+ * replies don't carry the request id, so it would be taken as the reply to
+ * the next request; use a new connection for that one instead. */
+static void
+ov_control_channel_forget_v1_reply (OvControlChannel * channel)
+{
+  if (channel->version >= 2 || channel->conn == NULL)
+    return;
+
+  GST_DEBUG ("Reconnecting to %s to discard a late reply", channel->addr_s);
+  ov_control_channel_close (channel);
+  ov_control_channel_write (channel);
+}
+
+static gboolean
+on_control_request_timeout (GTask * task)
+{
+  OvControlRequest *req = g_task_get_task_data (task);
+  OvControlChannel *channel = req->channel;
+  gboolean being_written, sent;
+
+  GST_WARNING ("Request %" G_GUINT64_FORMAT " to %s timed out", req->id,
+      channel->addr_s);
+
+  being_written = channel->writing &&
+    g_queue_peek_head (&channel->outq) == task;
+  sent = g_hash_table_lookup (channel->pending, &req->id) == task;
+
+  /* Keep the channel alive in case returning drops the last ref */
+  ov_control_channel_ref (channel);
+  ov_control_request_return (task, NULL, g_error_new (G_IO_ERROR,
+        G_IO_ERROR_TIMED_OUT, "Timed out waiting for a reply from %s",
+        channel->addr_s));
+  /* The remote isn't reading what we send, don't wait on it any longer */
+  if (being_written) {
+    GError *error = g_error_new (G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+        "Timed out writing to %s", channel->addr_s);
+    ov_control_channel_disconnected (channel, error);
+    g_error_free (error);
+  } else if (sent) {
+    ov_control_channel_forget_v1_reply (channel);
+  }
+  ov_control_channel_unref (channel);
+
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+on_control_request_cancelled (GCancellable * cancellable, GTask * task)
+{
+  OvControlRequest *req = g_task_get_task_data (task);
+  OvControlChannel *channel = req->channel;
+  gboolean sent;
+  GError *error = NULL;
+
+  sent = g_hash_table_lookup (channel->pending, &req->id) == task;
+
+  ov_control_channel_ref (channel);
+  g_cancellable_set_error_if_cancelled (cancellable, &error);
+  ov_control_request_return (task, NULL, error);
+  if (sent)
+    ov_control_channel_forget_v1_reply (channel);
+  ov_control_channel_unref (channel);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Runs in the control thread */
+static gboolean
+ov_control_channel_queue_request (GTask * task)
+{
+  GCancellable *cancellable;
+  OvControlRequest *req = g_task_get_task_data (task);
+  OvControlChannel *channel = req->channel;
+  OvLocalPeerPrivate *priv = ov_local_peer_get_private (channel->local);
+
+  if (!channel->listed) {
+    priv->control_channels = g_list_prepend (priv->control_channels, channel);
+    channel->listed = TRUE;
+  }
+
+  if (priv->control_stopping) {
+    req->done = TRUE;
+    g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_CLOSED,
+        "Shutting down");
+    g_object_unref (task);
+    ov_control_channel_unref (channel);
+    return G_SOURCE_REMOVE;
+  }
+
+  req->timeout_source = g_timeout_source_new_seconds (req->timeout);
+  g_source_set_callback (req->timeout_source,
+      (GSourceFunc) on_control_request_timeout, task, NULL);
+  g_source_attach (req->timeout_source, priv->control_context);
+
+  cancellable = g_task_get_cancellable (task);
+  if (cancellable) {
+    req->cancel_source = g_cancellable_source_new (cancellable);
+    g_source_set_callback (req->cancel_source,
+        (GSourceFunc) on_control_request_cancelled, task, NULL);
+    g_source_attach (req->cancel_source, priv->control_context);
+  }
+
+  g_queue_push_tail (&channel->outq, task);
+  ov_control_channel_write (channel);
+
+  return G_SOURCE_REMOVE;
 }
 
+/* Runs in the control thread */
+static gboolean
+ov_control_channel_do_release (OvControlChannel * channel)
+{
+  channel->released = TRUE;
+  ov_control_channel_maybe_close (channel);
+  ov_control_channel_unref (channel);
+  return G_SOURCE_REMOVE;
+}
+
+/* Drops the remote's ref. Requests that are already queued are still sent
+ * (or time out) before the connection is closed. */
 void
-ov_remote_peer_send_tcp_msg_quick_noreply (OvRemotePeer * remote,
-    OvTcpMsg * msg)
+ov_control_channel_release (OvControlChannel * channel)
 {
-  gchar *tmp;
-  GSocketClient *client;
-  GSocketConnection *conn;
-  GSocketAddress *addr;
-  GOutputStream *output;
-  GInetSocketAddress *local_addr;
+  OvLocalPeerPrivate *priv = ov_local_peer_get_private (channel->local);
 
-  client = g_socket_client_new ();
+  if (priv->control_context == NULL) {
+    /* Never used, or the control thread is already gone */
+    channel->released = TRUE;
+    ov_control_channel_unref (channel);
+    return;
+  }
 
-  /* Set local address with random port to ensure that we connect from the same
-   * interface that we're listening on */
-  g_object_get (OV_PEER (remote->local), "address", &local_addr, NULL);
-  addr = g_inet_socket_address_new (
-      g_inet_socket_address_get_address (local_addr), 0);
-  g_socket_client_set_local_address (client, addr);
-  g_object_unref (local_addr);
-  g_object_unref (addr);
+  g_main_context_invoke (priv->control_context,
+      (GSourceFunc) ov_control_channel_do_release, channel);
+}
+
+/* Runs in the control thread. Fails all requests except one-way messages
+ * that are already being sent, which get to finish their current attempt (so
+ * that END_CALL still goes out when we hang up and exit), closes all other
+ * connections, and quits the control loop once all I/O has come back. */
+gboolean
+ov_local_peer_stop_control (OvLocalPeer * local)
+{
+  GList *channels, *l;
+  GError *error;
+  OvLocalPeerPrivate *priv;
+
+  priv = ov_local_peer_get_private (local);
+  priv->control_stopping = TRUE;
+
+  error = g_error_new_literal (G_IO_ERROR, G_IO_ERROR_CLOSED, "Shutting down");
+  /* Failing requests can free released channels and unlist them */
+  channels = g_list_copy (priv->control_channels);
+  g_list_foreach (channels, (GFunc) ov_control_channel_ref, NULL);
+  for (l = channels; l != NULL; l = l->next) {
+    OvControlChannel *channel = l->data;
+
+    while (channel->retries != NULL) {
+      GST_WARNING ("Not resending a one-way message to %s: shutting down",
+          channel->addr_s);
+      ov_oneway_msg_free (channel->retries->data);
+      channel->retries = g_list_delete_link (channel->retries,
+          channel->retries);
+    }
+    ov_control_channel_fail_all (channel, error, TRUE);
+    ov_control_channel_maybe_close (channel);
+  }
+  g_list_free_full (channels, (GDestroyNotify) ov_control_channel_unref);
+  g_error_free (error);
+
+  if (priv->control_ops == 0)
+    g_main_loop_quit (priv->control_loop);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Sends @msg to @remote on its control channel. The reply is returned from
+ * ov_remote_peer_send_tcp_msg_finish(), and @callback is called in the
+ * thread-default main context of the calling thread. Fails with
+ * G_IO_ERROR_TIMED_OUT if there's no reply within @timeout seconds. */
+void
+ov_remote_peer_send_tcp_msg_async (OvRemotePeer * remote, OvTcpMsg * msg,
+    guint timeout, GCancellable * cancellable, GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  gchar *tmp;
+  GTask *task;
+  OvControlRequest *req;
+  OvLocalPeerPrivate *priv;
 
-  /* Wait at most 1 second per client */
-  g_socket_client_set_timeout (client, 1);
+  priv = ov_local_peer_get_private (remote->local);
 
-  conn = g_socket_client_connect (client, G_SOCKET_CONNECTABLE (remote->addr),
-      NULL, NULL);
-  if (!conn)
-    goto no_conn;
+  task = g_task_new (NULL, cancellable, callback, user_data);
+
+  if (priv->control_context == NULL) {
+    g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_NOT_CONNECTED,
+        "Local peer is not started");
+    g_object_unref (task);
+    return;
+  }
 
   tmp = ov_tcp_msg_print (msg);
-  GST_TRACE ("Quick-sending to '%s' a '%s' msg of size %u: %s", remote->id,
+  GST_TRACE ("Sending to '%s' a '%s' msg of size %u: %s", remote->id,
       ov_tcp_msg_type_to_string (msg->type, msg->version),
       msg->size, tmp);
   g_free (tmp);
 
-  output = g_io_stream_get_output_stream (G_IO_STREAM (conn));
-  if (!ov_tcp_msg_write_to_stream (output, msg, NULL, NULL))
+  req = g_new0 (OvControlRequest, 1);
+  req->channel = ov_control_channel_ref (remote->priv->control);
+  req->id = msg->id;
+  req->msg = ov_tcp_msg_copy (msg);
+  req->timeout = timeout;
+  g_task_set_task_data (task, req, (GDestroyNotify) ov_control_request_free);
+
+  /* The task and the channel ref are owned by the control thread now */
+  g_main_context_invoke (priv->control_context,
+      (GSourceFunc) ov_control_channel_queue_request, task);
+}
+
+OvTcpMsg *
+ov_remote_peer_send_tcp_msg_finish (GAsyncResult * result, GError ** error)
+{
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+static void
+on_async_result (GObject * source G_GNUC_UNUSED, GAsyncResult * res,
+    GAsyncResult ** result)
+{
+  *result = g_object_ref (res);
+}
+
+/* Iterates the thread-default context until @result is set. Used to wait for
+ * async operations started with that context as the thread-default. */
+static GAsyncResult *
+ov_wait_for_result (GAsyncResult ** result)
+{
+  GMainContext *context = g_main_context_get_thread_default ();
+
+  while (*result == NULL)
+    g_main_context_iteration (context, TRUE);
+
+  return *result;
+}
+
+/* Like ov_wait_for_result(), but for a whole batch of async operations that
+ * were started at the same time */
+static void
+ov_wait_for_results (GAsyncResult ** results, guint n_results)
+{
+  guint ii = 0;
+  GMainContext *context = g_main_context_get_thread_default ();
+
+  while (ii < n_results) {
+    if (results[ii] == NULL)
+      g_main_context_iteration (context, TRUE);
+    else
+      ii++;
+  }
+}
+
+static void
+ov_free_results (GAsyncResult ** results, guint n_results)
+{
+  guint ii;
+
+  for (ii = 0; ii < n_results; ii++)
+    g_clear_object (&results[ii]);
+  g_free (results);
+}
+
+/* Blocks until the reply arrives. Must not be called from the control thread
+ * or with the thread-default context of another thread. */
+OvTcpMsg *
+ov_remote_peer_send_tcp_msg (OvRemotePeer * remote, OvTcpMsg * msg,
+    GCancellable * cancellable, GError ** error)
+{
+  OvTcpMsg *reply;
+  GMainContext *context;
+  GAsyncResult *result = NULL;
+
+  context = g_main_context_new ();
+  g_main_context_push_thread_default (context);
+
+  ov_remote_peer_send_tcp_msg_async (remote, msg, OV_TCP_TIMEOUT, cancellable,
+      (GAsyncReadyCallback) on_async_result, &result);
+  reply = ov_remote_peer_send_tcp_msg_finish (ov_wait_for_result (&result),
+      error);
+  g_object_unref (result);
+
+  g_main_context_pop_thread_default (context);
+  g_main_context_unref (context);
+
+  return reply;
+}
+
+static const OvOnewayPolicy *
+ov_oneway_policy_lookup (OvTcpMsgType type)
+{
+  guint ii;
+
+  for (ii = 0; ii < G_N_ELEMENTS (oneway_policies); ii++)
+    if (oneway_policies[ii].type == type)
+      return &oneway_policies[ii];
+
+  return &oneway_default_policy;
+}
+
+static void
+ov_oneway_msg_free (OvOnewayMsg * oneway)
+{
+  if (oneway->retry_source) {
+    g_source_destroy (oneway->retry_source);
+    g_source_unref (oneway->retry_source);
+  }
+  ov_tcp_msg_free (oneway->msg);
+  ov_control_channel_unref (oneway->channel);
+  g_free (oneway);
+}
+
+static void ov_oneway_msg_send (OvOnewayMsg * oneway);
+
+static gboolean
+on_oneway_msg_retry (OvOnewayMsg * oneway)
+{
+  OvControlChannel *channel = oneway->channel;
+
+  channel->retries = g_list_remove (channel->retries, oneway);
+  g_clear_pointer (&oneway->retry_source, g_source_unref);
+  ov_oneway_msg_send (oneway);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Runs in the control thread */
+static void
+on_oneway_msg_reply (GObject * source G_GNUC_UNUSED, GAsyncResult * res,
+    OvOnewayMsg * oneway)
+{
+  guint delay;
+  gchar *error_msg;
+  OvTcpMsg *reply;
+  const gchar *type_s;
+  OvControlChannel *channel = oneway->channel;
+  OvLocalPeerPrivate *priv = ov_local_peer_get_private (channel->local);
+  GError *error = NULL;
+
+  type_s = ov_tcp_msg_type_to_string (oneway->msg->type,
+      oneway->msg->version);
+
+  reply = ov_remote_peer_send_tcp_msg_finish (res, &error);
+  if (reply) {
+    switch (reply->type) {
+      case OV_TCP_MSG_TYPE_ACK:
+        handle_tcp_msg_ack (reply);
+        GST_DEBUG ("Recvd from %s ACK for '%s'", channel->addr_s, type_s);
+        break;
+      case OV_TCP_MSG_TYPE_ERROR:
+        /* The remote got it, so sending it again won't help */
+        error_msg = handle_tcp_msg_error (reply);
+        GST_WARNING ("Remote %s returned an error in reply to '%s': %s",
+            channel->addr_s, type_s, error_msg);
+        g_free (error_msg);
+        break;
+      default:
+        GST_ERROR ("Expected message type '%s' from %s, got '%s'",
+            ov_tcp_msg_type_to_string (
+              OV_TCP_MSG_TYPE_ACK, OV_TCP_MAX_VERSION),
+            channel->addr_s, ov_tcp_msg_type_to_string (reply->type,
+              reply->version));
+    }
+    ov_tcp_msg_free (reply);
+    goto out;
+  }
+
+  if (priv->control_stopping ||
+      oneway->attempt >= oneway->policy->attempts) {
+    GST_WARNING ("Giving up on sending '%s' to %s after %u attempt(s): %s",
+        type_s, channel->addr_s, oneway->attempt, error->message);
     goto out;
+  }
 
-out:
-  g_io_stream_close (G_IO_STREAM (conn), NULL, NULL);
-  g_object_unref (conn);
-no_conn:
-  g_object_unref (client);
+  delay = MIN (OV_ONEWAY_RETRY_MS << (oneway->attempt - 1),
+      OV_ONEWAY_RETRY_MAX_MS);
+  GST_DEBUG ("Unable to send '%s' to %s: %s; trying again in %ums", type_s,
+      channel->addr_s, error->message, delay);
+  oneway->retry_source = g_timeout_source_new (delay);
+  g_source_set_callback (oneway->retry_source,
+      (GSourceFunc) on_oneway_msg_retry, oneway, NULL);
+  g_source_attach (oneway->retry_source, priv->control_context);
+  channel->retries = g_list_prepend (channel->retries, oneway);
+  g_clear_error (&error);
   return;
+
+out:
+  g_clear_error (&error);
+  ov_oneway_msg_free (oneway);
 }
 
+/* Runs in the control thread, so the reply is dispatched there too */
+static void
+ov_oneway_msg_send (OvOnewayMsg * oneway)
+{
+  GTask *task;
+  OvControlRequest *req;
+
+  oneway->attempt++;
+
+  task = g_task_new (NULL, NULL, (GAsyncReadyCallback) on_oneway_msg_reply,
+      oneway);
+  req = g_new0 (OvControlRequest, 1);
+  req->channel = ov_control_channel_ref (oneway->channel);
+  /* Resent with the same id; a late reply to an earlier attempt is just as
+   * good */
+  req->id = oneway->msg->id;
+  req->msg = ov_tcp_msg_copy (oneway->msg);
+  req->timeout = oneway->policy->timeout;
+  req->flush = TRUE;
+  g_task_set_task_data (task, req, (GDestroyNotify) ov_control_request_free);
+
+  ov_control_channel_queue_request (task);
+}
+
+/* Runs in the control thread */
 static gboolean
-ov_remote_peer_tcp_client_start_negotiate (OvRemotePeer * remote,
-    guint64 call_id, GCancellable * cancellable, GError ** error)
+ov_oneway_msg_start (OvOnewayMsg * oneway)
 {
-  gchar *error_msg, *local_id;
-  GInetSocketAddress *local_addr;
-  OvTcpMsg *msg, *reply = NULL;
-  gboolean ret = FALSE;
+  OvLocalPeerPrivate *priv;
+
+  priv = ov_local_peer_get_private (oneway->channel->local);
+  if (priv->control_stopping) {
+    GST_WARNING ("Not sending '%s' to %s: shutting down",
+        ov_tcp_msg_type_to_string (oneway->msg->type, oneway->msg->version),
+        oneway->channel->addr_s);
+    ov_oneway_msg_free (oneway);
+    return G_SOURCE_REMOVE;
+  }
 
-  g_object_get (remote->local, "address", &local_addr, "id", &local_id, NULL);
-  msg = ov_tcp_msg_new_start_negotiate (call_id, local_id,
-      g_inet_socket_address_get_port (local_addr));
-  g_object_unref (local_addr);
-  g_free (local_id);
+  ov_oneway_msg_send (oneway);
+  return G_SOURCE_REMOVE;
+}
 
-  reply = ov_remote_peer_send_tcp_msg (remote, msg, cancellable, error);
-  if (!reply)
-    goto no_reply;
+/* Queues @msg on @remote's control channel and returns immediately. The
+ * reply is only logged. How long we wait for it, and how many times the
+ * message is resent with exponential backoff if it times out or the
+ * connection fails, depends on its type; see oneway_policies. Messages that
+ * are already being sent are still sent after @remote is freed. */
+void
+ov_remote_peer_send_tcp_msg_oneway (OvRemotePeer * remote, OvTcpMsg * msg)
+{
+  gchar *tmp;
+  OvOnewayMsg *oneway;
+  OvLocalPeerPrivate *priv;
+
+  priv = ov_local_peer_get_private (remote->local);
+
+  if (priv->control_context == NULL) {
+    GST_WARNING ("Not sending '%s' to %s: local peer is not started",
+        ov_tcp_msg_type_to_string (msg->type, msg->version), remote->addr_s);
+    return;
+  }
+
+  tmp = ov_tcp_msg_print (msg);
+  GST_TRACE ("Sending to '%s' a one-way '%s' msg of size %u: %s", remote->id,
+      ov_tcp_msg_type_to_string (msg->type, msg->version),
+      msg->size, tmp);
+  g_free (tmp);
+
+  oneway = g_new0 (OvOnewayMsg, 1);
+  oneway->channel = ov_control_channel_ref (remote->priv->control);
+  oneway->msg = ov_tcp_msg_copy (msg);
+  oneway->policy = ov_oneway_policy_lookup (msg->type);
+
+  g_main_context_invoke (priv->control_context,
+      (GSourceFunc) ov_oneway_msg_start, oneway);
+}
+
+static void
+on_start_negotiate_reply (GObject * source G_GNUC_UNUSED, GAsyncResult * res,
+    GTask * task)
+{
+  gchar *error_msg;
+  OvTcpMsg *reply;
+  OvRemotePeer *remote = g_task_get_task_data (task);
+  GError *error = NULL;
+
+  reply = ov_remote_peer_send_tcp_msg_finish (res, &error);
+  if (!reply) {
+    g_task_return_error (task, error);
+    goto out;
+  }
 
   switch (reply->type) {
     case OV_TCP_MSG_TYPE_OK_NEGOTIATE:
       g_assert (remote->id == NULL);
       remote->id = handle_tcp_msg_ok_negotiate (reply);
       GST_DEBUG ("Recvd OK from '%s'", remote->id);
+      g_task_return_boolean (task, TRUE);
       break;
     case OV_TCP_MSG_TYPE_ERROR:
       /* Try again? */
       error_msg = handle_tcp_msg_error (reply);
       GST_ERROR ("Remote %s returned an error while starting negotiation: %s",
           remote->addr_s, error_msg);
+      g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED,
+          "Remote returned an error: %s", error_msg);
       g_free (error_msg);
-      goto err;
+      break;
     default:
       GST_ERROR ("Expected message type '%s' from %s, got '%s'",
           ov_tcp_msg_type_to_string (
-            OV_TCP_MSG_TYPE_ACK, OV_TCP_MAX_VERSION),
+            OV_TCP_MSG_TYPE_OK_NEGOTIATE, OV_TCP_MAX_VERSION),
           remote->addr_s, ov_tcp_msg_type_to_string (reply->type,
             reply->version));
-      goto err;
+      g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+          "Unexpected reply");
   }
 
-  ret = TRUE;
-err:
   ov_tcp_msg_free (reply);
-no_reply:
+out:
+  g_object_unref (task);
+}
+
+/* START_NEGOTIATE → OK_NEGOTIATE; sets remote->id */
+static void
+ov_remote_peer_tcp_client_start_negotiate_async (OvRemotePeer * remote,
+    guint64 call_id, GCancellable * cancellable, GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  GTask *task;
+  gchar *local_id;
+  GInetSocketAddress *local_addr;
+  OvCapsCacheEntry *cached;
+  OvLocalPeerPrivate *priv;
+  OvTcpMsg *msg;
+
+  priv = ov_local_peer_get_private (remote->local);
+  cached = g_hash_table_lookup (priv->caps_cache, remote->addr_s);
+
+  g_object_get (remote->local, "address", &local_addr, "id", &local_id, NULL);
+  msg = ov_tcp_msg_new_start_negotiate (call_id, local_id,
+      g_inet_socket_address_get_port (local_addr), cached ? cached->hash : 0);
+  g_object_unref (local_addr);
+  g_free (local_id);
+
+  task = g_task_new (NULL, cancellable, callback, user_data);
+  g_task_set_task_data (task, remote, NULL);
+  ov_remote_peer_send_tcp_msg_async (remote, msg, OV_TCP_TIMEOUT, cancellable,
+      (GAsyncReadyCallback) on_start_negotiate_reply, task);
+
   ov_tcp_msg_free (msg);
-  return ret;
+}
+
+static gboolean
+ov_remote_peer_tcp_client_start_negotiate_finish (GAsyncResult * result,
+    GError ** error)
+{
+  return g_task_propagate_boolean (G_TASK (result), error);
 }
 
 static void
@@ -243,11 +1318,12 @@ ov_remote_peer_tcp_client_cancel_negotiate (OvRemotePeer * remote,
   msg = ov_tcp_msg_new_cancel_negotiate (call_id, local_id);
   g_free (local_id);
 
-  ov_remote_peer_send_tcp_msg_quick_noreply (remote, msg);
+  ov_remote_peer_send_tcp_msg_oneway (remote, msg);
 
   ov_tcp_msg_free (msg);
 }
 
+/* Called with the lock TAKEN */
 static GVariant *
 get_all_peers_list_except_this (OvRemotePeer * remote, guint64 call_id)
 {
@@ -255,9 +1331,9 @@ get_all_peers_list_except_this (OvRemotePeer * remote, guint64 call_id)
   gchar *tmp, *local_id;
   GVariant *peers;
   GVariantBuilder *builder;
-  OvLocalPeerPrivate *local_priv;
+  GPtrArray *remotes;
 
-  local_priv = ov_local_peer_get_private (remote->local);
+  remotes = remote->priv->call->remote_peers;
   g_object_get (OV_PEER (remote->local), "id", &local_id, NULL);
 
   builder = g_variant_builder_new (G_VARIANT_TYPE ("as"));
@@ -266,8 +1342,8 @@ get_all_peers_list_except_this (OvRemotePeer * remote, guint64 call_id)
   g_variant_builder_add (builder, "s", local_id);
   g_free (local_id);
 
-  for (ii = 0; ii < local_priv->remote_peers->len; ii++) {
-    OvRemotePeer *peer = g_ptr_array_index (local_priv->remote_peers, ii);
+  for (ii = 0; ii < remotes->len; ii++) {
+    OvRemotePeer *peer = g_ptr_array_index (remotes, ii);
     if (peer != remote)
       g_variant_builder_add (builder, "s", peer->id);
   }
@@ -282,6 +1358,8 @@ get_all_peers_list_except_this (OvRemotePeer * remote, guint64 call_id)
   return peers;
 }
 
+/* Called with the lock TAKEN. Lists the remotes in the call that @remote is
+ * in, or is being added to. */
 static GVariant *
 get_all_remotes_addr_list_except_this (OvRemotePeer * remote,
     guint64 call_id)
@@ -290,16 +1368,16 @@ get_all_remotes_addr_list_except_this (OvRemotePeer * remote,
   gchar *tmp;
   GVariant *peers;
   GVariantBuilder *builder;
-  OvLocalPeerPrivate *local_priv;
+  GPtrArray *remotes;
 
-  local_priv = ov_local_peer_get_private (remote->local);
+  remotes = remote->priv->call->remote_peers;
 
   builder = g_variant_builder_new (G_VARIANT_TYPE ("a(ss)"));
 
   /* We don't add ourselves here because each peer already knows about us */
 
-  for (ii = 0; ii < local_priv->remote_peers->len; ii++) {
-    OvRemotePeer *peer = g_ptr_array_index (local_priv->remote_peers, ii);
+  for (ii = 0; ii < remotes->len; ii++) {
+    OvRemotePeer *peer = g_ptr_array_index (remotes, ii);
     if (peer != remote)
       /* Here we inform this remote about the address to use to connect to all
        * the other remotes */
@@ -316,19 +1394,20 @@ get_all_remotes_addr_list_except_this (OvRemotePeer * remote,
   return peers;
 }
 
-static OvTcpMsg *
-ov_remote_peer_tcp_client_query_caps (OvRemotePeer * remote,
-    guint64 call_id, GCancellable * cancellable, GError ** error)
+static void
+on_query_caps_reply (GObject * source G_GNUC_UNUSED, GAsyncResult * res,
+    GTask * task)
 {
   gchar *tmp;
-  OvTcpMsg *msg, *reply = NULL;
-
-  msg = ov_tcp_msg_new (OV_TCP_MSG_TYPE_QUERY_CAPS,
-      get_all_remotes_addr_list_except_this (remote, call_id));
+  OvTcpMsg *reply;
+  OvRemotePeer *remote = g_task_get_task_data (task);
+  GError *error = NULL;
 
-  reply = ov_remote_peer_send_tcp_msg (remote, msg, cancellable, error);
-  if (!reply)
-    goto no_reply;
+  reply = ov_remote_peer_send_tcp_msg_finish (res, &error);
+  if (!reply) {
+    g_task_return_error (task, error);
+    goto out;
+  }
 
   switch (reply->type) {
     case OV_TCP_MSG_TYPE_REPLY_CAPS:
@@ -336,34 +1415,121 @@ ov_remote_peer_tcp_client_query_caps (OvRemotePeer * remote,
       tmp = ov_tcp_msg_print (reply);
       GST_DEBUG ("Reply caps from %s: %s", remote->id, tmp);
       g_free (tmp);
-      break;
+      g_task_return_pointer (task, reply, (GDestroyNotify) ov_tcp_msg_free);
+      goto out;
     case OV_TCP_MSG_TYPE_ACK:
       handle_tcp_msg_ack (reply);
       GST_ERROR ("Expected a 'reply-caps' reply, but got ACK instead");
-      goto clear_reply;
+      g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+          "Unexpected reply");
+      break;
     case OV_TCP_MSG_TYPE_ERROR:
       /* Try again? */
       tmp = handle_tcp_msg_error (reply);
       GST_ERROR ("Remote %s returned an error while receiving query caps: %s",
           remote->id, tmp);
+      g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED,
+          "Remote returned an error: %s", tmp);
       g_free (tmp);
-      goto clear_reply;
+      break;
     default:
       GST_ERROR ("Expected message type '%s' from %s, got '%s'",
           ov_tcp_msg_type_to_string (
             OV_TCP_MSG_TYPE_REPLY_CAPS, OV_TCP_MAX_VERSION),
           remote->id, ov_tcp_msg_type_to_string (reply->type,
             reply->version));
-      goto clear_reply;
+      g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+          "Unexpected reply");
   }
 
-no_reply:
+  ov_tcp_msg_free (reply);
+out:
+  g_object_unref (task);
+}
+
+/* QUERY_CAPS → REPLY_CAPS */
+static void
+ov_remote_peer_tcp_client_query_caps_async (OvRemotePeer * remote,
+    guint64 call_id, GCancellable * cancellable, GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  GTask *task;
+  OvTcpMsg *msg;
+
+  msg = ov_tcp_msg_new (OV_TCP_MSG_TYPE_QUERY_CAPS,
+      get_all_remotes_addr_list_except_this (remote, call_id));
+
+  task = g_task_new (NULL, cancellable, callback, user_data);
+  g_task_set_task_data (task, remote, NULL);
+  ov_remote_peer_send_tcp_msg_async (remote, msg, OV_TCP_TIMEOUT, cancellable,
+      (GAsyncReadyCallback) on_query_caps_reply, task);
+
   ov_tcp_msg_free (msg);
-  return reply;
+}
+
+/* Returns the REPLY_CAPS message */
+static OvTcpMsg *
+ov_remote_peer_tcp_client_query_caps_finish (GAsyncResult * result,
+    GError ** error)
+{
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+/* Called with the lock TAKEN
+ *
+ * Returns @reply_caps (a REPLY_CAPS variant) with the caps filled in from the
+ * cache if @remote skipped sending them, and caches them otherwise. Returns
+ * NULL if @remote skipped them but we don't have them. */
+static GVariant *
+ov_local_peer_caps_cache_apply (OvLocalPeer * local, OvRemotePeer * remote,
+    GVariant * reply_caps)
+{
+  guint ii, n_items;
+  const gchar *caps_s[4];
+  GVariant **items, *filled;
+  OvCapsCacheEntry *cached;
+  OvLocalPeerPrivate *priv;
+
+  priv = ov_local_peer_get_private (local);
+
+  /* send_acaps, send_vcaps, recv_acaps, recv_vcaps are items 3 to 6 */
+  for (ii = 0; ii < 4; ii++)
+    g_variant_get_child (reply_caps, ii + 3, "&s", &caps_s[ii]);
+
+  if (caps_s[0][0] != '\0') {
+    cached = g_new0 (OvCapsCacheEntry, 1);
+    for (ii = 0; ii < 4; ii++)
+      cached->caps[ii] = g_strdup (caps_s[ii]);
+    cached->hash = ov_tcp_caps_hash (caps_s[0], caps_s[1], caps_s[2],
+        caps_s[3]);
+    g_hash_table_replace (priv->caps_cache, g_strdup (remote->addr_s),
+        cached);
+    return g_variant_ref (reply_caps);
+  }
 
-clear_reply:
-  g_clear_pointer (&reply, (GDestroyNotify) ov_tcp_msg_free);
-  goto no_reply;
+  cached = g_hash_table_lookup (priv->caps_cache, remote->addr_s);
+  if (cached == NULL) {
+    GST_ERROR ("Remote %s didn't send caps, but we don't have them cached",
+        remote->id);
+    return NULL;
+  }
+  GST_DEBUG ("Using cached caps for remote %s", remote->id);
+
+  n_items = g_variant_n_children (reply_caps);
+  items = g_new (GVariant*, n_items);
+  for (ii = 0; ii < n_items; ii++) {
+    if (ii >= 3 && ii < 7)
+      items[ii] = g_variant_ref_sink (g_variant_new_string (
+            cached->caps[ii - 3]));
+    else
+      items[ii] = g_variant_get_child_value (reply_caps, ii);
+  }
+  filled = g_variant_ref_sink (g_variant_new_tuple (items, n_items));
+  for (ii = 0; ii < n_items; ii++)
+    g_variant_unref (items[ii]);
+  g_free (items);
+
+  return filled;
 }
 
 static void
@@ -378,14 +1544,12 @@ _ov_free_negcaps_value (gpointer data)
 }
 
 static GPtrArray *
-_ov_get_all_peers (OvLocalPeer * local)
+_ov_get_all_peers (OvLocalPeer * local, OvCall * call)
 {
   guint ii;
   GPtrArray *remotes, *peers;
-  OvLocalPeerPrivate *local_priv;
 
-  local_priv = ov_local_peer_get_private (local);
-  remotes = local_priv->remote_peers;
+  remotes = call->remote_peers;
 
   peers = g_ptr_array_sized_new (remotes->len + 1);
   for (ii = 0; ii < remotes->len; ii++) {
@@ -433,8 +1597,8 @@ _ov_strdup_print_aggports (GHashTable * table)
 /* Format of GHashTable *in is: {OvRemotePeer*: GVariant*}
  * GVariant is of type OV_TCP_MSG_TYPE_REPLY_CAPS */
 static GHashTable *
-ov_aggregate_call_details_for_remotes (OvLocalPeer * local, GHashTable * in,
-    guint64 call_id)
+ov_aggregate_call_details_for_remotes (OvLocalPeer * local, OvCall * call,
+    GHashTable * in, guint64 call_id)
 {
   guint ii, jj;
   GstCaps **caps;
@@ -446,8 +1610,8 @@ ov_aggregate_call_details_for_remotes (OvLocalPeer * local, GHashTable * in,
 
   local_priv = ov_local_peer_get_private (local);
   g_object_get (local, "id", &local_id, NULL);
-  remotes = local_priv->remote_peers;
-  peers = _ov_get_all_peers (local);
+  remotes = call->remote_peers;
+  peers = _ov_get_all_peers (local, call);
 
   in_vtype = ov_tcp_msg_type_to_variant_type (
       OV_TCP_MSG_TYPE_REPLY_CAPS, OV_TCP_MAX_VERSION);
@@ -502,8 +1666,7 @@ ov_aggregate_call_details_for_remotes (OvLocalPeer * local, GHashTable * in,
   }
   /* Add ourselves because caps negotiation must include us */
   caps = g_new0 (GstCaps*, 4);
-  caps[0] = gst_caps_ref (local_priv->supported_send_acaps);
-  caps[1] = gst_caps_ref (local_priv->supported_send_vcaps);
+  ov_local_peer_get_send_caps (local, &caps[0], &caps[1]);
   caps[2] = gst_caps_ref (local_priv->supported_recv_acaps);
   caps[3] = gst_caps_ref (local_priv->supported_recv_vcaps);
   g_hash_table_insert (negcaps, local, caps);
@@ -706,8 +1869,9 @@ ov_aggregate_call_details_for_remotes (OvLocalPeer * local, GHashTable * in,
     g_free (from_send_vcaps);
   }
 
-  /* Set the caps we will send */
-  {
+  /* Set the caps we will send, unless we're already sending in another call,
+   * in which case that's what every call gets */
+  if (local_priv->transmit == NULL) {
     GstCaps **caps = g_hash_table_lookup (negcaps, local);
     gst_caps_replace (&local_priv->send_acaps, caps[0]);
     gst_caps_replace (&local_priv->send_vcaps, caps[1]);
@@ -726,173 +1890,230 @@ ov_aggregate_call_details_for_remotes (OvLocalPeer * local, GHashTable * in,
   return out;
 }
 
-static gboolean
-ov_remote_peer_tcp_client_send_call_details (OvRemotePeer * remote,
-    GVariant * details, GCancellable * cancellable, GError ** error)
+typedef struct {
+  OvRemotePeer *remote;
+  /* What the request was, for error messages */
+  const gchar *what;
+} OvAckRequest;
+
+static void
+on_ack_reply (GObject * source G_GNUC_UNUSED, GAsyncResult * res,
+    GTask * task)
 {
   gchar *error_msg;
-  OvTcpMsg *msg, *reply = NULL;
-  gboolean ret = FALSE;
-
-  msg = ov_tcp_msg_new (OV_TCP_MSG_TYPE_CALL_DETAILS, details);
+  OvTcpMsg *reply;
+  OvAckRequest *req = g_task_get_task_data (task);
+  GError *error = NULL;
 
-  reply = ov_remote_peer_send_tcp_msg (remote, msg, cancellable, error);
-  if (!reply)
-    goto no_reply;
+  reply = ov_remote_peer_send_tcp_msg_finish (res, &error);
+  if (!reply) {
+    g_task_return_error (task, error);
+    goto out;
+  }
 
   switch (reply->type) {
     case OV_TCP_MSG_TYPE_ACK:
       handle_tcp_msg_ack (reply);
-      GST_DEBUG ("Recvd from '%s' ACK", remote->id);
+      GST_DEBUG ("Recvd from '%s' ACK", req->remote->id);
+      g_task_return_boolean (task, TRUE);
       break;
     case OV_TCP_MSG_TYPE_ERROR:
       /* Try again? */
       error_msg = handle_tcp_msg_error (reply);
-      GST_ERROR ("Remote %s returned an error while receiving call details: %s",
-          remote->id, error_msg);
+      GST_ERROR ("Remote %s returned an error in reply to %s: %s",
+          req->remote->id, req->what, error_msg);
+      g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED,
+          "Remote returned an error: %s", error_msg);
       g_free (error_msg);
-      goto err;
+      break;
     default:
       GST_ERROR ("Expected message type '%s' from %s, got '%s'",
           ov_tcp_msg_type_to_string (
             OV_TCP_MSG_TYPE_ACK, OV_TCP_MAX_VERSION),
-          remote->id, ov_tcp_msg_type_to_string (reply->type,
+          req->remote->id, ov_tcp_msg_type_to_string (reply->type,
             reply->version));
-      goto err;
+      g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+          "Unexpected reply");
   }
 
-  ret = TRUE;
-err:
   ov_tcp_msg_free (reply);
-no_reply:
-  ov_tcp_msg_free (msg);
-  return ret;
+out:
+  g_object_unref (task);
 }
 
-static gboolean
-ov_remote_peer_tcp_client_start_call (OvRemotePeer * remote, GVariant * peers,
-    GCancellable * cancellable, GError ** error)
+/* Sends @msg, which is answered with an ACK */
+static void
+ov_remote_peer_tcp_client_send_acked_async (OvRemotePeer * remote,
+    OvTcpMsg * msg, const gchar * what, GCancellable * cancellable,
+    GAsyncReadyCallback callback, gpointer user_data)
 {
-  gchar *error_msg;
-  OvTcpMsg *msg, *reply = NULL;
-  gboolean ret = FALSE;
+  GTask *task;
+  OvAckRequest *req;
 
-  msg = ov_tcp_msg_new (OV_TCP_MSG_TYPE_START_CALL, peers);
+  req = g_new0 (OvAckRequest, 1);
+  req->remote = remote;
+  req->what = what;
 
-  reply = ov_remote_peer_send_tcp_msg (remote, msg, cancellable, error);
-  if (!reply)
-    goto no_reply;
+  task = g_task_new (NULL, cancellable, callback, user_data);
+  g_task_set_task_data (task, req, g_free);
+  ov_remote_peer_send_tcp_msg_async (remote, msg, OV_TCP_TIMEOUT, cancellable,
+      (GAsyncReadyCallback) on_ack_reply, task);
+}
 
-  switch (reply->type) {
-    case OV_TCP_MSG_TYPE_ACK:
-      handle_tcp_msg_ack (reply);
-      GST_DEBUG ("Recvd from '%s' ACK", remote->id);
-      break;
-    case OV_TCP_MSG_TYPE_ERROR:
-      /* Try again? */
-      error_msg = handle_tcp_msg_error (reply);
-      GST_ERROR ("Remote %s returned an error while receiving call details: %s",
-          remote->id, error_msg);
-      g_free (error_msg);
-      goto err;
-    default:
-      GST_ERROR ("Expected message type '%s' from %s, got '%s'",
-          ov_tcp_msg_type_to_string (
-            OV_TCP_MSG_TYPE_ACK, OV_TCP_MAX_VERSION),
-          remote->id, ov_tcp_msg_type_to_string (reply->type,
-            reply->version));
-      goto err;
-  }
+static gboolean
+ov_remote_peer_tcp_client_send_acked_finish (GAsyncResult * result,
+    GError ** error)
+{
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+/* CALL_DETAILS → ACK */
+static void
+ov_remote_peer_tcp_client_send_call_details_async (OvRemotePeer * remote,
+    GVariant * details, GCancellable * cancellable,
+    GAsyncReadyCallback callback, gpointer user_data)
+{
+  OvTcpMsg *msg;
 
-  ret = TRUE;
-err:
-  ov_tcp_msg_free (reply);
-no_reply:
+  msg = ov_tcp_msg_new (OV_TCP_MSG_TYPE_CALL_DETAILS, details);
+  ov_remote_peer_tcp_client_send_acked_async (remote, msg, "call details",
+      cancellable, callback, user_data);
   ov_tcp_msg_free (msg);
-  return ret;
 }
 
-/* Called with the lock TAKEN
- *
- * START_NEGOTIATE → ACK
+/* START_CALL → ACK */
+static void
+ov_remote_peer_tcp_client_start_call_async (OvRemotePeer * remote,
+    GVariant * peers, GCancellable * cancellable,
+    GAsyncReadyCallback callback, gpointer user_data)
+{
+  OvTcpMsg *msg;
+
+  msg = ov_tcp_msg_new (OV_TCP_MSG_TYPE_START_CALL, peers);
+  ov_remote_peer_tcp_client_send_acked_async (remote, msg, "start call",
+      cancellable, callback, user_data);
+  ov_tcp_msg_free (msg);
+}
+
+/* Logs how long a negotiation phase took and returns the time it ended at */
+static gint64
+ov_negotiate_log_phase (const gchar * phase, guint n_remotes, gint64 start)
+{
+  gint64 now = g_get_monotonic_time ();
+
+  GST_INFO ("Negotiation phase %s with %u remotes took %" G_GINT64_FORMAT
+      "ms", phase, n_remotes, (now - start) / 1000);
+  return now;
+}
+
+/* START_NEGOTIATE → ACK
  * QUERY_CAPS → REPLY_CAPS
  * CALL_DETAILS → ACK
- * START_CALL → ACK */
-void
-ov_local_peer_negotiate_thread (GTask * task, OvLocalPeer * local,
-    gpointer task_data, GCancellable * cancellable)
+ * START_CALL → ACK
+ *
+ * Each request is an async operation whose callback runs in the
+ * thread-default context that ov_local_peer_negotiate_thread() pushes. Every
+ * phase sends its request to all remotes at once and then iterates that
+ * context until all of them have replied or timed out, so a phase takes one
+ * round-trip no matter how many remotes there are. Since all the requests in
+ * a phase are sent together with the same timeout, OV_TCP_TIMEOUT is also the
+ * deadline for the whole phase.
+ *
+ * Like in ov_local_peer_join(), the lock is dropped while waiting for the
+ * replies so that the comms thread can keep handling incoming messages (and
+ * rejecting them as busy) instead of blocking on it for a whole phase. Nobody
+ * else touches the remotes while we're negotiating: they're only acted upon
+ * by others once the call is PAUSED or PLAYING. The reply callbacks only read
+ * remote->id and remote->addr_s, except for START_NEGOTIATE's, which sets the
+ * id of a remote nobody can look up by id yet. @call isn't freed while its
+ * negotiator_task is set, which we clear under the lock before returning. */
+static void
+ov_local_peer_negotiate (GTask * task, OvLocalPeer * local, OvCall * call,
+    GCancellable * cancellable)
 {
-  gint ii;
+  guint ii, n_results;
   guint64 call_id;
+  gint64 start_time, phase_time;
   GPtrArray *remotes;
+  OvRemotePeer **phase_remotes;
+  GAsyncResult **results;
   /* Hash table of incoming negotiation messages (REPLY_CAPS)
    * and outgoing messages (CALL_DETAILS) for each remote peer
    * The local peer is not included in this hash table as a key,
    * but it is referenced in the values (obviously) */
   GHashTable *in, *out;
-  OvLocalPeerPrivate *local_priv;
   GError *error = NULL;
 
-  local_priv = ov_local_peer_get_private (local);
-  remotes = local_priv->remote_peers;
+  remotes = call->remote_peers;
 
+  ov_local_peer_lock (local);
+  call_id = call->id;
   if (g_cancellable_is_cancelled (cancellable)) {
-    local_priv->negotiator_task = NULL;
+    call->negotiator_task = NULL;
+    ov_call_set_state (call, OV_LOCAL_STATE_STARTED | OV_LOCAL_STATE_FAILED);
+    ov_local_peer_end_call (local, call);
+    ov_local_peer_unlock (local);
     return;
   }
+  ov_local_peer_unlock (local);
 
   /* Format: {OvRemotePeer*: GVariant*}
    * GVariant is of type OV_TCP_MSG_TYPE_REPLY_CAPS */
   in = g_hash_table_new_full (NULL, NULL, NULL,
       (GDestroyNotify) g_variant_unref);
 
-  call_id = g_get_monotonic_time ();
+  start_time = phase_time = g_get_monotonic_time ();
 
   /* Send START_NEGOTIATE + QUERY_CAPS to remote peers and get REPLY_CAPS */
   ov_local_peer_lock (local);
   /* Every time we take the lock, check if our task has been cancelled */
   if (g_cancellable_is_cancelled (cancellable))
     goto cancelled;
-  ov_local_peer_set_state (local, OV_LOCAL_STATE_NEGOTIATING);
-  ov_local_peer_set_state_negotiator (local);
+  ov_call_set_state (call, OV_LOCAL_STATE_NEGOTIATING);
+  ov_call_set_state_negotiator (call);
   /* Begin negotiation with all peers first (which returns a peer id) */
-  /* TODO: Synchronous for now, make this async and then wait in this thread for
-   * all the replies to speed up negotiation */
-  for (ii = 0; ii < remotes->len; ii++) {
-    gboolean ret;
-    OvRemotePeer *remote;
+  n_results = remotes->len;
+  results = g_new0 (GAsyncResult *, n_results);
+  /* Remotes that fail are removed from the array below, so keep our own list */
+  phase_remotes = g_memdup (remotes->pdata, n_results * sizeof (gpointer));
+  for (ii = 0; ii < n_results; ii++)
+    /* START_NEGOTIATE → ACK */
+    ov_remote_peer_tcp_client_start_negotiate_async (phase_remotes[ii],
+        call_id, cancellable, (GAsyncReadyCallback) on_async_result,
+        &results[ii]);
+  ov_local_peer_unlock (local);
+  ov_wait_for_results (results, n_results);
+  phase_time = ov_negotiate_log_phase ("START_NEGOTIATE", n_results,
+      phase_time);
+  ov_local_peer_lock (local);
+  for (ii = 0; ii < n_results; ii++) {
+    OvPeer *skipped;
+    OvRemotePeer *remote = phase_remotes[ii];
 
-    remote = g_ptr_array_index (remotes, ii);
+    if (ov_remote_peer_tcp_client_start_negotiate_finish (results[ii], &error))
+      continue;
 
-    /* START_NEGOTIATE → ACK */
-    ret = ov_remote_peer_tcp_client_start_negotiate (remote, call_id,
-        cancellable, &error);
-    if (!ret) {
-      OvPeer *skipped;
-      GST_WARNING ("Unable to start negotiation with remote %s: %s. Skipped.",
-          /* We don't know remote->id yet */
-          remote->addr_s, error ? error->message : "Unknown error");
-
-      skipped = ov_peer_new (remote->addr);
-      g_ptr_array_remove_index (remotes, ii);
-
-      /* Unlock local and emit signal */
-      ov_local_peer_unlock (local);
-      g_signal_emit_by_name (local, "negotiate-skipped-remote", skipped, error);
-      ov_local_peer_lock (local);
-
-      g_object_unref (skipped);
-
-      if (g_cancellable_is_cancelled (cancellable)) {
-        /* We didn't START_NEGOTIATE with the rest, so don't send
-         * CANCEL_NEGOTIATE to them while cancelling */
-        g_ptr_array_remove_range (remotes, ii, remotes->len - ii);
-        goto cancelled;
-      }
-      /* This will be incremented in the next loop */
-      ii--;
-    }
+    GST_WARNING ("Unable to start negotiation with remote %s: %s. Skipped.",
+        /* We don't know remote->id yet */
+        remote->addr_s, error ? error->message : "Unknown error");
+
+    skipped = ov_peer_new (remote->addr);
+    g_ptr_array_remove (remotes, remote);
+
+    /* Unlock local and emit signal */
+    ov_local_peer_unlock (local);
+    g_signal_emit_by_name (local, "negotiate-skipped-remote", skipped, error);
+    ov_local_peer_lock (local);
+
+    g_object_unref (skipped);
+    g_clear_error (&error);
   }
+  ov_free_results (results, n_results);
+  g_free (phase_remotes);
+  /* All the remaining remotes have started negotiating, so they will all get
+   * a CANCEL_NEGOTIATE if we're cancelled */
+  if (g_cancellable_is_cancelled (cancellable))
+    goto cancelled;
   if (remotes->len == 0) {
     GST_ERROR ("No peers left to call, all failed to negotiate");
     goto err;
@@ -906,23 +2127,43 @@ ov_local_peer_negotiate_thread (GTask * task, OvLocalPeer * local,
   if (g_cancellable_is_cancelled (cancellable))
     goto cancelled;
   /* Continue negotiation now that we have the peer id for all peers */
-  /* TODO: Synchronous for now, make this async and then wait in this thread for
-   * all the replies to speed up negotiation */
-  for (ii = 0; ii < remotes->len; ii++) {
+  n_results = remotes->len;
+  results = g_new0 (GAsyncResult *, n_results);
+  for (ii = 0; ii < n_results; ii++)
+    /* QUERY_CAPS → REPLY_CAPS */
+    ov_remote_peer_tcp_client_query_caps_async (
+        g_ptr_array_index (remotes, ii), call_id, cancellable,
+        (GAsyncReadyCallback) on_async_result, &results[ii]);
+  ov_local_peer_unlock (local);
+  ov_wait_for_results (results, n_results);
+  phase_time = ov_negotiate_log_phase ("QUERY_CAPS", n_results, phase_time);
+  ov_local_peer_lock (local);
+  for (ii = 0; ii < n_results; ii++) {
     OvTcpMsg *reply;
-    OvRemotePeer *remote;
-
-    remote = g_ptr_array_index (remotes, ii);
+    GVariant *reply_caps;
+    OvRemotePeer *remote = g_ptr_array_index (remotes, ii);
 
-    /* QUERY_CAPS → REPLY_CAPS */
-    reply = ov_remote_peer_tcp_client_query_caps (remote, call_id,
-        cancellable, &error);
+    /* Keep the first error, but collect all the results */
+    reply = ov_remote_peer_tcp_client_query_caps_finish (results[ii],
+        error ? NULL : &error);
     if (!reply)
-      goto err;
+      continue;
 
-    g_hash_table_insert (in, remote, g_variant_ref (reply->variant));
+    reply_caps = ov_local_peer_caps_cache_apply (local, remote,
+        reply->variant);
     ov_tcp_msg_free (reply);
+    if (reply_caps == NULL) {
+      if (!error)
+        g_set_error (&error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+            "Remote %s didn't send its caps", remote->id);
+      continue;
+    }
+
+    g_hash_table_insert (in, remote, reply_caps);
   }
+  ov_free_results (results, n_results);
+  if (error)
+    goto err;
   ov_local_peer_unlock (local);
 
   ov_local_peer_lock (local);
@@ -930,7 +2171,7 @@ ov_local_peer_negotiate_thread (GTask * task, OvLocalPeer * local,
     goto cancelled;
   /* Transform REPLY_CAPS to CALL_DETAILS and also set the call details for
    * each remote peer */
-  out = ov_aggregate_call_details_for_remotes (local, in, call_id);
+  out = ov_aggregate_call_details_for_remotes (local, call, in, call_id);
   ov_local_peer_unlock (local);
 
   /* Distribute call details to all remotes */
@@ -939,24 +2180,30 @@ ov_local_peer_negotiate_thread (GTask * task, OvLocalPeer * local,
     g_hash_table_unref (out);
     goto cancelled;
   }
-  /* TODO: Synchronous for now, make this async to speed up negotiation */
-  for (ii = 0; ii < remotes->len; ii++) {
-    gboolean ret;
-    OvRemotePeer *remote;
-
-    remote = g_ptr_array_index (remotes, ii);
+  n_results = remotes->len;
+  results = g_new0 (GAsyncResult *, n_results);
+  for (ii = 0; ii < n_results; ii++) {
+    OvRemotePeer *remote = g_ptr_array_index (remotes, ii);
 
     /* CALL_DETAILS → ACK */
-    ret = ov_remote_peer_tcp_client_send_call_details (remote,
-        g_hash_table_lookup (out, remote), cancellable, &error);
-
-    if (!ret) {
-      g_hash_table_unref (out);
-      goto err;
-    }
+    ov_remote_peer_tcp_client_send_call_details_async (remote,
+        g_hash_table_lookup (out, remote), cancellable,
+        (GAsyncReadyCallback) on_async_result, &results[ii]);
+  }
+  ov_local_peer_unlock (local);
+  ov_wait_for_results (results, n_results);
+  phase_time = ov_negotiate_log_phase ("CALL_DETAILS", n_results, phase_time);
+  ov_local_peer_lock (local);
+  for (ii = 0; ii < n_results; ii++)
+    ov_remote_peer_tcp_client_send_acked_finish (results[ii],
+        error ? NULL : &error);
+  ov_free_results (results, n_results);
+  if (error) {
+    g_hash_table_unref (out);
+    goto err;
   }
-  ov_local_peer_set_state (local, OV_LOCAL_STATE_NEGOTIATED);
-  ov_local_peer_set_state_negotiator (local);
+  ov_call_set_state (call, OV_LOCAL_STATE_NEGOTIATED);
+  ov_call_set_state_negotiator (call);
   ov_local_peer_unlock (local);
 
   /* Start the call
@@ -966,28 +2213,33 @@ ov_local_peer_negotiate_thread (GTask * task, OvLocalPeer * local,
     g_hash_table_unref (out);
     goto cancelled;
   }
-  /* TODO: Synchronous for now, make this async and then wait in this thread for
-   * all the replies to speed up negotiation */
-  for (ii = 0; ii < remotes->len; ii++) {
-    gboolean ret;
+  n_results = remotes->len;
+  results = g_new0 (GAsyncResult *, n_results);
+  for (ii = 0; ii < n_results; ii++) {
     GVariant *peers;
-    OvRemotePeer *remote;
-
-    remote = g_ptr_array_index (remotes, ii);
+    OvRemotePeer *remote = g_ptr_array_index (remotes, ii);
 
     peers =
       g_variant_ref_sink (get_all_peers_list_except_this (remote, call_id));
     /* START_CALL → ACK */
-    ret = ov_remote_peer_tcp_client_start_call (remote,
-        peers, cancellable, &error);
+    ov_remote_peer_tcp_client_start_call_async (remote, peers, cancellable,
+        (GAsyncReadyCallback) on_async_result, &results[ii]);
     g_variant_unref (peers);
-    if (!ret) {
-      g_hash_table_unref (out);
-      goto err;
-    }
   }
-  ov_local_peer_set_state (local, OV_LOCAL_STATE_READY);
-  ov_local_peer_set_state_negotiator (local);
+  ov_local_peer_unlock (local);
+  ov_wait_for_results (results, n_results);
+  ov_negotiate_log_phase ("START_CALL", n_results, phase_time);
+  ov_local_peer_lock (local);
+  for (ii = 0; ii < n_results; ii++)
+    ov_remote_peer_tcp_client_send_acked_finish (results[ii],
+        error ? NULL : &error);
+  ov_free_results (results, n_results);
+  if (error) {
+    g_hash_table_unref (out);
+    goto err;
+  }
+  ov_call_set_state (call, OV_LOCAL_STATE_READY);
+  ov_call_set_state_negotiator (call);
 
   g_hash_table_unref (out);
 
@@ -997,12 +2249,16 @@ ov_local_peer_negotiate_thread (GTask * task, OvLocalPeer * local,
      * started the call above */
     goto cancelled;
 
-  local_priv->active_call_id = call_id;
   g_task_return_boolean (task, TRUE);
+  GST_INFO ("Negotiated call %" G_GUINT64_FORMAT " with %u remotes in %"
+      G_GINT64_FORMAT "ms", call_id, remotes->len,
+      (g_get_monotonic_time () - start_time) / 1000);
 
+  call->negotiator_task = NULL;
+  /* The application starts the call that it's told has been negotiated */
+  ov_local_peer_set_current_call (local, call);
   ov_local_peer_unlock (local);
   g_hash_table_unref (in);
-  local_priv->negotiator_task = NULL;
 
   /* Emit signal after unlocking */
   g_signal_emit_by_name (local, "negotiate-finished");
@@ -1014,98 +2270,639 @@ err:
    * We pass the old error to our NEGOTIATE_ABORTED closures (transfer-none) */
   g_task_return_error (task, error ? g_error_copy (error) : NULL);
 cancelled:
-  GST_DEBUG ("Negotiation cancelled, sending CANCEL_NEGOTIATE");
+  GST_INFO ("Negotiation failed or was cancelled after %" G_GINT64_FORMAT
+      "ms, sending CANCEL_NEGOTIATE",
+      (g_get_monotonic_time () - start_time) / 1000);
   for (ii = 0; ii < remotes->len; ii++) {
     OvRemotePeer *remote = g_ptr_array_index (remotes, ii);
     ov_remote_peer_tcp_client_cancel_negotiate (remote, call_id);
   }
-  /* Revert state to STARTED */
-  ov_local_peer_set_state (local, OV_LOCAL_STATE_STARTED);
-  ov_local_peer_set_state_failed (local);
+  /* Revert state to STARTED. The call keeps its remotes if it's the current
+   * one, so that the application can try again. */
+  ov_call_set_state (call, OV_LOCAL_STATE_STARTED | OV_LOCAL_STATE_FAILED);
+  call->negotiator_task = NULL;
+  ov_local_peer_end_call (local, call);
 
   ov_local_peer_unlock (local);
   g_hash_table_unref (in);
-  local_priv->negotiator_task = NULL;
 
   /* Emit signal after unlocking. FIXME: Set the error. */
   g_signal_emit_by_name (local, "negotiate-aborted", error);
-  g_error_free (error);
+  g_clear_error (&error);
   return;
 }
 
-static gboolean
-ov_remote_peer_tcp_client_end_call (OvRemotePeer * remote, OvTcpMsg * msg,
-    GCancellable * cancellable, GError ** error)
+void
+ov_local_peer_negotiate_thread (GTask * task, OvLocalPeer * local,
+    OvCall * call, GCancellable * cancellable)
+{
+  GMainContext *context;
+
+  /* Replies to our requests are dispatched here */
+  context = g_main_context_new ();
+  g_main_context_push_thread_default (context);
+
+  ov_local_peer_negotiate (task, local, call, cancellable);
+
+  g_main_context_pop_thread_default (context);
+  g_main_context_unref (context);
+}
+
+/*~~ Adding a remote to an active call ~~*/
+
+/* Returns the reply in @res if it is of type @expected. Unlike the reply
+ * callbacks above, this doesn't touch the remote, which might have left the
+ * call while we were waiting for the reply. */
+static OvTcpMsg *
+ov_join_check_reply (GAsyncResult * res, OvTcpMsgType expected,
+    const gchar * peer_id, GError ** error)
 {
   gchar *error_msg;
-  OvTcpMsg *reply = NULL;
-  gboolean ret = FALSE;
+  OvTcpMsg *reply;
 
-  /* FIXME: This does a blocking write which is really bad especially if we're
-   * ending the call because we're exiting */
-  reply = ov_remote_peer_send_tcp_msg (remote, msg, cancellable, error);
+  reply = ov_remote_peer_send_tcp_msg_finish (res, error);
   if (!reply)
-    goto no_reply;
+    return NULL;
 
   switch (reply->type) {
-    case OV_TCP_MSG_TYPE_ACK:
-      handle_tcp_msg_ack (reply);
-      GST_DEBUG ("Recvd from '%s' ACK", remote->id);
-      break;
     case OV_TCP_MSG_TYPE_ERROR:
-      /* Try again? */
       error_msg = handle_tcp_msg_error (reply);
-      GST_ERROR ("Remote %s returned an error in reply to end call: %s",
-          remote->id, error_msg);
+      GST_ERROR ("Remote %s returned an error while adding a remote to the"
+          " call: %s", peer_id, error_msg);
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+          "Remote returned an error: %s", error_msg);
       g_free (error_msg);
-      goto err;
+      break;
     default:
+      if (reply->type == expected)
+        return reply;
       GST_ERROR ("Expected message type '%s' from %s, got '%s'",
-          ov_tcp_msg_type_to_string (
-            OV_TCP_MSG_TYPE_ACK, OV_TCP_MAX_VERSION),
-          remote->id, ov_tcp_msg_type_to_string (reply->type,
-            reply->version));
+          ov_tcp_msg_type_to_string (expected, OV_TCP_MAX_VERSION),
+          peer_id, ov_tcp_msg_type_to_string (reply->type, reply->version));
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+          "Unexpected reply");
+  }
+
+  ov_tcp_msg_free (reply);
+  return NULL;
+}
+
+/* Called with the lock TAKEN
+ *
+ * Decides the caps that @joiner will send, and the ports that @joiner and
+ * each peer in the call will send to each other. @joiner_caps is the
+ * REPLY_CAPS that @joiner sent for QUERY_CAPS, and @in has the REPLY_CAPS
+ * that each remote in the call sent for QUERY_JOIN.
+ *
+ * Nobody in the call changes what it sends, so we only check that @joiner
+ * can receive that. Remotes that have left the call are skipped.
+ *
+ * Format of @in and of the returned hash table: {gchar *peer_id: GVariant*}
+ * The returned GVariants are of type OV_TCP_MSG_TYPE_JOIN_DETAILS, and
+ * *call_details is set to the OV_TCP_MSG_TYPE_CALL_DETAILS for @joiner */
+static GHashTable *
+ov_aggregate_join_details (OvLocalPeer * local, OvCall * call,
+    OvRemotePeer * joiner, GVariant * joiner_caps, GHashTable * in,
+    guint64 call_id, GVariant ** call_details, GError ** error)
+{
+  guint ii;
+  gpointer key, value;
+  GHashTableIter iter;
+  GVariantIter *entries;
+  GVariantBuilder *peersb;
+  GHashTable *joiner_ports, *out;
+  GstCaps *send_caps[2], *recv_caps[2], *tmp;
+  guint16 ports[4], joiner_rr_ports[2], *to_ports;
+  gchar *local_id, *from_id, *caps_s[4], *send_acaps, *send_vcaps;
+  gchar *joiner_send_acaps = NULL, *joiner_send_vcaps = NULL;
+  const gchar *in_vtype, *out_vtype, *details_vtype;
+  OvLocalPeerPrivate *priv;
+
+  priv = ov_local_peer_get_private (local);
+  g_object_get (local, "id", &local_id, NULL);
+
+  in_vtype = ov_tcp_msg_type_to_variant_type (
+      OV_TCP_MSG_TYPE_REPLY_CAPS, OV_TCP_MAX_VERSION);
+  out_vtype = ov_tcp_msg_type_to_variant_type (
+      OV_TCP_MSG_TYPE_JOIN_DETAILS, OV_TCP_MAX_VERSION);
+  details_vtype = ov_tcp_msg_type_to_variant_type (
+      OV_TCP_MSG_TYPE_CALL_DETAILS, OV_TCP_MAX_VERSION);
+
+  out = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      (GDestroyNotify) g_variant_unref);
+  peersb = g_variant_builder_new (G_VARIANT_TYPE ("a(sssqqqqqq)"));
+
+  /* The ports that the joiner has allocated to receive from each peer
+   * Format: {gchar *from_id: guint16 ports[4]} */
+  g_variant_get (joiner_caps, in_vtype, NULL, &joiner_rr_ports[0],
+      &joiner_rr_ports[1], &caps_s[0], &caps_s[1], &caps_s[2], &caps_s[3],
+      &entries);
+  joiner_ports = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      g_free);
+  while (g_variant_iter_next (entries, "(sqqqq)", &from_id, &ports[0],
+        &ports[1], &ports[2], &ports[3]))
+    g_hash_table_replace (joiner_ports, from_id,
+        g_memdup (ports, sizeof (ports)));
+  g_variant_iter_free (entries);
+
+  for (ii = 0; ii < 2; ii++) {
+    send_caps[ii] = gst_caps_from_string (caps_s[ii]);
+    recv_caps[ii] = gst_caps_from_string (caps_s[ii + 2]);
+  }
+  for (ii = 0; ii < 4; ii++)
+    g_free (caps_s[ii]);
+  if (!send_caps[0] || !send_caps[1] || !recv_caps[0] || !recv_caps[1]) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+        "Remote %s sent invalid caps", joiner->id);
+    goto err;
+  }
+
+  /* joiner.send_caps = joiner.send_caps.intersect(that.recv_caps) for us and
+   * for every remote in the call */
+  tmp = gst_caps_intersect (send_caps[0], priv->supported_recv_acaps);
+  gst_caps_unref (send_caps[0]), send_caps[0] = tmp;
+  tmp = gst_caps_intersect (send_caps[1], priv->supported_recv_vcaps);
+  gst_caps_unref (send_caps[1]), send_caps[1] = tmp;
+  g_hash_table_iter_init (&iter, in);
+  while (g_hash_table_iter_next (&iter, NULL, &value)) {
+    g_variant_get (value, in_vtype, NULL, NULL, NULL, NULL, NULL, &caps_s[2],
+        &caps_s[3], NULL);
+    for (ii = 0; ii < 2; ii++) {
+      GstCaps *that_recv = gst_caps_from_string (caps_s[ii + 2]);
+      g_free (caps_s[ii + 2]);
+      if (that_recv == NULL)
+        continue;
+      tmp = gst_caps_intersect (send_caps[ii], that_recv);
+      gst_caps_unref (send_caps[ii]), send_caps[ii] = tmp;
+      gst_caps_unref (that_recv);
+    }
+  }
+  if (gst_caps_is_empty (send_caps[0]) || gst_caps_is_empty (send_caps[1])) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+        "Remote %s can't send anything that everyone can receive", joiner->id);
+    goto err;
+  }
+  joiner_send_acaps = gst_caps_to_string (send_caps[0]);
+  joiner_send_vcaps = gst_caps_to_string (send_caps[1]);
+
+  /* Us */
+  if (!gst_caps_can_intersect (priv->send_acaps, recv_caps[0]) ||
+      !gst_caps_can_intersect (priv->send_vcaps, recv_caps[1])) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+        "Remote %s can't receive what we send", joiner->id);
+    goto err;
+  }
+  if (!(to_ports = g_hash_table_lookup (joiner_ports, local_id))) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+        "Remote %s didn't allocate ports for us", joiner->id);
+    goto err;
+  }
+  joiner->priv->send_ports[0] = to_ports[0];
+  joiner->priv->send_ports[1] = to_ports[1];
+  joiner->priv->send_ports[2] = joiner_rr_ports[0];
+  joiner->priv->send_ports[3] = to_ports[2];
+  joiner->priv->send_ports[4] = to_ports[3];
+  joiner->priv->send_ports[5] = joiner_rr_ports[1];
+  send_acaps = gst_caps_to_string (priv->send_acaps);
+  send_vcaps = gst_caps_to_string (priv->send_vcaps);
+  g_variant_builder_add (peersb, "(sssqqqqqq)", local_id, send_acaps,
+      send_vcaps, joiner->priv->recv_ports[0], joiner->priv->recv_ports[1],
+      priv->recv_rtcp_ports[0], joiner->priv->recv_ports[2],
+      joiner->priv->recv_ports[3], priv->recv_rtcp_ports[1]);
+  g_free (send_acaps);
+  g_free (send_vcaps);
+
+  /* Everyone else in the call */
+  g_hash_table_iter_init (&iter, in);
+  while (g_hash_table_iter_next (&iter, &key, &value)) {
+    guint16 rr_ports[2];
+    OvRemotePeer *remote;
+    GVariantBuilder *joinerb;
+    gboolean found = FALSE;
+
+    /* Left the call while we were waiting for replies */
+    if (!(remote = ov_call_get_remote_by_id (call, key)))
+      continue;
+
+    /* The caps we receive from it are the ones it sends */
+    if (!gst_caps_can_intersect (remote->priv->recv_acaps, recv_caps[0]) ||
+        !gst_caps_can_intersect (remote->priv->recv_vcaps, recv_caps[1])) {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+          "Remote %s can't receive what %s sends", joiner->id, remote->id);
+      goto err;
+    }
+    if (!(to_ports = g_hash_table_lookup (joiner_ports, key))) {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+          "Remote %s didn't allocate ports for %s", joiner->id, remote->id);
+      goto err;
+    }
+
+    /* The ports that this remote has allocated to receive from the joiner */
+    g_variant_get (value, in_vtype, NULL, &rr_ports[0], &rr_ports[1], NULL,
+        NULL, NULL, NULL, &entries);
+    while (!found && g_variant_iter_next (entries, "(sqqqq)", &from_id,
+          &ports[0], &ports[1], &ports[2], &ports[3])) {
+      found = g_strcmp0 (from_id, joiner->id) == 0;
+      g_free (from_id);
+    }
+    g_variant_iter_free (entries);
+    if (!found) {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+          "Remote %s didn't allocate ports for %s", remote->id, joiner->id);
       goto err;
+    }
+
+    send_acaps = gst_caps_to_string (remote->priv->recv_acaps);
+    send_vcaps = gst_caps_to_string (remote->priv->recv_vcaps);
+    g_variant_builder_add (peersb, "(sssqqqqqq)", remote->id, send_acaps,
+        send_vcaps, ports[0], ports[1], rr_ports[0], ports[2], ports[3],
+        rr_ports[1]);
+    g_free (send_acaps);
+    g_free (send_vcaps);
+
+    joinerb = g_variant_builder_new (G_VARIANT_TYPE ("a(sssqqqqqq)"));
+    g_variant_builder_add (joinerb, "(sssqqqqqq)", joiner->id,
+        joiner_send_acaps, joiner_send_vcaps, to_ports[0], to_ports[1],
+        joiner_rr_ports[0], to_ports[2], to_ports[3], joiner_rr_ports[1]);
+    g_hash_table_insert (out, g_strdup (key),
+        g_variant_ref_sink (g_variant_new (out_vtype, call_id, joinerb)));
+    g_variant_builder_unref (joinerb);
   }
 
-  ret = TRUE;
+  *call_details = g_variant_ref_sink (g_variant_new (details_vtype, call_id,
+        joiner_send_acaps, joiner_send_vcaps, peersb));
+
+  /* What we will receive from the joiner */
+  gst_caps_replace (&joiner->priv->recv_acaps, send_caps[0]);
+  gst_caps_replace (&joiner->priv->recv_vcaps, send_caps[1]);
+  goto out;
+
 err:
-  ov_tcp_msg_free (reply);
-no_reply:
-  return ret;
+  g_clear_pointer (&out, g_hash_table_unref);
+out:
+  for (ii = 0; ii < 2; ii++) {
+    g_clear_pointer (&send_caps[ii], gst_caps_unref);
+    g_clear_pointer (&recv_caps[ii], gst_caps_unref);
+  }
+  g_variant_builder_unref (peersb);
+  g_hash_table_unref (joiner_ports);
+  g_free (joiner_send_acaps);
+  g_free (joiner_send_vcaps);
+  g_free (local_id);
+  return out;
+}
+
+/* Called with the lock TAKEN. Returns the call that @task is adding a remote
+ * to, if it hasn't been hung up yet. */
+static OvCall *
+ov_local_peer_get_call_by_join_task (OvLocalPeer * local, GTask * task)
+{
+  OvCall *call;
+  GHashTableIter iter;
+  OvLocalPeerPrivate *priv;
+
+  priv = ov_local_peer_get_private (local);
+
+  g_hash_table_iter_init (&iter, priv->calls);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &call))
+    if (call->join_task == task)
+      return call;
+
+  return NULL;
+}
+
+/* Called with the lock TAKEN. The call can be hung up, and freed, whenever we
+ * drop the lock, so it's looked up again by id every time. */
+static OvCall *
+ov_local_peer_join_check_call (OvLocalPeer * local, guint64 call_id,
+    GCancellable * cancellable, GError ** error)
+{
+  OvCall *call;
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    return NULL;
+
+  call = ov_local_peer_get_call (local, call_id);
+  if (call == NULL || !(call->state & OV_LOCAL_STATE_PLAYING)) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_CANCELLED,
+        "The call has ended");
+    return NULL;
+  }
+
+  return call;
+}
+
+/* Adds @joiner to the active call.
+ *
+ * START_NEGOTIATE → OK_NEGOTIATE (joiner)
+ * QUERY_JOIN → REPLY_CAPS (everyone in the call)
+ *   + QUERY_CAPS → REPLY_CAPS (joiner)
+ * JOIN_DETAILS → ACK (everyone in the call)
+ *   + CALL_DETAILS → ACK (joiner)
+ * START_CALL → ACK (joiner)
+ *
+ * To the joiner this looks like an ordinary incoming call with us as the
+ * negotiator and the call id of the active call. The peers in the call only
+ * learn about the joiner; they keep sending what they were sending, and
+ * start sending to the joiner once they have its JOIN_DETAILS.
+ *
+ * Requests are sent the same way as in ov_local_peer_negotiate(), but the
+ * lock is only taken to send them and to look at the replies, not while
+ * waiting for them; the call is running and the main thread needs the lock
+ * to check for remote timeouts. The call and the remotes in it are looked up
+ * by id after every wait since they can go away in the meantime. */
+static void
+ov_local_peer_join (GTask * task, OvLocalPeer * local, OvRemotePeer * joiner,
+    GCancellable * cancellable)
+{
+  guint ii, n_results;
+  gint64 start_time;
+  guint64 call_id = 0;
+  gchar *local_id, *joiner_id = NULL, *joiner_addr_s, **peer_ids = NULL;
+  const gchar *variant_type;
+  OvTcpMsg *msg, *reply;
+  OvPeer *joined;
+  GAsyncResult **results;
+  GHashTableIter iter;
+  gpointer key, value;
+  GVariantBuilder *peersb;
+  GVariant *joiner_caps = NULL, *call_details = NULL;
+  /* Format: {gchar *peer_id: GVariant*}
+   * REPLY_CAPS for QUERY_JOIN, and JOIN_DETAILS, for each remote in the call */
+  GHashTable *in, *out = NULL;
+  OvCall *call;
+  gboolean negotiating = FALSE;
+  GError *error = NULL;
+
+  start_time = g_get_monotonic_time ();
+  joined = ov_peer_new (joiner->addr);
+  /* For after the joiner has been freed */
+  joiner_addr_s = g_strdup (joiner->addr_s);
+  in = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      (GDestroyNotify) g_variant_unref);
+
+  ov_local_peer_lock (local);
+  call = ov_local_peer_get_call_by_join_task (local, task);
+  if (call == NULL) {
+    g_set_error (&error, G_IO_ERROR, G_IO_ERROR_CANCELLED,
+        "The call has ended");
+    goto err;
+  }
+  call_id = call->id;
+  if (!ov_local_peer_join_check_call (local, call_id, cancellable, &error))
+    goto err;
+  results = g_new0 (GAsyncResult *, 1);
+  /* START_NEGOTIATE → OK_NEGOTIATE; sets joiner->id */
+  ov_remote_peer_tcp_client_start_negotiate_async (joiner, call_id,
+      cancellable, (GAsyncReadyCallback) on_async_result, &results[0]);
+  ov_local_peer_unlock (local);
+  ov_wait_for_results (results, 1);
+  negotiating = ov_remote_peer_tcp_client_start_negotiate_finish (results[0],
+      &error);
+  ov_free_results (results, 1);
+
+  ov_local_peer_lock (local);
+  if (error || !(call = ov_local_peer_join_check_call (local, call_id,
+          cancellable, &error)))
+    goto err;
+  joiner_id = g_strdup (joiner->id);
+  if (ov_call_get_remote_by_id (call, joiner->id)) {
+    g_set_error (&error, G_IO_ERROR, G_IO_ERROR_EXISTS,
+        "Remote %s is already in the call", joiner->id);
+    goto err;
+  }
+  n_results = call->remote_peers->len + 1;
+  results = g_new0 (GAsyncResult *, n_results);
+  peer_ids = g_new0 (gchar *, n_results);
+  variant_type = ov_tcp_msg_type_to_variant_type (
+      OV_TCP_MSG_TYPE_QUERY_JOIN, OV_TCP_MAX_VERSION);
+  msg = ov_tcp_msg_new (OV_TCP_MSG_TYPE_QUERY_JOIN,
+      g_variant_new (variant_type, call_id, joiner->id, joiner->addr_s));
+  for (ii = 0; ii < n_results - 1; ii++) {
+    OvRemotePeer *remote = g_ptr_array_index (call->remote_peers, ii);
+
+    peer_ids[ii] = g_strdup (remote->id);
+    /* QUERY_JOIN → REPLY_CAPS */
+    ov_remote_peer_send_tcp_msg_async (remote, msg, OV_TCP_TIMEOUT,
+        cancellable, (GAsyncReadyCallback) on_async_result, &results[ii]);
+  }
+  ov_tcp_msg_free (msg);
+  /* QUERY_CAPS → REPLY_CAPS; lists everyone in the call except us */
+  joiner->priv->call = call;
+  ov_remote_peer_tcp_client_query_caps_async (joiner, call_id, cancellable,
+      (GAsyncReadyCallback) on_async_result, &results[n_results - 1]);
+  ov_local_peer_unlock (local);
+  ov_wait_for_results (results, n_results);
+
+  ov_local_peer_lock (local);
+  for (ii = 0; ii < n_results - 1; ii++) {
+    /* Keep the first error, but collect all the results */
+    reply = ov_join_check_reply (results[ii], OV_TCP_MSG_TYPE_REPLY_CAPS,
+        peer_ids[ii], error ? NULL : &error);
+    if (!reply)
+      continue;
+    g_hash_table_insert (in, g_strdup (peer_ids[ii]),
+        g_variant_ref (reply->variant));
+    ov_tcp_msg_free (reply);
+  }
+  reply = ov_remote_peer_tcp_client_query_caps_finish (results[n_results - 1],
+      error ? NULL : &error);
+  if (reply) {
+    joiner_caps = ov_local_peer_caps_cache_apply (local, joiner,
+        reply->variant);
+    ov_tcp_msg_free (reply);
+    if (joiner_caps == NULL && !error)
+      g_set_error (&error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+          "Remote %s didn't send its caps", joiner->id);
+  }
+  ov_free_results (results, n_results);
+  g_clear_pointer (&peer_ids, g_strfreev);
+  if (error || !(call = ov_local_peer_join_check_call (local, call_id,
+          cancellable, &error)))
+    goto err;
+
+  out = ov_aggregate_join_details (local, call, joiner, joiner_caps, in,
+      call_id, &call_details, &error);
+  if (!out)
+    goto err;
+  n_results = g_hash_table_size (out) + 1;
+  results = g_new0 (GAsyncResult *, n_results);
+  peer_ids = g_new0 (gchar *, n_results);
+  ii = 0;
+  g_hash_table_iter_init (&iter, out);
+  while (g_hash_table_iter_next (&iter, &key, &value)) {
+    msg = ov_tcp_msg_new (OV_TCP_MSG_TYPE_JOIN_DETAILS, value);
+    /* JOIN_DETAILS → ACK */
+    ov_remote_peer_send_tcp_msg_async (
+        ov_call_get_remote_by_id (call, key), msg, OV_TCP_TIMEOUT,
+        cancellable, (GAsyncReadyCallback) on_async_result, &results[ii]);
+    ov_tcp_msg_free (msg);
+    peer_ids[ii++] = g_strdup (key);
+  }
+  /* CALL_DETAILS → ACK */
+  ov_remote_peer_tcp_client_send_call_details_async (joiner, call_details,
+      cancellable, (GAsyncReadyCallback) on_async_result,
+      &results[n_results - 1]);
+  ov_local_peer_unlock (local);
+  ov_wait_for_results (results, n_results);
+
+  ov_local_peer_lock (local);
+  for (ii = 0; ii < n_results - 1; ii++) {
+    reply = ov_join_check_reply (results[ii], OV_TCP_MSG_TYPE_ACK,
+        peer_ids[ii], error ? NULL : &error);
+    if (reply)
+      ov_tcp_msg_free (reply);
+  }
+  ov_remote_peer_tcp_client_send_acked_finish (results[n_results - 1],
+      error ? NULL : &error);
+  ov_free_results (results, n_results);
+  g_clear_pointer (&peer_ids, g_strfreev);
+  if (error || !(call = ov_local_peer_join_check_call (local, call_id,
+          cancellable, &error)))
+    goto err;
+
+  /* Only list the remotes that have the joiner's details; a remote that was
+   * added to the call by someone else in the meantime doesn't know about it */
+  g_object_get (local, "id", &local_id, NULL);
+  peersb = g_variant_builder_new (G_VARIANT_TYPE ("as"));
+  g_variant_builder_add (peersb, "s", local_id);
+  g_free (local_id);
+  g_hash_table_iter_init (&iter, out);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    g_variant_builder_add (peersb, "s", key);
+  variant_type = ov_tcp_msg_type_to_variant_type (
+      OV_TCP_MSG_TYPE_START_CALL, OV_TCP_MAX_VERSION);
+  results = g_new0 (GAsyncResult *, 1);
+  /* START_CALL → ACK */
+  ov_remote_peer_tcp_client_start_call_async (joiner,
+      g_variant_new (variant_type, call_id, peersb), cancellable,
+      (GAsyncReadyCallback) on_async_result, &results[0]);
+  g_variant_builder_unref (peersb);
+  ov_local_peer_unlock (local);
+  ov_wait_for_results (results, 1);
+  ov_remote_peer_tcp_client_send_acked_finish (results[0], &error);
+  ov_free_results (results, 1);
+
+  ov_local_peer_lock (local);
+  if (error || !(call = ov_local_peer_join_check_call (local, call_id,
+          cancellable, &error)))
+    goto err;
+  /* Start sending to and receiving from the joiner */
+  if (!ov_local_peer_call_add_remote (local, call, joiner)) {
+    /* Frees the joiner; the others will time it out */
+    joiner = NULL;
+    g_set_error (&error, G_IO_ERROR, G_IO_ERROR_FAILED,
+        "Unable to start receiving from the remote");
+    goto err;
+  }
+
+  GST_INFO ("Added remote %s to the call in %" G_GINT64_FORMAT "ms",
+      joiner->id, (g_get_monotonic_time () - start_time) / 1000);
+
+  g_task_return_boolean (task, TRUE);
+  call->join_task = NULL;
+  ov_local_peer_unlock (local);
+
+  g_hash_table_unref (out);
+  g_hash_table_unref (in);
+  g_variant_unref (call_details);
+  g_variant_unref (joiner_caps);
+  g_free (joiner_addr_s);
+  g_free (joiner_id);
+
+  /* Emit signal after unlocking */
+  g_signal_emit_by_name (local, "call-remote-added", joined);
+  g_object_unref (joined);
+  return;
+
+  /* Called with the lock TAKEN */
+err:
+  GST_WARNING ("Unable to add remote %s to the call: %s", joiner_addr_s,
+      error->message);
+  if (negotiating && joiner)
+    ov_remote_peer_tcp_client_cancel_negotiate (joiner, call_id);
+  /* Remotes that have the joiner's details have added it to the call, and the
+   * rest have allocated ports for it; END_CALL on its behalf undoes both */
+  call = ov_local_peer_get_call (local, call_id);
+  if (call && g_hash_table_size (in) > 0) {
+    variant_type = ov_tcp_msg_type_to_variant_type (
+        OV_TCP_MSG_TYPE_END_CALL, OV_TCP_MAX_VERSION);
+    msg = ov_tcp_msg_new (OV_TCP_MSG_TYPE_END_CALL,
+        g_variant_new (variant_type, call_id, joiner_id));
+    g_hash_table_iter_init (&iter, in);
+    while (g_hash_table_iter_next (&iter, &key, NULL)) {
+      OvRemotePeer *remote = ov_call_get_remote_by_id (call, key);
+      if (remote)
+        ov_remote_peer_send_tcp_msg_oneway (remote, msg);
+    }
+    ov_tcp_msg_free (msg);
+  }
+  g_task_return_error (task, g_error_copy (error));
+  if (call && call->join_task == task)
+    call->join_task = NULL;
+  ov_local_peer_unlock (local);
+
+  if (joiner)
+    ov_remote_peer_free (joiner);
+  g_clear_pointer (&out, g_hash_table_unref);
+  g_hash_table_unref (in);
+  g_clear_pointer (&call_details, g_variant_unref);
+  g_clear_pointer (&joiner_caps, g_variant_unref);
+  g_clear_pointer (&peer_ids, g_strfreev);
+  g_free (joiner_addr_s);
+  g_free (joiner_id);
+
+  /* Emit signal after unlocking */
+  g_signal_emit_by_name (local, "call-join-failed", joined, error);
+  g_object_unref (joined);
+  g_clear_error (&error);
+}
+
+void
+ov_local_peer_join_thread (GTask * task, OvLocalPeer * local,
+    OvRemotePeer * joiner, GCancellable * cancellable)
+{
+  GMainContext *context;
+
+  /* Replies to our requests are dispatched here */
+  context = g_main_context_new ();
+  g_main_context_push_thread_default (context);
+
+  ov_local_peer_join (task, local, joiner, cancellable);
+
+  g_main_context_pop_thread_default (context);
+  g_main_context_unref (context);
 }
 
+/* Called with the lock TAKEN. Doesn't block; END_CALL is sent to each remote
+ * in @call from the control thread */
 void
-ov_local_peer_send_end_call (OvLocalPeer * local)
+ov_local_peer_send_end_call (OvLocalPeer * local, OvCall * call)
 {
   guint ii;
   OvTcpMsg *msg;
   gchar *local_id;
   const gchar *variant_type;
-  OvLocalPeerPrivate *local_priv;
-
-  local_priv = ov_local_peer_get_private (local);
-  g_object_get (OV_PEER (local), "id", &local_id, NULL);
 
-  if (!local_priv->active_call_id)
-    /* No active call */
+  if (!call->id)
+    /* Not an active call */
     return;
 
+  g_object_get (OV_PEER (local), "id", &local_id, NULL);
+
   variant_type = ov_tcp_msg_type_to_variant_type (
       OV_TCP_MSG_TYPE_END_CALL, OV_TCP_MAX_VERSION);
   msg = ov_tcp_msg_new (OV_TCP_MSG_TYPE_END_CALL,
-      g_variant_new (variant_type, local_priv->active_call_id, local_id));
+      g_variant_new (variant_type, call->id, local_id));
   g_free (local_id);
 
   GST_DEBUG ("Sending END_CALL to remote peers");
-  for (ii = 0; ii < local_priv->remote_peers->len; ii++) {
+  for (ii = 0; ii < call->remote_peers->len; ii++) {
     OvRemotePeer *remote;
 
-    remote = g_ptr_array_index (local_priv->remote_peers, ii);
-    ov_remote_peer_tcp_client_end_call (remote, msg, NULL, NULL);
+    remote = g_ptr_array_index (call->remote_peers, ii);
+    ov_remote_peer_send_tcp_msg_oneway (remote, msg);
   }
 
-  local_priv->active_call_id = 0;
-
   ov_tcp_msg_free (msg);
 }
@@ -31,15 +31,27 @@
 #include <gio/gio.h>
 
 #include "lib.h"
+#include "lib-priv.h"
 
 G_BEGIN_DECLS
 
 void	ov_local_peer_negotiate_thread    (GTask *task,
                                            OvLocalPeer *local,
-                                           gpointer task_data,
+                                           OvCall *call,
                                            GCancellable *cancellable);
+void    ov_local_peer_join_thread         (GTask *task,
+                                           OvLocalPeer *local,
+                                           OvRemotePeer *joiner,
+                                           GCancellable *cancellable);
+
+void    ov_local_peer_send_end_call       (OvLocalPeer *local,
+                                           OvCall *call);
 
-void    ov_local_peer_send_end_call       (OvLocalPeer *local);
+OvControlChannel* ov_control_channel_new  (OvLocalPeer *local,
+                                           GInetSocketAddress *addr,
+                                           const gchar *addr_s);
+void    ov_control_channel_release        (OvControlChannel *channel);
+gboolean ov_local_peer_stop_control       (OvLocalPeer *local);
 
 G_END_DECLS
 
@@ -33,6 +33,32 @@
 
 G_BEGIN_DECLS
 
+/* Default interval at which we check for remote peers that have timed out */
+#define OV_REMOTE_PEER_TIMEOUT_CHECK_MSECS 250
+
+/* Default initial size of the audio playout buffer, and the size up to which
+ * it is grown when underruns are seen */
+#define OV_AUDIO_BUFFER_TIME_MSECS 20
+#define OV_AUDIO_BUFFER_TIME_MAX_MSECS 200
+/* Minimum time between two grows of the audio playout buffer, so that one
+ * burst of underruns doesn't grow it all the way to the maximum */
+#define OV_AUDIO_BUFFER_GROW_INTERVAL_SECS 10
+
+/* Time the negotiator gets to send the message each step waits for. It sends
+ * it once every remote has replied to the previous one, which can take up to
+ * OV_TCP_TIMEOUT, so allow for that and some slack. */
+#define OV_NEGOTIATE_STEP_TIMEOUT_MSECS (OV_TCP_TIMEOUT * 1000 + 1000)
+
+typedef enum _OvNegotiateStep OvNegotiateStep;
+
+/* What we're waiting for from the negotiator as a negotiatee */
+enum _OvNegotiateStep {
+  OV_NEGOTIATE_STEP_QUERY_CAPS,
+  OV_NEGOTIATE_STEP_CALL_DETAILS,
+  OV_NEGOTIATE_STEP_START_CALL,
+  OV_NEGOTIATE_N_STEPS,
+};
+
 typedef struct _OvNegotiate OvNegotiate;
 
 struct _OvNegotiate {
@@ -42,8 +68,74 @@ struct _OvNegotiate {
   OvRemotePeer *negotiator;
   /* Potential remotes while negotiating */
   GHashTable *remotes;
-  /* A GSourceFunc id that checks for timeouts */
-  guint check_timeout_id;
+  /* ov_tcp_caps_hash() of our caps as cached by the negotiator, or 0 */
+  guint64 caps_hash;
+  /* The current step, and the monotonic times at which the negotiation
+   * started, we entered this step, and this step times out */
+  OvNegotiateStep step;
+  gint64 start_time;
+  gint64 step_time;
+  gint64 deadline;
+  /* Aborts the negotiation at @deadline */
+  GSource *deadline_source;
+  /* Microseconds spent in each step that we're done with */
+  gint64 step_durations[OV_NEGOTIATE_N_STEPS];
+};
+
+/* Everything about a call that isn't shared with other calls. The devices,
+ * the transmit pipeline, the playback pipeline up to the audio sink, and the
+ * sockets belong to the local peer and are shared by all the calls that it's
+ * in. Each call sends to its own remotes as clients of the shared
+ * multiudpsinks, and mixes and composites their audio and video in its own
+ * branch of the playback pipeline. */
+struct _OvCall {
+  /* A unique id representing the call (0 until it has been negotiated, and
+   * after it has ended) */
+  guint64 id;
+  /* Monotonic time at which the call was created */
+  gint64 created;
+  /* State of the call, see ov_local_peer_get_state() */
+  OvLocalPeerState state;
+  /* Array of OvRemotePeers: peers we are connecting to or are connected to */
+  GPtrArray *remote_peers;
+  /* The remote that is currently speaking the loudest (if any), and the remote
+   * that will replace it if it continues to be the loudest */
+  OvRemotePeer *active_speaker;
+  OvRemotePeer *speaker_candidate;
+  gint64 speaker_candidate_since;
+
+  /* Struct used for holding info while negotiating as the negotiatee */
+  OvNegotiate *negotiate;
+  /* The task used for doing negotiation when we're the negotiator. The call
+   * isn't freed while this is set; the task ends it if it fails. */
+  GTask *negotiator_task;
+  /* The task used for adding a remote to the call */
+  GTask *join_task;
+  /* Remotes that another peer is adding to the call, which we have allocated
+   * ports for but aren't sending to or receiving from yet.
+   * Format: {gchar *peer_id: OvRemotePeer*} */
+  GHashTable *joining;
+
+  /*~ Playback branch ~*/
+  /* Bin inside the playback pipeline with the playback bins of the remotes in
+   * the call, the mixer for their audio, and the compositor for their video
+   * (if compositing); NULL until the call starts */
+  GstElement *playback;
+  GstElement *audiomixer;
+  GstElement *compositor;
+  /* Request pad on the local peer's audiomixer that the above audiomixer
+   * feeds */
+  GstPad *audiomixer_pad;
+};
+
+typedef struct _OvCapsCacheEntry OvCapsCacheEntry;
+
+/* The caps a remote replied with to QUERY_CAPS */
+struct _OvCapsCacheEntry {
+  /* send_acaps, send_vcaps, recv_acaps, recv_vcaps */
+  gchar *caps[4];
+  /* ov_tcp_caps_hash() of the above */
+  guint64 hash;
 };
 
 struct _OvLocalPeerPrivate {
@@ -59,20 +151,51 @@ struct _OvLocalPeerPrivate {
   GstElement *vsend_rtp_sink;
   GstElement *vsend_rtcp_sink;
   GstElement *vrecv_rtcp_src;
+  /* Sink showing a preview of the video we transmit (if any); we own a ref
+   * since it's re-used across transmit pipelines */
+  GstElement *preview_sink;
 
   /*~ Playback pipeline ~*/
   GstElement *playback;
-  /* primary audio playback elements */
+  /* primary audio playback elements; the audio of each call is mixed by the
+   * call and then mixed with that of the other calls here */
   GstElement *audiomixer;
   GstElement *audiosink;
+  /* Sink for the composited video set with ov_local_peer_add_gtksink() (if
+   * any); we own a ref since it's re-used across playback pipelines. Only one
+   * call can render to it at a time; others get a fallback sink. */
+  GstElement *video_sink;
+  /* Whether to use a compositor instead of a separate sink per remote */
+  gboolean composite_video;
+  /* How to render audio and video from remotes */
+  OvPlaybackMode playback_mode;
+  /* Size of the audio playout buffer at the start of a call, and currently
+   * (in milliseconds) */
+  guint audio_buffer_time_start;
+  guint audio_buffer_time;
+  /* Number of times the audiosink ran out of audio to play, and how many of
+   * those we've already grown the playout buffer for */
+  guint audio_underruns;
+  guint audio_underruns_handled;
+  /* Monotonic time of the last grow of the playout buffer, and whether one is
+   * waiting for silence to be applied */
+  gint64 audio_buffer_grown_time;
+  gint audio_buffer_grow_pending;
 
-  /* A unique id representing an active call (0 if no active call) */
-  guint64 active_call_id;
+  /* The calls that have an id, which are being negotiated or are in
+   * progress.
+   * Format: {guint64 *call_id: OvCall*} */
+  GHashTable *calls;
+  /* The call that the public API acts on. Never NULL. It's either one of the
+   * calls above, or a call that hasn't been negotiated yet (id 0) and is only
+   * referenced from here. */
+  OvCall *call;
 
-  /* Struct used for holding info while negotiating */
-  OvNegotiate *negotiate;
-  /* The task used for doing negotiation when we're the negotiator */
-  GTask *negotiator_task;
+  /* Caps that remotes sent us in previous calls, so that they can skip
+   * sending them again if they haven't changed. Keyed by address since peer
+   * ids are regenerated every time a peer starts.
+   * Format: {gchar *addr_s: OvCapsCacheEntry*} */
+  GHashTable *caps_cache;
 
   /* The video device monitor being used */
   GstDeviceMonitor *dm;
@@ -105,6 +228,29 @@ struct _OvLocalPeerPrivate {
   GList *mc_ifaces;
   /* TCP Server for comms (listens on all interfaces if none are specified) */
   GSocketService *tcp_server;
+  /* Context that incoming TCP connections are serviced on, and the thread
+   * running it */
+  GMainContext *comms_context;
+  GMainLoop *comms_loop;
+  GThread *comms_thread;
+  /* Open incoming TCP connections (OvIncomingConn), and whether we're waiting
+   * for them to close before quitting comms_loop. Only used from the comms
+   * thread. */
+  GList *incoming_conns;
+  gboolean comms_stopping;
+  /* Context that outgoing control channels (OvControlChannel) do their I/O
+   * on, and the thread running it. Separate from the comms thread because
+   * incoming message handlers take the local peer lock, which is often held
+   * while waiting for replies to outgoing requests. */
+  GMainContext *control_context;
+  GMainLoop *control_loop;
+  GThread *control_thread;
+  /* Control channels that have been used, async operations in flight on them,
+   * and whether we're waiting for those to finish before quitting
+   * control_loop. Only used from the control thread. */
+  GList *control_channels;
+  guint control_ops;
+  gboolean control_stopping;
   /* The incoming multicast UDP message listener for all interfaces */
   GSource *mc_socket_source;
   /* The incoming discovery unicast UDP message listener for all interfaces */
@@ -129,14 +275,21 @@ struct _OvLocalPeerPrivate {
 
   /* Array of UDP ports that are either reserved or in use for receiving */
   GArray *used_ports;
-  /* Array of OvRemotePeers: peers we are connecting to or are connected to */
-  GPtrArray *remote_peers;
   /* A timed source that checks if any of the remote peers have timed out */
   GSource *remotes_timeout_source;
+  /* Interval at which the above source runs, in milliseconds */
+  guint timeout_check_interval;
+  /* Watches for ICMP errors on the socket we send audio RTP data on */
+  GSource *transmit_error_source;
+  /* The previous call's transmit pipeline while it sends RTCP BYE, and the
+   * timeout after which it is torn down anyway */
+  GstElement *stopping_transmit;
+  GSource *stopping_transmit_timeout;
 
   /* Lock to access non-thread-safe structures like GPtrArray */
   GRecMutex lock;
 
+  /* NULL, STARTED or STOPPED; everything else is the state of a call */
   OvLocalPeerState state;
 };
 
@@ -147,10 +300,54 @@ void                  ov_local_peer_unlock        (OvLocalPeer *self);
 
 void                  ov_local_peer_set_state             (OvLocalPeer *self,
                                                            OvLocalPeerState state);
-void                  ov_local_peer_set_state_failed      (OvLocalPeer *self);
-void                  ov_local_peer_set_state_timedout    (OvLocalPeer *self);
-void                  ov_local_peer_set_state_negotiator  (OvLocalPeer *self);
-void                  ov_local_peer_set_state_negotiatee  (OvLocalPeer *self);
+void                  ov_call_set_state                   (OvCall *call,
+                                                           OvLocalPeerState state);
+void                  ov_call_set_state_failed            (OvCall *call);
+void                  ov_call_set_state_timedout          (OvCall *call);
+void                  ov_call_set_state_negotiator        (OvCall *call);
+void                  ov_call_set_state_negotiatee        (OvCall *call);
+
+OvCall*               ov_call_new                 (void);
+void                  ov_call_free                (OvCall *call);
+void                  ov_call_add_remote          (OvCall *call,
+                                                   OvRemotePeer *remote);
+OvRemotePeer*         ov_call_get_remote_by_id    (OvCall *call,
+                                                   const gchar *id);
+
+OvCall*               ov_local_peer_get_call              (OvLocalPeer *self,
+                                                           guint64 call_id);
+OvCall*               ov_local_peer_get_negotiating_call  (OvLocalPeer *self);
+gboolean              ov_local_peer_in_other_calls        (OvLocalPeer *self,
+                                                           OvCall *call);
+void                  ov_local_peer_insert_call           (OvLocalPeer *self,
+                                                           OvCall *call,
+                                                           guint64 call_id);
+void                  ov_local_peer_set_current_call      (OvLocalPeer *self,
+                                                           OvCall *call);
+void                  ov_local_peer_end_call              (OvLocalPeer *self,
+                                                           OvCall *call);
+void                  ov_local_peer_call_negotiate_abort  (OvLocalPeer *self,
+                                                           OvCall *call,
+                                                           gboolean timedout);
+
+const gchar*          ov_negotiate_step_to_string (OvNegotiateStep step);
+void                  ov_negotiate_free           (OvNegotiate *negotiate,
+                                                   const gchar *outcome);
+
+void                  ov_local_peer_schedule_remotes_check (OvLocalPeer *self);
+gboolean              ov_local_peer_call_add_remote        (OvLocalPeer *self,
+                                                            OvCall *call,
+                                                            OvRemotePeer *remote);
+void                  ov_local_peer_update_video_layout    (OvLocalPeer *self,
+                                                            OvCall *call);
+void                  ov_local_peer_update_active_speaker  (OvLocalPeer *self,
+                                                            guint64 call_id);
+void                  ov_local_peer_update_priorities      (OvLocalPeer *self,
+                                                            OvCall *call);
+void                  ov_local_peer_finish_stop_transmit   (OvLocalPeer *self);
+void                  ov_local_peer_get_send_caps          (OvLocalPeer *self,
+                                                            GstCaps **acaps,
+                                                            GstCaps **vcaps);
 
 GstCaps*              ov_local_peer_get_transmit_video_caps (OvLocalPeer *self);
 gboolean              ov_local_peer_set_transmit_video_caps (OvLocalPeer *self,
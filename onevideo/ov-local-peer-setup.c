@@ -29,11 +29,18 @@
 #include "comms.h"
 #include "utils.h"
 #include "incoming.h"
+#include "outgoing.h"
 #include "discovery.h"
 #include "ov-local-peer-priv.h"
 #include "ov-local-peer-setup.h"
 
 #include <string.h>
+#include <sys/socket.h>
+
+#ifdef __linux__
+/* For SK_MEMINFO_DROPS */
+#include <linux/sock_diag.h>
+#endif
 
 /* The default buffer size for kernel-side UDP send/recv buffers varies
  * between operating systems and installations. It's not unusual that
@@ -57,6 +64,56 @@ ov_on_gst_bus_error (GstBus * bus, GstMessage * msg, gpointer user_data)
   g_free (tmp);
 }
 
+/* Per-socket kernel drop accounting and receive buffer tuning
+ *
+ * udpsrc does all the reading from the socket, so we can't see the SO_RXQ_OVFL
+ * ancillary data on each packet. Instead, we read the same counter (sk_drops)
+ * with SO_MEMINFO whenever we need it. */
+guint
+ov_socket_get_kernel_drops (GSocket * socket)
+{
+#ifdef SO_MEMINFO
+  guint32 meminfo[SK_MEMINFO_VARS];
+  socklen_t len = sizeof (meminfo);
+
+  if (getsockopt (g_socket_get_fd (socket), SOL_SOCKET, SO_MEMINFO, meminfo,
+        &len) < 0 || len <= SK_MEMINFO_DROPS * sizeof (guint32))
+    return 0;
+
+  return meminfo[SK_MEMINFO_DROPS];
+#else
+  return 0;
+#endif
+}
+
+gint
+ov_socket_get_recv_buffer_size (GSocket * socket)
+{
+  gint size = 0;
+  socklen_t len = sizeof (size);
+
+  getsockopt (g_socket_get_fd (socket), SOL_SOCKET, SO_RCVBUF, &size, &len);
+  return size;
+}
+
+/* Returns the new size as reported by the kernel. On Linux this is twice the
+ * requested size to account for bookkeeping overhead. */
+gint
+ov_socket_set_recv_buffer_size (GSocket * socket, gint size)
+{
+  gint fd = g_socket_get_fd (socket);
+
+#ifdef SO_RCVBUFFORCE
+  /* Like udpsrc, try to override the system-wide maximum first; this only
+   * works if we have CAP_NET_ADMIN */
+  if (setsockopt (fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof (size)) < 0)
+#endif
+    if (setsockopt (fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof (size)) < 0)
+      GST_WARNING ("Unable to set receive buffer size to %i", size);
+
+  return ov_socket_get_recv_buffer_size (socket);
+}
+
 #define on_local_transmit_error ov_on_gst_bus_error
 #define on_local_playback_error ov_on_gst_bus_error
 
@@ -110,6 +167,177 @@ ov_set_rtpbin_sdes_id (GstElement * rtpbin, OvLocalPeer * local)
   g_free (id);
 }
 
+/* Called on the main thread with the audio level of a remote, measured by the
+ * level element inside its aplayback bin */
+static void
+on_playback_element_message (G_GNUC_UNUSED GstBus * bus, GstMessage * msg,
+    OvLocalPeer * local)
+{
+  guint ii;
+  GstObject *bin;
+  GValueArray *rms;
+  GHashTableIter iter;
+  OvCall *call;
+  guint64 call_id = 0;
+  gdouble level = -G_MAXDOUBLE;
+  OvLocalPeerPrivate *priv = ov_local_peer_get_private (local);
+  const GstStructure *s = gst_message_get_structure (msg);
+
+  if (!gst_structure_has_name (s, "level"))
+    return;
+
+  /* Use the loudest channel */
+  rms = g_value_get_boxed (gst_structure_get_value (s, "rms"));
+G_GNUC_BEGIN_IGNORE_DEPRECATIONS
+  for (ii = 0; ii < rms->n_values; ii++)
+    level = MAX (level, g_value_get_double (g_value_array_get_nth (rms, ii)));
+G_GNUC_END_IGNORE_DEPRECATIONS
+
+  bin = GST_OBJECT_PARENT (GST_MESSAGE_SRC (msg));
+
+  ov_local_peer_lock (local);
+  g_hash_table_iter_init (&iter, priv->calls);
+  while (!call_id && g_hash_table_iter_next (&iter, NULL, (gpointer *) &call)) {
+    for (ii = 0; ii < call->remote_peers->len; ii++) {
+      OvRemotePeer *remote = g_ptr_array_index (call->remote_peers, ii);
+      if (GST_OBJECT (remote->priv->aplayback) == bin) {
+        remote->priv->audio_level = level;
+        remote->priv->audio_level_time = g_get_monotonic_time ();
+        GST_TRACE ("Audio level of %s is %.1f dB", remote->addr_s, level);
+        call_id = call->id;
+        break;
+      }
+    }
+  }
+  ov_local_peer_unlock (local);
+
+  /* Each call has its own active speaker */
+  if (call_id)
+    ov_local_peer_update_active_speaker (local, call_id);
+}
+
+/* The inner loop has a constant trip count and no exits, so compilers
+ * vectorize it at -O2 into packed 16-bit min/max */
+static inline gboolean
+ov_audio_block_is_silent (const gint16 * block)
+{
+  guint ii;
+  gint16 max = 0, min = 0;
+
+  for (ii = 0; ii < OV_AUDIO_SILENCE_BLOCK; ii++) {
+    max = block[ii] > max ? block[ii] : max;
+    min = block[ii] < min ? block[ii] : min;
+  }
+
+  return max < OV_AUDIO_SILENCE_THRESHOLD && min > -OV_AUDIO_SILENCE_THRESHOLD;
+}
+
+/* Checks a block at a time, so that audio that isn't silent stops the scan
+ * within the first few samples. Only buffers that really are silent are read
+ * in full. */
+static gboolean
+ov_audio_is_silent (const gint16 * samples, guint n_samples)
+{
+  guint ii = 0;
+
+  for (; ii + OV_AUDIO_SILENCE_BLOCK <= n_samples; ii += OV_AUDIO_SILENCE_BLOCK)
+    if (!ov_audio_block_is_silent (samples + ii))
+      return FALSE;
+
+  for (; ii < n_samples; ii++)
+    if (ABS ((gint) samples[ii]) >= OV_AUDIO_SILENCE_THRESHOLD)
+      return FALSE;
+
+  return TRUE;
+}
+
+/* Mark silent audio (f.ex., decoded Opus DTX frames) as a GAP so that the
+ * mixer skips it instead of mixing it in. With many remotes in a call, most of
+ * them are usually not speaking. Muted remotes are already skipped by the
+ * mixer itself. */
+static GstPadProbeReturn
+on_remote_audio_buffer (G_GNUC_UNUSED GstPad * pad, GstPadProbeInfo * info,
+    OvRemotePeer * remote)
+{
+  gboolean silent;
+  GstMapInfo map;
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+
+  if (GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_GAP))
+    goto skipped;
+
+  if (!gst_buffer_map (buffer, &map, GST_MAP_READ))
+    return GST_PAD_PROBE_OK;
+
+  /* Audio is always S16 here (see AUDIO_CAPS_STR) */
+  silent = ov_audio_is_silent ((const gint16 *) map.data,
+      map.size / sizeof (gint16));
+  gst_buffer_unmap (buffer, &map);
+
+  if (!silent)
+    goto out;
+
+  /* Only copies the metadata, if at all */
+  buffer = gst_buffer_make_writable (buffer);
+  GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_GAP);
+  GST_PAD_PROBE_INFO_DATA (info) = buffer;
+
+skipped:
+  g_atomic_int_inc (&remote->priv->audio_silent_buffers);
+out:
+  if (g_atomic_int_add (&remote->priv->audio_buffers, 1) %
+      OV_AUDIO_SILENCE_REPORT_BUFFERS == 0)
+    GST_DEBUG ("Skipped mixing %u of %u audio buffers from %s",
+        g_atomic_int_get (&remote->priv->audio_silent_buffers),
+        g_atomic_int_get (&remote->priv->audio_buffers), remote->addr_s);
+  return GST_PAD_PROBE_OK;
+}
+
+/* Called on the main thread. GstAudioBaseSink posts a warning each time it
+ * ran out of audio to play and had to resync to the clock, so every warning
+ * from the audiosink is an underrun. */
+static void
+on_playback_warning (G_GNUC_UNUSED GstBus * bus, GstMessage * msg,
+    OvLocalPeer * local)
+{
+  gchar *debug = NULL;
+  GError *error = NULL;
+  OvLocalPeerPrivate *priv = ov_local_peer_get_private (local);
+
+  gst_message_parse_warning (msg, &error, &debug);
+  GST_WARNING_OBJECT (GST_MESSAGE_SRC (msg), "%s (%s)", error->message,
+      debug);
+  g_error_free (error);
+  g_free (debug);
+
+  if (priv->audiosink != NULL &&
+      GST_MESSAGE_SRC (msg) == GST_OBJECT (priv->audiosink))
+    g_atomic_int_inc (&priv->audio_underruns);
+}
+
+/* Sink used instead of the audio sink and video sinks when not rendering */
+static GstElement *
+ov_get_fakesink (OvPlaybackMode mode)
+{
+  GstElement *sink;
+
+  sink = gst_element_factory_make ("fakesink", NULL);
+  /* Only sync to the clock when everything is decoded, so that buffers are
+   * consumed at the same rate as a real sink would. We don't want to wait for
+   * prerolling since remotes can come and go. */
+  g_object_set (sink, "sync", mode == OV_PLAYBACK_MODE_HEADLESS,
+      "async", FALSE, NULL);
+  return sink;
+}
+
+static GstPadProbeReturn
+on_remote_frame (G_GNUC_UNUSED GstPad * pad,
+    G_GNUC_UNUSED GstPadProbeInfo * info, guint * frames)
+{
+  g_atomic_int_inc (frames);
+  return GST_PAD_PROBE_OK;
+}
+
 /*-- LOCAL PEER SETUP --*/
 gboolean
 ov_local_peer_setup_playback_pipeline (OvLocalPeer * local)
@@ -127,24 +355,46 @@ ov_local_peer_setup_playback_pipeline (OvLocalPeer * local)
   /* Setup audio bits */
   priv->playback = gst_object_ref_sink (gst_pipeline_new ("playback-%u"));
   gst_pipeline_set_auto_flush_bus (GST_PIPELINE (priv->playback), FALSE);
-  priv->audiomixer = gst_element_factory_make ("audiomixer", NULL);
+  /* ovaudiomixer skips silent and muted remotes entirely and mixes the rest
+   * with SIMD; it's only missing if our plugin isn't in the plugin path */
+  priv->audiomixer = gst_element_factory_make ("ovaudiomixer", NULL);
+  if (priv->audiomixer == NULL) {
+    GST_WARNING ("ovaudiomixer not found, falling back to audiomixer");
+    priv->audiomixer = gst_element_factory_make ("audiomixer", NULL);
+  }
+
+  priv->audio_buffer_time = priv->audio_buffer_time_start;
+  priv->audio_underruns_handled = 0;
+  priv->audio_buffer_grown_time = 0;
+  g_atomic_int_set (&priv->audio_buffer_grow_pending, FALSE);
+  g_atomic_int_set (&priv->audio_underruns, 0);
+
+  if (priv->playback_mode != OV_PLAYBACK_MODE_NORMAL) {
+    /* No sound server; mixed audio is discarded, but still synchronized to
+     * the clock as it would be when played */
+    priv->audiosink = ov_get_fakesink (priv->playback_mode);
+    goto audiosink_done;
+  }
 
 #ifdef __linux__
   priv->audiosink = gst_element_factory_make ("pulsesink", NULL);
-  /* These values give the lowest audio latency with the least chance of audio
-   * artefacting with Pulseaudio on my machine. Setting buffer-time less than
-   * 50ms gives audio artefacts. */
-  g_object_set (priv->audiosink, "buffer-time", 50000, NULL);
 #elif defined(__APPLE__) && defined(TARGET_OS_MAC)
   priv->audiosink = gst_element_factory_make ("osxaudiosink", NULL);
-  /* These values give the lowest audio latency with the least chance of audio
-   * artefacting with Pulseaudio on my machine. Setting buffer-time less than
-   * 30ms gives audio artefacts. */
-  g_object_set (priv->audiosink, "buffer-time", 30000, NULL);
 #else
 #error "Unsupported operating system"
 #endif
 
+  /* The lowest buffer-time that doesn't cause audio artefacts depends on the
+   * machine and the audio server, so we start low and grow it when audio
+   * underruns are seen. See: ov_local_peer_tune_audio_buffer() */
+  g_object_set (priv->audiosink, "buffer-time",
+      (gint64) priv->audio_buffer_time * 1000, NULL);
+  /* The mixer is live, so there's nothing to preroll. This also means that
+   * the sink plays again right away after being reconfigured. */
+  g_object_set (priv->audiosink, "async", FALSE, NULL);
+
+audiosink_done:
+
   /* FIXME: If there's no audio, this pipeline will mess up while going from
    * NULL -> PLAYING -> NULL -> PLAYING because of async state change bugs in
    * basesink. Fix this by only plugging a sink if audio is present. */
@@ -153,7 +403,8 @@ ov_local_peer_setup_playback_pipeline (OvLocalPeer * local)
   ret = gst_element_link_many (priv->audiomixer, priv->audiosink, NULL);
   g_assert (ret);
 
-  /* Video bits are setup by each local */
+  /* Each call mixes its remotes and composites their video in a bin that is
+   * added to this pipeline by ov_local_peer_setup_call_playback() */
 
   /* Use the system clock and explicitly reset the base/start times to ensure
    * that all the pipelines started by us have the same base/start times */
@@ -165,6 +416,12 @@ ov_local_peer_setup_playback_pipeline (OvLocalPeer * local)
   gst_bus_add_signal_watch (bus);
   g_signal_connect (bus, "message::error",
       G_CALLBACK (on_local_playback_error), local);
+  /* Audio levels of each remote for detecting the active speaker */
+  g_signal_connect (bus, "message::element",
+      G_CALLBACK (on_playback_element_message), local);
+  /* Audio underruns, see ov_local_peer_tune_audio_buffer() */
+  g_signal_connect (bus, "message::warning",
+      G_CALLBACK (on_playback_warning), local);
   g_object_unref (bus);
 
   GST_DEBUG ("Setup pipeline to playback remote peers");
@@ -172,6 +429,120 @@ ov_local_peer_setup_playback_pipeline (OvLocalPeer * local)
   return TRUE;
 }
 
+/* Called with the lock TAKEN. Whether @sink is already rendering the
+ * composited video of a call. */
+static gboolean
+ov_local_peer_video_sink_in_use (OvLocalPeer * local, GstElement * sink)
+{
+  OvCall *call;
+  GHashTableIter iter;
+  OvLocalPeerPrivate *priv;
+
+  priv = ov_local_peer_get_private (local);
+
+  g_hash_table_iter_init (&iter, priv->calls);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &call))
+    if (call->playback != NULL &&
+        GST_OBJECT_PARENT (sink) == GST_OBJECT (call->playback))
+      return TRUE;
+
+  return FALSE;
+}
+
+/* Called with the lock TAKEN. Sets up a bin in the playback pipeline that
+ * mixes the audio of the remotes in @call into the audio sink, and renders
+ * their video with a single sink when compositing. Every call gets its own
+ * bin, so that calls can be torn down independently of each other.
+ *  [ ovaudiomixer ] ! audiomixer (priv->playback)
+ *  [ compositor ! capsfilter ! video_sink ] */
+gboolean
+ov_local_peer_setup_call_playback (OvLocalPeer * local, OvCall * call)
+{
+  GstPad *srcpad, *ghostpad;
+  GstPadLinkReturn ret;
+  gboolean res;
+  OvLocalPeerPrivate *priv;
+
+  priv = ov_local_peer_get_private (local);
+
+  if (call->playback != NULL)
+    /* Already setup */
+    return TRUE;
+
+  call->playback = gst_bin_new (NULL);
+  call->audiomixer = gst_element_factory_make ("ovaudiomixer", NULL);
+  if (call->audiomixer == NULL)
+    call->audiomixer = gst_element_factory_make ("audiomixer", NULL);
+  gst_bin_add (GST_BIN (call->playback), call->audiomixer);
+
+  srcpad = gst_element_get_static_pad (call->audiomixer, "src");
+  ghostpad = gst_ghost_pad_new ("audiopad", srcpad);
+  res = gst_pad_set_active (ghostpad, TRUE);
+  g_assert (res);
+  res = gst_element_add_pad (call->playback, ghostpad);
+  g_assert (res);
+  gst_object_unref (srcpad);
+
+  /* Video bits are setup by each remote, except when compositing, in which case
+   * each remote links to the compositor */
+  if (priv->composite_video &&
+      priv->playback_mode != OV_PLAYBACK_MODE_COUNT_FRAMES) {
+    GstCaps *caps;
+    GstElement *capsfilter, *video_sink;
+
+    call->compositor = gst_element_factory_make ("compositor", NULL);
+    g_assert (call->compositor != NULL);
+    /* Black background for empty tiles */
+    g_object_set (call->compositor, "background", 1, NULL);
+
+    /* The layout is computed for this size in
+     * ov_local_peer_update_video_layout() */
+    capsfilter = gst_element_factory_make ("capsfilter", NULL);
+    caps = gst_caps_new_simple ("video/x-raw",
+        "width", G_TYPE_INT, OV_COMPOSITOR_WIDTH,
+        "height", G_TYPE_INT, OV_COMPOSITOR_HEIGHT, NULL);
+    g_object_set (capsfilter, "caps", caps, NULL);
+    gst_caps_unref (caps);
+
+    /* If ov_local_peer_add_gtksink() wasn't used, or its sink is rendering
+     * another call, use a fallback glimagesink. There's only one GL context
+     * per call here, so the Mesa bug with multiple GLX contexts only applies
+     * when several calls are rendered at once. */
+    if (priv->video_sink != NULL &&
+        !ov_local_peer_video_sink_in_use (local, priv->video_sink))
+      video_sink = priv->video_sink;
+    else if (priv->playback_mode == OV_PLAYBACK_MODE_HEADLESS)
+      video_sink = ov_get_fakesink (priv->playback_mode);
+    else
+      video_sink = gst_element_factory_make ("glimagesink", NULL);
+
+    /* In case the last playback pipeline wasn't cleared */
+    if (GST_OBJECT_PARENT (video_sink) != NULL)
+      gst_bin_remove (GST_BIN (GST_OBJECT_PARENT (video_sink)), video_sink);
+
+    gst_bin_add_many (GST_BIN (call->playback), call->compositor, capsfilter,
+        video_sink, NULL);
+    res = gst_element_link_many (call->compositor, capsfilter, video_sink,
+        NULL);
+    g_assert (res);
+  }
+
+  res = gst_bin_add (GST_BIN (priv->playback), call->playback);
+  g_assert (res);
+  call->audiomixer_pad = gst_element_get_request_pad (priv->audiomixer,
+      "sink_%u");
+  ret = gst_pad_link (ghostpad, call->audiomixer_pad);
+  g_assert (ret == GST_PAD_LINK_OK);
+
+  /* Calls after the first are added while the pipeline is playing */
+  if (GST_STATE (priv->playback) == GST_STATE_PLAYING)
+    gst_element_sync_state_with_parent (call->playback);
+
+  GST_DEBUG ("Setup playback for call %" G_GUINT64_FORMAT, call->id);
+
+  return TRUE;
+}
+
 #if defined(__APPLE__) && defined(TARGET_OS_MAC)
 static GstElement *
 ov_pipeline_get_osxaudiosrcbin (const gchar * name)
@@ -257,8 +628,7 @@ on_transmit_ssrc_sdes (GstElement * rtpbin, guint session, guint ssrc,
    * so we'll have internal session SSRCs allocated and we can set those. */
   if (local_priv->ssrcs[session] == 0) {
     local_priv->ssrcs[session] =
-      ov_local_peer_get_ssrc_for_session_internal (local, local_priv->rtpbin,
-          session);
+      ov_local_peer_get_ssrc_for_session_internal (local, rtpbin, session);
     GST_DEBUG ("Internal %s session has SSRC: %u",
         OV_RTP_SESSION_TO_NAME (session), local_priv->ssrcs[session]);
   }
@@ -283,6 +653,60 @@ out:
   g_object_unref (rtpsource);
 }
 
+/* Feed video from the tee after capture into the preview sink using as
+ * little CPU as possible: frames are dropped down to OV_PREVIEW_FPS before
+ * decoding (where possible), the JPEG decoder uses the fast integer IDCT,
+ * and the preview sink scales down before converting.
+ *  [ tee ! queue ! videorate ! (jpegdec) ! preview_sink ] */
+static void
+ov_local_peer_setup_preview (OvLocalPeer * local, GstElement * tee)
+{
+  GstElement *queue, *rate, *decode = NULL;
+  OvLocalPeerPrivate *priv;
+  gboolean ret;
+
+  priv = ov_local_peer_get_private (local);
+
+  /* The preview must never hold up transmission */
+  queue = gst_element_factory_make ("queue", "preview-queue");
+  g_object_set (queue, "leaky", 2, "max-size-buffers", 1, "max-size-bytes", 0,
+      "max-size-time", 0, NULL);
+
+  rate = gst_element_factory_make ("videorate", NULL);
+  g_object_set (rate, "drop-only", TRUE, "max-rate", OV_PREVIEW_FPS, NULL);
+
+  if (priv->device_video_format == OV_VIDEO_FORMAT_JPEG) {
+    decode = gst_element_factory_make ("jpegdec", NULL);
+    /* ifast */
+    g_object_set (decode, "idct-method", 1, NULL);
+  } else if (priv->device_video_format == OV_VIDEO_FORMAT_H264) {
+    /* Every frame has to be decoded, so drop frames after decoding */
+    decode = gst_element_factory_make ("avdec_h264", NULL);
+  }
+
+  /* The preview sink was used in a previous transmit pipeline */
+  if (GST_OBJECT_PARENT (priv->preview_sink) != NULL)
+    gst_bin_remove (GST_BIN (GST_OBJECT_PARENT (priv->preview_sink)),
+        priv->preview_sink);
+
+  gst_bin_add_many (GST_BIN (priv->transmit), queue, rate, priv->preview_sink,
+      NULL);
+  if (decode == NULL) {
+    ret = gst_element_link_many (tee, queue, rate, priv->preview_sink, NULL);
+  } else if (priv->device_video_format == OV_VIDEO_FORMAT_H264) {
+    gst_bin_add (GST_BIN (priv->transmit), decode);
+    ret = gst_element_link_many (tee, queue, decode, rate, priv->preview_sink,
+        NULL);
+  } else {
+    gst_bin_add (GST_BIN (priv->transmit), decode);
+    ret = gst_element_link_many (tee, queue, rate, decode, priv->preview_sink,
+        NULL);
+  }
+  g_assert (ret);
+
+  GST_DEBUG ("Showing a %i fps preview of transmitted video", OV_PREVIEW_FPS);
+}
+
 gboolean
 ov_local_peer_setup_transmit_pipeline (OvLocalPeer * local)
 {
@@ -435,9 +859,18 @@ ov_local_peer_setup_transmit_pipeline (OvLocalPeer * local)
       OV_AUDIO_RTP_SESSION_STR);
   g_assert (ret);
 
-  /* Link video branch */
-  ret = gst_element_link_many (vsrc, vqueue, vfilter, vpay, NULL);
-  g_assert (ret);
+  /* Link video branch, with a tee right after capture for the preview */
+  if (priv->preview_sink != NULL) {
+    GstElement *tee = gst_element_factory_make ("tee", "video-tee");
+
+    gst_bin_add (GST_BIN (priv->transmit), tee);
+    ret = gst_element_link_many (vsrc, tee, vqueue, vfilter, vpay, NULL);
+    g_assert (ret);
+    ov_local_peer_setup_preview (local, tee);
+  } else {
+    ret = gst_element_link_many (vsrc, vqueue, vfilter, vpay, NULL);
+    g_assert (ret);
+  }
   ret = gst_element_link (vrtcpqueue, vrtcpsink);
   g_assert (ret);
   priv->vsend_rtcp_sink = vrtcpsink;
@@ -492,6 +925,30 @@ ov_local_peer_setup_transmit_pipeline (OvLocalPeer * local)
   return TRUE;
 }
 
+static gpointer
+ov_local_peer_comms_thread (OvLocalPeer * local)
+{
+  OvLocalPeerPrivate *priv = ov_local_peer_get_private (local);
+
+  g_main_context_push_thread_default (priv->comms_context);
+  g_main_loop_run (priv->comms_loop);
+  g_main_context_pop_thread_default (priv->comms_context);
+
+  return NULL;
+}
+
+static gpointer
+ov_local_peer_control_thread (OvLocalPeer * local)
+{
+  OvLocalPeerPrivate *priv = ov_local_peer_get_private (local);
+
+  g_main_context_push_thread_default (priv->control_context);
+  g_main_loop_run (priv->control_loop);
+  g_main_context_pop_thread_default (priv->control_context);
+
+  return NULL;
+}
+
 gboolean
 ov_local_peer_setup_comms (OvLocalPeer * local)
 {
@@ -510,10 +967,14 @@ ov_local_peer_setup_comms (OvLocalPeer * local)
 
   /*-- Listen for incoming TCP connections --*/
 
-  /* Threaded socket service since we use blocking TCP network reads
-   * TODO: Use threads equal to number of remote peers? To ensure that peers
-   * never wait while communicating. */
-  priv->tcp_server = g_threaded_socket_service_new (10);
+  /* All incoming connections are serviced with async reads and writes on our
+   * own context, which runs in the comms thread. The service must be created
+   * with that context as the thread-default so that it accepts on it. */
+  priv->comms_context = g_main_context_new ();
+  priv->comms_stopping = FALSE;
+  g_main_context_push_thread_default (priv->comms_context);
+
+  priv->tcp_server = g_socket_service_new ();
 
   g_object_get (OV_PEER (local), "address", &addr, "address-string", &addr_s,
       NULL);
@@ -524,13 +985,27 @@ ov_local_peer_setup_comms (OvLocalPeer * local)
   if (!ret) {
     GST_ERROR ("Unable to setup TCP server (%s): %s", addr_s, error->message);
     g_error_free (error);
+    g_main_context_pop_thread_default (priv->comms_context);
+    g_clear_object (&priv->tcp_server);
+    g_clear_pointer (&priv->comms_context, g_main_context_unref);
     goto out_early;
   }
 
-  g_signal_connect (priv->tcp_server, "run",
+  g_signal_connect (priv->tcp_server, "incoming",
       G_CALLBACK (on_incoming_peer_tcp_connection), local);
 
   g_socket_service_start (priv->tcp_server);
+  g_main_context_pop_thread_default (priv->comms_context);
+
+  priv->comms_loop = g_main_loop_new (priv->comms_context, FALSE);
+  priv->comms_thread = g_thread_new ("ov-comms",
+      (GThreadFunc) ov_local_peer_comms_thread, local);
+
+  priv->control_context = g_main_context_new ();
+  priv->control_loop = g_main_loop_new (priv->control_context, FALSE);
+  priv->control_stopping = FALSE;
+  priv->control_thread = g_thread_new ("ov-control",
+      (GThreadFunc) ov_local_peer_control_thread, local);
   GST_DEBUG ("Listening for incoming TCP connections on %s", addr_s);
 
   /*-- Listen for incoming UDP messages (multicast and unicast) --*/
@@ -592,6 +1067,35 @@ out_early:
   return ret;
 }
 
+/* Must be called without the local peer lock since incoming message handlers
+ * running in the comms thread take it */
+void
+ov_local_peer_teardown_comms (OvLocalPeer * local)
+{
+  OvLocalPeerPrivate *priv = ov_local_peer_get_private (local);
+
+  if (priv->comms_thread == NULL)
+    return;
+
+  /* Closes all incoming connections and quits the loop once they're gone */
+  g_main_context_invoke (priv->comms_context,
+      (GSourceFunc) ov_local_peer_stop_incoming, local);
+  g_thread_join (priv->comms_thread);
+  priv->comms_thread = NULL;
+
+  g_clear_pointer (&priv->comms_loop, g_main_loop_unref);
+  g_clear_pointer (&priv->comms_context, g_main_context_unref);
+
+  /* Fails all outgoing requests and closes all control channels */
+  g_main_context_invoke (priv->control_context,
+      (GSourceFunc) ov_local_peer_stop_control, local);
+  g_thread_join (priv->control_thread);
+  priv->control_thread = NULL;
+
+  g_clear_pointer (&priv->control_loop, g_main_loop_unref);
+  g_clear_pointer (&priv->control_context, g_main_context_unref);
+}
+
 /*-- REMOTE PEER SETUP --*/
 static void
 rtpbin_pad_added (GstElement * rtpbin, GstPad * srcpad,
@@ -628,12 +1132,55 @@ on_receiver_ssrc_active (GstElement * rtpbin, guint session, guint ssrc,
   GST_TRACE ("ssrc %u, session %u, remote %s active", ssrc, session,
       remote->addr_s);
   remote->last_seen = g_get_monotonic_time ();
+  if (OV_RTP_SESSION_IS_VALID (session))
+    remote->priv->recv_ssrcs[session] = ssrc;
+}
+
+/* Remember the RTP timestamp of the latest buffer along with its PTS, which
+ * is used for measuring and correcting A/V skew. The pipeline uses the system
+ * clock with a base time of 0, so the PTS is also the time it'll be played. */
+static GstPadProbeReturn
+on_remote_rtp_buffer (GstPad * pad, GstPadProbeInfo * info,
+    OvRemotePeer * remote)
+{
+  guint session;
+  guint32 rtptime;
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+
+  /* The RTP timestamp is at offset 4 in the fixed RTP header */
+  if (!GST_BUFFER_PTS_IS_VALID (buffer) ||
+      gst_buffer_extract (buffer, 4, &rtptime, 4) != 4)
+    return GST_PAD_PROBE_OK;
+
+  if (GST_ELEMENT (GST_PAD_PARENT (pad)) == remote->priv->adepay)
+    session = OV_AUDIO_RTP_SESSION;
+  else
+    session = OV_VIDEO_RTP_SESSION;
+
+  g_mutex_lock (&remote->priv->av_sync_lock);
+  remote->priv->last_pts[session] = GST_BUFFER_PTS (buffer);
+  remote->priv->last_rtptime[session] = GUINT32_FROM_BE (rtptime);
+  g_mutex_unlock (&remote->priv->av_sync_lock);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+on_receiver_bye_ssrc (GstElement * rtpbin, guint session, guint ssrc,
+    OvRemotePeer * remote)
+{
+  GST_DEBUG ("ssrc %u, session %u, remote %s sent BYE", ssrc, session,
+      remote->addr_s);
+  /* Remove the remote right away instead of waiting for it to time out */
+  g_atomic_int_set (&remote->priv->departed, 1);
+  ov_local_peer_schedule_remotes_check (remote->local);
 }
 
 void
 ov_local_peer_setup_remote_receive (OvLocalPeer * local, OvRemotePeer * remote)
 {
   gboolean ret;
+  GstPad *pad;
   GSocket *socket;
   GstElement *rtpbin;
   GstElement *asrc, *artcpsrc, *adecode, *asink, *artcpsink;
@@ -642,6 +1189,7 @@ ov_local_peer_setup_remote_receive (OvLocalPeer * local, OvRemotePeer * remote)
   gchar *local_addr_s, *remote_addr_s;
   OvVideoFormat video_format;
   GstCaps *rtpcaps;
+  gboolean count_frames;
 
   g_assert (remote->priv->recv_acaps != NULL &&
       remote->priv->recv_vcaps != NULL && remote->priv->recv_ports[0] > 0 &&
@@ -658,8 +1206,12 @@ ov_local_peer_setup_remote_receive (OvLocalPeer * local, OvRemotePeer * remote)
   /* Setup pipeline (remote->receive) to recv & decode from a remote peer */
 
   video_format = ov_caps_to_video_format (remote->priv->recv_vcaps);
+  /* Depayloaded frames are counted and discarded without decoding */
+  count_frames = ov_local_peer_get_private (local)->playback_mode ==
+    OV_PLAYBACK_MODE_COUNT_FRAMES;
 
   rtpbin = gst_element_factory_make ("rtpbin", "recv-rtpbin-%u");
+  remote->priv->rtpbin = rtpbin;
   g_object_set (rtpbin, "latency", RTP_DEFAULT_LATENCY_MS, "drop-on-latency",
       TRUE, NULL);
   ov_set_rtpbin_sdes_id (rtpbin, local);
@@ -673,10 +1225,16 @@ ov_local_peer_setup_remote_receive (OvLocalPeer * local, OvRemotePeer * remote)
   rtpcaps = gst_caps_from_string (RTP_ALL_AUDIO_CAPS_STR);
   g_object_set (asrc, "socket", socket, "caps", rtpcaps, NULL);
   gst_caps_unref (rtpcaps);
-  g_object_unref (socket);
+  /* Kept around for kernel drop accounting */
+  remote->priv->recv_rtp_sockets[OV_AUDIO_RTP_SESSION] = socket;
   remote->priv->adepay = gst_element_factory_make ("rtpopusdepay", NULL);
-  adecode = gst_element_factory_make ("opusdec", NULL);
-  asink = gst_element_factory_make ("proxysink", "audio-proxysink-%u");
+  if (count_frames) {
+    adecode = NULL;
+    asink = ov_get_fakesink (OV_PLAYBACK_MODE_COUNT_FRAMES);
+  } else {
+    adecode = gst_element_factory_make ("opusdec", NULL);
+    asink = gst_element_factory_make ("proxysink", "audio-proxysink-%u");
+  }
   g_assert (asink != NULL);
   /* Recv RTCP SR for audio */
   socket = ov_get_socket_for_addr (local_addr_s, remote->priv->recv_ports[1]);
@@ -700,11 +1258,23 @@ ov_local_peer_setup_remote_receive (OvLocalPeer * local, OvRemotePeer * remote)
   if (video_format == OV_VIDEO_FORMAT_JPEG) {
     rtpcaps = gst_caps_from_string (RTP_JPEG_VIDEO_CAPS_STR);
     remote->priv->vdepay = gst_element_factory_make ("rtpjpegdepay", NULL);
-    vdecode = gst_element_factory_make ("jpegdec", NULL);
+    vdecode = count_frames ? NULL : gst_element_factory_make ("jpegdec", NULL);
+    /* Every JPEG frame is a keyframe, so frames can be dropped before the
+     * decoder when it falls behind. Only lower-priority remotes do that; see
+     * ov_local_peer_update_priorities(). Also decouples decoding from
+     * depayloading. */
+    if (vdecode != NULL) {
+      remote->priv->decode_queue =
+        gst_element_factory_make ("queue", "vdecode-queue");
+      g_object_set (remote->priv->decode_queue, "max-size-buffers",
+          OV_DECODE_QUEUE_FRAMES, "max-size-bytes", 0, "max-size-time",
+          G_GUINT64_CONSTANT (0), NULL);
+    }
   } else if (video_format == OV_VIDEO_FORMAT_H264) {
     rtpcaps = gst_caps_from_string (RTP_H264_VIDEO_CAPS_STR);
     remote->priv->vdepay = gst_element_factory_make ("rtph264depay", NULL);
-    vdecode = gst_element_factory_make ("avdec_h264", NULL);
+    vdecode = count_frames ? NULL :
+      gst_element_factory_make ("avdec_h264", NULL);
   } else {
     g_assert_not_reached ();
   }
@@ -720,9 +1290,13 @@ ov_local_peer_setup_remote_receive (OvLocalPeer * local, OvRemotePeer * remote)
   g_object_set (vsrc, "buffer-size", OV_VIDEO_RECV_BUFSIZE, "socket", socket,
       "caps", rtpcaps, NULL);
   gst_caps_unref (rtpcaps);
-  g_object_unref (socket);
+  /* Kept around for kernel drop accounting and buffer size tuning */
+  remote->priv->recv_rtp_sockets[OV_VIDEO_RTP_SESSION] = socket;
 
-  vsink = gst_element_factory_make ("proxysink", "video-proxysink-%u");
+  if (count_frames)
+    vsink = ov_get_fakesink (OV_PLAYBACK_MODE_COUNT_FRAMES);
+  else
+    vsink = gst_element_factory_make ("proxysink", "video-proxysink-%u");
   g_assert (vsink != NULL);
   /* Recv RTCP SR for video */
   socket = ov_get_socket_for_addr (local_addr_s, remote->priv->recv_ports[3]);
@@ -739,13 +1313,19 @@ ov_local_peer_setup_remote_receive (OvLocalPeer * local, OvRemotePeer * remote)
   g_object_unref (socket);
 
   gst_bin_add_many (GST_BIN (remote->receive), rtpbin,
-      asrc, remote->priv->aqueue, remote->priv->adepay, adecode, asink,
-      vsrc, remote->priv->vqueue, remote->priv->vdepay, vdecode, vsink,
+      asrc, remote->priv->aqueue, remote->priv->adepay, asink,
+      vsrc, remote->priv->vqueue, remote->priv->vdepay, vsink,
       artcpsink, artcpsrc, vrtcpsink, vrtcpsrc, NULL);
 
   /* Link audio branch via rtpbin */
-  ret = gst_element_link_many (remote->priv->aqueue, remote->priv->adepay,
-      adecode, asink, NULL);
+  if (adecode != NULL) {
+    gst_bin_add (GST_BIN (remote->receive), adecode);
+    ret = gst_element_link_many (remote->priv->aqueue, remote->priv->adepay,
+        adecode, asink, NULL);
+  } else {
+    ret = gst_element_link_many (remote->priv->aqueue, remote->priv->adepay,
+        asink, NULL);
+  }
   g_assert (ret);
 
   /* Recv audio RTP and send to rtpbin */
@@ -764,10 +1344,31 @@ ov_local_peer_setup_remote_receive (OvLocalPeer * local, OvRemotePeer * remote)
   g_assert (ret);
 
   /* Link video branch via rtpbin */
-  ret = gst_element_link_many (remote->priv->vqueue, remote->priv->vdepay,
-      vdecode, vsink, NULL);
+  if (remote->priv->decode_queue != NULL) {
+    gst_bin_add_many (GST_BIN (remote->receive), remote->priv->decode_queue,
+        vdecode, NULL);
+    ret = gst_element_link_many (remote->priv->vqueue, remote->priv->vdepay,
+        remote->priv->decode_queue, vdecode, vsink, NULL);
+  } else if (vdecode != NULL) {
+    gst_bin_add (GST_BIN (remote->receive), vdecode);
+    ret = gst_element_link_many (remote->priv->vqueue, remote->priv->vdepay,
+        vdecode, vsink, NULL);
+  } else {
+    ret = gst_element_link_many (remote->priv->vqueue, remote->priv->vdepay,
+        vsink, NULL);
+  }
   g_assert (ret);
 
+  /* Track RTP timestamps going into the depayloaders for A/V sync */
+  pad = gst_element_get_static_pad (remote->priv->adepay, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) on_remote_rtp_buffer, remote, NULL);
+  gst_object_unref (pad);
+  pad = gst_element_get_static_pad (remote->priv->vdepay, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) on_remote_rtp_buffer, remote, NULL);
+  gst_object_unref (pad);
+
   /* Recv video RTP and send to rtpbin */
   ret = gst_element_link_pads (vsrc, "src", rtpbin, "recv_rtp_sink_"
       OV_VIDEO_RTP_SESSION_STR);
@@ -797,11 +1398,30 @@ ov_local_peer_setup_remote_receive (OvLocalPeer * local, OvRemotePeer * remote)
    * RTPSource statistics from here for the application. */
   g_signal_connect (rtpbin, "on-ssrc-active",
       G_CALLBACK (on_receiver_ssrc_active), remote);
+  /* The remote has left the call; f.ex., it stopped transmitting */
+  g_signal_connect (rtpbin, "on-bye-ssrc",
+      G_CALLBACK (on_receiver_bye_ssrc), remote);
+
+  if (count_frames) {
+    /* Nothing is played back */
+    pad = gst_element_get_static_pad (asink, "sink");
+    gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+        (GstPadProbeCallback) on_remote_frame,
+        &remote->priv->frames[OV_AUDIO_RTP_SESSION], NULL);
+    gst_object_unref (pad);
+    pad = gst_element_get_static_pad (vsink, "sink");
+    gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+        (GstPadProbeCallback) on_remote_frame,
+        &remote->priv->frames[OV_VIDEO_RTP_SESSION], NULL);
+    gst_object_unref (pad);
+    goto out;
+  }
 
   /* This is what exposes video/audio data from this remote peer */
   remote->priv->audio_proxysink = asink;
   remote->priv->video_proxysink = vsink;
 
+out:
   GST_DEBUG ("Setup pipeline to receive from remote");
   g_free (remote_addr_s);
   g_free (local_addr_s);
@@ -813,14 +1433,19 @@ ov_local_peer_setup_remote_playback (OvLocalPeer * local, OvRemotePeer * remote)
   GstPad *ghostpad, *srcpad, *sinkpad;
   GstPadLinkReturn ret;
   gboolean res;
+  OvCall *call;
   OvLocalPeerPrivate *priv;
 
   priv = ov_local_peer_get_private (local);
+  call = remote->priv->call;
 
-  /* Setup pipeline (priv->playback) to aggregate audio from all remote peers
-   * to audiomixer and then render using the provided audio sink
-   *  [ proxysrc ! audiomixer ] */
+  /* Setup the bin of the call (call->playback) to aggregate audio from all
+   * remote peers in it to the mixer, which is then rendered using the provided
+   * audio sink. The level element is used for detecting the active speaker.
+   *  [ proxysrc ! level ! ovaudiomixer ] */
   if (remote->priv->audio_proxysink) {
+    GstElement *level;
+
     remote->priv->audio_proxysrc =
       gst_element_factory_make ("proxysrc", "audio-proxysrc-%u");
     g_assert (remote->priv->audio_proxysrc != NULL);
@@ -828,15 +1453,29 @@ ov_local_peer_setup_remote_playback (OvLocalPeer * local, OvRemotePeer * remote)
     /* Link the two pipelines */
     g_object_set (remote->priv->audio_proxysrc, "proxysink",
         remote->priv->audio_proxysink, NULL);
+    srcpad = gst_element_get_static_pad (remote->priv->audio_proxysrc, "src");
+    gst_pad_add_probe (srcpad, GST_PAD_PROBE_TYPE_BUFFER,
+        (GstPadProbeCallback) on_remote_frame,
+        &remote->priv->frames[OV_AUDIO_RTP_SESSION], NULL);
+    gst_object_unref (srcpad);
+
+    sinkpad = gst_element_get_request_pad (call->audiomixer, "sink_%u");
 
-    sinkpad = gst_element_get_request_pad (priv->audiomixer, "sink_%u");
+    level = gst_element_factory_make ("level", NULL);
+    g_object_set (level, "interval", OV_AUDIO_LEVEL_INTERVAL_MS * GST_MSECOND,
+        "post-messages", TRUE, NULL);
 
     gst_bin_add_many (GST_BIN (remote->priv->aplayback),
-        remote->priv->audio_proxysrc, NULL);
-    res = gst_bin_add (GST_BIN (priv->playback), remote->priv->aplayback);
+        remote->priv->audio_proxysrc, level, NULL);
+    res = gst_element_link (remote->priv->audio_proxysrc, level);
+    g_assert (res);
+    res = gst_bin_add (GST_BIN (call->playback), remote->priv->aplayback);
     g_assert (res);
 
-    srcpad = gst_element_get_static_pad (remote->priv->audio_proxysrc, "src");
+    srcpad = gst_element_get_static_pad (level, "src");
+    /* After level, so that silence is still measured correctly */
+    gst_pad_add_probe (srcpad, GST_PAD_PROBE_TYPE_BUFFER,
+        (GstPadProbeCallback) on_remote_audio_buffer, remote, NULL);
     ghostpad = gst_ghost_pad_new ("audiopad", srcpad);
     res = gst_pad_set_active (ghostpad, TRUE);
     g_assert (res);
@@ -849,8 +1488,8 @@ ov_local_peer_setup_remote_playback (OvLocalPeer * local, OvRemotePeer * remote)
     gst_object_unref (sinkpad);
   }
 
-  /* Setup pipeline (priv->playback) to render video from each local to the
-   * provided video sink */
+  /* Setup the bin of the call (call->playback) to render video from each
+   * remote to the provided video sink */
   if (remote->priv->video_proxysink) {
     remote->priv->video_proxysrc =
       gst_element_factory_make ("proxysrc", "video-proxysrc-%u");
@@ -858,13 +1497,28 @@ ov_local_peer_setup_remote_playback (OvLocalPeer * local, OvRemotePeer * remote)
 
     /* Link the two pipelines */
     g_object_set (remote->priv->video_proxysrc, "proxysink",
-        remote->priv->video_proxysink, NULL);
+        remote->priv->video_proxysink, "max-latency",
+        OV_VIDEO_PLAYBACK_QUEUE_MS * GST_MSECOND, NULL);
+    /* Drop old frames instead of letting latency build up when the sink
+     * stalls, f.ex., on a main loop hiccup with gtksink */
+    gst_util_set_object_arg (G_OBJECT (remote->priv->video_proxysrc), "leaky",
+        "downstream");
+    srcpad = gst_element_get_static_pad (remote->priv->video_proxysrc, "src");
+    gst_pad_add_probe (srcpad, GST_PAD_PROBE_TYPE_BUFFER,
+        (GstPadProbeCallback) on_remote_frame,
+        &remote->priv->frames[OV_VIDEO_RTP_SESSION], NULL);
+    gst_object_unref (srcpad);
+
+    if (call->compositor != NULL)
+      goto composite_video;
 
     /* If a remote_peer_add_sink wasn't used, use a fallback (xv|gl)imagesink */
     if (remote->priv->video_sink == NULL) {
       /* On Linux (Mesa), using multiple GL output windows leads to a
        * crash due to a bug in Mesa related to multiple GLX contexts */
-      if (_ov_opengl_is_mesa ())
+      if (priv->playback_mode == OV_PLAYBACK_MODE_HEADLESS)
+        remote->priv->video_sink = ov_get_fakesink (priv->playback_mode);
+      else if (_ov_opengl_is_mesa ())
         remote->priv->video_sink =
           gst_parse_bin_from_description ("videoconvert ! xvimagesink", TRUE,
               NULL);
@@ -875,7 +1529,7 @@ ov_local_peer_setup_remote_playback (OvLocalPeer * local, OvRemotePeer * remote)
 
     gst_bin_add_many (GST_BIN (remote->priv->vplayback),
         remote->priv->video_proxysrc, remote->priv->video_sink, NULL);
-    res = gst_bin_add (GST_BIN (priv->playback), remote->priv->vplayback);
+    res = gst_bin_add (GST_BIN (call->playback), remote->priv->vplayback);
     g_assert (res);
     res = gst_element_link (remote->priv->video_proxysrc,
         remote->priv->video_sink);
@@ -883,4 +1537,36 @@ ov_local_peer_setup_remote_playback (OvLocalPeer * local, OvRemotePeer * remote)
   }
 
   GST_DEBUG ("Setup local pipeline to playback remote");
+  return;
+
+composite_video:
+  /* Render video from all remotes with a single sink
+   *  [ proxysrc ! compositor ] */
+  if (remote->priv->video_sink != NULL) {
+    GST_WARNING ("Ignoring video sink for remote %s since all video is being"
+        " composited", remote->addr_s);
+    gst_object_ref_sink (remote->priv->video_sink);
+    g_clear_pointer (&remote->priv->video_sink, gst_object_unref);
+  }
+
+  gst_bin_add (GST_BIN (remote->priv->vplayback),
+      remote->priv->video_proxysrc);
+  res = gst_bin_add (GST_BIN (call->playback), remote->priv->vplayback);
+  g_assert (res);
+
+  srcpad = gst_element_get_static_pad (remote->priv->video_proxysrc, "src");
+  ghostpad = gst_ghost_pad_new ("videopad", srcpad);
+  res = gst_pad_set_active (ghostpad, TRUE);
+  g_assert (res);
+  res = gst_element_add_pad (remote->priv->vplayback, ghostpad);
+  g_assert (res);
+  gst_object_unref (srcpad);
+
+  sinkpad = gst_element_get_request_pad (call->compositor, "sink_%u");
+  ret = gst_pad_link (ghostpad, sinkpad);
+  g_assert (ret == GST_PAD_LINK_OK);
+  gst_object_unref (sinkpad);
+
+  ov_local_peer_update_video_layout (local, call);
+  GST_DEBUG ("Setup local pipeline to playback remote (composited)");
 }
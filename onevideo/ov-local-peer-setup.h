@@ -29,6 +29,7 @@
 #define __OV_LOCAL_PEER_SETUP_H__
 
 #include "lib.h"
+#include "lib-priv.h"
 #include "ov-local-peer.h"
 
 G_BEGIN_DECLS
@@ -39,10 +40,17 @@ void      ov_on_gst_bus_error                     (GstBus *bus,
 
 GSocket*  ov_get_socket_for_addr                  (const gchar *addr_s,
                                                    guint port);
+guint     ov_socket_get_kernel_drops              (GSocket *socket);
+gint      ov_socket_get_recv_buffer_size          (GSocket *socket);
+gint      ov_socket_set_recv_buffer_size          (GSocket *socket,
+                                                   gint size);
 
 gboolean  ov_local_peer_setup_transmit_pipeline   (OvLocalPeer *local);
 gboolean  ov_local_peer_setup_playback_pipeline   (OvLocalPeer *local);
+gboolean  ov_local_peer_setup_call_playback       (OvLocalPeer *local,
+                                                   OvCall *call);
 gboolean  ov_local_peer_setup_comms               (OvLocalPeer *local);
+void      ov_local_peer_teardown_comms            (OvLocalPeer *local);
 
 void      ov_local_peer_setup_remote_receive      (OvLocalPeer *local,
                                                    OvRemotePeer *remote);
@@ -29,14 +29,41 @@
 #include "outgoing.h"
 #include "ov-local-peer.h"
 #include "ov-local-peer-priv.h"
+#include "ov-local-peer-setup.h"
 
 G_DEFINE_TYPE_WITH_PRIVATE (OvLocalPeer, ov_local_peer, OV_TYPE_PEER)
 
+GType
+ov_playback_mode_get_type (void)
+{
+  static volatile gsize mode_type = 0;
+  static const GEnumValue modes[] = {
+    {OV_PLAYBACK_MODE_NORMAL, "Render audio and video", "normal"},
+    {OV_PLAYBACK_MODE_HEADLESS, "Decode but discard audio and video",
+      "headless"},
+    {OV_PLAYBACK_MODE_COUNT_FRAMES, "Only count received frames",
+      "count-frames"},
+    {0, NULL, NULL},
+  };
+
+  if (g_once_init_enter (&mode_type)) {
+    GType tmp = g_enum_register_static ("OvPlaybackMode", modes);
+    g_once_init_leave (&mode_type, tmp);
+  }
+
+  return (GType) mode_type;
+}
+
 enum
 {
   PROP_0,
 
   PROP_IFACE,
+  PROP_TIMEOUT_CHECK_INTERVAL,
+  PROP_COMPOSITE_VIDEO,
+  PROP_AUDIO_BUFFER_TIME,
+  PROP_AUDIO_UNDERRUNS,
+  PROP_PLAYBACK_MODE,
 
   N_PROPERTIES
 };
@@ -55,6 +82,9 @@ enum
   /* Call */
   CALL_REMOTE_GONE,
   CALL_ALL_REMOTES_GONE,
+  CALL_REMOTE_ADDED,
+  CALL_JOIN_FAILED,
+  ACTIVE_SPEAKER_CHANGED,
   /* Network quality statistics for all remote peers */
   /* FIXME: These should be done via "video-stats" and "audio-stats"
    * props on each OvRemotePeer once that's a GObject like OvLocalPeer */
@@ -85,6 +115,24 @@ ov_local_peer_set_property (GObject * object, guint prop_id,
       g_free (priv->iface);
       priv->iface = g_value_dup_string (value);
       break;
+    case PROP_TIMEOUT_CHECK_INTERVAL:
+      /* Takes effect from the next call */
+      priv->timeout_check_interval = g_value_get_uint (value);
+      break;
+    case PROP_COMPOSITE_VIDEO:
+      /* Takes effect from the next call */
+      priv->composite_video = g_value_get_boolean (value);
+      break;
+    case PROP_PLAYBACK_MODE:
+      /* Takes effect from the next call */
+      priv->playback_mode = g_value_get_enum (value);
+      break;
+    case PROP_AUDIO_BUFFER_TIME:
+      /* Takes effect from the next call */
+      priv->audio_buffer_time_start = g_value_get_uint (value);
+      if (priv->audiosink == NULL)
+        priv->audio_buffer_time = priv->audio_buffer_time_start;
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
   }
@@ -100,6 +148,21 @@ ov_local_peer_get_property (GObject * object, guint prop_id, GValue * value,
     case PROP_IFACE:
       g_value_set_string (value, priv->iface);
       break;
+    case PROP_TIMEOUT_CHECK_INTERVAL:
+      g_value_set_uint (value, priv->timeout_check_interval);
+      break;
+    case PROP_COMPOSITE_VIDEO:
+      g_value_set_boolean (value, priv->composite_video);
+      break;
+    case PROP_AUDIO_BUFFER_TIME:
+      g_value_set_uint (value, priv->audio_buffer_time);
+      break;
+    case PROP_AUDIO_UNDERRUNS:
+      g_value_set_uint (value, g_atomic_int_get (&priv->audio_underruns));
+      break;
+    case PROP_PLAYBACK_MODE:
+      g_value_set_enum (value, priv->playback_mode);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
   }
@@ -258,7 +321,8 @@ ov_local_peer_class_init (OvLocalPeerClass * klass)
    * @timedout: whether the disconnection was due to a timeout
    *
    * Emitted when a remote peers leaves a call due to a timeout or because of
-   * a call hangup.
+   * a call hangup. A remote that sends an RTCP BYE or whose ports become
+   * unreachable is considered to have hung up, and is removed immediately.
    *
    * This signal is not emitted when either ov_local_peer_call_hangup() or
    * ov_local_peer_remove_remote() is invoked.
@@ -288,6 +352,60 @@ ov_local_peer_class_init (OvLocalPeerClass * klass)
         NULL, NULL, NULL,
         G_TYPE_NONE, 0);
 
+  /**
+   * OvLocalPeer::call-remote-added:
+   * @local: the local peer
+   * @remote: the #OvPeer that has joined the call
+   *
+   * Emitted when a remote peer is added to the call that we're in, either by
+   * us with ov_local_peer_call_join_start() or by another peer in the call.
+   * Audio and video from the other remotes keeps flowing while it's added.
+   **/
+  signals[CALL_REMOTE_ADDED] =
+    g_signal_new ("call-remote-added", G_OBJECT_CLASS_TYPE (object_class),
+        G_SIGNAL_RUN_LAST,
+        G_STRUCT_OFFSET (OvLocalPeerClass, call_remote_added),
+        NULL, NULL, NULL,
+        G_TYPE_NONE, 1,
+        OV_TYPE_PEER);
+
+  /**
+   * OvLocalPeer::call-join-failed:
+   * @local: the local peer
+   * @remote: the #OvPeer that we were adding to the call
+   * @error: the #GError describing why it failed
+   *
+   * Emitted when adding a remote peer to the call with
+   * ov_local_peer_call_join_start() fails. The call continues with the
+   * remotes that were already in it.
+   **/
+  signals[CALL_JOIN_FAILED] =
+    g_signal_new ("call-join-failed", G_OBJECT_CLASS_TYPE (object_class),
+        G_SIGNAL_RUN_LAST,
+        G_STRUCT_OFFSET (OvLocalPeerClass, call_join_failed),
+        NULL, NULL, NULL,
+        G_TYPE_NONE, 2,
+        OV_TYPE_PEER,
+        G_TYPE_ERROR);
+
+  /**
+   * OvLocalPeer::active-speaker-changed:
+   * @local: the local peer
+   * @speaker: the #OvPeer that is now the active speaker
+   *
+   * Emitted during a call when a remote peer has been speaking louder than
+   * everyone else for long enough to become the active speaker. When video is
+   * composited, the active speaker is always shown in the first tile. Use
+   * ov_local_peer_get_active_speaker() to get the corresponding #OvRemotePeer.
+   **/
+  signals[ACTIVE_SPEAKER_CHANGED] =
+    g_signal_new ("active-speaker-changed", G_OBJECT_CLASS_TYPE (object_class),
+        G_SIGNAL_RUN_LAST,
+        G_STRUCT_OFFSET (OvLocalPeerClass, active_speaker_changed),
+        NULL, NULL, NULL,
+        G_TYPE_NONE, 1,
+        OV_TYPE_PEER);
+
   /**
    * OvLocalPeer::get-stats:
    * @local: the local peer
@@ -316,6 +434,33 @@ ov_local_peer_class_init (OvLocalPeerClass * klass)
    * "packets-fractionlost"   G_TYPE_UINT     lost packets as an 8-bit fraction
    * "round-trip"             G_TYPE_UINT     the round-trip time in milliseconds
    *
+   * The following fields are about data that we receive from the remote peer:
+   *
+   * "kernel-drops"           G_TYPE_UINT     packets dropped by the kernel
+   *                                          because our receive buffer was full
+   * "recv-buffer-size"       G_TYPE_INT      current receive buffer size in bytes
+   * "av-skew"                G_TYPE_INT      audio/video skew in milliseconds
+   *                                          after correction; positive means
+   *                                          audio is played late
+   * "frames"                 G_TYPE_UINT     number of frames that reached
+   *                                          playback (or were counted)
+   * "priority"               G_TYPE_UINT     see ov_remote_peer_get_priority()
+   *
+   * The following fields are about the handoff of decoded data from the
+   * receive pipeline to the playback pipeline. They are not set in the
+   * count-frames playback mode.
+   *
+   * "proxy-buffers"          G_TYPE_UINT64   buffers handed off
+   * "proxy-bytes"            G_TYPE_UINT64   bytes handed off
+   * "proxy-dropped"          G_TYPE_UINT64   buffers dropped because playback
+   *                                          was falling behind
+   * "proxy-queue-level"      G_TYPE_UINT64   data currently queued for
+   *                                          playback in nanoseconds
+   * "proxy-queue-buffers"    G_TYPE_UINT     buffers currently queued for
+   *                                          playback
+   * "proxy-handoff-latency"  G_TYPE_UINT64   average time in nanoseconds
+   *                                          from handoff to playback
+   *
    * Returns: a #GHashTable
    **/
   signals[GET_STATS] =
@@ -336,6 +481,73 @@ ov_local_peer_class_init (OvLocalPeerClass * klass)
         "User-supplied network interface", NULL, G_PARAM_CONSTRUCT_ONLY |
         G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  /**
+   * OvLocalPeer::timeout-check-interval
+   *
+   * How often (in milliseconds) to check whether remote peers in a call have
+   * timed out.
+   */
+  g_object_class_install_property (object_class, PROP_TIMEOUT_CHECK_INTERVAL,
+      g_param_spec_uint ("timeout-check-interval", "Timeout Check Interval",
+        "How often to check whether remote peers have timed out (in ms)."
+        " Remotes that leave with an RTCP BYE or become unreachable are"
+        " removed immediately regardless of this", 10, 10000,
+        OV_REMOTE_PEER_TIMEOUT_CHECK_MSECS, G_PARAM_READWRITE |
+        G_PARAM_STATIC_STRINGS));
+
+  /**
+   * OvLocalPeer::composite-video
+   *
+   * Whether to composite video from all remote peers into a grid rendered by
+   * a single video sink instead of using one sink per remote peer. The layout
+   * is updated automatically when remotes join or leave. Calling
+   * ov_local_peer_add_gtksink() enables this.
+   */
+  g_object_class_install_property (object_class, PROP_COMPOSITE_VIDEO,
+      g_param_spec_boolean ("composite-video", "Composite Video",
+        "Render video from all remote peers with a single sink", FALSE,
+        G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * OvLocalPeer::playback-mode
+   *
+   * How audio and video received from remote peers is rendered. In headless
+   * mode, everything is decoded but no sound server or display is used. In
+   * count-frames mode, nothing is decoded either. Both are useful for
+   * measuring receive-side throughput with the "frames" field of the
+   * statistics returned by #OvLocalPeer::get-stats.
+   */
+  g_object_class_install_property (object_class, PROP_PLAYBACK_MODE,
+      g_param_spec_enum ("playback-mode", "Playback Mode",
+        "How to render audio and video from remote peers",
+        OV_TYPE_PLAYBACK_MODE, OV_PLAYBACK_MODE_NORMAL, G_PARAM_READWRITE |
+        G_PARAM_STATIC_STRINGS));
+
+  /**
+   * OvLocalPeer::audio-buffer-time
+   *
+   * Size of the audio playout buffer in milliseconds. Setting this sets the
+   * size at the start of the next call; during a call, the buffer is grown
+   * automatically (up to 200ms, at most once every 10 seconds) when audio
+   * underruns are seen, and reading this returns the current size.
+   */
+  g_object_class_install_property (object_class, PROP_AUDIO_BUFFER_TIME,
+      g_param_spec_uint ("audio-buffer-time", "Audio Buffer Time",
+        "Size of the audio playout buffer (in ms)", 10, 1000,
+        OV_AUDIO_BUFFER_TIME_MSECS, G_PARAM_READWRITE |
+        G_PARAM_STATIC_STRINGS));
+
+  /**
+   * OvLocalPeer::audio-underruns
+   *
+   * Number of times audio from remote peers could not be played in time
+   * during the current (or last) call.
+   */
+  g_object_class_install_property (object_class, PROP_AUDIO_UNDERRUNS,
+      g_param_spec_uint ("audio-underruns", "Audio Underruns",
+        "Number of audio playout underruns in the current call", 0,
+        G_MAXUINT, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
   klass->get_stats = GST_DEBUG_FUNCPTR (ov_local_peer_get_stats);
 }
 
@@ -352,6 +564,70 @@ _ov_gst_can_decode_h264 (void)
   return TRUE;
 }
 
+static void
+ov_caps_cache_entry_free (OvCapsCacheEntry * entry)
+{
+  guint ii;
+
+  for (ii = 0; ii < 4; ii++)
+    g_free (entry->caps[ii]);
+  g_free (entry);
+}
+
+OvCall *
+ov_call_new (void)
+{
+  OvCall *call;
+
+  call = g_new0 (OvCall, 1);
+  call->created = g_get_monotonic_time ();
+  call->state = OV_LOCAL_STATE_STARTED;
+  call->remote_peers = g_ptr_array_new ();
+  call->joining = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+      (GDestroyNotify) ov_remote_peer_free);
+
+  return call;
+}
+
+/* The remotes that were set up must already have been removed, along with the
+ * playback branch; the ones that are still in the call because it never
+ * started, and the ones that were joining it, are freed. A task that is
+ * adding a remote to the call notices that it's gone when it next looks it up
+ * by id. Freeing remotes takes the local peer lock. */
+void
+ov_call_free (OvCall * call)
+{
+  g_assert (call->negotiate == NULL && call->negotiator_task == NULL);
+  g_assert (call->playback == NULL);
+  g_hash_table_unref (call->joining);
+  g_ptr_array_foreach (call->remote_peers, (GFunc) ov_remote_peer_free, NULL);
+  g_ptr_array_free (call->remote_peers, TRUE);
+  g_free (call);
+}
+
+/* Called with the lock TAKEN */
+void
+ov_call_add_remote (OvCall * call, OvRemotePeer * remote)
+{
+  remote->priv->call = call;
+  g_ptr_array_add (call->remote_peers, remote);
+}
+
+/* Called with the lock TAKEN */
+OvRemotePeer *
+ov_call_get_remote_by_id (OvCall * call, const gchar * id)
+{
+  guint ii;
+
+  for (ii = 0; ii < call->remote_peers->len; ii++) {
+    OvRemotePeer *remote = g_ptr_array_index (call->remote_peers, ii);
+    if (g_strcmp0 (id, remote->id) == 0)
+      return remote;
+  }
+
+  return NULL;
+}
+
 static void
 ov_local_peer_init (OvLocalPeer * self)
 {
@@ -371,7 +647,13 @@ ov_local_peer_init (OvLocalPeer * self)
   /* NOTE: GArray and GPtrArray are not thread-safe; we must lock accesses */
   g_rec_mutex_init (&priv->lock);
   priv->used_ports = g_array_sized_new (FALSE, TRUE, sizeof (guint16), 4);
-  priv->remote_peers = g_ptr_array_new ();
+  priv->calls = g_hash_table_new (g_int64_hash, g_int64_equal);
+  priv->call = ov_call_new ();
+  priv->caps_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      (GDestroyNotify) ov_caps_cache_entry_free);
+  priv->timeout_check_interval = OV_REMOTE_PEER_TIMEOUT_CHECK_MSECS;
+  priv->audio_buffer_time_start = OV_AUDIO_BUFFER_TIME_MSECS;
+  priv->audio_buffer_time = OV_AUDIO_BUFFER_TIME_MSECS;
 
   /*-- Initialize (non-RTP) caps supported by us --*/
   /* NOTE: Caps negotiated/exchanged between peers are always non-RTP caps */
@@ -415,6 +697,7 @@ ov_local_peer_dispose (GObject * object)
 
   g_clear_object (&priv->dm);
 
+  ov_local_peer_teardown_comms (OV_LOCAL_PEER (object));
   g_clear_object (&priv->tcp_server);
   g_clear_pointer (&priv->mc_socket_source, g_source_destroy);
 
@@ -425,7 +708,10 @@ ov_local_peer_dispose (GObject * object)
   g_clear_pointer (&priv->send_acaps, gst_caps_unref);
   g_clear_pointer (&priv->send_vcaps, gst_caps_unref);
 
+  ov_local_peer_finish_stop_transmit (OV_LOCAL_PEER (object));
   g_clear_object (&priv->transmit_vcapsfilter);
+  g_clear_object (&priv->preview_sink);
+  g_clear_object (&priv->video_sink);
   g_clear_object (&priv->transmit);
   g_clear_object (&priv->playback);
 
@@ -438,8 +724,12 @@ ov_local_peer_finalize (GObject * object)
   OvLocalPeerPrivate *priv = ov_local_peer_get_private (OV_LOCAL_PEER (object));
 
   GST_DEBUG ("Freeing local peer");
+  /* Freeing remotes takes the lock. ov_local_peer_stop() has ended all the
+   * calls, and the current one is kept around until here. */
+  g_hash_table_unref (priv->calls);
+  ov_call_free (priv->call);
   g_rec_mutex_clear (&priv->lock);
-  g_ptr_array_free (priv->remote_peers, TRUE);
+  g_hash_table_unref (priv->caps_cache);
   g_list_free_full (priv->mc_ifaces, g_free);
   g_array_free (priv->used_ports, TRUE);
   g_free (priv->iface);
@@ -501,12 +791,22 @@ ov_local_peer_unlock (OvLocalPeer * self)
 
 /*~~ State manipulation ~~*/
 
-/* This is the only one that is publicly exposed */
+/* This is the only one that is publicly exposed. Once the local peer has
+ * been started, its state is that of the current call. */
 OvLocalPeerState
 ov_local_peer_get_state (OvLocalPeer * self)
 {
+  OvLocalPeerState state;
   OvLocalPeerPrivate *priv = ov_local_peer_get_private (self);
-  return priv->state;
+
+  ov_local_peer_lock (self);
+  if (priv->state == OV_LOCAL_STATE_STARTED)
+    state = priv->call->state;
+  else
+    state = priv->state;
+  ov_local_peer_unlock (self);
+
+  return state;
 }
 
 void
@@ -517,35 +817,175 @@ ov_local_peer_set_state (OvLocalPeer * self, OvLocalPeerState state)
 }
 
 void
-ov_local_peer_set_state_failed (OvLocalPeer * self)
+ov_call_set_state (OvCall * call, OvLocalPeerState state)
+{
+  call->state = state;
+}
+
+void
+ov_call_set_state_failed (OvCall * call)
+{
+  call->state |= OV_LOCAL_STATE_FAILED;
+}
+
+void
+ov_call_set_state_timedout (OvCall * call)
+{
+  call->state |= OV_LOCAL_STATE_TIMEOUT;
+}
+
+void
+ov_call_set_state_negotiator (OvCall * call)
+{
+  /* Can't be negotiator and negotiatee at the same time */
+  g_return_if_fail (!(call->state & OV_LOCAL_STATE_NEGOTIATEE));
+  call->state |= OV_LOCAL_STATE_NEGOTIATOR;
+}
+
+void
+ov_call_set_state_negotiatee (OvCall * call)
+{
+  /* Can't be negotiator and negotiatee at the same time */
+  g_return_if_fail (!(call->state & OV_LOCAL_STATE_NEGOTIATOR));
+  call->state |= OV_LOCAL_STATE_NEGOTIATEE;
+}
+
+/*~~ Calls ~~*/
+
+/* Called with the lock TAKEN. Returns the call with id @call_id, or NULL if
+ * there's no such call (anymore). */
+OvCall *
+ov_local_peer_get_call (OvLocalPeer * self, guint64 call_id)
 {
   OvLocalPeerPrivate *priv = ov_local_peer_get_private (self);
-  priv->state |= OV_LOCAL_STATE_FAILED;
+
+  if (call_id == 0)
+    return NULL;
+
+  return g_hash_table_lookup (priv->calls, &call_id);
 }
 
+/* Called with the lock TAKEN. The caps we send are decided while negotiating
+ * and all calls share the transmit pipeline, so we only negotiate one call at
+ * a time. Returns the call that is being negotiated, or has been negotiated
+ * but not started yet, if any. */
+OvCall *
+ov_local_peer_get_negotiating_call (OvLocalPeer * self)
+{
+  OvCall *call;
+  GHashTableIter iter;
+  OvLocalPeerPrivate *priv = ov_local_peer_get_private (self);
+
+  g_hash_table_iter_init (&iter, priv->calls);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &call))
+    if (!(call->state & (OV_LOCAL_STATE_PLAYING | OV_LOCAL_STATE_PAUSED)))
+      return call;
+
+  return NULL;
+}
+
+/* Called with the lock TAKEN. Whether a call other than @call is in progress,
+ * and hence still needs the transmit and playback pipelines. */
+gboolean
+ov_local_peer_in_other_calls (OvLocalPeer * self, OvCall * call)
+{
+  OvCall *other;
+  GHashTableIter iter;
+  OvLocalPeerPrivate *priv = ov_local_peer_get_private (self);
+
+  g_hash_table_iter_init (&iter, priv->calls);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &other))
+    if (other != call &&
+        other->state & (OV_LOCAL_STATE_PLAYING | OV_LOCAL_STATE_PAUSED))
+      return TRUE;
+
+  return FALSE;
+}
+
+/* Called with the lock TAKEN. Gives @call the id @call_id, after which
+ * messages from remotes for that id are handled by it. */
 void
-ov_local_peer_set_state_timedout (OvLocalPeer * self)
+ov_local_peer_insert_call (OvLocalPeer * self, OvCall * call, guint64 call_id)
 {
   OvLocalPeerPrivate *priv = ov_local_peer_get_private (self);
-  priv->state |= OV_LOCAL_STATE_TIMEOUT;
+
+  g_assert (call->id == 0);
+  call->id = call_id;
+  g_hash_table_insert (priv->calls, &call->id, call);
 }
 
+/* Called with the lock TAKEN. Makes @call the one that the public API acts
+ * on. If the previous one never got an id, it's freed along with any remotes
+ * that were added to it. */
 void
-ov_local_peer_set_state_negotiator (OvLocalPeer * self)
+ov_local_peer_set_current_call (OvLocalPeer * self, OvCall * call)
 {
+  OvCall *old;
   OvLocalPeerPrivate *priv = ov_local_peer_get_private (self);
-  /* Can't be negotiator and negotiatee at the same time */
-  g_return_if_fail (!(priv->state & OV_LOCAL_STATE_NEGOTIATEE));
-  priv->state |= OV_LOCAL_STATE_NEGOTIATOR;
+
+  old = priv->call;
+  if (old == call)
+    return;
+
+  priv->call = call;
+  if (old->id == 0)
+    ov_call_free (old);
 }
 
+/* Called with the lock TAKEN, once the remotes that were set up for @call have
+ * been removed, or if it never started. Forgets its id, so that messages for
+ * it are rejected from now on. If it's the current call and it still has
+ * remotes, or there's no other call, it's kept as the current call so that
+ * the application can look at it and retry or hang up. Otherwise it's freed,
+ * and the most recent of the other calls becomes the current one. */
 void
-ov_local_peer_set_state_negotiatee (OvLocalPeer * self)
+ov_local_peer_end_call (OvLocalPeer * self, OvCall * call)
 {
+  OvCall *other, *next = NULL;
+  GHashTableIter iter;
   OvLocalPeerPrivate *priv = ov_local_peer_get_private (self);
-  /* Can't be negotiator and negotiatee at the same time */
-  g_return_if_fail (!(priv->state & OV_LOCAL_STATE_NEGOTIATOR));
-  priv->state |= OV_LOCAL_STATE_NEGOTIATEE;
+
+  if (call->id != 0) {
+    g_hash_table_remove (priv->calls, &call->id);
+    call->id = 0;
+  }
+
+  if (call != priv->call) {
+    ov_call_free (call);
+    return;
+  }
+
+  if (call->remote_peers->len > 0)
+    return;
+
+  g_hash_table_iter_init (&iter, priv->calls);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &other))
+    if (next == NULL || other->created > next->created)
+      next = other;
+
+  if (next != NULL) {
+    GST_DEBUG ("Call %" G_GUINT64_FORMAT " is now the current call",
+        next->id);
+    ov_local_peer_set_current_call (self, next);
+  }
+}
+
+/* Called with the lock TAKEN. The caps that we can send to the remotes of a
+ * new call: once a call is transmitting, every other call gets what it sends,
+ * since they share the transmit pipeline. Returns new references. */
+void
+ov_local_peer_get_send_caps (OvLocalPeer * self, GstCaps ** acaps,
+    GstCaps ** vcaps)
+{
+  OvLocalPeerPrivate *priv = ov_local_peer_get_private (self);
+
+  if (priv->transmit != NULL && priv->send_acaps != NULL) {
+    *acaps = gst_caps_ref (priv->send_acaps);
+    *vcaps = gst_caps_ref (priv->send_vcaps);
+  } else {
+    *acaps = gst_caps_ref (priv->supported_send_acaps);
+    *vcaps = gst_caps_ref (priv->supported_send_vcaps);
+  }
 }
 
 /* Video transmit caps manipulation -- NOT publicly exposed */
@@ -580,53 +1020,146 @@ ov_local_peer_set_transmit_video_caps (OvLocalPeer * self, GstCaps * vcaps)
 
 /*~~ Negotiation ~~*/
 
-static void
-negotiate_async_ready_cb (OvLocalPeer * local, GAsyncResult * result,
-    gpointer user_data)
-{
-  OvLocalPeerPrivate *priv = ov_local_peer_get_private (local);
-  priv->negotiator_task = NULL;
-}
-
 /* Will send each remote peer the list of all other remote peers, and each
  * remote peer replies with the recv/send caps it supports. Once all the peers
  * have replied, we'll decide caps for everyone and send them to everyone. All
  * this will happen asynchronously. The caller should just call
  * ov_local_peer_call_start() when it wants to start the call, and it will
- * start when everyone is ready. */
+ * start when everyone is ready.
+ *
+ * This negotiates the current call, which must not have been negotiated yet.
+ * Other calls can be in progress, but not being negotiated. */
 gboolean
 ov_local_peer_negotiate_start (OvLocalPeer * local)
 {
   GTask *task;
   GCancellable *cancellable;
+  OvCall *call;
   OvLocalPeerPrivate *priv;
   OvLocalPeerState state;
 
   ov_local_peer_lock (local);
   priv = ov_local_peer_get_private (local);
+  call = priv->call;
 
   state = ov_local_peer_get_state (local);
 
-  if (!(state & OV_LOCAL_STATE_STARTED)) {
+  if (!(state & OV_LOCAL_STATE_STARTED) || call->id != 0) {
     GST_ERROR ("State is %u instead of STARTED", state);
-    return FALSE;
+    goto err;
   }
-  ov_local_peer_set_state (local, OV_LOCAL_STATE_STARTED);
+
+  if (ov_local_peer_get_negotiating_call (local) != NULL) {
+    GST_ERROR ("Already negotiating another call");
+    goto err;
+  }
+  ov_call_set_state (call, OV_LOCAL_STATE_STARTED);
 
   cancellable = g_cancellable_new ();
 
-  task = g_task_new (local, cancellable,
-      (GAsyncReadyCallback) negotiate_async_ready_cb, NULL);
+  /* The call id is only unique for us, but remotes only need to tell apart
+   * the calls they are in */
+  ov_local_peer_insert_call (local, call, g_get_monotonic_time ());
+  /* The task clears itself from the call, under the lock */
+  task = g_task_new (local, cancellable, NULL, NULL);
+  g_task_set_task_data (task, call, NULL);
   g_task_set_return_on_cancel (task, TRUE);
+  call->negotiator_task = task;
   g_task_run_in_thread (task,
       (GTaskThreadFunc) ov_local_peer_negotiate_thread);
-  priv->negotiator_task = task;
   g_object_unref (cancellable); /* Hand over ref to the task */
   g_object_unref (task);
 
   ov_local_peer_unlock (local);
 
   return TRUE;
+err:
+  ov_local_peer_unlock (local);
+  return FALSE;
+}
+
+static const gchar *negotiate_step_names[OV_NEGOTIATE_N_STEPS] = {
+  "query caps",
+  "call details",
+  "start call",
+};
+
+const gchar *
+ov_negotiate_step_to_string (OvNegotiateStep step)
+{
+  g_return_val_if_fail (step < OV_NEGOTIATE_N_STEPS, NULL);
+  return negotiate_step_names[step];
+}
+
+/* Logs how long each step of the negotiation took, and frees it along with
+ * all the remotes that haven't been moved into the call. @outcome says how it
+ * ended, f.ex., "finished" or "aborted". */
+void
+ov_negotiate_free (OvNegotiate * negotiate, const gchar * outcome)
+{
+  guint ii;
+  gint64 now;
+  GString *steps;
+
+  now = g_get_monotonic_time ();
+  negotiate->step_durations[negotiate->step] += now - negotiate->step_time;
+
+  steps = g_string_new (NULL);
+  for (ii = 0; ii <= negotiate->step; ii++)
+    g_string_append_printf (steps, "%s%s: %" G_GINT64_FORMAT "ms",
+        ii > 0 ? ", " : "", negotiate_step_names[ii],
+        negotiate->step_durations[ii] / 1000);
+  GST_INFO ("Negotiation of call %" G_GUINT64_FORMAT " with %s %s after %"
+      G_GINT64_FORMAT "ms (%s)", negotiate->call_id,
+      negotiate->negotiator->id, outcome,
+      (now - negotiate->start_time) / 1000, steps->str);
+  g_string_free (steps, TRUE);
+
+  if (negotiate->deadline_source) {
+    g_source_destroy (negotiate->deadline_source);
+    g_source_unref (negotiate->deadline_source);
+  }
+
+  /* Freeing the remotes removes the allocated udp ports as well. The
+   * negotiator is one of them once we have them. */
+  if (negotiate->remotes)
+    g_hash_table_unref (negotiate->remotes);
+  else if (negotiate->step == OV_NEGOTIATE_STEP_QUERY_CAPS)
+    ov_remote_peer_free (negotiate->negotiator);
+  g_free (negotiate);
+}
+
+/* Called with the lock TAKEN. As the negotiatee, @call is ended right away,
+ * and might be freed; as the negotiator, the negotiation task ends it. */
+void
+ov_local_peer_call_negotiate_abort (OvLocalPeer * local, OvCall * call,
+    gboolean timedout)
+{
+  OvLocalPeerState failed;
+
+  failed = OV_LOCAL_STATE_FAILED | (timedout ? OV_LOCAL_STATE_TIMEOUT : 0);
+
+  GST_DEBUG ("Cancelling negotiation of call %" G_GUINT64_FORMAT, call->id);
+
+  if (call->state & OV_LOCAL_STATE_NEGOTIATOR) {
+    if (call->negotiator_task == NULL)
+      /* Negotiation has already failed or finished, cleanup has already been
+       * done, nothing to do */
+      return;
+    GST_DEBUG ("Stopping negotiation as the negotiator");
+    g_cancellable_cancel (g_task_get_cancellable (call->negotiator_task));
+    /* The task notices once it gets the lock */
+    call->state |= failed;
+  } else if (call->state & OV_LOCAL_STATE_NEGOTIATEE) {
+    GST_DEBUG ("Stopping negotiation as the negotiatee");
+    ov_negotiate_free (call->negotiate, "aborted");
+    call->negotiate = NULL;
+    /* Reset state so we accept incoming connections again */
+    ov_call_set_state (call, OV_LOCAL_STATE_STARTED | failed);
+    ov_local_peer_end_call (local, call);
+  } else {
+    g_assert_not_reached ();
+  }
 }
 
 gboolean
@@ -638,7 +1171,7 @@ ov_local_peer_negotiate_abort (OvLocalPeer * local)
   ov_local_peer_lock (local);
   priv = ov_local_peer_get_private (local);
 
-  state = ov_local_peer_get_state (local);
+  state = priv->call->state;
   if (!(state & OV_LOCAL_STATE_NEGOTIATING) &&
       !(state & OV_LOCAL_STATE_NEGOTIATED)) {
     GST_ERROR ("Can't stop negotiating when not negotiating");
@@ -646,36 +1179,76 @@ ov_local_peer_negotiate_abort (OvLocalPeer * local)
     return FALSE;
   }
 
-  GST_DEBUG ("Cancelling call negotiation");
+  ov_local_peer_call_negotiate_abort (local, priv->call, FALSE);
+  ov_local_peer_unlock (local);
 
-  if (state & OV_LOCAL_STATE_NEGOTIATOR) {
-    if (state & OV_LOCAL_STATE_FAILED)
-      /* Negotiation has already failed, cleanup has already been done,
-       * nothing to do */
-      goto out;
-    g_assert (priv->negotiator_task != NULL);
-    GST_DEBUG ("Stopping negotiation as the negotiator");
-    g_cancellable_cancel (
-        g_task_get_cancellable (priv->negotiator_task));
-    /* Unlock mutex so that the other thread gets access */
-  } else if (state & OV_LOCAL_STATE_NEGOTIATEE) {
-    GST_DEBUG ("Stopping negotiation as the negotiatee");
-    g_source_remove (priv->negotiate->check_timeout_id);
-    g_clear_pointer (&priv->negotiate->remotes,
-        (GDestroyNotify) g_hash_table_unref);
-    g_clear_pointer (&priv->negotiate, g_free);
-    /* Reset state so we accept incoming connections again */
-    ov_local_peer_set_state (local, OV_LOCAL_STATE_STARTED);
-  } else {
-    g_assert_not_reached ();
+  return TRUE;
+}
+
+/*~~ Adding remotes to a call ~~*/
+
+/* Adds @remote to the call that we're in without renegotiating with the
+ * remotes that are already in it. @remote sees this as an incoming call and
+ * gets the caps and ports of everyone in the call, and everyone else only
+ * allocates ports for @remote and is told what it will send. What everyone
+ * in the call already sends doesn't change, so audio and video keep flowing.
+ * This happens asynchronously, and ends with either
+ * OvLocalPeer::call-remote-added or OvLocalPeer::call-join-failed. As with any
+ * incoming call, @remote has to call ov_local_peer_call_start() after it gets
+ * OvLocalPeer::negotiate-finished.
+ *
+ * @remote is added to the current call. Only one remote can be added to a call
+ * at a time. Takes ownership of @remote if it returns TRUE. */
+gboolean
+ov_local_peer_call_join_start (OvLocalPeer * local, OvRemotePeer * remote)
+{
+  guint ii;
+  GTask *task;
+  GCancellable *cancellable;
+  OvCall *call;
+  OvLocalPeerPrivate *priv;
+  OvLocalPeerState state;
+
+  ov_local_peer_lock (local);
+  priv = ov_local_peer_get_private (local);
+  call = priv->call;
+
+  state = ov_local_peer_get_state (local);
+  if (!(state & OV_LOCAL_STATE_PLAYING)) {
+    GST_ERROR ("State is %u instead of PLAYING", state);
+    goto err;
   }
 
-  ov_local_peer_set_state_failed (local);
+  if (call->join_task != NULL) {
+    GST_ERROR ("Already adding a remote to the call");
+    goto err;
+  }
+
+  for (ii = 0; ii < call->remote_peers->len; ii++) {
+    OvRemotePeer *other = g_ptr_array_index (call->remote_peers, ii);
+    if (g_strcmp0 (other->addr_s, remote->addr_s) == 0) {
+      GST_ERROR ("Remote %s is already in the call", remote->addr_s);
+      goto err;
+    }
+  }
+
+  cancellable = g_cancellable_new ();
+
+  /* The task is cleared by the thread itself, under the lock, or by hanging up
+   * the call. The thread finds the call by looking for the task in it. */
+  task = g_task_new (local, cancellable, NULL, NULL);
+  g_task_set_task_data (task, remote, NULL);
+  call->join_task = task;
+  g_task_run_in_thread (task, (GTaskThreadFunc) ov_local_peer_join_thread);
+  g_object_unref (cancellable); /* Hand over ref to the task */
+  g_object_unref (task);
 
-out:
   ov_local_peer_unlock (local);
 
   return TRUE;
+err:
+  ov_local_peer_unlock (local);
+  return FALSE;
 }
 
 /*~~ Call Properties ~~*/
@@ -692,6 +1265,9 @@ ov_local_peer_set_volume (OvLocalPeer * local, gdouble volume)
     converted_volume = 1 + (volume - 1) * 9;
   else
     converted_volume = volume;
+  /* There's no volume to set when audio isn't played */
+  if (priv->playback_mode != OV_PLAYBACK_MODE_NORMAL)
+    return;
   /* XXX: This assumes that pulsesink is being used */
   g_object_set (priv->audiosink, "volume", converted_volume, NULL);
 }
@@ -766,6 +1342,39 @@ ov_gst_structure_free (GstStructure * s)
   gst_structure_free (s);
 }
 
+/* Statistics about the handoff of decoded data from the receive pipeline of
+ * the remote to our playback pipeline */
+static void
+ov_remote_peer_add_proxy_stats (OvRemotePeer * remote, guint session,
+    GstStructure * stats)
+{
+  GstElement *proxysink, *proxysrc;
+  guint64 buffers, bytes, dropped, level, latency;
+  guint level_buffers;
+
+  proxysink = (session == OV_AUDIO_RTP_SESSION) ?
+    remote->priv->audio_proxysink : remote->priv->video_proxysink;
+  proxysrc = (session == OV_AUDIO_RTP_SESSION) ?
+    remote->priv->audio_proxysrc : remote->priv->video_proxysrc;
+
+  /* Not set in count-frames playback mode */
+  if (proxysink == NULL || proxysrc == NULL)
+    return;
+
+  g_object_get (proxysink, "buffers", &buffers, "bytes", &bytes, NULL);
+  g_object_get (proxysrc, "dropped", &dropped, "current-level-time", &level,
+      "current-level-buffers", &level_buffers, "handoff-latency", &latency,
+      NULL);
+
+  gst_structure_set (stats,
+      "proxy-buffers", G_TYPE_UINT64, buffers,
+      "proxy-bytes", G_TYPE_UINT64, bytes,
+      "proxy-dropped", G_TYPE_UINT64, dropped,
+      "proxy-queue-level", G_TYPE_UINT64, level,
+      "proxy-queue-buffers", G_TYPE_UINT, level_buffers,
+      "proxy-handoff-latency", G_TYPE_UINT64, latency, NULL);
+}
+
 static GHashTable *
 ov_local_peer_get_stats (OvLocalPeer * local, const gchar * media_type)
 {
@@ -812,6 +1421,22 @@ ov_local_peer_get_stats (OvLocalPeer * local, const gchar * media_type)
 
     stats = ov_local_peer_get_stats_from_ssrc (rtpsession,
         remote->priv->ssrcs[session]);
+    if (stats != NULL && remote->priv->recv_rtp_sockets[session] != NULL) {
+      GSocket *socket = remote->priv->recv_rtp_sockets[session];
+      /* Packets from this remote that were lost in our own socket queue
+       * instead of on the wire */
+      gst_structure_set (stats,
+          "kernel-drops", G_TYPE_UINT, ov_socket_get_kernel_drops (socket),
+          "recv-buffer-size", G_TYPE_INT,
+          ov_socket_get_recv_buffer_size (socket), NULL);
+    }
+    if (stats != NULL) {
+      gst_structure_set (stats, "av-skew", G_TYPE_INT,
+          (gint) (remote->priv->av_skew / GST_MSECOND), "frames", G_TYPE_UINT,
+          g_atomic_int_get (&remote->priv->frames[session]), "priority",
+          G_TYPE_UINT, remote->priv->priority, NULL);
+      ov_remote_peer_add_proxy_stats (remote, session, stats);
+    }
     g_hash_table_insert (statistics, remote_id, stats);
   }
 
@@ -67,13 +67,20 @@ struct _OvLocalPeerClass {
                                      OvPeer *remote,
                                      gboolean timedout);
   void (*call_all_remotes_gone)     (OvLocalPeer *local);
+  void (*call_remote_added)         (OvLocalPeer *local,
+                                     OvPeer *remote);
+  void (*call_join_failed)          (OvLocalPeer *local,
+                                     OvPeer *remote,
+                                     GError *error);
+  void (*active_speaker_changed)    (OvLocalPeer *local,
+                                     OvPeer *speaker);
 
   /* action signals */
   GHashTable* (*get_stats)          (OvLocalPeer *local,
                                      const gchar *media_type);
 
-  /* Padding to allow up to 12 new virtual functions without breaking ABI */
-  gpointer padding[12];
+  /* Padding to allow up to 9 new virtual functions without breaking ABI */
+  gpointer padding[9];
 };
 
 enum _OvLocalPeerState {
@@ -101,6 +108,21 @@ enum _OvLocalPeerState {
   OV_LOCAL_STATE_STOPPED        = 1 << 15,
 };
 
+typedef enum _OvPlaybackMode      OvPlaybackMode;
+
+enum _OvPlaybackMode {
+  /* Render audio and video from remote peers with the sound server and on the
+   * display */
+  OV_PLAYBACK_MODE_NORMAL,
+  /* Decode everything as usual, but discard the decoded audio and video */
+  OV_PLAYBACK_MODE_HEADLESS,
+  /* Don't decode anything; only count the audio and video frames received */
+  OV_PLAYBACK_MODE_COUNT_FRAMES,
+};
+
+#define OV_TYPE_PLAYBACK_MODE ov_playback_mode_get_type ()
+GType                 ov_playback_mode_get_type   (void);
+
 OvLocalPeer*          ov_local_peer_new           (const gchar *iface,
                                                    guint16 port);
 OvLocalPeerState      ov_local_peer_get_state     (OvLocalPeer *self);
@@ -194,6 +194,9 @@ static struct plugin_names plugins_req[] = {
   { "udpsink",            OV_PACKAGE_GOOD },
   { "udpsrc",             OV_PACKAGE_GOOD },
 
+  /* Per-remote audio levels for active speaker detection */
+  { "level",              OV_PACKAGE_GOOD },
+
   { "audiomixer",         OV_PACKAGE_BAD },
 #ifdef __linux__
   /* On Linux (Mesa), using multiple GL output windows leads to a
@@ -260,6 +263,7 @@ ov_get_missing_gstreamer_plugins (const gchar * toolkit)
 #include <net/if.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/ioctl.h>
 #include <ifaddrs.h>
 
@@ -333,6 +337,20 @@ ov_get_inet_addr_for_iface (const gchar * iface_name)
   return g_inet_address_new_from_string (inet_ntoa (sa.in->sin_addr));
 }
 
+gboolean
+ov_socket_set_tcp_nodelay (GSocket * socket)
+{
+  gint v = 1;
+
+  if (setsockopt (g_socket_get_fd (socket), IPPROTO_TCP, TCP_NODELAY, &v,
+        sizeof (v)) < 0) {
+    GST_WARNING ("Unable to set TCP_NODELAY on socket");
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
 #elif defined(G_OS_WIN32)
 
 #include <winsock2.h>
@@ -419,4 +437,18 @@ out:
   return ip;
 }
 
+gboolean
+ov_socket_set_tcp_nodelay (GSocket * socket)
+{
+  BOOL v = TRUE;
+
+  if (setsockopt (g_socket_get_fd (socket), IPPROTO_TCP, TCP_NODELAY,
+        (const char *) &v, sizeof (v)) == SOCKET_ERROR) {
+    GST_WARNING ("Unable to set TCP_NODELAY on socket");
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
 #endif /* G_OS_UNIX/WIN32 */
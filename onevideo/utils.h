@@ -48,6 +48,7 @@ gboolean            ov_inet_socket_address_is_iface     (GInetSocketAddress *add
 #if defined(G_OS_UNIX) || defined (G_OS_WIN32)
 GInetAddress*       ov_get_inet_addr_for_iface          (const gchar *iface_name);
 GList*              ov_get_network_interfaces           (void);
+gboolean            ov_socket_set_tcp_nodelay           (GSocket *socket);
 #endif
 
 #ifdef __linux__
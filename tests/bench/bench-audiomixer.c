@@ -0,0 +1,185 @@
+/*  vim: set sts=2 sw=2 et :
+ *
+ *  Copyright (C) 2015 Centricular Ltd
+ *  Author(s): Nirbheek Chauhan <nirbheek@centricular.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Measures the CPU time that mixing the audio of a call costs, with
+ * audiomixer (what the playback pipeline used before) and with ovaudiomixer
+ * (what it uses now).
+ *
+ * Each remote is a live audiotestsrc producing 10 ms buffers in the playback
+ * format. Only --speaking of them produce sound; the others are silent and
+ * their buffers are flagged as GAP, like on_remote_audio_buffer() does in the
+ * playback pipeline. The mixed audio goes to a fakesink that is synchronised
+ * to the clock, so the test runs in real time; the sources are cheap and the
+ * same for both mixers, so the difference in CPU time is the mixer.
+ *
+ * ovaudiomixer has to be in the plugin path, f.ex. by running this from the
+ * build directory with GST_PLUGIN_PATH=gst/mixer/.libs
+ *
+ * Usage: bench-audiomixer [--remotes N] [--speaking N] [--seconds N] */
+
+#include <gst/gst.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+
+#define AUDIO_CAPS_STR "audio/x-raw,format=S16LE,layout=interleaved," \
+  "rate=48000,channels=2"
+
+static const gchar *mixers[] = {"audiomixer", "ovaudiomixer"};
+
+static GstPadProbeReturn
+mark_gap (G_GNUC_UNUSED GstPad * pad, GstPadProbeInfo * info,
+    G_GNUC_UNUSED gpointer user_data)
+{
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+
+  buffer = gst_buffer_make_writable (buffer);
+  GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_GAP);
+  GST_PAD_PROBE_INFO_DATA (info) = buffer;
+  return GST_PAD_PROBE_OK;
+}
+
+static gdouble
+get_cpu_time (void)
+{
+  struct rusage usage;
+
+  getrusage (RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+      (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+static gboolean
+run_mixer (const gchar * name, guint n_remotes, guint n_speaking,
+    guint seconds)
+{
+  GstElement *pipeline, *mixer, *sink;
+  GstMessage *msg;
+  gdouble cpu;
+  GstBus *bus;
+  guint ii;
+
+  mixer = gst_element_factory_make (name, NULL);
+  if (mixer == NULL) {
+    g_printerr ("%s not found, check GST_PLUGIN_PATH\n", name);
+    return FALSE;
+  }
+
+  pipeline = gst_pipeline_new (NULL);
+  sink = gst_element_factory_make ("fakesink", NULL);
+  g_object_set (sink, "sync", TRUE, NULL);
+  gst_bin_add_many (GST_BIN (pipeline), mixer, sink, NULL);
+  gst_element_link (mixer, sink);
+
+  for (ii = 0; ii < n_remotes; ii++) {
+    GstElement *src, *capsfilter;
+    GstCaps *caps;
+
+    src = gst_element_factory_make ("audiotestsrc", NULL);
+    /* Different frequencies, so that the mixed audio isn't trivial */
+    g_object_set (src, "is-live", TRUE, "samplesperbuffer", 480,
+        "freq", 220.0 * (ii + 1), "volume", 0.5, NULL);
+    capsfilter = gst_element_factory_make ("capsfilter", NULL);
+    caps = gst_caps_from_string (AUDIO_CAPS_STR);
+    g_object_set (capsfilter, "caps", caps, NULL);
+    gst_caps_unref (caps);
+
+    gst_bin_add_many (GST_BIN (pipeline), src, capsfilter, NULL);
+    gst_element_link_many (src, capsfilter, mixer, NULL);
+
+    if (ii >= n_speaking) {
+      GstPad *srcpad = gst_element_get_static_pad (capsfilter, "src");
+
+      g_object_set (src, "wave", 4 /* silence */, NULL);
+      gst_pad_add_probe (srcpad, GST_PAD_PROBE_TYPE_BUFFER, mark_gap, NULL,
+          NULL);
+      gst_object_unref (srcpad);
+    }
+  }
+
+  cpu = get_cpu_time ();
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+  msg = gst_bus_timed_pop_filtered (bus, seconds * GST_SECOND,
+      GST_MESSAGE_ERROR);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  cpu = get_cpu_time () - cpu;
+  gst_object_unref (bus);
+  gst_object_unref (pipeline);
+
+  if (msg != NULL) {
+    GError *error = NULL;
+
+    gst_message_parse_error (msg, &error, NULL);
+    g_printerr ("%s: %s\n", name, error->message);
+    g_error_free (error);
+    gst_message_unref (msg);
+    return FALSE;
+  }
+
+  g_print ("%-14s %u remotes, %u speaking: %5.2f%% of one core\n", name,
+      n_remotes, n_speaking, cpu * 100 / seconds);
+  return TRUE;
+}
+
+int
+main (int argc, char *argv[])
+{
+  guint ii;
+  gint n_remotes = 8, n_speaking = 2, seconds = 10;
+  gboolean ret = TRUE;
+  GOptionContext *ctx;
+  GError *error = NULL;
+  GOptionEntry entries[] = {
+    {"remotes", 'r', 0, G_OPTION_ARG_INT, &n_remotes, "Number of remotes"
+          " in the call (default: 8)", "N"},
+    {"speaking", 's', 0, G_OPTION_ARG_INT, &n_speaking, "How many of them"
+          " are not silent (default: 2)", "N"},
+    {"seconds", 't', 0, G_OPTION_ARG_INT, &seconds, "How long to run each"
+          " mixer for (default: 10)", "N"},
+    {NULL}
+  };
+
+  ctx = g_option_context_new ("- CPU cost of mixing the audio of a call");
+  g_option_context_add_main_entries (ctx, entries, NULL);
+  g_option_context_add_group (ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (ctx, &argc, &argv, &error)) {
+    g_printerr ("Error initializing: %s\n", error->message);
+    return EXIT_FAILURE;
+  }
+  g_option_context_free (ctx);
+
+  if (n_remotes <= 0 || n_speaking < 0 || n_speaking > n_remotes ||
+      seconds <= 0) {
+    g_printerr ("Invalid arguments\n");
+    return EXIT_FAILURE;
+  }
+
+  for (ii = 0; ii < G_N_ELEMENTS (mixers); ii++)
+    ret &= run_mixer (mixers[ii], n_remotes, n_speaking, seconds);
+
+  return ret ? EXIT_SUCCESS : EXIT_FAILURE;
+}
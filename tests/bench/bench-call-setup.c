@@ -0,0 +1,262 @@
+/*  vim: set sts=2 sw=2 et :
+ *
+ *  Copyright (C) 2015 Centricular Ltd
+ *  Author(s): Nirbheek Chauhan <nirbheek@centricular.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Measures how long it takes to set up a call against the number of peers.
+ * For each peer count, one local peer calls N others that accept every
+ * incoming call, all in this process and over loopback, and we time
+ * ov_local_peer_negotiate_start() until negotiate-finished. That covers all
+ * four negotiation round-trips (START_NEGOTIATE, QUERY_CAPS, CALL_DETAILS and
+ * START_CALL); GST_DEBUG=onevideo:4 shows how long each of them took.
+ *
+ * Loopback has next to no round-trip time, so to see how setup time scales
+ * with it, add a delay first, f.ex. with
+ *   tests/scripts/simulate-packetloss.sh 0% 20ms lo
+ * With every phase sent to all remotes at once, setup time should stay close
+ * to 4 × RTT whatever the number of peers.
+ *
+ * Every peer uses the test video source. The proxy and mixer plugins have to
+ * be in the plugin path, f.ex. by running this from the build directory after
+ * sourcing wrappers/setup.sh
+ *
+ * Usage: bench-call-setup [--max-peers N] [--runs N] [--port PORT] */
+
+#include "onevideo/lib.h"
+#include <stdlib.h>
+
+/* How long to wait for a call to be set up before giving up */
+#define SETUP_TIMEOUT_SECS 30
+/* How long to let the peers of a run tear down before the next one */
+#define TEARDOWN_MSECS 1000
+
+typedef struct {
+  GMainLoop *loop;
+  gint64 end;
+  gboolean failed;
+} SetupData;
+
+static guint16 next_port;
+
+static gboolean
+on_negotiate_incoming (OvLocalPeer * local, OvPeer * peer, gpointer user_data)
+{
+  return TRUE;
+}
+
+static void
+on_negotiate_finished (OvLocalPeer * local, SetupData * data)
+{
+  data->end = g_get_monotonic_time ();
+  g_main_loop_quit (data->loop);
+}
+
+static void
+on_negotiate_aborted (OvLocalPeer * local, GError * error, SetupData * data)
+{
+  g_printerr ("Negotiation aborted: %s\n",
+      error ? error->message : "Unknown error");
+  data->failed = TRUE;
+  g_main_loop_quit (data->loop);
+}
+
+static void
+on_negotiate_skipped (OvLocalPeer * local, OvPeer * skipped, GError * error,
+    SetupData * data)
+{
+  g_printerr ("A remote was skipped: %s\n",
+      error ? error->message : "Unknown error");
+  data->failed = TRUE;
+}
+
+static gboolean
+on_timeout (SetupData * data)
+{
+  g_printerr ("Call setup took longer than %us\n", SETUP_TIMEOUT_SECS);
+  data->failed = TRUE;
+  g_main_loop_quit (data->loop);
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+quit_loop (GMainLoop * loop)
+{
+  g_main_loop_quit (loop);
+  return G_SOURCE_REMOVE;
+}
+
+static OvLocalPeer *
+make_local_peer (void)
+{
+  OvLocalPeer *local;
+
+  local = ov_local_peer_new ("lo", next_port++);
+  if (local == NULL)
+    return NULL;
+
+  if (!ov_local_peer_start (local) ||
+      !ov_local_peer_set_video_device (local, NULL)) {
+    g_object_unref (local);
+    return NULL;
+  }
+
+  return local;
+}
+
+/* Returns the number of microseconds it took to set up a call with n_remotes
+ * remotes, or -1 on error */
+static gint64
+run_call_setup (GMainLoop * loop, guint n_remotes)
+{
+  SetupData data = { loop, -1, FALSE };
+  GPtrArray *peers;
+  OvLocalPeer *caller;
+  gint64 start, ret = -1;
+  guint ii, timeout_id;
+
+  peers = g_ptr_array_new_with_free_func (g_object_unref);
+
+  caller = make_local_peer ();
+  if (caller == NULL)
+    goto out;
+  g_ptr_array_add (peers, caller);
+
+  for (ii = 0; ii < n_remotes; ii++) {
+    OvLocalPeer *callee;
+    OvRemotePeer *remote;
+    gchar *addr_s;
+
+    callee = make_local_peer ();
+    if (callee == NULL)
+      goto out;
+    g_ptr_array_add (peers, callee);
+    g_signal_connect (callee, "negotiate-incoming",
+        G_CALLBACK (on_negotiate_incoming), NULL);
+
+    addr_s = g_strdup_printf ("127.0.0.1:%u", next_port - 1);
+    remote = ov_remote_peer_new_from_string (caller, addr_s);
+    ov_local_peer_add_remote (caller, remote);
+    g_free (addr_s);
+  }
+
+  g_signal_connect (caller, "negotiate-finished",
+      G_CALLBACK (on_negotiate_finished), &data);
+  g_signal_connect (caller, "negotiate-aborted",
+      G_CALLBACK (on_negotiate_aborted), &data);
+  g_signal_connect (caller, "negotiate-skipped-remote",
+      G_CALLBACK (on_negotiate_skipped), &data);
+  timeout_id = g_timeout_add_seconds (SETUP_TIMEOUT_SECS,
+      (GSourceFunc) on_timeout, &data);
+
+  start = g_get_monotonic_time ();
+  if (!ov_local_peer_negotiate_start (caller)) {
+    g_printerr ("Unable to start negotiation\n");
+    g_source_remove (timeout_id);
+    goto out;
+  }
+  g_main_loop_run (loop);
+  if (!data.failed)
+    g_source_remove (timeout_id);
+
+  if (!data.failed && data.end >= 0)
+    ret = data.end - start;
+
+out:
+  for (ii = 0; ii < peers->len; ii++) {
+    g_signal_handlers_disconnect_by_data (g_ptr_array_index (peers, ii),
+        &data);
+    ov_local_peer_stop (g_ptr_array_index (peers, ii));
+  }
+  /* Let the transmit pipelines send their RTCP BYEs and go away */
+  g_timeout_add (TEARDOWN_MSECS, (GSourceFunc) quit_loop, loop);
+  g_main_loop_run (loop);
+  g_ptr_array_free (peers, TRUE);
+
+  return ret;
+}
+
+static gint
+compare_int64 (gconstpointer a, gconstpointer b)
+{
+  gint64 x = *(const gint64 *) a, y = *(const gint64 *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+int
+main (int argc, char *argv[])
+{
+  GMainLoop *loop;
+  GOptionContext *ctx;
+  GError *error = NULL;
+  gint64 *times;
+  guint n_remotes, ii;
+  gint max_peers = 8, runs = 3, port = 15000;
+  GOptionEntry entries[] = {
+    {"max-peers", 'n', 0, G_OPTION_ARG_INT, &max_peers, "Call 1 to N remote "
+          "peers (default: 8)", "N"},
+    {"runs", 'r', 0, G_OPTION_ARG_INT, &runs, "Calls to set up for each "
+          "number of peers (default: 3)", "N"},
+    {"port", 'p', 0, G_OPTION_ARG_INT, &port, "First TCP port to listen on; "
+          "every peer of every run uses a new one (default: 15000)", "PORT"},
+    {NULL}
+  };
+
+  ctx = g_option_context_new ("- call setup time against the number of peers");
+  g_option_context_add_main_entries (ctx, entries, NULL);
+  g_option_context_add_group (ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (ctx, &argc, &argv, &error)) {
+    g_printerr ("Error initializing: %s\n", error->message);
+    return 1;
+  }
+  g_option_context_free (ctx);
+
+  if (max_peers < 1 || runs < 1 || port <= 0 ||
+      port + (max_peers + 1) * max_peers / 2 * runs + max_peers * runs > 65535) {
+    g_printerr ("Invalid options\n");
+    return 1;
+  }
+  next_port = port;
+
+  loop = g_main_loop_new (NULL, FALSE);
+  times = g_new (gint64, runs);
+
+  g_print ("%6s %10s %10s %10s\n", "peers", "min (ms)", "median", "max");
+  for (n_remotes = 1; n_remotes <= (guint) max_peers; n_remotes++) {
+    for (ii = 0; ii < (guint) runs; ii++) {
+      times[ii] = run_call_setup (loop, n_remotes);
+      if (times[ii] < 0)
+        return 1;
+    }
+    qsort (times, runs, sizeof (gint64), compare_int64);
+    g_print ("%6u %10.1f %10.1f %10.1f\n", n_remotes, times[0] / 1000.0,
+        times[runs / 2] / 1000.0, times[runs - 1] / 1000.0);
+  }
+
+  g_free (times);
+  g_main_loop_unref (loop);
+
+  return 0;
+}
@@ -0,0 +1,138 @@
+/*  vim: set sts=2 sw=2 et :
+ *
+ *  Copyright (C) 2015 Centricular Ltd
+ *  Author(s): Nirbheek Chauhan <nirbheek@centricular.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Measures the saturating S16 mixing kernels that ovaudiomixer picks from at
+ * runtime, on the block size that it mixes (10 ms of 48 kHz stereo), and
+ * checks that each of them gives the same result as the plain C one.
+ *
+ * OV_MIX_KERNEL=<name> makes ovaudiomixer use a specific kernel; this lists
+ * the names that can be used on this machine.
+ *
+ * Usage: bench-mix-kernels [--inputs N] [--blocks N] */
+
+#include "gstovmixerkernels.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* 10 ms of 48 kHz stereo */
+#define BLOCK_SAMPLES 960
+
+static gint16 *
+make_inputs (guint n_inputs)
+{
+  gint16 *inputs;
+  guint ii;
+
+  inputs = g_new (gint16, n_inputs * BLOCK_SAMPLES);
+  for (ii = 0; ii < n_inputs * BLOCK_SAMPLES; ii++)
+    inputs[ii] = g_random_int_range (G_MININT16, G_MAXINT16 + 1);
+
+  /* Make sure both ends saturate */
+  for (ii = 0; ii < BLOCK_SAMPLES; ii += 2) {
+    inputs[ii] = G_MAXINT16;
+    inputs[ii + 1] = G_MININT16;
+  }
+
+  return inputs;
+}
+
+static void
+mix_block (GstOvMixFunc mix, gint16 * dst, const gint16 * inputs,
+    guint n_inputs)
+{
+  guint ii;
+
+  memcpy (dst, inputs, BLOCK_SAMPLES * sizeof (gint16));
+  for (ii = 1; ii < n_inputs; ii++)
+    mix (dst, inputs + ii * BLOCK_SAMPLES, BLOCK_SAMPLES);
+}
+
+int
+main (int argc, char *argv[])
+{
+  gint n_inputs = 8, n_blocks = 200000;
+  GOptionEntry entries[] = {
+    {"inputs", 'i', 0, G_OPTION_ARG_INT, &n_inputs,
+      "Number of inputs that are not silent (default: 8)", "N"},
+    {"blocks", 'b', 0, G_OPTION_ARG_INT, &n_blocks,
+      "Number of 10 ms blocks to mix (default: 200000)", "N"},
+    {NULL}
+  };
+  gint16 *inputs, expected[BLOCK_SAMPLES], out[BLOCK_SAMPLES];
+  const GstOvMixKernel *kernels;
+  GOptionContext *ctx;
+  GError *error = NULL;
+  guint ii, n_kernels;
+  gboolean ret = TRUE;
+
+  ctx = g_option_context_new ("- benchmark audio mixing kernels");
+  g_option_context_add_main_entries (ctx, entries, NULL);
+  if (!g_option_context_parse (ctx, &argc, &argv, &error)) {
+    g_printerr ("Error parsing options: %s\n", error->message);
+    return EXIT_FAILURE;
+  }
+  g_option_context_free (ctx);
+
+  if (n_inputs < 1 || n_blocks < 1) {
+    g_printerr ("Invalid arguments\n");
+    return EXIT_FAILURE;
+  }
+
+  inputs = make_inputs (n_inputs);
+  kernels = gst_ov_mix_kernels_get (&n_kernels);
+  mix_block (kernels[0].mix, expected, inputs, n_inputs);
+
+  g_print ("%-6s %14s %14s\n", "kernel", "ns/block", "ns/input");
+  for (ii = 0; ii < n_kernels; ii++) {
+    gint64 start, elapsed;
+    guint64 checksum = 0;
+    gint jj;
+
+    mix_block (kernels[ii].mix, out, inputs, n_inputs);
+    if (memcmp (out, expected, sizeof (out)) != 0) {
+      g_printerr ("%s: result differs from the C kernel\n", kernels[ii].name);
+      ret = FALSE;
+      continue;
+    }
+
+    start = g_get_monotonic_time ();
+    for (jj = 0; jj < n_blocks; jj++) {
+      mix_block (kernels[ii].mix, out, inputs, n_inputs);
+      checksum += (guint16) out[jj % BLOCK_SAMPLES];
+    }
+    elapsed = g_get_monotonic_time () - start;
+
+    g_print ("%-6s %14.1f %14.1f", kernels[ii].name,
+        elapsed * 1000.0 / n_blocks, elapsed * 1000.0 / n_blocks / n_inputs);
+    /* So that the mixing can't be optimised away */
+    g_print (checksum == 0 ? " \n" : "\n");
+  }
+
+  g_free (inputs);
+  return ret ? EXIT_SUCCESS : EXIT_FAILURE;
+}
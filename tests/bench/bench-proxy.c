@@ -0,0 +1,185 @@
+/*  vim: set sts=2 sw=2 et :
+ *
+ *  Copyright (C) 2015 Centricular Ltd
+ *  Author(s): Nirbheek Chauhan <nirbheek@centricular.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Measures how many buffers per second go through a proxysink -> proxysrc
+ * pair, which is how every remote's audio and video get from its receive
+ * pipeline into the playback pipeline.
+ *
+ *  proxy: fakesrc ! proxysink   |   proxysrc ! fakesink
+ *  queue: fakesrc ! queue ! fakesink    (the same thread handoff without the
+ *                                        proxy elements, for reference)
+ *
+ * Nothing is synchronised to the clock and the buffers aren't filled in, so
+ * this is the cost of the proxying itself. The buffer size defaults to that
+ * of a typical RTP packet.
+ *
+ * The proxy plugin has to be in the plugin path, f.ex. by running this from
+ * the build directory with GST_PLUGIN_PATH=gst/proxy/.libs
+ *
+ * Usage: bench-proxy [--buffers N] [--size BYTES] */
+
+#include <gst/gst.h>
+#include <stdlib.h>
+
+static GstElement *
+make_source (const gchar * desc, guint n_buffers, guint size)
+{
+  GstElement *pipeline;
+  gchar *full_desc;
+  GError *error = NULL;
+
+  full_desc = g_strdup_printf ("fakesrc num-buffers=%u sizetype=fixed "
+      "sizemax=%u filltype=nothing ! %s", n_buffers, size, desc);
+  pipeline = gst_parse_launch (full_desc, &error);
+  g_free (full_desc);
+  if (pipeline == NULL) {
+    g_printerr ("Unable to create pipeline: %s\n", error->message);
+    g_error_free (error);
+  }
+
+  return pipeline;
+}
+
+/* Plays the pipelines and returns the number of microseconds until the last
+ * one of them reaches EOS, or -1 on error */
+static gint64
+run_pipelines (GstElement * pipelines[], guint n_pipelines)
+{
+  GstBus *bus;
+  GstMessage *msg;
+  gint64 start, end = -1;
+  GstElement *last = pipelines[n_pipelines - 1];
+  guint ii;
+
+  /* Downstream first, so that nothing is dropped */
+  start = g_get_monotonic_time ();
+  for (ii = n_pipelines; ii > 0; ii--)
+    gst_element_set_state (pipelines[ii - 1], GST_STATE_PLAYING);
+
+  bus = gst_pipeline_get_bus (GST_PIPELINE (last));
+  msg = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE,
+      GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_EOS) {
+    end = g_get_monotonic_time ();
+  } else {
+    GError *error = NULL;
+
+    gst_message_parse_error (msg, &error, NULL);
+    g_printerr ("%s\n", error->message);
+    g_error_free (error);
+  }
+  gst_message_unref (msg);
+  gst_object_unref (bus);
+
+  for (ii = 0; ii < n_pipelines; ii++)
+    gst_element_set_state (pipelines[ii], GST_STATE_NULL);
+
+  return end < 0 ? -1 : end - start;
+}
+
+static void
+print_result (const gchar * name, guint n_buffers, gint64 elapsed)
+{
+  g_print ("%-6s %10.0f buffers/s  %6.2f us/buffer\n", name,
+      n_buffers * (gdouble) G_USEC_PER_SEC / elapsed,
+      (gdouble) elapsed / n_buffers);
+}
+
+int
+main (int argc, char *argv[])
+{
+  gint n_buffers = 1000000, size = 1200;
+  GstElement *pipelines[2], *proxysink, *proxysrc;
+  gboolean ret = FALSE;
+  GOptionContext *ctx;
+  GError *error = NULL;
+  gint64 elapsed;
+  GOptionEntry entries[] = {
+    {"buffers", 'n', 0, G_OPTION_ARG_INT, &n_buffers, "Number of buffers"
+          " to send (default: 1000000)", "N"},
+    {"size", 's', 0, G_OPTION_ARG_INT, &size, "Size of each buffer"
+          " (default: 1200)", "BYTES"},
+    {NULL}
+  };
+
+  ctx = g_option_context_new ("- buffers/sec through proxysink ! proxysrc");
+  g_option_context_add_main_entries (ctx, entries, NULL);
+  g_option_context_add_group (ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (ctx, &argc, &argv, &error)) {
+    g_printerr ("Error initializing: %s\n", error->message);
+    return EXIT_FAILURE;
+  }
+  g_option_context_free (ctx);
+
+  if (n_buffers <= 0 || size <= 0) {
+    g_printerr ("Invalid arguments\n");
+    return EXIT_FAILURE;
+  }
+
+  /* proxy */
+  pipelines[0] = make_source ("proxysink name=proxysink", n_buffers, size);
+  pipelines[1] = gst_parse_launch ("proxysrc name=proxysrc ! "
+      "fakesink sync=false", &error);
+  if (pipelines[0] == NULL || pipelines[1] == NULL) {
+    if (error != NULL) {
+      g_printerr ("Unable to create pipeline: %s\n", error->message);
+      g_error_free (error);
+    }
+    g_printerr ("Is the proxy plugin in GST_PLUGIN_PATH?\n");
+    if (pipelines[0] != NULL)
+      gst_object_unref (pipelines[0]);
+    if (pipelines[1] != NULL)
+      gst_object_unref (pipelines[1]);
+    goto out;
+  }
+  proxysink = gst_bin_get_by_name (GST_BIN (pipelines[0]), "proxysink");
+  proxysrc = gst_bin_get_by_name (GST_BIN (pipelines[1]), "proxysrc");
+  g_object_set (proxysrc, "proxysink", proxysink, NULL);
+  gst_object_unref (proxysrc);
+  gst_object_unref (proxysink);
+
+  elapsed = run_pipelines (pipelines, 2);
+  gst_object_unref (pipelines[0]);
+  gst_object_unref (pipelines[1]);
+  if (elapsed < 0)
+    goto out;
+  print_result ("proxy", n_buffers, elapsed);
+
+  /* queue */
+  pipelines[0] = make_source ("queue ! fakesink sync=false", n_buffers, size);
+  if (pipelines[0] == NULL)
+    goto out;
+  elapsed = run_pipelines (pipelines, 1);
+  gst_object_unref (pipelines[0]);
+  if (elapsed < 0)
+    goto out;
+  print_result ("queue", n_buffers, elapsed);
+
+  ret = TRUE;
+out:
+  return ret ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,197 @@
+/*  vim: set sts=2 sw=2 et :
+ *
+ *  Copyright (C) 2015 Centricular Ltd
+ *  Author(s): Nirbheek Chauhan <nirbheek@centricular.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Measures the per-frame cost of the software video render path that
+ * ov_get_gtksink() builds, against what it replaced.
+ *
+ *  convert:       videoconvert ! BGRx            (the old path; gtksink then
+ *                                                 scaled it while drawing)
+ *  convert-scale: videoconvert ! BGRx ! videoscale ! display size
+ *                                                (the old path, including the
+ *                                                 scaling that gtksink did)
+ *  scale-convert: videoscale ! display size ! videoconvert ! BGRx
+ *                                                (the current path)
+ *
+ * Decoded JPEG from remotes is I420, so that's what we feed in. The time is
+ * measured between two identity elements around the path, which all runs in
+ * the source's streaming thread.
+ *
+ * Usage: bench-render [--frames N] [--size WxH] [--display WxH] */
+
+#include <gst/gst.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct {
+  GstClockTime start;
+  GstClockTime total;
+  guint frames;
+} RenderCost;
+
+static const struct {
+  const gchar *name;
+  const gchar *path;
+} modes[] = {
+  {"convert",       "videoconvert ! video/x-raw,format=BGRx"},
+  {"convert-scale", "videoconvert ! video/x-raw,format=BGRx ! videoscale ! "
+                    "video/x-raw,width=%i,height=%i"},
+  {"scale-convert", "videoscale ! video/x-raw,width=%i,height=%i ! "
+                    "videoconvert ! video/x-raw,format=BGRx"},
+};
+
+static GstPadProbeReturn
+on_enter (G_GNUC_UNUSED GstPad * pad, G_GNUC_UNUSED GstPadProbeInfo * info,
+    RenderCost * cost)
+{
+  cost->start = gst_util_get_timestamp ();
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn
+on_leave (G_GNUC_UNUSED GstPad * pad, G_GNUC_UNUSED GstPadProbeInfo * info,
+    RenderCost * cost)
+{
+  cost->total += gst_util_get_timestamp () - cost->start;
+  cost->frames++;
+  return GST_PAD_PROBE_OK;
+}
+
+static gboolean
+parse_size (const gchar * str, gint * width, gint * height)
+{
+  return str != NULL && sscanf (str, "%ix%i", width, height) == 2 &&
+      *width > 0 && *height > 0;
+}
+
+static gboolean
+run_mode (guint mode, guint n_frames, gint width, gint height,
+    gint display_width, gint display_height)
+{
+  gchar *path, *desc;
+  GstPad *pad;
+  GstBus *bus;
+  GstMessage *msg;
+  GstElement *pipeline, *element;
+  RenderCost cost = { GST_CLOCK_TIME_NONE, 0, 0 };
+  GError *error = NULL;
+
+  path = g_strdup_printf (modes[mode].path, display_width, display_height);
+  desc = g_strdup_printf ("videotestsrc num-buffers=%u pattern=snow ! "
+      "video/x-raw,format=I420,width=%i,height=%i,framerate=30/1 ! "
+      "identity name=enter ! %s ! identity name=leave ! fakesink", n_frames,
+      width, height, path);
+  pipeline = gst_parse_launch (desc, &error);
+  g_free (desc);
+  g_free (path);
+  if (pipeline == NULL) {
+    g_printerr ("Unable to create the %s pipeline: %s\n", modes[mode].name,
+        error->message);
+    g_error_free (error);
+    return FALSE;
+  }
+
+  element = gst_bin_get_by_name (GST_BIN (pipeline), "enter");
+  pad = gst_element_get_static_pad (element, "src");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) on_enter, &cost, NULL);
+  gst_object_unref (pad);
+  gst_object_unref (element);
+  element = gst_bin_get_by_name (GST_BIN (pipeline), "leave");
+  pad = gst_element_get_static_pad (element, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) on_leave, &cost, NULL);
+  gst_object_unref (pad);
+  gst_object_unref (element);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+  msg = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE,
+      GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR) {
+    gst_message_parse_error (msg, &error, NULL);
+    g_printerr ("%s: %s\n", modes[mode].name, error->message);
+    g_error_free (error);
+  }
+  gst_message_unref (msg);
+  gst_object_unref (bus);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+
+  if (cost.frames == 0)
+    return FALSE;
+
+  g_print ("%-14s %ix%i -> %ix%i: %8.1f us/frame over %u frames\n",
+      modes[mode].name, width, height, display_width, display_height,
+      (gdouble) cost.total / cost.frames / GST_USECOND, cost.frames);
+  return TRUE;
+}
+
+int
+main (int argc, char *argv[])
+{
+  guint ii;
+  gint n_frames = 300;
+  gint width = 1280, height = 720;
+  gint display_width = 640, display_height = 360;
+  gchar *size = NULL, *display = NULL;
+  gboolean ret = TRUE;
+  GOptionContext *ctx;
+  GError *error = NULL;
+  GOptionEntry entries[] = {
+    {"frames", 'n', 0, G_OPTION_ARG_INT, &n_frames, "Number of frames to"
+          " render in each mode (default: 300)", "N"},
+    {"size", 's', 0, G_OPTION_ARG_STRING, &size, "Size of the decoded video"
+          " (default: 1280x720)", "WxH"},
+    {"display", 'd', 0, G_OPTION_ARG_STRING, &display, "Size that the video"
+          " is displayed at (default: 640x360)", "WxH"},
+    {NULL}
+  };
+
+  ctx = g_option_context_new ("- per-frame cost of the video render path");
+  g_option_context_add_main_entries (ctx, entries, NULL);
+  g_option_context_add_group (ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (ctx, &argc, &argv, &error)) {
+    g_printerr ("Error initializing: %s\n", error->message);
+    return EXIT_FAILURE;
+  }
+  g_option_context_free (ctx);
+
+  if ((size != NULL && !parse_size (size, &width, &height)) ||
+      (display != NULL && !parse_size (display, &display_width,
+              &display_height)) || n_frames <= 0) {
+    g_printerr ("Invalid arguments\n");
+    return EXIT_FAILURE;
+  }
+
+  for (ii = 0; ii < G_N_ELEMENTS (modes); ii++)
+    ret &= run_mode (ii, n_frames, width, height, display_width,
+        display_height);
+
+  g_free (size);
+  g_free (display);
+  return ret ? EXIT_SUCCESS : EXIT_FAILURE;
+}
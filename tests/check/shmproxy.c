@@ -0,0 +1,225 @@
+/*  vim: set sts=2 sw=2 et :
+ *
+ *  Copyright (C) 2015 Centricular Ltd
+ *  Author(s): Nirbheek Chauhan <nirbheek@centricular.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Round-trip test for shmproxysink and shmproxysrc: a child process sends
+ * buffers over one end of a socketpair and we receive them on the other.
+ *
+ *  child:  fakesrc ! capsfilter ! shmproxysink fd=X
+ *  parent: shmproxysrc fd=Y ! fakesink
+ *
+ * The buffers are filled with a pattern that continues from one buffer to the
+ * next, so we check that all of them arrive, in order and intact. Then we
+ * check that a caps query from the parent is answered by the child's
+ * capsfilter.
+ *
+ * The proxy plugin has to be in the plugin path; `make check` sets it. */
+
+#include <gst/gst.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define N_BUFFERS 100
+#define BUFFER_SIZE 4096
+#define TEST_CAPS "application/x-test"
+/* How long each side waits for the other before giving up */
+#define TIMEOUT (10 * GST_SECOND)
+
+typedef struct {
+  guint n_buffers;
+  guint8 next_byte;
+  gboolean corrupted;
+} ReceiveState;
+
+static GstElement *
+make_pipeline (const gchar * format, gint fd)
+{
+  GstElement *pipeline;
+  gchar *desc;
+  GError *error = NULL;
+
+  desc = g_strdup_printf (format, fd);
+  pipeline = gst_parse_launch (desc, &error);
+  g_free (desc);
+  if (pipeline == NULL) {
+    g_printerr ("Unable to create pipeline: %s\n", error->message);
+    g_error_free (error);
+  }
+
+  return pipeline;
+}
+
+static int
+run_child (gint fd)
+{
+  GstElement *pipeline;
+  GstMessage *msg;
+
+  pipeline = make_pipeline ("fakesrc num-buffers=" G_STRINGIFY (N_BUFFERS)
+      " sizetype=fixed sizemax=" G_STRINGIFY (BUFFER_SIZE) " "
+      "filltype=pattern-span ! capsfilter caps=" TEST_CAPS " ! "
+      "shmproxysink fd=%i", fd);
+  if (pipeline == NULL)
+    return 1;
+  close (fd);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  /* Stay around after EOS to answer queries until the parent kills us */
+  msg = gst_bus_timed_pop_filtered (GST_ELEMENT_BUS (pipeline), TIMEOUT,
+      GST_MESSAGE_ERROR);
+  if (msg) {
+    GError *error;
+
+    gst_message_parse_error (msg, &error, NULL);
+    g_printerr ("Child: %s\n", error->message);
+    g_error_free (error);
+    gst_message_unref (msg);
+  }
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+
+  return msg ? 1 : 0;
+}
+
+static void
+on_handoff (GstElement * fakesink, GstBuffer * buffer, GstPad * pad,
+    ReceiveState * state)
+{
+  GstMapInfo info;
+  gsize ii;
+
+  if (!gst_buffer_map (buffer, &info, GST_MAP_READ)) {
+    state->corrupted = TRUE;
+    return;
+  }
+
+  if (info.size != BUFFER_SIZE)
+    state->corrupted = TRUE;
+  for (ii = 0; ii < info.size; ii++)
+    if (info.data[ii] != state->next_byte++)
+      state->corrupted = TRUE;
+
+  gst_buffer_unmap (buffer, &info);
+  state->n_buffers++;
+}
+
+static gboolean
+run_parent (gint fd)
+{
+  ReceiveState state = { 0 };
+  GstElement *pipeline, *fakesink;
+  GstMessage *msg;
+  GstCaps *caps, *expected;
+  GstPad *sinkpad;
+  gboolean ret = FALSE;
+
+  pipeline = make_pipeline ("shmproxysrc fd=%i ! "
+      "fakesink name=sink sync=false signal-handoffs=true", fd);
+  if (pipeline == NULL)
+    return FALSE;
+  close (fd);
+
+  fakesink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+  g_signal_connect (fakesink, "handoff", G_CALLBACK (on_handoff), &state);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  msg = gst_bus_timed_pop_filtered (GST_ELEMENT_BUS (pipeline), TIMEOUT,
+      GST_MESSAGE_EOS | GST_MESSAGE_ERROR | GST_MESSAGE_WARNING);
+  if (msg == NULL || GST_MESSAGE_TYPE (msg) != GST_MESSAGE_EOS) {
+    g_printerr ("Parent: did not get EOS\n");
+    goto out;
+  }
+
+  if (state.n_buffers != N_BUFFERS || state.corrupted) {
+    g_printerr ("Parent: received %u of %u buffers%s\n", state.n_buffers,
+        N_BUFFERS, state.corrupted ? ", some of them corrupted" : "");
+    goto out;
+  }
+
+  /* Answered by the capsfilter in the child */
+  sinkpad = gst_element_get_static_pad (fakesink, "sink");
+  caps = gst_pad_peer_query_caps (sinkpad, NULL);
+  expected = gst_caps_from_string (TEST_CAPS);
+  ret = gst_caps_is_equal (caps, expected);
+  if (!ret)
+    g_printerr ("Parent: caps query returned %" GST_PTR_FORMAT "\n", caps);
+  gst_caps_unref (expected);
+  gst_caps_unref (caps);
+  gst_object_unref (sinkpad);
+
+out:
+  if (msg)
+    gst_message_unref (msg);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (fakesink);
+  gst_object_unref (pipeline);
+  return ret;
+}
+
+int
+main (int argc, char *argv[])
+{
+  gint fds[2], status;
+  gboolean ret;
+  pid_t pid;
+
+  if (socketpair (AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) < 0) {
+    g_printerr ("Unable to create socketpair: %s\n", g_strerror (errno));
+    return 1;
+  }
+
+  /* Before gst_init(), so that the child doesn't inherit any threads */
+  pid = fork ();
+  if (pid < 0) {
+    g_printerr ("Unable to fork: %s\n", g_strerror (errno));
+    return 1;
+  }
+
+  if (pid == 0) {
+    close (fds[1]);
+    gst_init (&argc, &argv);
+    return run_child (fds[0]);
+  }
+
+  close (fds[0]);
+  gst_init (&argc, &argv);
+  ret = run_parent (fds[1]);
+
+  kill (pid, SIGTERM);
+  if (waitpid (pid, &status, 0) < 0 ||
+      (WIFEXITED (status) && WEXITSTATUS (status) != 0)) {
+    g_printerr ("Child failed\n");
+    ret = FALSE;
+  }
+
+  g_print ("%s\n", ret ? "PASS" : "FAIL");
+  return ret ? 0 : 1;
+}
@@ -1,6 +1,6 @@
 #!/bin/echo Should be run as: source
 # vim: set sts=2 sw=2 et :
-extra_plugin_path="${build_dir}/gst/proxy/.libs"
+extra_plugin_path="${build_dir}/gst/proxy/.libs:${build_dir}/gst/mixer/.libs"
 
 if [[ -n "${GST_PLUGIN_PATH_1_0}" ]]; then
   export GST_PLUGIN_PATH_1_0="${GST_PLUGIN_PATH_1_0}:${extra_plugin_path}"